@@ -0,0 +1,79 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * mx-compile-style.c: compile a style sheet for faster loading
+ *
+ * Copyright 2011 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Parses a CSS style sheet and writes it out in the compiled format read by
+ * mx_style_load_from_compiled_file(). The output defaults to the name of
+ * the style sheet with ".cache" appended, which is where MxStyle looks for
+ * a compiled version of the default style sheet. The compiled file must be
+ * installed in the same directory as the style sheet.
+ */
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "mx-css.h"
+
+int
+main (int argc, char **argv)
+{
+  MxStyleSheet *sheet;
+  GError *error = NULL;
+  gchar *output;
+  gint result = EXIT_SUCCESS;
+
+  if (argc < 2 || argc > 3)
+    {
+      g_printerr ("Usage: %s STYLESHEET [OUTPUT]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  if (!g_file_test (argv[1], G_FILE_TEST_IS_REGULAR))
+    {
+      g_printerr ("%s: Invalid style sheet '%s'\n", argv[0], argv[1]);
+      return EXIT_FAILURE;
+    }
+
+  if (argc == 3)
+    output = g_strdup (argv[2]);
+  else
+    output = g_strconcat (argv[1], ".cache", NULL);
+
+  sheet = mx_style_sheet_new ();
+
+  if (!mx_style_sheet_add_from_file (sheet, argv[1], NULL))
+    {
+      g_printerr ("%s: Unable to parse '%s'\n", argv[0], argv[1]);
+      result = EXIT_FAILURE;
+    }
+  else if (!mx_style_sheet_write_compiled (sheet, output, &error))
+    {
+      g_printerr ("%s: Unable to write '%s': %s\n", argv[0], output,
+                  error->message);
+      g_error_free (error);
+      result = EXIT_FAILURE;
+    }
+
+  mx_style_sheet_destroy (sheet);
+  g_free (output);
+
+  return result;
+}
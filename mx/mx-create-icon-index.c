@@ -0,0 +1,113 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * mx-create-icon-index.c: index an icon theme for faster lookups
+ *
+ * Copyright 2011 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Indexes every directory of an icon theme with _mx_icon_index_build() and
+ * writes the index into the theme directory. The index must be regenerated
+ * whenever icons are added to or removed from the theme; MxIconTheme
+ * ignores it once the theme directory is more recent than it.
+ */
+
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#ifdef G_OS_WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include "mx-icon-index.h"
+
+/* Writing the index into the theme directory updates the directory's
+ * modification time, possibly to a later second than the index's, after
+ * which MxIconTheme would ignore the index. Set it back to the index's
+ * modification time, as gtk-update-icon-cache does. */
+static void
+set_directory_mtime (const gchar *directory,
+                     const gchar *index)
+{
+  struct stat dir_stat, index_stat;
+  struct utimbuf times;
+
+  if (g_stat (directory, &dir_stat) != 0 ||
+      g_stat (index, &index_stat) != 0)
+    return;
+
+  times.actime = dir_stat.st_atime;
+  times.modtime = index_stat.st_mtime;
+  g_utime (directory, &times);
+}
+
+int
+main (int argc, char **argv)
+{
+  const MxIconIndexHeader *header;
+  GPtrArray *directories;
+  GError *error = NULL;
+  gchar *output, *data;
+  gint result = EXIT_SUCCESS;
+  gsize length;
+  guint i;
+
+  if (argc != 2)
+    {
+      g_printerr ("Usage: %s THEME_DIRECTORY\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  if (!g_file_test (argv[1], G_FILE_TEST_IS_DIR))
+    {
+      g_printerr ("%s: Invalid theme directory '%s'\n", argv[0], argv[1]);
+      return EXIT_FAILURE;
+    }
+
+  data = _mx_icon_index_build (argv[1], &length, &directories);
+  header = (const MxIconIndexHeader *) data;
+
+  output = g_build_filename (argv[1], MX_ICON_INDEX_FILENAME, NULL);
+
+  if (!g_file_set_contents (output, data, length, &error))
+    {
+      g_printerr ("%s: Unable to write '%s': %s\n", argv[0], output,
+                  error->message);
+      g_error_free (error);
+      result = EXIT_FAILURE;
+    }
+  else
+    {
+      set_directory_mtime (argv[1], output);
+
+      g_print ("Indexed %u icons in %u directories\n",
+               GUINT32_FROM_LE (header->n_entries), directories->len);
+    }
+
+  for (i = 0; i < directories->len; i++)
+    g_free (g_ptr_array_index (directories, i));
+  g_ptr_array_free (directories, TRUE);
+  g_free (output);
+  g_free (data);
+
+  return result;
+}
@@ -19,451 +19,668 @@
  * Boston, MA 02111-1307, USA.
  *
  */
+
+/* Packs the images found in a directory into atlas pages and writes an
+ * image cache file for them, in the format described in mx-image-cache.h.
+ * Images are decoded in parallel and packed with a skyline bottom-left
+ * packer, opening a new page whenever an image does not fit in the pages
+ * that are already open.
+ */
+
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/types.h>
-#include <dirent.h>
 #include <string.h>
-#include <assert.h>
-#include <stdint.h>
 
 #include <glib.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 
+#include "mx-image-cache.h"
 
-#ifndef PATH_MAX
-#define PATH_MAX 1024
-#endif
+/* images larger than this are not cached */
+#define MAX_IMAGE_SIZE 256
 
-struct imgcache_element {
-  char  filename[256];
-  int   width, height;
-  int   posX, posY;
-  void *ptr;
-};
+/* the largest page that is written */
+#define PAGE_SIZE 1024
 
-GList *images;
+/* space left between images, so that filtering does not bleed */
+#define PADDING 1
 
-int totalarea = 0;
+/* the smallest reduced level that is written for a page */
+#define MIN_LEVEL_SIZE 16
 
+typedef struct
+{
+  gchar     *filename;
+  GdkPixbuf *pixbuf;
+  gint       width, height;
 
-int sizes[] = { 0, 256, 384, 512, 640, 768, 896, 1024, 1280, 1536, 1792,  2048, -1};
+  gint       page;
+  gint       x, y;
+} Image;
 
+typedef struct
+{
+  gint x, y, width;
+} SkylineNode;
 
-static gint sort_by_size(gconstpointer a,
-                         gconstpointer b)
+typedef struct
 {
-  const struct imgcache_element *A=a, *B=b;
-  if (A->height > B->height)
-    return -1;
-  if (A->height < B->height)
-    return 1;
-  if (A->width > B->width)
-    return -1;
-  if (A->width < B->width)
-    return 1;
-  return 0;
+  GArray  *skyline;
+  gint     width, height;    /* the area actually used */
+  guint64  area;             /* the area covered by images */
+  gint     n_levels;
+} Page;
+
+static gint
+sort_by_size (gconstpointer a,
+              gconstpointer b)
+{
+  const Image *A = *(Image **) a, *B = *(Image **) b;
 
+  if (A->height != B->height)
+    return B->height - A->height;
+
+  return B->width - A->width;
 }
-static void do_one_file(char *filename)
-{
-  GdkPixbuf *image;
-  struct imgcache_element *element;
 
-  if (strlen(filename) >= 256)
-    return;
+static gint
+sort_by_filename (gconstpointer a,
+                  gconstpointer b)
+{
+  const Image *A = *(Image **) a, *B = *(Image **) b;
 
-  image = gdk_pixbuf_new_from_file(filename, NULL);
-  if (!image)
-    return;
+  return strcmp (A->filename, B->filename);
+}
 
-  /* we don't want to do files > 256x256 */
+static void
+collect_files (const gchar *directory,
+               GPtrArray   *images)
+{
+  GDir *dir;
+  const gchar *name;
+  GError *error = NULL;
 
-  if (gdk_pixbuf_get_width(image) > 256) {
-      gdk_pixbuf_unref(image);
-      return;
-    }
-  if (gdk_pixbuf_get_height(image) > 256) {
-      gdk_pixbuf_unref(image);
-      return;
-    }
-  element = malloc(sizeof(struct imgcache_element));
-  if (!element) {
-      gdk_pixbuf_unref(image);
+  dir = g_dir_open (directory, 0, &error);
+  if (!dir)
+    {
+      g_printerr ("Error opening %s: %s\n", directory, error->message);
+      g_clear_error (&error);
       return;
     }
 
-  memset(element, 0, sizeof(struct imgcache_element));
-  element->width = gdk_pixbuf_get_width(image);
-  element->height = gdk_pixbuf_get_height(image);
-  element->posX = -1;
-  element->posY = -1;
-  element->ptr = image;
-  totalarea += element->width * element->height;
-  strncpy(element->filename, filename, 256);
+  while ((name = g_dir_read_name (dir)))
+    {
+      gchar *fullpath;
+
+      if (name[0] == '.')
+        continue;
+
+      fullpath = g_build_filename (directory, name, NULL);
+
+      if (g_file_test (fullpath, G_FILE_TEST_IS_DIR))
+        collect_files (fullpath, images);
+      else if (g_file_test (fullpath, G_FILE_TEST_IS_REGULAR))
+        {
+          Image *image = g_slice_new0 (Image);
 
-  if (element->width > sizes[0])
-    sizes[0] = element->width;
+          image->filename = fullpath;
+          image->page = -1;
+          g_ptr_array_add (images, image);
+          continue;
+        }
+
+      g_free (fullpath);
+    }
 
-  images = g_list_append(images, element);
+  g_dir_close (dir);
 }
 
-static int get_effective_Y(int X1,
-                           int X2)
+/* runs in the decoding threads; each image is only touched by one thread */
+static void
+decode_image (gpointer data,
+              gpointer user_data)
 {
-  int Y = 0;
-  GList *item;
-  struct imgcache_element *element;
-  item = g_list_first(images);
-  while (item) {
-      element = item->data;
-      item = g_list_next(item);
-      if (element->posX == -1)
-        continue;
-      if (element->posX >= X2)
-        continue;
-      if (element->posX + element->width <= X1)
-        continue;
-      /* at this point we know the element overlaps our range */
-      if (element->posY + element->height > Y)
-        Y = element->posY + element->height;
+  Image *image = data;
+  GdkPixbuf *pixbuf;
+
+  pixbuf = gdk_pixbuf_new_from_file (image->filename, NULL);
+  if (!pixbuf)
+    return;
+
+  if (gdk_pixbuf_get_width (pixbuf) > MAX_IMAGE_SIZE ||
+      gdk_pixbuf_get_height (pixbuf) > MAX_IMAGE_SIZE)
+    {
+      g_object_unref (pixbuf);
+      return;
     }
-  return Y;
 
+  if (!gdk_pixbuf_get_has_alpha (pixbuf))
+    {
+      GdkPixbuf *alpha = gdk_pixbuf_add_alpha (pixbuf, FALSE, 0, 0, 0);
+      g_object_unref (pixbuf);
+      pixbuf = alpha;
+    }
+
+  image->pixbuf = pixbuf;
+  image->width = gdk_pixbuf_get_width (pixbuf);
+  image->height = gdk_pixbuf_get_height (pixbuf);
 }
 
-static inline uint32_t get_pixel(struct imgcache_element *element,
-                                 int                      X,
-                                 int                      Y)
+static void
+decode_images (GPtrArray *images)
 {
-  GdkPixbuf *buf;
-  unsigned char *p;
-  buf = element->ptr;
+  GThreadPool *pool;
+  GError *error = NULL;
+  gint n_threads = 1;
+  guint i;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  n_threads = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+#endif
+
+  pool = g_thread_pool_new (decode_image, NULL, n_threads, TRUE, &error);
+  if (!pool)
+    {
+      g_printerr ("Unable to start decoding threads: %s\n", error->message);
+      g_clear_error (&error);
 
-  p = gdk_pixbuf_get_pixels(buf);
-  p += Y * gdk_pixbuf_get_rowstride(buf);
-  p += X * 4;
+      for (i = 0; i < images->len; i++)
+        decode_image (g_ptr_array_index (images, i), NULL);
 
-  return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+      return;
+    }
+
+  for (i = 0; i < images->len; i++)
+    g_thread_pool_push (pool, g_ptr_array_index (images, i), NULL);
+
+  /* wait for all the images to be decoded */
+  g_thread_pool_free (pool, FALSE, TRUE);
 }
 
-static int can_scooch(struct imgcache_element *one,
-                      struct imgcache_element *two)
+static Page *
+page_new (void)
 {
-  int i,x,y;
+  SkylineNode node = { 0, 0, PAGE_SIZE };
+  Page *page = g_slice_new0 (Page);
 
-  if (!one)
-    return 0;
-  if (!two)
-    return 0;
+  page->skyline = g_array_new (FALSE, FALSE, sizeof (SkylineNode));
+  g_array_append_val (page->skyline, node);
 
-  if (one->posY != two->posY)
-    return 0;
-  if (one->height != two->height)
-    return 0;
-  if (one->posX + one->width != two->posX)
-    return 0;
+  return page;
+}
 
+/* Returns the lowest y at which a rectangle of the given size can be
+ * placed with its left edge on the node at @index, or -1 */
+static gint
+page_fit (Page *page,
+          guint index,
+          gint  width,
+          gint  height)
+{
+  SkylineNode *node = &g_array_index (page->skyline, SkylineNode, index);
+  gint x = node->x, y = 0, remaining = width;
 
-  i = 0;
+  if (x + width > PAGE_SIZE)
+    return -1;
 
-  while (i < one->width && i < two->width) {
-      i ++;
-      for (y = 0; y < one->height; y++) {
-          for (x = 0; x < i; x++ ) {
-              int p1, p2;
+  while (remaining > 0)
+    {
+      if (index >= page->skyline->len)
+        return -1;
 
-              p1 = get_pixel(one, one->width - i + x,y);
-              p2 = get_pixel(two, x, y);
-              if ( p1 != p2)
-                return i-1;
-            }
-        }
+      node = &g_array_index (page->skyline, SkylineNode, index);
+      y = MAX (y, node->y);
+      if (y + height > PAGE_SIZE)
+        return -1;
+
+      remaining -= node->width;
+      index++;
     }
-  return i;
+
+  return y;
 }
-static int do_placement(int maxX)
+
+static void
+page_add (Page  *page,
+          guint  index,
+          gint   x,
+          gint   y,
+          gint   width,
+          gint   height)
 {
-  int maxY;
-  int X, Y, baseY;
-  int tempY, tempX, biggestX = -1;
-  struct imgcache_element *element, *element2, *prev = NULL;
-  GList *item, *item2;
-  int workdone = 1;
+  SkylineNode node = { x, y + height, width };
+  guint i;
 
-  maxY = 0;
+  g_array_insert_val (page->skyline, index, node);
 
-  X = 0;
-  Y = 0;
+  /* shrink or remove the nodes now covered by the new one */
+  i = index + 1;
+  while (i < page->skyline->len)
+    {
+      SkylineNode *prev = &g_array_index (page->skyline, SkylineNode, i - 1);
+      SkylineNode *next = &g_array_index (page->skyline, SkylineNode, i);
+      gint shrink = prev->x + prev->width - next->x;
 
+      if (shrink <= 0)
+        break;
 
-  while (workdone) {
-      workdone = 0;
+      if (next->width > shrink)
+        {
+          next->x += shrink;
+          next->width -= shrink;
+          break;
+        }
 
-      X = 0;
-      item = g_list_first(images);
-      while (item) {
-          int sc;
-          element = item->data;
-          item = g_list_next(item);
+      g_array_remove_index (page->skyline, i);
+    }
 
-          if (element->posX != -1)               /* already placed */
-            continue;
+  /* merge neighbours at the same height */
+  for (i = 0; i + 1 < page->skyline->len; )
+    {
+      SkylineNode *a = &g_array_index (page->skyline, SkylineNode, i);
+      SkylineNode *b = &g_array_index (page->skyline, SkylineNode, i + 1);
 
-          /* first, check if we fit */
-          if (X + element->width > maxX)
-            continue;
+      if (a->y == b->y)
+        {
+          a->width += b->width;
+          g_array_remove_index (page->skyline, i + 1);
+        }
+      else
+        i++;
+    }
+}
 
-          tempY = get_effective_Y(X, X + element->width);
+/* Finds the bottom-left position for a rectangle on @page */
+static gboolean
+page_insert (Page *page,
+             gint  width,
+             gint  height,
+             gint *x,
+             gint *y)
+{
+  gint best_index = -1, best_bottom = G_MAXINT, best_width = G_MAXINT;
+  guint i;
 
-          element->posX = X;
-          element->posY = tempY;
-          workdone ++;
+  for (i = 0; i < page->skyline->len; i++)
+    {
+      SkylineNode *node = &g_array_index (page->skyline, SkylineNode, i);
+      gint node_y = page_fit (page, i, width, height);
 
+      if (node_y < 0)
+        continue;
 
-          sc = can_scooch(prev, element);
+      if (node_y + height < best_bottom ||
+          (node_y + height == best_bottom && node->width < best_width))
+        {
+          best_index = i;
+          best_bottom = node_y + height;
+          best_width = node->width;
+          *x = node->x;
+          *y = node_y;
+        }
+    }
 
-          element->posX -= sc;
+  if (best_index < 0)
+    return FALSE;
 
-          if (element->posY + element->height > maxY)
-            maxY = element->posY + element->height;
+  page_add (page, best_index, *x, *y, width, height);
 
-          prev = element;
+  return TRUE;
+}
 
+static void
+pack_images (GPtrArray *images,
+             GPtrArray *pages)
+{
+  guint i, j;
 
-          /* shortcut .. find other icons that fit us without expanding vertically*/
+  /* placing the tallest images first keeps the skyline flat */
+  g_ptr_array_sort (images, sort_by_size);
 
-          tempX = X;
-          tempY += element->height;
-repeat:
-          biggestX = -1;
-          item2 = item;
-          baseY = element->posY + element->height;
-          while (item2 && !sc) {
-              element2 = item2->data;
-              item2 = g_list_next(item2);
-              if (element2->posX != -1)
-                continue;
-              if (tempX + element2->width > X + element->width)
-                continue;
-              if (element2->height > maxY - baseY)
-                continue;
+  for (i = 0; i < images->len; i++)
+    {
+      Image *image = g_ptr_array_index (images, i);
+      gint width, height;
 
-              tempY = get_effective_Y(tempX, tempX+element2->width);
+      if (!image->pixbuf)
+        continue;
 
-              if (element2->height > maxY - tempY)
-                continue;
-              element2->posX = tempX;
-              element2->posY = tempY;
+      width = image->width + PADDING;
+      height = image->height + PADDING;
 
-              if (element2->posX + element2->width > biggestX && element2->width != element->width)
-                biggestX = element2->posX + element2->width;
-              if (element2->width == element->width)
-                biggestX = -1;
-              workdone++;
-              prev = NULL;
-            }
-          if (biggestX > 0) {
-              tempX = biggestX;
-              goto repeat;
-            }
-          X = element->posX +  element->width;
+      for (j = 0; j < pages->len; j++)
+        if (page_insert (g_ptr_array_index (pages, j), width, height,
+                         &image->x, &image->y))
+          break;
+
+      if (j == pages->len)
+        {
+          g_ptr_array_add (pages, page_new ());
+          page_insert (g_ptr_array_index (pages, j), width, height,
+                       &image->x, &image->y);
         }
-    }
 
-  X = 0;
-  Y = 0;
-  /* find the bounding box */
-  item = g_list_first(images);
-  while (item) {
-      element = item->data;
-      item = g_list_next(item);
-      if (element->posX + element->width > X)
-        X = element->posX + element->width;
-      if (element->posY + element->height > Y)
-        Y = element->posY + element->height;
+      image->page = j;
     }
 
-  /* penalties for getting too big for a texture */
-  if (X > 2048)
-    X *= 4;
-  if (Y > 2048)
-    Y *= 4;
-  return X * Y;
+  for (i = 0; i < images->len; i++)
+    {
+      Image *image = g_ptr_array_index (images, i);
+      Page *page;
+
+      if (image->page < 0)
+        continue;
+
+      page = g_ptr_array_index (pages, image->page);
+      page->width = MAX (page->width, image->x + image->width);
+      page->height = MAX (page->height, image->y + image->height);
+      page->area += image->width * image->height;
+    }
 }
 
-static void clear_placement(void)
+static gchar *
+page_filename (const gchar *prefix,
+               gint         page,
+               gint         level)
 {
-  struct imgcache_element *element;
-  GList *item;
-
-  /* find the bounding box */
-  item = g_list_first(images);
-  while (item) {
-      element = item->data;
-      item = g_list_next(item);
-      element->posX = -1;
-      element->posY = -1;
-    }
+  if (level == 0)
+    return g_strdup_printf ("%s-%i.png", prefix, page);
+  else
+    return g_strdup_printf ("%s-%i-%i.png", prefix, page, level);
 }
 
-static void optimal_placement(void)
+static gboolean
+write_pages (GPtrArray   *images,
+             GPtrArray   *pages,
+             const gchar *prefix)
 {
-  int bestX = -1;
-  int best_score = INT_MAX;
-  int score;
-  int i;
-  int minX;
-  i = 0;
-
-  /* skip X values that would lead to a too large Y dimension */
-  minX = totalarea / 2048;
-
-  if (minX > 1000)
-    minX = 0;
-  while (sizes[i] > 0) {
-      if (sizes[i] < minX) {
-          i++;
-          continue;
+  GError *error = NULL;
+  guint i, j;
+
+  for (i = 0; i < pages->len; i++)
+    {
+      Page *page = g_ptr_array_index (pages, i);
+      GdkPixbuf *pixbuf;
+      gint width, height;
+      gchar *filename;
+
+      pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
+                               page->width, page->height);
+      gdk_pixbuf_fill (pixbuf, 0);
+
+      for (j = 0; j < images->len; j++)
+        {
+          Image *image = g_ptr_array_index (images, j);
+
+          if (image->page == (gint) i)
+            gdk_pixbuf_copy_area (image->pixbuf, 0, 0,
+                                  image->width, image->height,
+                                  pixbuf, image->x, image->y);
         }
-      score = do_placement(sizes[i]);
-      if (score < best_score) {
-          bestX = sizes[i];
-          best_score = score;
+
+      filename = page_filename (prefix, i, 0);
+      if (!gdk_pixbuf_save (pixbuf, filename, "png", &error, NULL))
+        {
+          g_printerr ("Cannot write image file %s: %s\n", filename,
+                      error->message);
+          g_error_free (error);
+          g_free (filename);
+          g_object_unref (pixbuf);
+          return FALSE;
         }
-      clear_placement();
-      i++;
-    }
+      g_free (filename);
+
+      /* write reduced levels, each half the size of the previous one */
+      width = page->width;
+      height = page->height;
+      while (width / 2 >= MIN_LEVEL_SIZE && height / 2 >= MIN_LEVEL_SIZE)
+        {
+          GdkPixbuf *level;
+
+          width /= 2;
+          height /= 2;
+
+          level = gdk_pixbuf_scale_simple (pixbuf, width, height,
+                                           GDK_INTERP_HYPER);
+          filename = page_filename (prefix, i, page->n_levels + 1);
+
+          if (!gdk_pixbuf_save (level, filename, "png", &error, NULL))
+            {
+              g_printerr ("Cannot write image file %s: %s\n", filename,
+                          error->message);
+              g_clear_error (&error);
+              g_free (filename);
+              g_object_unref (level);
+              break;
+            }
 
-  do_placement(bestX);
-  printf("Best score is %i, %0.1f %% waste\n", best_score, (100.0*best_score / totalarea) -100.0);
-}
+          g_free (filename);
+          g_object_unref (level);
+          page->n_levels++;
+        }
 
-static int make_final_image(char *filename)
-{
-  int maxX = 0, maxY = 0;
-  struct imgcache_element *element;
-  GList *item;
-  GdkPixbuf *final;
-
-  /* find the bounding box */
-  item = g_list_first(images);
-  while (item) {
-      element = item->data;
-      item = g_list_next(item);
-      if (element->posX + element->width > maxX)
-        maxX = element->posX + element->width;
-      if (element->posY + element->height > maxY)
-        maxY = element->posY + element->height;
+      g_object_unref (pixbuf);
     }
 
-  printf("Final image is %ix%i\n", maxX, maxY);
+  return TRUE;
+}
 
-  if (!maxX)
-    return 0;
-  if (!maxY)
-    return 0;
-  final = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, maxX, maxY);
-  assert(final != NULL);
+static guint32
+add_string (GString     *strings,
+            const gchar *string)
+{
+  guint32 offset = strings->len;
 
-  item = g_list_first(images);
-  while (item) {
-      element = item->data;
-      item = g_list_next(item);
-      if (element->posX == -1)
-        continue;
-      gdk_pixbuf_copy_area(element->ptr, 0, 0, element->width, element->height, final, element->posX, element->posY);
-    }
+  g_string_append_len (strings, string, strlen (string) + 1);
 
-  gdk_pixbuf_save(final, filename, "png", NULL, NULL);
-  return 1;
+  return offset;
 }
 
-static void makecache(char *directory,
-                      int   recurse)
+static gboolean
+write_cache_file (GPtrArray   *images,
+                  GPtrArray   *pages,
+                  const gchar *prefix,
+                  const gchar *filename,
+                  guint       *n_entries_out)
 {
-  GDir *dir;
+  MxImageCacheHeader header;
+  GArray *page_records, *entries;
+  GString *strings;
+  GByteArray *data;
   GError *error = NULL;
+  gboolean result;
+  guint i;
+  gint level;
+
+  /* entries are looked up with a binary search */
+  g_ptr_array_sort (images, sort_by_filename);
+
+  strings = g_string_new ("");
+  /* an empty string at offset 0 */
+  g_string_append_c (strings, '\0');
+
+  /* full size pages come first, so that entries can refer to them by the
+   * index they were packed in */
+  page_records = g_array_new (FALSE, TRUE, sizeof (MxImageCachePage));
+  for (level = 0; ; level++)
+    {
+      gboolean added = FALSE;
+
+      for (i = 0; i < pages->len; i++)
+        {
+          Page *page = g_ptr_array_index (pages, i);
+          MxImageCachePage record;
+          gchar *page_file;
+
+          if (level > page->n_levels)
+            continue;
 
-  dir = g_dir_open (directory, 0, &error);
-  if (!dir) {
-      printf("Error opening %s: %s\n", directory, error->message);
-      g_clear_error (&error);
-      return;
-    }
+          page_file = page_filename (prefix, i, level);
+          record.filename = GUINT32_TO_LE (add_string (strings, page_file));
+          record.width = GUINT32_TO_LE (page->width >> level);
+          record.height = GUINT32_TO_LE (page->height >> level);
+          record.base_page = GUINT32_TO_LE (i);
+          record.level = GUINT32_TO_LE (level);
+          g_array_append_val (page_records, record);
+          g_free (page_file);
 
-  while (TRUE) {
-      const char *name = g_dir_read_name (dir);
-      char *fullpath = g_build_filename (directory, name, NULL);
+          added = TRUE;
+        }
 
-      if (!name)
+      if (!added)
         break;
-      if (name[0] == '.')
+    }
+
+  entries = g_array_new (FALSE, TRUE, sizeof (MxImageCacheEntry));
+  for (i = 0; i < images->len; i++)
+    {
+      Image *image = g_ptr_array_index (images, i);
+      MxImageCacheEntry entry;
+
+      if (image->page < 0)
         continue;
-      if (recurse && g_file_test (fullpath, G_FILE_TEST_IS_DIR)) {
-          makecache(fullpath, recurse);
-        }
 
-      if (recurse && g_file_test (fullpath, G_FILE_TEST_IS_REGULAR)) {
-          do_one_file(fullpath);
-        }
+      entry.filename = GUINT32_TO_LE (add_string (strings, image->filename));
+      entry.page = GUINT32_TO_LE (image->page);
+      entry.x = GUINT32_TO_LE (image->x);
+      entry.y = GUINT32_TO_LE (image->y);
+      entry.width = GUINT32_TO_LE (image->width);
+      entry.height = GUINT32_TO_LE (image->height);
+      g_array_append_val (entries, entry);
+    }
 
-      g_free (fullpath);
-  }
+  /* keep the file size a multiple of 4 */
+  while (strings->len % 4)
+    g_string_append_c (strings, '\0');
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, MX_IMAGE_CACHE_MAGIC, sizeof (header.magic));
+  header.version = GUINT32_TO_LE (MX_IMAGE_CACHE_VERSION);
+  header.n_pages = GUINT32_TO_LE (page_records->len);
+  header.pages_offset = GUINT32_TO_LE (sizeof (header));
+  header.n_entries = GUINT32_TO_LE (entries->len);
+  header.entries_offset =
+    GUINT32_TO_LE (sizeof (header) +
+                   page_records->len * sizeof (MxImageCachePage));
+  header.strings_offset =
+    GUINT32_TO_LE (GUINT32_FROM_LE (header.entries_offset) +
+                   entries->len * sizeof (MxImageCacheEntry));
+  header.strings_size = GUINT32_TO_LE (strings->len);
+
+  data = g_byte_array_new ();
+  g_byte_array_append (data, (guint8 *) &header, sizeof (header));
+  g_byte_array_append (data, (guint8 *) page_records->data,
+                       page_records->len * sizeof (MxImageCachePage));
+  g_byte_array_append (data, (guint8 *) entries->data,
+                       entries->len * sizeof (MxImageCacheEntry));
+  g_byte_array_append (data, (guint8 *) strings->str, strings->len);
+
+  header.checksum =
+    GUINT32_TO_LE (mx_image_cache_checksum (data->data + sizeof (header),
+                                            data->len - sizeof (header)));
+  memcpy (data->data, &header, sizeof (header));
+
+  result = g_file_set_contents (filename, (gchar *) data->data, data->len,
+                                &error);
+  if (!result)
+    {
+      g_printerr ("Cannot write cache file: %s\n", error->message);
+      g_error_free (error);
+    }
 
-  g_dir_close (dir);
+  *n_entries_out = entries->len;
 
-  images = g_list_sort(images, sort_by_size);
+  g_byte_array_free (data, TRUE);
+  g_string_free (strings, TRUE);
+  g_array_free (entries, TRUE);
+  g_array_free (page_records, TRUE);
+
+  return result;
 }
 
-static void write_cache_file(char *directory,
-                             char *pngfile)
+int
+main (int    argc,
+      char **argv)
 {
-  FILE *file;
-  char filename[PATH_MAX *2];
-  struct imgcache_element element;
-  struct imgcache_element *elm;
-  GList *item;
+  GPtrArray *images, *pages;
+  GTimer *timer;
+  gdouble decode_time, pack_time;
+  guint64 image_area = 0, page_area = 0;
+  gchar *prefix, *cache_file;
+  guint i, n_entries = 0;
+  gint result = EXIT_SUCCESS;
+
+  if (argc != 2)
+    {
+      g_printerr ("Usage: %s DIRECTORY\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+#if !GLIB_CHECK_VERSION (2, 31, 0)
+  g_thread_init (NULL);
+#endif
+  g_type_init ();
 
-  memset(&element, 0, sizeof(element));
+  timer = g_timer_new ();
 
-  strcpy(&element.filename[0], pngfile);
+  images = g_ptr_array_new ();
+  pages = g_ptr_array_new ();
 
-  sprintf(filename, "%s/mx.cache", directory);
+  collect_files (argv[1], images);
+  decode_images (images);
+  decode_time = g_timer_elapsed (timer, NULL);
 
-  file = fopen(filename, "w");
-  if (!file) {
-      fprintf(stderr, "Cannot write cache file: %s\n", filename);
-      return;
+  pack_images (images, pages);
+  pack_time = g_timer_elapsed (timer, NULL) - decode_time;
+
+  prefix = g_strdup_printf ("/var/cache/mx/%08x", g_str_hash (argv[1]));
+  cache_file = g_build_filename (argv[1], "mx.cache", NULL);
+
+  if (pages->len == 0)
+    g_printerr ("No images found in %s\n", argv[1]);
+  else if (!write_pages (images, pages, prefix) ||
+           !write_cache_file (images, pages, prefix, cache_file, &n_entries))
+    result = EXIT_FAILURE;
+
+  for (i = 0; i < pages->len; i++)
+    {
+      Page *page = g_ptr_array_index (pages, i);
+
+      image_area += page->area;
+      page_area += page->width * page->height;
     }
-  fwrite(&element, 1, sizeof(element), file);
-
-  item = g_list_first(images);
-  while (item) {
-      elm = item->data;
-      item = g_list_next(item);
-      elm->ptr = NULL;
-      fwrite(elm, 1, sizeof(element), file);
+
+  printf ("%u images in %u pages, %.1f%% filled\n"
+          "Decoding %.2fs, packing %.2fs, total %.2fs\n",
+          n_entries, pages->len,
+          page_area ? 100.0 * image_area / page_area : 0.0,
+          decode_time, pack_time, g_timer_elapsed (timer, NULL));
+
+  for (i = 0; i < images->len; i++)
+    {
+      Image *image = g_ptr_array_index (images, i);
+
+      if (image->pixbuf)
+        g_object_unref (image->pixbuf);
+      g_free (image->filename);
+      g_slice_free (Image, image);
     }
-  fclose(file);
+  g_ptr_array_free (images, TRUE);
 
-}
+  for (i = 0; i < pages->len; i++)
+    {
+      Page *page = g_ptr_array_index (pages, i);
 
-int main(int    argc,
-         char **argv)
-{
-  char image_file[PATH_MAX];
-  if (argc <= 1) {
-      printf("Usage:\n\t\tmakecache <directory>\n");
-      return EXIT_FAILURE;
+      g_array_free (page->skyline, TRUE);
+      g_slice_free (Page, page);
     }
-  g_type_init();
-  makecache(argv[1], 1);
-  optimal_placement();
-  sprintf(image_file, "/var/cache/mx/%08x.png", g_str_hash(argv[1]));
-  if (make_final_image(image_file))
-    write_cache_file(argv[1], image_file);
-  return EXIT_SUCCESS;
+  g_ptr_array_free (pages, TRUE);
+
+  g_free (cache_file);
+  g_free (prefix);
+  g_timer_destroy (timer);
+
+  return result;
 }
@@ -21,8 +21,11 @@
 #include <clutter/clutter.h>
 #include <string.h>
 
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
 
 #include "mx-private.h"
 
@@ -31,15 +34,83 @@ struct _MxStyleSheet
   GList *selectors;
   GList *styles;
   GList *filenames;
+  GList *mapped_files; /* compiled style sheets that strings point into */
+
+  /* Selectors bucketed by the most specific key of their rightmost simple
+   * selector, so that only candidate rules are tested against a node. The
+   * index is rebuilt lazily after a file has been added.
+   */
+  GHashTable *id_selectors;
+  GHashTable *class_selectors;
+  GHashTable *type_selectors;
+  GList      *universal_selectors;
+  gboolean    index_dirty;
+
+  /* The ids, classes and pseudo-classes used in parent and ancestor
+   * selectors. A change to any other property of a node cannot change the
+   * matches of its descendants. Built along with the index.
+   */
+  GHashTable *ancestor_ids;
+  GHashTable *ancestor_classes;
+  guint64     ancestor_pseudo_classes;
+
+  /* Computed styles, interned by the styles of their matching selectors.
+   * The table does not hold a reference, a computed style removes itself
+   * when it is freed. */
+  GHashTable *computed_styles;
+  guint       computed_style_serial;
 };
 
+/* The result of matching a node against a style sheet. Nodes that match the
+ * same styles in the same order share one computed style, and with it one
+ * property table and the diffs against other computed styles.
+ */
+struct _MxComputedStyle
+{
+  gint          ref_count;
+  MxStyleSheet *sheet;
+
+  /* the styles of the matching selectors, in order of increasing score */
+  GHashTable  **styles;
+  guint         n_styles;
+  guint         hash;
+
+  GHashTable   *properties;
+
+  /* changed property names, keyed by the serial of the computed style
+   * compared against, as it may be freed and its address reused */
+  guint         serial;
+  GHashTable   *diffs;
+};
+
+/* The number of diffs kept by a computed style before they are dropped and
+ * worked out again as needed. Most styles only change into a few others,
+ * e.g. on hover or focus, but without a limit the diffs of a sheet could
+ * grow with the square of its number of computed styles.
+ */
+#define CSS_MAX_DIFFS 16
+
+/* Pseudo-classes are compiled into a bitset. Each pseudo-class name seen in
+ * a style sheet is given a bit from a process-wide registry; when the
+ * registry is full, further names share the overflow bit and are matched
+ * by name instead.
+ */
+#define CSS_N_PSEUDO_CLASS_BITS   63
+
+static GHashTable *pseudo_class_bits = NULL;
+static GQuark      pseudo_class_names[CSS_N_PSEUDO_CLASS_BITS];
+static gint        n_pseudo_class_bits = 0;
+
 typedef struct _MxSelector MxSelector;
 struct _MxSelector
 {
-  gchar *type;
-  gchar *id;
-  gchar *class;
-  gchar *pseudo_class;
+  GQuark type;              /* 0 for the universal selector */
+  GType type_id;            /* resolved on first match */
+  GQuark id;
+  GQuark class;
+  guint64 pseudo_classes;
+  gint n_pseudo_classes;
+  gchar *pseudo_class;      /* overflowed pseudo-classes, if any */
   MxSelector *parent;
   MxSelector *ancestor;
   GHashTable *style;
@@ -49,65 +120,220 @@ struct _MxSelector
   gint priority;
 };
 
+/* Properties of a node that selectors are matched against, looked up once
+ * per node rather than once per selector.
+ */
+typedef struct
+{
+  MxStylable  *stylable;
+  GType        type;
+  GQuark       id;
+  GQuark       class;
+  guint64      pseudo_classes;
+  const gchar *pseudo_class;
+} CssNode;
+
+
+static guint64
+css_pseudo_class_register (const gchar *name)
+{
+  GQuark quark;
+  gpointer bit;
+
+  if (G_UNLIKELY (!pseudo_class_bits))
+    pseudo_class_bits = g_hash_table_new (NULL, NULL);
+
+  quark = g_quark_from_string (name);
+  bit = g_hash_table_lookup (pseudo_class_bits, GUINT_TO_POINTER (quark));
+
+  if (bit)
+    return G_GUINT64_CONSTANT (1) << (GPOINTER_TO_UINT (bit) - 1);
+
+  if (n_pseudo_class_bits == CSS_N_PSEUDO_CLASS_BITS)
+    return MX_CSS_PSEUDO_CLASS_OVERFLOW;
+
+  pseudo_class_names[n_pseudo_class_bits] = quark;
+  n_pseudo_class_bits++;
+  g_hash_table_insert (pseudo_class_bits, GUINT_TO_POINTER (quark),
+                       GINT_TO_POINTER (n_pseudo_class_bits));
+
+  return G_GUINT64_CONSTANT (1) << (n_pseudo_class_bits - 1);
+}
+
+/* The serial changes whenever a pseudo-class is added to the registry, as
+ * masks returned before then may be missing the new pseudo-class.
+ */
+guint
+_mx_css_pseudo_class_serial (void)
+{
+  return n_pseudo_class_bits;
+}
+
+guint64
+_mx_css_pseudo_class_mask (const gchar *pseudo_class)
+{
+  const gchar *start, *end;
+  guint64 mask = 0;
+
+  if (!pseudo_class || !pseudo_class_bits)
+    return 0;
+
+  for (start = pseudo_class; *start; start = end)
+    {
+      gchar buffer[64];
+      GQuark quark;
+      gpointer bit;
+      gsize length;
+
+      if (*start == ':')
+        {
+          end = start + 1;
+          continue;
+        }
+
+      end = strchr (start, ':');
+      if (!end)
+        end = start + strlen (start);
+
+      /* names that were never registered do not appear in any selector;
+       * the name is only copied, to the stack, if it isn't the last one */
+      length = end - start;
+      if (*end == '\0')
+        quark = g_quark_try_string (start);
+      else if (length < sizeof (buffer))
+        {
+          memcpy (buffer, start, length);
+          buffer[length] = '\0';
+          quark = g_quark_try_string (buffer);
+        }
+      else
+        {
+          gchar *name = g_strndup (start, length);
+          quark = g_quark_try_string (name);
+          g_free (name);
+        }
+
+      if (!quark)
+        continue;
+
+      bit = g_hash_table_lookup (pseudo_class_bits, GUINT_TO_POINTER (quark));
+      if (bit)
+        mask |= G_GUINT64_CONSTANT (1) << (GPOINTER_TO_UINT (bit) - 1);
+      else if (n_pseudo_class_bits == CSS_N_PSEUDO_CLASS_BITS)
+        mask |= MX_CSS_PSEUDO_CLASS_OVERFLOW;
+    }
+
+  return mask;
+}
+
+static void
+css_node_init (CssNode    *node,
+               MxStylable *stylable)
+{
+  const gchar *id, *class;
+
+  node->stylable = stylable;
+  node->type = G_OBJECT_TYPE (stylable);
+
+  /* names that are not quarks yet cannot be referenced by any selector */
+  id = clutter_actor_get_name (CLUTTER_ACTOR (stylable));
+  node->id = id ? g_quark_try_string (id) : 0;
+
+  class = mx_stylable_get_style_class (stylable);
+  node->class = class ? g_quark_try_string (class) : 0;
+
+  node->pseudo_class = mx_stylable_get_style_pseudo_class (stylable);
+  node->pseudo_classes = _mx_css_pseudo_class_mask (node->pseudo_class);
+}
+
 
 /* MxStyleSheetValue */
 
 static MxStyleSheetValue *
-mx_style_sheet_value_new ()
+mx_style_sheet_value_new (const gchar *string,
+                          const gchar *source)
 {
-  return g_slice_new0 (MxStyleSheetValue);
+  MxStyleSheetValue *value = g_slice_new0 (MxStyleSheetValue);
+
+  value->string = string;
+  value->source = source;
+
+  return value;
 }
 
 static void
 mx_style_sheet_value_free (MxStyleSheetValue *value)
 {
+  while (value->typed_values)
+    {
+      GValue *typed_value = value->typed_values->data;
+
+      g_value_unset (typed_value);
+      g_slice_free (GValue, typed_value);
+
+      value->typed_values = g_slist_delete_link (value->typed_values,
+                                                 value->typed_values);
+    }
+
   g_slice_free (MxStyleSheetValue, value);
 }
 
-
-static gchar*
-append (gchar *str1, const gchar *str2)
+/* values parsed from CSS own their string, compiled ones point into the
+ * mapped file */
+static void
+mx_style_sheet_value_free_with_string (MxStyleSheetValue *value)
 {
-  gchar *tmp;
+  g_free ((gchar *) value->string);
+  mx_style_sheet_value_free (value);
+}
 
-  if (!str1)
-      return g_strdup (str2);
+/*
+ * mx_style_sheet_value_get_typed:
+ *
+ * Returns the value previously stored with mx_style_sheet_value_set_typed()
+ * for @type, or %NULL.
+ */
+const GValue *
+mx_style_sheet_value_get_typed (MxStyleSheetValue *value,
+                                GType              type)
+{
+  GSList *l;
 
-  if (!str2)
-      return str1;
+  for (l = value->typed_values; l; l = l->next)
+    if (G_VALUE_TYPE (l->data) == type)
+      return l->data;
 
-  tmp = g_strconcat (str1, str2, NULL);
-  g_free (str1);
-  return tmp;
+  return NULL;
 }
 
-static gchar*
-appendc (gchar *str, gchar c)
+/*
+ * mx_style_sheet_value_set_typed:
+ *
+ * Stores a copy of @typed_value, which must be the result of transforming
+ * the string of @value, so that it does not have to be transformed again.
+ */
+void
+mx_style_sheet_value_set_typed (MxStyleSheetValue *value,
+                                const GValue      *typed_value)
 {
-  gchar *tmp;
-  gint len;
+  GValue *copy;
 
-  if (str == NULL)
-    {
-      tmp = g_malloc (2);
-      len = 0;
-    }
-  else
-    {
-      len = strlen (str);
-      tmp = g_realloc (str, len + 2);
-    }
+  g_return_if_fail (!mx_style_sheet_value_get_typed (value,
+                                                     G_VALUE_TYPE (typed_value)));
 
-  tmp[len] = c;
-  tmp[len + 1] = '\0';
+  copy = g_slice_new0 (GValue);
+  g_value_init (copy, G_VALUE_TYPE (typed_value));
+  g_value_copy (typed_value, copy);
 
-  return tmp;
+  value->typed_values = g_slist_prepend (value->typed_values, copy);
 }
 
+
 static GTokenType
 css_parse_key_value (GScanner *scanner, gchar **key, gchar **value)
 {
   GTokenType token;
+  GString *string;
   gboolean start_with_dash = FALSE;
   gchar *id_first = scanner->config->cset_identifier_first;
   gchar *id_nth = scanner->config->cset_identifier_nth;
@@ -147,19 +373,21 @@ css_parse_key_value (GScanner *scanner, gchar **key, gchar **value)
   scanner->config->cset_skip_characters = "\n";
 
   /* parse value */
+  string = g_string_new (NULL);
   while (scanner->next_value.v_char != ';')
     {
       token = g_scanner_get_next_token (scanner);
       switch (token)
         {
         case G_TOKEN_IDENTIFIER:
-          *value = append (*value, scanner->value.v_identifier);
+          g_string_append (string, scanner->value.v_identifier);
           break;
         case G_TOKEN_CHAR:
-          *value = appendc (*value, scanner->value.v_char);
+          g_string_append_c (string, scanner->value.v_char);
           break;
 
         default:
+          g_string_free (string, TRUE);
           return ';';
         }
 
@@ -169,7 +397,12 @@ css_parse_key_value (GScanner *scanner, gchar **key, gchar **value)
   /* semi colon */
   g_scanner_get_next_token (scanner);
   if (scanner->value.v_char != ';')
-    return ';';
+    {
+      g_string_free (string, TRUE);
+      return ';';
+    }
+
+  *value = g_string_free (string, FALSE);
 
   /* we've come to the end of the value, so reset the options */
   scanner->config->cset_identifier_nth = id_nth;
@@ -187,6 +420,7 @@ css_parse_key_value (GScanner *scanner, gchar **key, gchar **value)
 static GTokenType
 css_parse_style (GScanner *scanner, GHashTable *table)
 {
+  const gchar *source = scanner->input_name;
   GTokenType token;
 
   /* { */
@@ -204,7 +438,8 @@ css_parse_style (GScanner *scanner, GHashTable *table)
       if (token != G_TOKEN_NONE)
         return token;
 
-      g_hash_table_insert (table, key, value);
+      g_hash_table_insert (table, key,
+                           mx_style_sheet_value_new (value, source));
 
       token = g_scanner_peek_next_token (scanner);
     }
@@ -218,12 +453,35 @@ css_parse_style (GScanner *scanner, GHashTable *table)
 }
 
 
+static void
+css_selector_add_pseudo_class (MxSelector  *selector,
+                               const gchar *name)
+{
+  guint64 bit;
+
+  bit = css_pseudo_class_register (name);
+
+  if (bit == MX_CSS_PSEUDO_CLASS_OVERFLOW)
+    {
+      gchar *tmp = selector->pseudo_class;
+
+      if (tmp)
+        selector->pseudo_class = g_strconcat (tmp, ":", name, NULL);
+      else
+        selector->pseudo_class = g_strdup (name);
+
+      g_free (tmp);
+    }
+
+  selector->pseudo_classes |= bit;
+  selector->n_pseudo_classes++;
+}
+
 static GTokenType
 css_parse_simple_selector (GScanner      *scanner,
                            MxSelector    *selector)
 {
   guint token;
-  gchar *tmp;
 
   /* parse optional type (either '*' or an identifier) */
   token = g_scanner_peek_next_token (scanner);
@@ -231,11 +489,11 @@ css_parse_simple_selector (GScanner      *scanner,
     {
     case '*':
       g_scanner_get_next_token (scanner);
-      selector->type = g_strdup ("*");
+      selector->type = 0;
       break;
     case G_TOKEN_IDENTIFIER:
       g_scanner_get_next_token (scanner);
-      selector->type = g_strdup (scanner->value.v_identifier);
+      selector->type = g_quark_from_string (scanner->value.v_identifier);
       break;
     default:
       break;
@@ -253,7 +511,7 @@ css_parse_simple_selector (GScanner      *scanner,
           token = g_scanner_get_next_token (scanner);
           if (token != G_TOKEN_IDENTIFIER)
             return G_TOKEN_IDENTIFIER;
-          selector->id = g_strdup (scanner->value.v_identifier);
+          selector->id = g_quark_from_string (scanner->value.v_identifier);
           break;
           /* class */
         case '.':
@@ -261,7 +519,7 @@ css_parse_simple_selector (GScanner      *scanner,
           token = g_scanner_get_next_token (scanner);
           if (token != G_TOKEN_IDENTIFIER)
             return G_TOKEN_IDENTIFIER;
-          selector->class = g_strdup (scanner->value.v_identifier);
+          selector->class = g_quark_from_string (scanner->value.v_identifier);
           break;
           /* pseudo-class */
         case ':':
@@ -270,17 +528,8 @@ css_parse_simple_selector (GScanner      *scanner,
           if (token != G_TOKEN_IDENTIFIER)
             return G_TOKEN_IDENTIFIER;
 
-          tmp = selector->pseudo_class;
-
-          if (selector->pseudo_class)
-            selector->pseudo_class = g_strconcat (selector->pseudo_class, ":",
-                                                  scanner->value.v_identifier,
-                                                  NULL);
-          else
-            selector->pseudo_class = g_strdup (scanner->value.v_identifier);
-
-          g_free (tmp);
-
+          css_selector_add_pseudo_class (selector,
+                                         scanner->value.v_identifier);
           break;
 
           /* unhandled */
@@ -293,10 +542,32 @@ css_parse_simple_selector (GScanner      *scanner,
   return G_TOKEN_NONE;
 }
 
+static gchar*
+selector_pseudo_class_to_string (MxSelector *selector)
+{
+  GString *string;
+  gint i;
+
+  if (!selector->pseudo_classes)
+    return NULL;
+
+  string = g_string_new (NULL);
+
+  for (i = 0; i < n_pseudo_class_bits; i++)
+    if (selector->pseudo_classes & (G_GUINT64_CONSTANT (1) << i))
+      g_string_append_printf (string, ":%s",
+                              g_quark_to_string (pseudo_class_names[i]));
+
+  if (selector->pseudo_class)
+    g_string_append_printf (string, ":%s", selector->pseudo_class);
+
+  return g_string_free (string, FALSE);
+}
+
 static char*
 selector_to_string (MxSelector *selector)
 {
-  gchar *ancestor, *string, *tmp, *parent, *ret;
+  gchar *ancestor, *string, *tmp, *parent, *ret, *pseudo_class;
 
   if (!selector)
     return NULL;
@@ -315,15 +586,20 @@ selector_to_string (MxSelector *selector)
     parent = NULL;
   g_free (tmp);
 
-  string = g_strdup_printf ("%s%s%s%s%s%s%s",
-                            (selector->type) ?  selector->type : "",
+  pseudo_class = selector_pseudo_class_to_string (selector);
+
+  string = g_strdup_printf ("%s%s%s%s%s%s",
+                            (selector->type) ?
+                            g_quark_to_string (selector->type) : "",
                             (selector->class) ? "." : "",
-                            (selector->class) ? selector->class : "",
+                            (selector->class) ?
+                            g_quark_to_string (selector->class) : "",
                             (selector->id) ? "#" : "",
-                            (selector->id) ? selector->id : "",
-                            (selector->pseudo_class) ? "#" : "",
-                            (selector->pseudo_class)
-                            ? selector->pseudo_class : "");
+                            (selector->id) ?
+                            g_quark_to_string (selector->id) : "",
+                            (pseudo_class) ? pseudo_class : "");
+
+  g_free (pseudo_class);
 
   ret = g_strconcat ((ancestor) ? ancestor : "",
                      (parent) ? parent : "",
@@ -374,12 +650,10 @@ mx_selector_free (MxSelector *selector)
   if (!selector)
     return;
 
-  g_free (selector->type);
-  g_free (selector->id);
-  g_free (selector->class);
   g_free (selector->pseudo_class);
 
   mx_selector_free (selector->parent);
+  mx_selector_free (selector->ancestor);
 
   g_slice_free (MxSelector, selector);
 }
@@ -496,8 +770,9 @@ css_parse_block (GScanner *scanner, GList **selectors, GList **styles)
 
 
   /* create a hash table for the properties */
-  table = g_hash_table_new_full (g_str_hash, g_direct_equal, g_free,
-                                 (GDestroyNotify) mx_style_sheet_value_free);
+  table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                 (GDestroyNotify)
+                                 mx_style_sheet_value_free_with_string);
 
   token = css_parse_style (scanner, table);
 
@@ -613,14 +888,11 @@ list_contains (const gchar *needle,
 
 static gint
 css_node_matches_selector (MxSelector *selector,
-                           MxStylable *stylable)
+                           CssNode    *node)
 {
   gint score;
   gint a, b, c;
 
-  const gchar *type = "*";
-  const gchar *class, *pseudo_class;
-  const gchar *id;
   ClutterActor *actor;
   MxStylable *parent;
 
@@ -628,114 +900,102 @@ css_node_matches_selector (MxSelector *selector,
   b = 0;
   c = 0;
 
-  /* get properties for this stylable */
-  id = clutter_actor_get_name (CLUTTER_ACTOR (stylable));
-  class = mx_stylable_get_style_class (stylable);
-  pseudo_class = mx_stylable_get_style_pseudo_class (stylable);
-
   /* check type */
-  if (selector->type == NULL || selector->type[0] == '*')
+  if (selector->type == 0)
     {
       /* NULL or universal selector match, but are ignored for score */
     }
   else
     {
-      GType type_id;
-      gint matched;
       gint depth;
 
-      type_id = G_OBJECT_CLASS_TYPE (G_OBJECT_GET_CLASS (stylable));
-      type = g_type_name (type_id);
-      matched = FALSE;
-
-      depth = 10;
-      while (type)
+      /* the type may not have been registered when the style sheet was
+       * parsed, but it must be by the time one of its instances is matched */
+      if (G_UNLIKELY (!selector->type_id))
         {
-          if (!strcmp (selector->type, type))
-            {
-              matched = depth;
-              break;
-            }
-          else
-            {
-              type_id = g_type_parent (type_id);
-              type = g_type_name (type_id);
-              if (depth > 1)
-                depth--;
-            }
+          selector->type_id =
+            g_type_from_name (g_quark_to_string (selector->type));
+
+          if (!selector->type_id)
+            return -1;
         }
 
-      if (!matched)
+      /* only the class hierarchy is matched, not implemented interfaces */
+      if (G_TYPE_IS_INTERFACE (selector->type_id) ||
+          !g_type_is_a (node->type, selector->type_id))
         return -1;
-      else
-        c += depth;
+
+      /* the score is reduced for each step up the type hierarchy */
+      depth = 10 - (g_type_depth (node->type) -
+                    g_type_depth (selector->type_id));
+      c += MAX (depth, 1);
     }
 
   /* check id */
   if (selector->id)
     {
-      if (!id || strcmp (selector->id, id))
+      if (selector->id != node->id)
         return -1;
       else
         a += 10;
     }
 
   /* check pseudo_class */
-  if (selector->pseudo_class)
+  if (selector->pseudo_classes)
     {
-      gchar *needle;
-      gint n_matches;
-
-      /* if no pseudo class is supplied on the node, return instantly */
-      if (!pseudo_class)
+      /* check that each pseudo-class from the selector appears in the
+       * pseudo-classes from the node, i.e. the selector pseudo-class set
+       * is a subset of the node's pseudo-class set */
+      if ((selector->pseudo_classes & node->pseudo_classes) !=
+          selector->pseudo_classes)
         return -1;
 
-      /* check that each pseudo-class from the selector appears in the
-       * pseudo-classes from the node, i.e. the selector pseudo-class list
-       * is a subset of the node's pseudo-class list */
-      n_matches = 0;
-      for (needle = selector->pseudo_class;
-           needle; needle = strchr (needle, ':'))
+      /* pseudo-classes that did not fit in the bitset are compared by name */
+      if (G_UNLIKELY (selector->pseudo_class))
         {
-          gint needle_len;
-          gchar *next;
-
-          /* move beyond ':' */
-          if (needle[0] == ':')
-            needle++;
-
-          /* calculate the length of this needle */
-          next = strchr (needle, ':');
-          if (next)
-            needle_len = next - needle;
-          else
-            needle_len = strlen (needle);
+          gchar *needle;
 
-          /* if the pseudo-class from the selector does not appear in the
-           * list of pseudo-classes from the node, then this is not a
-           * match */
-          if (!list_contains (needle, needle_len, pseudo_class, ':'))
-            return -1;
-          else
-            n_matches++;
+          for (needle = selector->pseudo_class;
+               needle; needle = strchr (needle, ':'))
+            {
+              gint needle_len;
+              gchar *next;
+
+              /* move beyond ':' */
+              if (needle[0] == ':')
+                needle++;
+
+              /* calculate the length of this needle */
+              next = strchr (needle, ':');
+              if (next)
+                needle_len = next - needle;
+              else
+                needle_len = strlen (needle);
+
+              if (!list_contains (needle, needle_len, node->pseudo_class, ':'))
+                return -1;
+            }
         }
 
       /* increase the 'b' score by the number of pseudo-classes in the
        * selector */
-      b = b + (10 * n_matches);
+      b = b + (10 * selector->n_pseudo_classes);
     }
 
   /* check class */
   if (selector->class)
     {
-      if (!class || strcmp (selector->class, class))
+      if (selector->class != node->class)
         return -1;
       else
         b += 10;
     }
 
+  if (!selector->parent && !selector->ancestor)
+    return (a * 10000) + (b * 100) + c;
+
   /* check parent */
-  actor = clutter_actor_get_parent (CLUTTER_ACTOR (stylable));
+  actor = clutter_actor_get_parent (CLUTTER_ACTOR (node->stylable));
   if (MX_IS_STYLABLE (actor))
     parent = MX_STYLABLE (actor);
   else
@@ -744,11 +1004,14 @@ css_node_matches_selector (MxSelector *selector,
   if (selector->parent)
     {
       gint parent_matches;
+      CssNode parent_node;
 
       if (!parent)
         return -1;
 
-      parent_matches = css_node_matches_selector (selector->parent, parent);
+      css_node_init (&parent_node, parent);
+      parent_matches = css_node_matches_selector (selector->parent,
+                                                  &parent_node);
       if (parent_matches < 0)
         return -1;
 
@@ -769,15 +1032,17 @@ css_node_matches_selector (MxSelector *selector,
       ancestor = parent;
       while (ancestor)
         {
+          CssNode ancestor_node;
+
           parent_actor = clutter_actor_get_parent (CLUTTER_ACTOR (ancestor));
           if (MX_IS_STYLABLE (parent_actor))
             pparent = MX_STYLABLE (parent_actor);
           else
             pparent = NULL;
 
-
+          css_node_init (&ancestor_node, ancestor);
           ancestor_matches = css_node_matches_selector (selector->ancestor,
-                                                        ancestor);
+                                                        &ancestor_node);
 
           /* if one of the ancestors match, stop search and increase 'c' score
            */
@@ -808,6 +1073,121 @@ typedef struct _SelectorMatch
   gint score;
 } SelectorMatch;
 
+static void
+mx_style_sheet_index_add (GHashTable  *index,
+                          GQuark       key,
+                          MxSelector  *selector)
+{
+  GList *bucket;
+
+  bucket = g_hash_table_lookup (index, GUINT_TO_POINTER (key));
+
+  /* the list head stays the same after g_list_append, so only insert when
+   * creating the bucket */
+  if (bucket)
+    g_list_append (bucket, selector);
+  else
+    g_hash_table_insert (index, GUINT_TO_POINTER (key),
+                         g_list_prepend (NULL, selector));
+}
+
+static void
+mx_style_sheet_index_clear (MxStyleSheet *sheet)
+{
+  if (sheet->id_selectors)
+    {
+      g_hash_table_destroy (sheet->id_selectors);
+      g_hash_table_destroy (sheet->class_selectors);
+      g_hash_table_destroy (sheet->type_selectors);
+    }
+
+  g_list_free (sheet->universal_selectors);
+
+  if (sheet->ancestor_ids)
+    {
+      g_hash_table_destroy (sheet->ancestor_ids);
+      g_hash_table_destroy (sheet->ancestor_classes);
+    }
+
+  sheet->id_selectors = NULL;
+  sheet->class_selectors = NULL;
+  sheet->type_selectors = NULL;
+  sheet->universal_selectors = NULL;
+
+  sheet->ancestor_ids = NULL;
+  sheet->ancestor_classes = NULL;
+  sheet->ancestor_pseudo_classes = 0;
+}
+
+static void
+mx_style_sheet_index_ancestors (MxStyleSheet *sheet,
+                                MxSelector   *selector)
+{
+  MxSelector *ancestors[2] = { selector->parent, selector->ancestor };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (ancestors); i++)
+    {
+      MxSelector *ancestor = ancestors[i];
+
+      if (!ancestor)
+        continue;
+
+      if (ancestor->id)
+        g_hash_table_insert (sheet->ancestor_ids,
+                             GUINT_TO_POINTER (ancestor->id), ancestor);
+      if (ancestor->class)
+        g_hash_table_insert (sheet->ancestor_classes,
+                             GUINT_TO_POINTER (ancestor->class), ancestor);
+      sheet->ancestor_pseudo_classes |= ancestor->pseudo_classes;
+
+      mx_style_sheet_index_ancestors (sheet, ancestor);
+    }
+}
+
+static void
+mx_style_sheet_index (MxStyleSheet *sheet)
+{
+  GList *l;
+
+  mx_style_sheet_index_clear (sheet);
+
+  sheet->id_selectors = g_hash_table_new_full (NULL, NULL, NULL,
+                                               (GDestroyNotify) g_list_free);
+  sheet->class_selectors = g_hash_table_new_full (NULL, NULL, NULL,
+                                                  (GDestroyNotify) g_list_free);
+  sheet->type_selectors = g_hash_table_new_full (NULL, NULL, NULL,
+                                                 (GDestroyNotify) g_list_free);
+  sheet->ancestor_ids = g_hash_table_new (NULL, NULL);
+  sheet->ancestor_classes = g_hash_table_new (NULL, NULL);
+
+  /* Each selector is put into exactly one bucket, chosen by the key of the
+   * rightmost simple selector that is least likely to match, i.e. id, then
+   * class, then type. Selectors without any of these can match any node.
+   */
+  for (l = sheet->selectors; l; l = l->next)
+    {
+      MxSelector *selector = l->data;
+
+      if (selector->id)
+        mx_style_sheet_index_add (sheet->id_selectors, selector->id,
+                                  selector);
+      else if (selector->class)
+        mx_style_sheet_index_add (sheet->class_selectors, selector->class,
+                                  selector);
+      else if (selector->type)
+        mx_style_sheet_index_add (sheet->type_selectors, selector->type,
+                                  selector);
+      else
+        sheet->universal_selectors =
+          g_list_prepend (sheet->universal_selectors, selector);
+
+      mx_style_sheet_index_ancestors (sheet, selector);
+    }
+
+  sheet->index_dirty = FALSE;
+}
+
 static gint
 compare_selector_matches (SelectorMatch *a,
                           SelectorMatch *b)
@@ -829,40 +1209,311 @@ compare_selector_matches (SelectorMatch *a,
     return 0;
 }
 
-struct _css_table_copy_data
+static void
+css_table_copy (gpointer    key,
+                gpointer    value,
+                GHashTable *table)
 {
-  GHashTable *table;
-  const gchar *filename;
-};
+  g_hash_table_insert (table, key, value);
+}
 
 static void
-css_table_copy (gpointer                    *key,
-                gpointer                    *value,
-                struct _css_table_copy_data *data)
+free_selector_match (SelectorMatch *data)
+{
+  g_slice_free (SelectorMatch, data);
+}
+
+static GList *
+css_match_selectors (GList      *selectors,
+                     CssNode    *node,
+                     GList      *matching_selectors)
+{
+  GList *l;
+
+  for (l = selectors; l; l = l->next)
+    {
+      gint score;
+
+      score = css_node_matches_selector (l->data, node);
+
+      if (score >= 0)
+        {
+          SelectorMatch *selector_match;
+
+          selector_match = g_slice_new (SelectorMatch);
+          selector_match->selector = l->data;
+          selector_match->score = score;
+          matching_selectors = g_list_prepend (matching_selectors,
+                                               selector_match);
+        }
+    }
+
+  return matching_selectors;
+}
+
+static guint
+mx_computed_style_hash (gconstpointer key)
 {
-  MxStyleSheetValue *css_value;
+  return ((const MxComputedStyle *) key)->hash;
+}
 
-  css_value = mx_style_sheet_value_new ();
-  css_value->source = data->filename;
-  css_value->string = (gchar*) value;
+static gboolean
+mx_computed_style_equal (gconstpointer a,
+                         gconstpointer b)
+{
+  const MxComputedStyle *style_a = a;
+  const MxComputedStyle *style_b = b;
 
-  g_hash_table_insert (data->table, key, css_value);
+  return (style_a->hash == style_b->hash &&
+          style_a->n_styles == style_b->n_styles &&
+          memcmp (style_a->styles, style_b->styles,
+                  style_a->n_styles * sizeof (GHashTable *)) == 0);
 }
 
 static void
-free_selector_match (SelectorMatch *data)
+mx_computed_style_free (MxComputedStyle *style)
 {
-  g_slice_free (SelectorMatch, data);
+  if (style->diffs)
+    g_hash_table_destroy (style->diffs);
+  g_hash_table_unref (style->properties);
+  g_free (style->styles);
+  g_slice_free (MxComputedStyle, style);
+}
+
+MxComputedStyle *
+mx_computed_style_ref (MxComputedStyle *style)
+{
+  g_return_val_if_fail (style != NULL, NULL);
+
+  g_atomic_int_inc (&style->ref_count);
+
+  return style;
+}
+
+void
+mx_computed_style_unref (MxComputedStyle *style)
+{
+  g_return_if_fail (style != NULL);
+
+  if (g_atomic_int_dec_and_test (&style->ref_count))
+    {
+      if (style->sheet)
+        g_hash_table_remove (style->sheet->computed_styles, style);
+      mx_computed_style_free (style);
+    }
 }
 
 GHashTable *
-mx_style_sheet_get_properties (MxStyleSheet *sheet,
-                               MxStylable   *node)
+mx_computed_style_get_properties (MxComputedStyle *style)
+{
+  g_return_val_if_fail (style != NULL, NULL);
+
+  return style->properties;
+}
+
+/**
+ * mx_computed_style_get_size:
+ * @style: a computed style
+ *
+ * Works out the approximate memory used by @style: the computed style, its
+ * property table and its diffs, which grow as it is compared with other
+ * computed styles. The property values are shared with the style sheet and
+ * are not included.
+ *
+ * Returns: the size in bytes
+ */
+gsize
+mx_computed_style_get_size (MxComputedStyle *style)
+{
+  /* a hash table node is a key, a value and a hash */
+  const gsize node_size = 2 * sizeof (gpointer) + sizeof (guint);
+  gsize size;
+
+  g_return_val_if_fail (style != NULL, 0);
+
+  size = sizeof (MxComputedStyle) +
+    style->n_styles * sizeof (GHashTable *) +
+    g_hash_table_size (style->properties) * node_size;
+
+  if (style->diffs)
+    {
+      GHashTableIter iter;
+      GPtrArray *changed;
+
+      g_hash_table_iter_init (&iter, style->diffs);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &changed))
+        size += node_size + sizeof (GPtrArray) + changed->len * sizeof (gpointer);
+    }
+
+  return size;
+}
+
+static gboolean
+css_values_equal (MxStyleSheetValue *a,
+                  MxStyleSheetValue *b)
+{
+  if (a == b)
+    return TRUE;
+
+  if (!a || !b)
+    return FALSE;
+
+  /* the source is used to resolve relative URIs */
+  return (g_strcmp0 (a->string, b->string) == 0 &&
+          g_strcmp0 (a->source, b->source) == 0);
+}
+
+static void
+css_diff_properties (GHashTable *properties,
+                     GHashTable *other,
+                     GPtrArray  *changed)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, properties);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      guint i;
+
+      if (css_values_equal (value, g_hash_table_lookup (other, key)))
+        continue;
+
+      for (i = 0; i < changed->len; i++)
+        if (g_str_equal (g_ptr_array_index (changed, i), key))
+          break;
+
+      if (i == changed->len)
+        g_ptr_array_add (changed, key);
+    }
+}
+
+/**
+ * mx_computed_style_diff:
+ * @old_style: the previous computed style
+ * @new_style: the current computed style
+ *
+ * Lists the properties that differ between two computed styles of the same
+ * style sheet. The diffs against the last few computed styles compared are
+ * kept, so a diff is usually only worked out once for each pair of computed
+ * styles, however many stylables move from one to the other.
+ *
+ * Returns: the names of the changed properties, owned by @old_style and
+ *   valid until it is next compared, or %NULL if the computed styles belong
+ *   to different style sheets and all properties should be considered
+ *   changed.
+ */
+const GPtrArray *
+mx_computed_style_diff (MxComputedStyle *old_style,
+                        MxComputedStyle *new_style)
+{
+  GPtrArray *changed;
+
+  g_return_val_if_fail (old_style != NULL, NULL);
+  g_return_val_if_fail (new_style != NULL, NULL);
+
+  /* computed styles can only be compared while their sheet exists */
+  if (!old_style->sheet || old_style->sheet != new_style->sheet)
+    return NULL;
+
+  if (!old_style->diffs)
+    old_style->diffs = g_hash_table_new_full (NULL, NULL, NULL,
+                                              (GDestroyNotify) g_ptr_array_unref);
+  else if ((changed = g_hash_table_lookup (old_style->diffs,
+                                           GUINT_TO_POINTER (new_style->serial))))
+    return changed;
+  else if (g_hash_table_size (old_style->diffs) >= CSS_MAX_DIFFS)
+    g_hash_table_remove_all (old_style->diffs);
+
+  changed = g_ptr_array_new ();
+  if (old_style != new_style)
+    {
+      css_diff_properties (old_style->properties, new_style->properties,
+                           changed);
+      css_diff_properties (new_style->properties, old_style->properties,
+                           changed);
+    }
+
+  g_hash_table_insert (old_style->diffs, GUINT_TO_POINTER (new_style->serial),
+                       changed);
+
+  return changed;
+}
+
+static MxComputedStyle *
+mx_style_sheet_intern_computed_style (MxStyleSheet *sheet,
+                                      GList        *matching_selectors)
+{
+  MxComputedStyle *style, lookup = { 0, };
+  GHashTable *styles[32];
+  GList *l;
+  guint i;
+
+  lookup.n_styles = g_list_length (matching_selectors);
+  lookup.styles = (lookup.n_styles <= G_N_ELEMENTS (styles)) ?
+    styles : g_new (GHashTable *, lookup.n_styles);
+
+  lookup.hash = lookup.n_styles;
+  for (l = matching_selectors, i = 0; l; l = l->next, i++)
+    {
+      SelectorMatch *match = l->data;
+
+      lookup.styles[i] = match->selector->style;
+      lookup.hash = (lookup.hash * 31) + GPOINTER_TO_UINT (lookup.styles[i]);
+    }
+
+  if (!sheet->computed_styles)
+    sheet->computed_styles =
+      g_hash_table_new (mx_computed_style_hash, mx_computed_style_equal);
+  else if ((style = g_hash_table_lookup (sheet->computed_styles, &lookup)))
+    {
+      if (lookup.styles != styles)
+        g_free (lookup.styles);
+
+      return mx_computed_style_ref (style);
+    }
+
+  style = g_slice_new0 (MxComputedStyle);
+  style->ref_count = 1;
+  style->sheet = sheet;
+  style->n_styles = lookup.n_styles;
+  style->hash = lookup.hash;
+  style->serial = ++sheet->computed_style_serial;
+
+  if (lookup.styles != styles)
+    style->styles = lookup.styles;
+  else
+    style->styles = g_memdup (styles, lookup.n_styles * sizeof (GHashTable *));
+
+  /* get properties from selector's styles, the values are shared with the
+   * style sheet */
+  style->properties = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < style->n_styles; i++)
+    g_hash_table_foreach (style->styles[i], (GHFunc) css_table_copy,
+                          style->properties);
+
+  /* the style sheet does not keep a reference, so that computed styles no
+   * longer used by any stylable are freed */
+  g_hash_table_insert (sheet->computed_styles, style, style);
+
+  return style;
+}
+
+static void
+css_computed_style_release (MxComputedStyle *style)
+{
+  style->sheet = NULL;
+}
+
+MxComputedStyle *
+mx_style_sheet_get_computed_style (MxStyleSheet *sheet,
+                                   MxStylable   *node)
 {
   GTimer *timer = NULL;
   GList *l, *matching_selectors = NULL;
-  SelectorMatch *selector_match = NULL;
-  GHashTable *result;
+  MxComputedStyle *result;
+  CssNode css_node;
+  GType type_id;
 
   if (_mx_debug (MX_DEBUG_CSS))
     {
@@ -884,46 +1535,46 @@ mx_style_sheet_get_properties (MxStyleSheet *sheet,
       g_print ("\x1b[22m");
     }
 
-  /* find matching selectors */
-  for (l = sheet->selectors; l; l = l->next)
-    {
-      gint score;
+  if (sheet->index_dirty)
+    mx_style_sheet_index (sheet);
 
-      score = css_node_matches_selector (l->data, node);
+  css_node_init (&css_node, node);
 
-      if (score >= 0)
-        {
-          selector_match = g_slice_new (SelectorMatch);
-          selector_match->selector = l->data;
-          selector_match->score = score;
-          matching_selectors = g_list_prepend (matching_selectors,
-                                               selector_match);
-        }
-    }
+  /* find matching selectors, only testing the buckets that can match */
+  if (css_node.id)
+    matching_selectors =
+      css_match_selectors (g_hash_table_lookup (sheet->id_selectors,
+                                                GUINT_TO_POINTER (css_node.id)),
+                           &css_node, matching_selectors);
+
+  if (css_node.class)
+    matching_selectors =
+      css_match_selectors (g_hash_table_lookup (sheet->class_selectors,
+                                                GUINT_TO_POINTER (css_node.class)),
+                           &css_node, matching_selectors);
+
+  for (type_id = css_node.type; type_id; type_id = g_type_parent (type_id))
+    matching_selectors =
+      css_match_selectors (g_hash_table_lookup (sheet->type_selectors,
+                                                GUINT_TO_POINTER (g_type_qname (type_id))),
+                           &css_node, matching_selectors);
+
+  matching_selectors = css_match_selectors (sheet->universal_selectors,
+                                            &css_node, matching_selectors);
 
   /* score the selectors by their score */
   matching_selectors = g_list_sort (matching_selectors,
                                     (GCompareFunc) compare_selector_matches);
 
-  /* get properties from selector's styles */
-  result = g_hash_table_new_full (g_str_hash,
-                                  g_str_equal,
-                                  NULL,
-                                  (GDestroyNotify)mx_style_sheet_value_free);
-  for (l = matching_selectors; l; l = l->next)
-    {
-      SelectorMatch *match = l->data;
-      struct _css_table_copy_data copy_data;
-
-      copy_data.filename = match->selector->filename;
-      copy_data.table = result;
+  result = mx_style_sheet_intern_computed_style (sheet, matching_selectors);
 
-      g_hash_table_foreach (match->selector->style, (GHFunc) css_table_copy,
-                            &copy_data);
+  if (_mx_debug (MX_DEBUG_CSS))
+    for (l = matching_selectors; l; l = l->next)
+      {
+        SelectorMatch *match = l->data;
 
-      if (_mx_debug (MX_DEBUG_CSS))
         print_selector (match->selector, match->score);
-    }
+      }
 
   g_list_foreach (matching_selectors, (GFunc) free_selector_match, NULL);
   g_list_free (matching_selectors);
@@ -939,6 +1590,41 @@ mx_style_sheet_get_properties (MxStyleSheet *sheet,
   return result;
 }
 
+/**
+ * mx_style_sheet_has_ancestor_dependency:
+ * @sheet: a #MxStyleSheet
+ * @id: an id, or 0
+ * @class: a style class, or 0
+ * @pseudo_classes: a pseudo-class mask
+ *
+ * Checks whether a parent or ancestor selector of @sheet refers to @id,
+ * @class or any of @pseudo_classes. If not, changing them on a node cannot
+ * change what its descendants match.
+ *
+ * Returns: %TRUE if the matches of descendants can depend on the arguments
+ */
+gboolean
+mx_style_sheet_has_ancestor_dependency (MxStyleSheet *sheet,
+                                        GQuark        id,
+                                        GQuark        class,
+                                        guint64       pseudo_classes)
+{
+  if (sheet->index_dirty || !sheet->ancestor_ids)
+    mx_style_sheet_index (sheet);
+
+  if (pseudo_classes & sheet->ancestor_pseudo_classes)
+    return TRUE;
+
+  if (id && g_hash_table_lookup (sheet->ancestor_ids, GUINT_TO_POINTER (id)))
+    return TRUE;
+
+  if (class &&
+      g_hash_table_lookup (sheet->ancestor_classes, GUINT_TO_POINTER (class)))
+    return TRUE;
+
+  return FALSE;
+}
+
 MxStyleSheet *
 mx_style_sheet_new ()
 {
@@ -948,6 +1634,19 @@ mx_style_sheet_new ()
 void
 mx_style_sheet_destroy (MxStyleSheet *sheet)
 {
+  mx_style_sheet_index_clear (sheet);
+
+  /* computed styles still referenced elsewhere outlive the sheet, but can
+   * no longer be compared */
+  if (sheet->computed_styles)
+    {
+      GList *styles = g_hash_table_get_keys (sheet->computed_styles);
+
+      g_hash_table_destroy (sheet->computed_styles);
+      g_list_foreach (styles, (GFunc) css_computed_style_release, NULL);
+      g_list_free (styles);
+    }
+
   g_list_foreach (sheet->selectors, (GFunc) mx_selector_free, NULL);
   g_list_free (sheet->selectors);
 
@@ -957,6 +1656,9 @@ mx_style_sheet_destroy (MxStyleSheet *sheet)
   g_list_foreach (sheet->filenames, (GFunc) g_free, NULL);
   g_list_free (sheet->filenames);
 
+  g_list_foreach (sheet->mapped_files, (GFunc) g_mapped_file_unref, NULL);
+  g_list_free (sheet->mapped_files);
+
   g_free (sheet);
 }
 
@@ -975,6 +1677,584 @@ mx_style_sheet_add_from_file (MxStyleSheet *sheet,
   input_name = g_strdup (filename);
   result = css_parse_file (sheet, input_name, g_list_length (sheet->filenames));
   sheet->filenames = g_list_prepend (sheet->filenames, input_name);
+  sheet->index_dirty = TRUE;
+
+  return result;
+}
+
+
+/* Compiled style sheets
+ *
+ * A compiled style sheet is a parsed style sheet written out as a single
+ * file that is mapped into memory when loaded, so that no tokenizing is
+ * needed at start-up. Strings are stored once in a string table at the end
+ * of the file and the style tables point straight into the mapping.
+ *
+ * The file is written in host byte order and is rejected if it was written
+ * by a host with a different byte order or by a different version of the
+ * format. It records the size and modification time of the CSS it was
+ * compiled from, which must be installed next to it; if the CSS has changed
+ * size, or has been modified since it was compiled and is more recent than
+ * the compiled file, the compiled file is considered stale. Only the CSS is
+ * stat()ed, as reading it would cost about as much as parsing it.
+ */
+
+#define MX_CSS_COMPILED_MAGIC      "MXCSSBIN"
+#define MX_CSS_COMPILED_VERSION    2
+#define MX_CSS_COMPILED_BYTE_ORDER 0x01020304
+#define MX_CSS_COMPILED_NONE       G_MAXUINT32
+
+typedef struct
+{
+  gchar   magic[8];
+  guint32 version;
+  guint32 byte_order;
+
+  guint32 source;             /* basename of the CSS file, in strings */
+  guint32 source_size;
+  guint32 source_mtime;       /* in seconds since the epoch */
+
+  /* sections, as offsets from the start of the file */
+  guint32 n_selectors;
+  guint32 selectors;
+  guint32 n_styles;
+  guint32 styles;
+  guint32 n_properties;
+  guint32 properties;
+  guint32 strings;
+  guint32 strings_size;
+} MxCssCompiledHeader;
+
+typedef struct
+{
+  guint32 type;         /* string, or NONE for the universal selector */
+  guint32 id;           /* string or NONE */
+  guint32 class;        /* string or NONE */
+  guint32 pseudo_class; /* ':' separated string or NONE */
+  guint32 parent;       /* index of an earlier selector, or NONE */
+  guint32 ancestor;     /* index of an earlier selector, or NONE */
+  guint32 style;        /* style index, NONE for parent/ancestor selectors */
+  guint32 line;
+  guint32 position;
+} MxCssCompiledSelector;
+
+typedef struct
+{
+  guint32 first_property;
+  guint32 n_properties;
+} MxCssCompiledStyle;
+
+typedef struct
+{
+  guint32 key;
+  guint32 value;
+} MxCssCompiledProperty;
+
+typedef struct
+{
+  GArray     *selectors;
+  GArray     *styles;
+  GArray     *properties;
+  GString    *strings;
+  GHashTable *string_offsets;
+  GHashTable *style_indices;
+} CssCompiler;
+
+static gboolean
+css_stat_source (const gchar *filename,
+                 guint32     *size,
+                 guint32     *mtime,
+                 GError     **error)
+{
+  struct stat source_stat;
+
+  if (g_stat (filename, &source_stat) != 0)
+    {
+      gint errsv = errno;
+
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                   "Unable to stat '%s': %s", filename, g_strerror (errsv));
+      return FALSE;
+    }
+
+  *size = source_stat.st_size;
+  *mtime = source_stat.st_mtime;
+
+  return TRUE;
+}
+
+static guint32
+css_compiler_add_string (CssCompiler *compiler,
+                         const gchar *string)
+{
+  gpointer offset;
+
+  if (!string)
+    return MX_CSS_COMPILED_NONE;
+
+  if (!g_hash_table_lookup_extended (compiler->string_offsets, string,
+                                     NULL, &offset))
+    {
+      offset = GUINT_TO_POINTER (compiler->strings->len);
+      g_string_append_len (compiler->strings, string, strlen (string) + 1);
+      g_hash_table_insert (compiler->string_offsets, g_strdup (string),
+                           offset);
+    }
+
+  return GPOINTER_TO_UINT (offset);
+}
+
+static void
+css_compiler_add_property (const gchar       *key,
+                           MxStyleSheetValue *value,
+                           CssCompiler       *compiler)
+{
+  MxCssCompiledProperty property;
+
+  property.key = css_compiler_add_string (compiler, key);
+  property.value = css_compiler_add_string (compiler, value->string);
+
+  g_array_append_val (compiler->properties, property);
+}
+
+static guint32
+css_compiler_add_selector (CssCompiler *compiler,
+                           MxSelector  *selector)
+{
+  MxCssCompiledSelector record;
+  gchar *pseudo_class;
+
+  if (!selector)
+    return MX_CSS_COMPILED_NONE;
+
+  /* parent and ancestor selectors are written before the selectors that
+   * reference them */
+  record.parent = css_compiler_add_selector (compiler, selector->parent);
+  record.ancestor = css_compiler_add_selector (compiler, selector->ancestor);
+
+  record.type = css_compiler_add_string (compiler,
+                                         g_quark_to_string (selector->type));
+  record.id = css_compiler_add_string (compiler,
+                                       g_quark_to_string (selector->id));
+  record.class = css_compiler_add_string (compiler,
+                                          g_quark_to_string (selector->class));
+
+  pseudo_class = selector_pseudo_class_to_string (selector);
+  record.pseudo_class = css_compiler_add_string (compiler, pseudo_class);
+  g_free (pseudo_class);
+
+  if (selector->style)
+    record.style =
+      GPOINTER_TO_UINT (g_hash_table_lookup (compiler->style_indices,
+                                             selector->style));
+  else
+    record.style = MX_CSS_COMPILED_NONE;
+
+  record.line = selector->line;
+  record.position = selector->position;
+
+  g_array_append_val (compiler->selectors, record);
+
+  return compiler->selectors->len - 1;
+}
+
+/*
+ * mx_style_sheet_write_compiled:
+ *
+ * Writes a style sheet that has been loaded from a single CSS file to
+ * @filename, so that it can be loaded again with
+ * mx_style_sheet_add_from_compiled_file(). The compiled file must be
+ * installed in the same directory as the CSS file.
+ */
+gboolean
+mx_style_sheet_write_compiled (MxStyleSheet  *sheet,
+                               const gchar   *filename,
+                               GError       **error)
+{
+  MxCssCompiledHeader header;
+  CssCompiler compiler;
+  GByteArray *data;
+  GList *l;
+  gchar *basename;
+  gboolean result;
+
+  g_return_val_if_fail (sheet != NULL, FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+  g_return_val_if_fail (g_list_length (sheet->filenames) == 1, FALSE);
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, MX_CSS_COMPILED_MAGIC, sizeof (header.magic));
+  header.version = MX_CSS_COMPILED_VERSION;
+  header.byte_order = MX_CSS_COMPILED_BYTE_ORDER;
+
+  if (!css_stat_source (sheet->filenames->data, &header.source_size,
+                        &header.source_mtime, error))
+    return FALSE;
+
+  compiler.selectors = g_array_new (FALSE, FALSE,
+                                    sizeof (MxCssCompiledSelector));
+  compiler.styles = g_array_new (FALSE, FALSE, sizeof (MxCssCompiledStyle));
+  compiler.properties = g_array_new (FALSE, FALSE,
+                                     sizeof (MxCssCompiledProperty));
+  compiler.strings = g_string_new (NULL);
+  compiler.string_offsets = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, NULL);
+  compiler.style_indices = g_hash_table_new (NULL, NULL);
+
+  basename = g_path_get_basename (sheet->filenames->data);
+  header.source = css_compiler_add_string (&compiler, basename);
+  g_free (basename);
+
+  for (l = sheet->styles; l; l = l->next)
+    {
+      MxCssCompiledStyle style;
+
+      style.first_property = compiler.properties->len;
+      g_hash_table_foreach (l->data, (GHFunc) css_compiler_add_property,
+                            &compiler);
+      style.n_properties = compiler.properties->len - style.first_property;
+
+      g_hash_table_insert (compiler.style_indices, l->data,
+                           GUINT_TO_POINTER (compiler.styles->len));
+      g_array_append_val (compiler.styles, style);
+    }
+
+  for (l = sheet->selectors; l; l = l->next)
+    css_compiler_add_selector (&compiler, l->data);
+
+  header.n_selectors = compiler.selectors->len;
+  header.selectors = sizeof (header);
+  header.n_styles = compiler.styles->len;
+  header.styles = header.selectors
+    + header.n_selectors * sizeof (MxCssCompiledSelector);
+  header.n_properties = compiler.properties->len;
+  header.properties = header.styles
+    + header.n_styles * sizeof (MxCssCompiledStyle);
+  header.strings = header.properties
+    + header.n_properties * sizeof (MxCssCompiledProperty);
+  header.strings_size = compiler.strings->len;
+
+  data = g_byte_array_new ();
+  g_byte_array_append (data, (const guint8 *) &header, sizeof (header));
+  g_byte_array_append (data, (const guint8 *) compiler.selectors->data,
+                       header.n_selectors * sizeof (MxCssCompiledSelector));
+  g_byte_array_append (data, (const guint8 *) compiler.styles->data,
+                       header.n_styles * sizeof (MxCssCompiledStyle));
+  g_byte_array_append (data, (const guint8 *) compiler.properties->data,
+                       header.n_properties * sizeof (MxCssCompiledProperty));
+  g_byte_array_append (data, (const guint8 *) compiler.strings->str,
+                       header.strings_size);
+
+  result = g_file_set_contents (filename, (const gchar *) data->data,
+                                data->len, error);
+
+  g_byte_array_free (data, TRUE);
+  g_array_free (compiler.selectors, TRUE);
+  g_array_free (compiler.styles, TRUE);
+  g_array_free (compiler.properties, TRUE);
+  g_string_free (compiler.strings, TRUE);
+  g_hash_table_destroy (compiler.string_offsets);
+  g_hash_table_destroy (compiler.style_indices);
+
+  MX_NOTE (CSS, "Compiled %s to %s: %d selectors, %d styles, %d properties",
+           (gchar *) sheet->filenames->data, filename, header.n_selectors,
+           header.n_styles, header.n_properties);
 
   return result;
 }
+
+static gboolean
+css_compiled_section_is_valid (gsize   length,
+                               guint32 offset,
+                               guint32 n_items,
+                               gsize   item_size)
+{
+  if (offset % sizeof (guint32))
+    return FALSE;
+
+  return ((guint64) offset + (guint64) n_items * item_size) <= length;
+}
+
+static const gchar *
+css_compiled_get_string (const MxCssCompiledHeader *header,
+                         const gchar               *strings,
+                         guint32                    offset)
+{
+  /* the string table is NUL terminated, so any offset inside it yields a
+   * valid string */
+  if (offset >= header->strings_size)
+    return NULL;
+
+  return strings + offset;
+}
+
+static gboolean
+css_compiled_string_is_valid (const MxCssCompiledHeader *header,
+                              guint32                    offset)
+{
+  return (offset == MX_CSS_COMPILED_NONE) || (offset < header->strings_size);
+}
+
+static gboolean
+css_compiled_is_valid (const MxCssCompiledHeader *header,
+                       gsize                      length)
+{
+  const MxCssCompiledSelector *selectors;
+  const MxCssCompiledStyle *styles;
+  const MxCssCompiledProperty *properties;
+  const gchar *data = (const gchar *) header;
+  gboolean *referenced;
+  gboolean valid = TRUE;
+  guint i;
+
+  if (length < sizeof (MxCssCompiledHeader) ||
+      memcmp (header->magic, MX_CSS_COMPILED_MAGIC, sizeof (header->magic)) ||
+      header->version != MX_CSS_COMPILED_VERSION ||
+      header->byte_order != MX_CSS_COMPILED_BYTE_ORDER)
+    return FALSE;
+
+  if (!css_compiled_section_is_valid (length, header->selectors,
+                                      header->n_selectors,
+                                      sizeof (MxCssCompiledSelector)) ||
+      !css_compiled_section_is_valid (length, header->styles,
+                                      header->n_styles,
+                                      sizeof (MxCssCompiledStyle)) ||
+      !css_compiled_section_is_valid (length, header->properties,
+                                      header->n_properties,
+                                      sizeof (MxCssCompiledProperty)) ||
+      ((guint64) header->strings + header->strings_size) > length ||
+      header->strings_size == 0 ||
+      data[header->strings + header->strings_size - 1] != '\0' ||
+      header->source >= header->strings_size)
+    return FALSE;
+
+  properties = (const MxCssCompiledProperty *) (data + header->properties);
+  for (i = 0; i < header->n_properties; i++)
+    if (properties[i].key >= header->strings_size ||
+        properties[i].value >= header->strings_size)
+      return FALSE;
+
+  styles = (const MxCssCompiledStyle *) (data + header->styles);
+  for (i = 0; i < header->n_styles; i++)
+    if ((guint64) styles[i].first_property + styles[i].n_properties >
+        header->n_properties)
+      return FALSE;
+
+  /* parent and ancestor selectors must come before the selector that uses
+   * them and may only be used once, as they are owned by that selector */
+  selectors = (const MxCssCompiledSelector *) (data + header->selectors);
+  referenced = g_new0 (gboolean, header->n_selectors);
+  for (i = 0; valid && i < header->n_selectors; i++)
+    {
+      const MxCssCompiledSelector *record = &selectors[i];
+
+      if (!css_compiled_string_is_valid (header, record->type) ||
+          !css_compiled_string_is_valid (header, record->id) ||
+          !css_compiled_string_is_valid (header, record->class) ||
+          !css_compiled_string_is_valid (header, record->pseudo_class) ||
+          (record->style != MX_CSS_COMPILED_NONE &&
+           record->style >= header->n_styles))
+        valid = FALSE;
+      else if (record->parent != MX_CSS_COMPILED_NONE &&
+               (record->parent >= i || referenced[record->parent] ||
+                selectors[record->parent].style != MX_CSS_COMPILED_NONE))
+        valid = FALSE;
+      else if (record->ancestor != MX_CSS_COMPILED_NONE &&
+               (record->ancestor >= i || referenced[record->ancestor] ||
+                record->ancestor == record->parent ||
+                selectors[record->ancestor].style != MX_CSS_COMPILED_NONE))
+        valid = FALSE;
+      else
+        {
+          if (record->parent != MX_CSS_COMPILED_NONE)
+            referenced[record->parent] = TRUE;
+          if (record->ancestor != MX_CSS_COMPILED_NONE)
+            referenced[record->ancestor] = TRUE;
+        }
+    }
+
+  /* every selector must either be in the list or owned by another one */
+  for (i = 0; valid && i < header->n_selectors; i++)
+    if (selectors[i].style == MX_CSS_COMPILED_NONE && !referenced[i])
+      valid = FALSE;
+
+  g_free (referenced);
+
+  return valid;
+}
+
+static gboolean
+css_compiled_is_current (const MxCssCompiledHeader *header,
+                         const gchar               *filename,
+                         const gchar               *source)
+{
+  struct stat compiled_stat;
+  guint32 size, mtime;
+
+  /* without the CSS there is nothing to fall back to */
+  if (!g_file_test (source, G_FILE_TEST_EXISTS))
+    return TRUE;
+
+  if (!css_stat_source (source, &size, &mtime, NULL) ||
+      size != header->source_size)
+    return FALSE;
+
+  if (mtime == header->source_mtime)
+    return TRUE;
+
+  /* installing the files doesn't preserve their modification times, so
+   * the CSS may also not be more recent than the compiled file */
+  return (g_stat (filename, &compiled_stat) == 0) &&
+    (mtime <= compiled_stat.st_mtime);
+}
+
+/*
+ * mx_style_sheet_add_from_compiled_file:
+ *
+ * Adds the style sheet compiled with mx_style_sheet_write_compiled() in
+ * @filename to @sheet. Returns %FALSE if the file is not a valid compiled
+ * style sheet, or if it is out of date with respect to the CSS it was
+ * compiled from. In the latter case, @source_filename is set to the path of
+ * the CSS file, which should be loaded instead.
+ */
+gboolean
+mx_style_sheet_add_from_compiled_file (MxStyleSheet  *sheet,
+                                       const gchar   *filename,
+                                       gchar        **source_filename)
+{
+  const MxCssCompiledHeader *header;
+  const MxCssCompiledSelector *records;
+  const MxCssCompiledStyle *style_records;
+  const MxCssCompiledProperty *properties;
+  const gchar *data, *strings;
+  MxSelector **selectors;
+  GHashTable **styles;
+  GMappedFile *file;
+  gchar *dirname, *source;
+  gint priority;
+  guint i, j;
+
+  g_return_val_if_fail (sheet != NULL, FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+  if (source_filename)
+    *source_filename = NULL;
+
+  file = g_mapped_file_new (filename, FALSE, NULL);
+  if (!file)
+    return FALSE;
+
+  data = g_mapped_file_get_contents (file);
+  header = (const MxCssCompiledHeader *) data;
+
+  if (!data ||
+      !css_compiled_is_valid (header, g_mapped_file_get_length (file)))
+    {
+      MX_NOTE (CSS, "Invalid compiled style sheet: %s", filename);
+      g_mapped_file_unref (file);
+      return FALSE;
+    }
+
+  strings = data + header->strings;
+
+  dirname = g_path_get_dirname (filename);
+  source = g_build_filename (dirname, strings + header->source, NULL);
+  g_free (dirname);
+
+  if (!css_compiled_is_current (header, filename, source))
+    {
+      MX_NOTE (CSS, "Compiled style sheet %s is out of date", filename);
+
+      if (source_filename)
+        *source_filename = source;
+      else
+        g_free (source);
+
+      g_mapped_file_unref (file);
+      return FALSE;
+    }
+
+  /* the source file is kept as the origin of the selectors, so that
+   * relative paths in values are resolved as if the CSS had been loaded */
+  priority = g_list_length (sheet->filenames);
+  sheet->filenames = g_list_prepend (sheet->filenames, source);
+  sheet->mapped_files = g_list_prepend (sheet->mapped_files, file);
+
+  properties = (const MxCssCompiledProperty *) (data + header->properties);
+  style_records = (const MxCssCompiledStyle *) (data + header->styles);
+  styles = g_new (GHashTable *, header->n_styles);
+  for (i = 0; i < header->n_styles; i++)
+    {
+      const MxCssCompiledStyle *record = &style_records[i];
+
+      /* keys and value strings point into the mapped file */
+      styles[i] = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                         (GDestroyNotify)
+                                         mx_style_sheet_value_free);
+
+      for (j = record->first_property;
+           j < record->first_property + record->n_properties;
+           j++)
+        g_hash_table_insert (styles[i],
+                             (gpointer) (strings + properties[j].key),
+                             mx_style_sheet_value_new (strings +
+                                                       properties[j].value,
+                                                       source));
+
+      sheet->styles = g_list_prepend (sheet->styles, styles[i]);
+    }
+
+  records = (const MxCssCompiledSelector *) (data + header->selectors);
+  selectors = g_new (MxSelector *, header->n_selectors);
+  for (i = 0; i < header->n_selectors; i++)
+    {
+      const MxCssCompiledSelector *record = &records[i];
+      const gchar *string;
+      MxSelector *selector;
+
+      selector = mx_selector_new (source, priority, record->line,
+                                  record->position);
+
+      if ((string = css_compiled_get_string (header, strings, record->type)))
+        selector->type = g_quark_from_string (string);
+      if ((string = css_compiled_get_string (header, strings, record->id)))
+        selector->id = g_quark_from_string (string);
+      if ((string = css_compiled_get_string (header, strings, record->class)))
+        selector->class = g_quark_from_string (string);
+
+      if ((string = css_compiled_get_string (header, strings,
+                                             record->pseudo_class)))
+        {
+          gchar **names = g_strsplit (string, ":", -1);
+
+          for (j = 0; names[j]; j++)
+            if (names[j][0] != '\0')
+              css_selector_add_pseudo_class (selector, names[j]);
+
+          g_strfreev (names);
+        }
+
+      if (record->parent != MX_CSS_COMPILED_NONE)
+        selector->parent = selectors[record->parent];
+      if (record->ancestor != MX_CSS_COMPILED_NONE)
+        selector->ancestor = selectors[record->ancestor];
+
+      selectors[i] = selector;
+
+      /* only the rightmost selectors have a style and go in the list */
+      if (record->style != MX_CSS_COMPILED_NONE)
+        {
+          selector->style = styles[record->style];
+          sheet->selectors = g_list_prepend (sheet->selectors, selector);
+        }
+    }
+
+  g_free (selectors);
+  g_free (styles);
+
+  sheet->index_dirty = TRUE;
+
+  MX_NOTE (CSS, "Loaded compiled style sheet %s", filename);
+
+  return TRUE;
+}
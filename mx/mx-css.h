@@ -25,9 +25,13 @@
 #include <glib.h>
 #include "mx-stylable.h"
 
+/* set in pseudo-class masks when a pseudo-class has no bit of its own */
+#define MX_CSS_PSEUDO_CLASS_OVERFLOW (G_GUINT64_CONSTANT (1) << 63)
+
 typedef struct _MxNode MxNode;
 typedef struct _MxStyleSheetValue MxStyleSheetValue;
 typedef struct _MxStyleSheet MxStyleSheet;
+typedef struct _MxComputedStyle MxComputedStyle;
 
 struct _MxNode
 {
@@ -42,6 +46,9 @@ struct _MxStyleSheetValue
 {
   const gchar *string;
   const gchar *source;
+
+  /* GValues holding the string converted to property types */
+  GSList      *typed_values;
 };
 
 MxStyleSheet*  mx_style_sheet_new            ();
@@ -49,7 +56,34 @@ void           mx_style_sheet_destroy        ();
 gboolean       mx_style_sheet_add_from_file  (MxStyleSheet *sheet,
                                               const gchar  *filename,
                                               GError       **error);
-GHashTable*    mx_style_sheet_get_properties (MxStyleSheet *sheet,
-                                              MxStylable   *node);
+MxComputedStyle* mx_style_sheet_get_computed_style (MxStyleSheet *sheet,
+                                                   MxStylable   *node);
+
+gboolean       mx_style_sheet_write_compiled (MxStyleSheet  *sheet,
+                                              const gchar   *filename,
+                                              GError       **error);
+gboolean       mx_style_sheet_add_from_compiled_file (MxStyleSheet  *sheet,
+                                                      const gchar   *filename,
+                                                      gchar        **source_filename);
+
+const GValue*  mx_style_sheet_value_get_typed (MxStyleSheetValue *value,
+                                               GType              type);
+void           mx_style_sheet_value_set_typed (MxStyleSheetValue *value,
+                                               const GValue      *typed_value);
+
+gboolean       mx_style_sheet_has_ancestor_dependency (MxStyleSheet *sheet,
+                                                       GQuark        id,
+                                                       GQuark        class,
+                                                       guint64       pseudo_classes);
+
+MxComputedStyle* mx_computed_style_ref            (MxComputedStyle *style);
+void             mx_computed_style_unref          (MxComputedStyle *style);
+GHashTable*      mx_computed_style_get_properties (MxComputedStyle *style);
+gsize            mx_computed_style_get_size       (MxComputedStyle *style);
+const GPtrArray* mx_computed_style_diff           (MxComputedStyle *old_style,
+                                                   MxComputedStyle *new_style);
+
+guint64        _mx_css_pseudo_class_mask     (const gchar  *pseudo_class);
+guint          _mx_css_pseudo_class_serial   (void);
 
 #endif /* MX_CSS_H */
@@ -0,0 +1,350 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * mx-icon-index.c: icon theme index builder
+ *
+ * Copyright 2011 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Builds the index described in mx-icon-index.h for a theme directory.
+ * This is used by mx-create-icon-index to write index files and by
+ * MxIconTheme to index themes in memory, and only depends on GLib so that
+ * it can run in a thread.
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "mx-icon-index.h"
+
+typedef struct
+{
+  gchar   *name;
+  GArray  *images;
+} Entry;
+
+static void
+entry_free (Entry *entry)
+{
+  g_free (entry->name);
+  g_array_free (entry->images, TRUE);
+  g_slice_free (Entry, entry);
+}
+
+static guint32
+icon_flags (const gchar  *filename,
+            gchar       **name)
+{
+  static const struct
+  {
+    const gchar *extension;
+    guint32      flag;
+  } extensions[] = {
+    { ".png", MX_ICON_INDEX_PNG },
+    { ".svg", MX_ICON_INDEX_SVG },
+    { ".xpm", MX_ICON_INDEX_XPM }
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (extensions); i++)
+    if (g_str_has_suffix (filename, extensions[i].extension))
+      {
+        *name = g_strndup (filename,
+                           strlen (filename) - strlen (extensions[i].extension));
+        return extensions[i].flag;
+      }
+
+  return 0;
+}
+
+/* The device and inode of a directory being scanned */
+typedef struct
+{
+  dev_t dev;
+  ino_t ino;
+} DirId;
+
+/* Scans @path, relative to @root, and its subdirectories. @ancestors holds
+ * the directories being scanned above @path, so that a symbolic link to one
+ * of them is not followed round in a loop. */
+static void
+scan_directory (const gchar *root,
+                const gchar *path,
+                GArray      *ancestors,
+                GPtrArray   *directories,
+                GHashTable  *entries)
+{
+  GHashTable *dir_icons;
+  GHashTableIter iter;
+  gpointer key, value;
+  struct stat dir_stat;
+  gchar *full_path;
+  const gchar *file;
+  DirId dir_id;
+  GDir *dir;
+  guint32 dir_index;
+  guint i;
+
+  full_path = g_build_filename (root, path, NULL);
+
+  if (g_stat (full_path, &dir_stat) != 0)
+    {
+      g_free (full_path);
+      return;
+    }
+
+  dir_id.dev = dir_stat.st_dev;
+  dir_id.ino = dir_stat.st_ino;
+
+  for (i = 0; i < ancestors->len; i++)
+    {
+      DirId *ancestor = &g_array_index (ancestors, DirId, i);
+
+      if (ancestor->dev == dir_id.dev && ancestor->ino == dir_id.ino)
+        {
+          g_free (full_path);
+          return;
+        }
+    }
+
+  dir = g_dir_open (full_path, 0, NULL);
+
+  if (!dir)
+    {
+      g_free (full_path);
+      return;
+    }
+
+  g_array_append_val (ancestors, dir_id);
+
+  dir_index = directories->len;
+  g_ptr_array_add (directories, g_strdup (path));
+
+  /* the extensions each icon is available with in this directory */
+  dir_icons = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  while ((file = g_dir_read_name (dir)))
+    {
+      gchar *file_path = g_build_filename (full_path, file, NULL);
+      gchar *name;
+      guint32 flags;
+
+      if (g_file_test (file_path, G_FILE_TEST_IS_DIR))
+        {
+          gchar *rel_dir = g_build_filename (path, file, NULL);
+          scan_directory (root, rel_dir, ancestors, directories, entries);
+          g_free (rel_dir);
+        }
+      else if ((flags = icon_flags (file, &name)))
+        {
+          flags |= GPOINTER_TO_UINT (g_hash_table_lookup (dir_icons, name));
+          g_hash_table_insert (dir_icons, name, GUINT_TO_POINTER (flags));
+        }
+
+      g_free (file_path);
+    }
+
+  g_dir_close (dir);
+  g_free (full_path);
+
+  g_array_set_size (ancestors, ancestors->len - 1);
+
+  g_hash_table_iter_init (&iter, dir_icons);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      MxIconIndexImage image;
+      Entry *entry = g_hash_table_lookup (entries, key);
+
+      if (!entry)
+        {
+          entry = g_slice_new (Entry);
+          entry->name = g_strdup (key);
+          entry->images = g_array_new (FALSE, FALSE, sizeof (MxIconIndexImage));
+          g_hash_table_insert (entries, entry->name, entry);
+        }
+
+      /* directory is the index in directories until the file is written */
+      image.directory = dir_index;
+      image.flags = GPOINTER_TO_UINT (value);
+      g_array_append_val (entry->images, image);
+    }
+
+  g_hash_table_unref (dir_icons);
+}
+
+static guint32
+add_string (GString     *strings,
+            const gchar *string)
+{
+  guint32 offset = strings->len;
+
+  g_string_append_len (strings, string, strlen (string) + 1);
+
+  return offset;
+}
+
+static gchar *
+build_index (GPtrArray  *directories,
+             GHashTable *entries,
+             gsize      *length)
+{
+  MxIconIndexHeader header;
+  GArray *buckets, *entry_records, *images;
+  guint32 *dir_offsets;
+  GHashTableIter iter;
+  gpointer value;
+  GString *strings;
+  GByteArray *data;
+  guint i, n_buckets;
+
+  strings = g_string_new ("");
+  g_string_append_c (strings, '\0');
+
+  dir_offsets = g_new (guint32, directories->len);
+  for (i = 0; i < directories->len; i++)
+    dir_offsets[i] = add_string (strings, g_ptr_array_index (directories, i));
+
+  /* keep the buckets about half full */
+  n_buckets = MAX (1, g_hash_table_size (entries) * 2);
+  buckets = g_array_new (FALSE, TRUE, sizeof (guint32));
+  g_array_set_size (buckets, n_buckets);
+
+  entry_records = g_array_new (FALSE, TRUE, sizeof (MxIconIndexEntry));
+  images = g_array_new (FALSE, TRUE, sizeof (MxIconIndexImage));
+
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      Entry *entry = value;
+      MxIconIndexEntry record;
+      guint32 *bucket;
+
+      bucket = &g_array_index (buckets, guint32,
+                               mx_icon_index_hash (entry->name) % n_buckets);
+
+      record.name = GUINT32_TO_LE (add_string (strings, entry->name));
+      record.next = *bucket;
+      record.first_image = GUINT32_TO_LE (images->len);
+      record.n_images = GUINT32_TO_LE (entry->images->len);
+
+      for (i = 0; i < entry->images->len; i++)
+        {
+          MxIconIndexImage image =
+            g_array_index (entry->images, MxIconIndexImage, i);
+
+          image.directory = GUINT32_TO_LE (dir_offsets[image.directory]);
+          image.flags = GUINT32_TO_LE (image.flags);
+          g_array_append_val (images, image);
+        }
+
+      g_array_append_val (entry_records, record);
+      *bucket = GUINT32_TO_LE (entry_records->len);
+    }
+
+  /* keep the file size a multiple of 4 */
+  while (strings->len % 4)
+    g_string_append_c (strings, '\0');
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, MX_ICON_INDEX_MAGIC, sizeof (header.magic));
+  header.version = GUINT32_TO_LE (MX_ICON_INDEX_VERSION);
+  header.n_buckets = GUINT32_TO_LE (n_buckets);
+  header.buckets_offset = GUINT32_TO_LE (sizeof (header));
+  header.n_entries = GUINT32_TO_LE (entry_records->len);
+  header.entries_offset = GUINT32_TO_LE (sizeof (header) +
+                                         n_buckets * sizeof (guint32));
+  header.n_images = GUINT32_TO_LE (images->len);
+  header.images_offset =
+    GUINT32_TO_LE (GUINT32_FROM_LE (header.entries_offset) +
+                   entry_records->len * sizeof (MxIconIndexEntry));
+  header.strings_offset =
+    GUINT32_TO_LE (GUINT32_FROM_LE (header.images_offset) +
+                   images->len * sizeof (MxIconIndexImage));
+  header.strings_size = GUINT32_TO_LE (strings->len);
+
+  data = g_byte_array_new ();
+  g_byte_array_append (data, (guint8 *) &header, sizeof (header));
+  g_byte_array_append (data, (guint8 *) buckets->data,
+                       n_buckets * sizeof (guint32));
+  g_byte_array_append (data, (guint8 *) entry_records->data,
+                       entry_records->len * sizeof (MxIconIndexEntry));
+  g_byte_array_append (data, (guint8 *) images->data,
+                       images->len * sizeof (MxIconIndexImage));
+  g_byte_array_append (data, (guint8 *) strings->str, strings->len);
+
+  header.checksum =
+    GUINT32_TO_LE (mx_image_cache_checksum (data->data + sizeof (header),
+                                            data->len - sizeof (header)));
+  memcpy (data->data, &header, sizeof (header));
+
+  *length = data->len;
+
+  g_array_free (images, TRUE);
+  g_array_free (entry_records, TRUE);
+  g_array_free (buckets, TRUE);
+  g_string_free (strings, TRUE);
+  g_free (dir_offsets);
+
+  return (gchar *) g_byte_array_free (data, FALSE);
+}
+
+/*
+ * _mx_icon_index_build:
+ * @theme_dir: the directory of an icon theme
+ * @length: (out): return location for the length of the index
+ * @directories: (out) (allow-none): return location for the directories
+ *   that were indexed, relative to @theme_dir, or %NULL
+ *
+ * Indexes every directory below @theme_dir. The returned index and the
+ * strings in @directories should be freed with g_free().
+ *
+ * Returns: the index, in the format of an index file
+ */
+gchar *
+_mx_icon_index_build (const gchar  *theme_dir,
+                      gsize        *length,
+                      GPtrArray   **directories)
+{
+  GPtrArray *dirs;
+  GArray *ancestors;
+  GHashTable *entries;
+  gchar *data;
+  guint i;
+
+  dirs = g_ptr_array_new ();
+  entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                   (GDestroyNotify) entry_free);
+
+  ancestors = g_array_new (FALSE, FALSE, sizeof (DirId));
+  scan_directory (theme_dir, "", ancestors, dirs, entries);
+  g_array_free (ancestors, TRUE);
+
+  data = build_index (dirs, entries, length);
+
+  g_hash_table_unref (entries);
+
+  if (directories)
+    *directories = dirs;
+  else
+    {
+      for (i = 0; i < dirs->len; i++)
+        g_free (g_ptr_array_index (dirs, i));
+      g_ptr_array_free (dirs, TRUE);
+    }
+
+  return data;
+}
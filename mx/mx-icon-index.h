@@ -0,0 +1,117 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * mx-icon-index.h: icon theme index file format
+ *
+ * Copyright 2011 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* An icon index is written by mx-create-icon-index into the directory of
+ * an icon theme and read by MxIconTheme, which can also build indexes in
+ * memory, see mx_icon_theme_set_warmup(). It lists, for every icon name,
+ * the theme directories containing an image of that name and the file
+ * extensions it is available with, so that looking up an icon doesn't need
+ * to test for files in every directory of the theme. The size and type of
+ * each directory are still read from the theme's index.theme.
+ *
+ * The file starts with a header, followed by the hash buckets, the entries,
+ * the images and a string table. All integers are 32-bit little-endian and
+ * all records are 4-byte aligned, so the file can be mapped and read in
+ * place. Strings are referred to by their offset in the string table and
+ * are nul-terminated.
+ *
+ * Each bucket holds the index of the first entry whose name hashes to it,
+ * plus one, or 0 if there is none; entries of the same bucket are chained
+ * through their next member in the same way. The images of an entry are
+ * consecutive.
+ *
+ * An index is used only if it is at least as recent as the theme directory
+ * it is in.
+ */
+
+#ifndef __MX_ICON_INDEX_H__
+#define __MX_ICON_INDEX_H__
+
+#include <glib.h>
+
+#include "mx-image-cache.h"
+
+G_BEGIN_DECLS
+
+#define MX_ICON_INDEX_FILENAME "mx-icon-index.cache"
+#define MX_ICON_INDEX_MAGIC    "MXICONIX"
+#define MX_ICON_INDEX_VERSION  1
+
+typedef enum
+{
+  MX_ICON_INDEX_PNG = 1 << 0,
+  MX_ICON_INDEX_SVG = 1 << 1,
+  MX_ICON_INDEX_XPM = 1 << 2
+} MxIconIndexFlags;
+
+typedef struct
+{
+  gchar   magic[8];
+  guint32 version;
+
+  guint32 n_buckets;
+  guint32 buckets_offset;
+  guint32 n_entries;
+  guint32 entries_offset;
+  guint32 n_images;
+  guint32 images_offset;
+  guint32 strings_offset;
+  guint32 strings_size;
+
+  /* checksum of everything following the header, computed with
+   * mx_image_cache_checksum() */
+  guint32 checksum;
+} MxIconIndexHeader;
+
+typedef struct
+{
+  guint32 name;
+  guint32 next;        /* the next entry in the bucket, plus one, or 0 */
+  guint32 first_image;
+  guint32 n_images;
+} MxIconIndexEntry;
+
+typedef struct
+{
+  guint32 directory;   /* relative to the theme directory */
+  guint32 flags;       /* MxIconIndexFlags */
+} MxIconIndexImage;
+
+/* djb2, as the index must not depend on the hash function of a GLib
+ * version */
+static inline guint32
+mx_icon_index_hash (const gchar *name)
+{
+  guint32 hash = 5381;
+
+  for (; *name; name++)
+    hash = hash * 33 + (guchar) *name;
+
+  return hash;
+}
+
+gchar *_mx_icon_index_build (const gchar  *theme_dir,
+                             gsize        *length,
+                             GPtrArray   **directories);
+
+G_END_DECLS
+
+#endif /* __MX_ICON_INDEX_H__ */
@@ -22,8 +22,12 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 #include "mx-icon-theme.h"
+#include "mx-icon-index.h"
 #include "mx-marshal.h"
 #include "mx-texture-cache.h"
 #include "mx-private.h"
@@ -41,6 +45,9 @@ enum
 #define ICON_THEME_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), MX_TYPE_ICON_THEME, MxIconThemePrivate))
 
+/* how often, in seconds, the theme directories are checked for changes */
+#define MX_ICON_THEME_CHECK_INTERVAL 5
+
 typedef enum
 {
   MX_FIXED,
@@ -58,9 +65,44 @@ typedef struct
   gint         threshold;
 } MxIconData;
 
+/* The result of looking an icon up at a size */
+typedef struct
+{
+  gchar       *path;
+  gint         size;   /* the size of the image at path */
+} MxIconLookup;
+
+typedef struct
+{
+  /* the index file, or the index built in memory by a warmup */
+  GMappedFile            *mapped;
+  gchar                  *data;
+
+  const guint32          *buckets;
+  guint32                 n_buckets;
+  const MxIconIndexEntry *entries;
+  guint32                 n_entries;
+  const MxIconIndexImage *images;
+  guint32                 n_images;
+  const gchar            *strings;
+  guint32                 strings_size;
+} MxIconIndex;
+
+/* A theme directory being indexed in a thread, see
+ * mx_icon_theme_set_warmup() */
+typedef struct
+{
+  MxIconTheme *theme;
+  guint        generation;
+  gchar       *theme_dir;
+
+  MxIconIndex *index;
+} MxIconThemeWarmup;
+
 struct _MxIconThemePrivate
 {
   guint       override_theme : 1;
+  guint       warmup : 1;
 
   GList      *search_paths;
   GHashTable *icon_hash;
@@ -71,15 +113,44 @@ struct _MxIconThemePrivate
   GList      *theme_fallbacks;
 
   GKeyFile   *hicolor_file;
+
+  /* theme directory -> MxIconIndex, or NULL if it has no usable index */
+  GHashTable *indexes;
+
+  /* "size:name" -> MxIconLookup of the best match, or NULL if there is
+   * none */
+  GHashTable *lookups;
+
+  /* the most recent modification time of the search paths and theme
+   * directories, and when it was last checked */
+  time_t      dirs_mtime;
+  gint64      last_check;
+
+  /* theme directories being indexed by a warmup, see MxIconThemeWarmup,
+   * and the monitors of the theme directories indexed by a warmup */
+  guint       generation;
+  GHashTable *warming;
+  GHashTable *monitors;
 };
 
 enum
 {
   PROP_0,
 
-  PROP_THEME_NAME
+  PROP_THEME_NAME,
+  PROP_WARMUP
 };
 
+/* the values of MxIconThemePrivate.warming */
+#define MX_ICON_THEME_WARMING 1
+#define MX_ICON_THEME_WARMING_DIRTY 2
+
+static GThreadPool *mx_icon_theme_warmup_threads = NULL;
+
+static void mx_icon_theme_warmup (MxIconTheme *theme);
+static void mx_icon_theme_warmup_dir (MxIconTheme *theme,
+                                      const gchar *theme_dir);
+
 static void
 mx_icon_theme_get_property (GObject    *object,
                             guint       property_id,
@@ -94,6 +165,10 @@ mx_icon_theme_get_property (GObject    *object,
       g_value_set_string (value, mx_icon_theme_get_theme_name (theme));
       break;
 
+    case PROP_WARMUP:
+      g_value_set_boolean (value, mx_icon_theme_get_warmup (theme));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -112,6 +187,11 @@ mx_icon_theme_set_property (GObject      *object,
                                     g_value_get_string (value));
       break;
 
+    case PROP_WARMUP:
+      mx_icon_theme_set_warmup (MX_ICON_THEME (object),
+                                g_value_get_boolean (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -132,6 +212,10 @@ mx_icon_theme_finalize (GObject *object)
   mx_icon_theme_set_search_paths (self, NULL);
   g_hash_table_unref (priv->icon_hash);
   g_hash_table_unref (priv->theme_path_hash);
+  g_hash_table_unref (priv->indexes);
+  g_hash_table_unref (priv->lookups);
+  g_hash_table_unref (priv->warming);
+  g_hash_table_unref (priv->monitors);
   g_free (priv->theme);
 
   if (priv->theme_file)
@@ -170,6 +254,22 @@ mx_icon_theme_class_init (MxIconThemeClass *klass)
                                NULL,
                                MX_PARAM_READWRITE);
   g_object_class_install_property (object_class, PROP_THEME_NAME, pspec);
+
+  /**
+   * MxIconTheme:warmup:
+   *
+   * Whether the directories of the theme and the themes it inherits from
+   * are indexed in a thread when the theme is loaded, and then watched
+   * for changes. See mx_icon_theme_set_warmup().
+   *
+   * Since: 1.6
+   */
+  pspec = g_param_spec_boolean ("warmup",
+                                "Warmup",
+                                "Index the theme directories in a thread.",
+                                FALSE,
+                                MX_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_WARMUP, pspec);
 }
 
 static GKeyFile *
@@ -201,6 +301,501 @@ mx_icon_theme_load_theme (MxIconTheme *self, const gchar *name)
   return NULL;
 }
 
+static void
+mx_icon_theme_index_free (MxIconIndex *index)
+{
+  if (!index)
+    return;
+
+  if (index->mapped)
+    g_mapped_file_unref (index->mapped);
+  g_free (index->data);
+  g_slice_free (MxIconIndex, index);
+}
+
+static gboolean
+mx_icon_theme_index_check_section (gsize    length,
+                                   guint32  offset,
+                                   guint32  count,
+                                   gsize    record_size)
+{
+  return (offset % 4 == 0 &&
+          offset <= length &&
+          count <= (length - offset) / record_size);
+}
+
+/* Checks an index and returns an MxIconIndex that refers to @contents,
+ * without taking ownership of it */
+static MxIconIndex *
+mx_icon_theme_index_new_from_data (const gchar  *contents,
+                                   gsize         length,
+                                   GError      **error)
+{
+  const MxIconIndexHeader *header;
+  MxIconIndex *index;
+  guint32 strings_offset;
+
+  header = (const MxIconIndexHeader *) contents;
+
+  if (length < sizeof (MxIconIndexHeader) ||
+      memcmp (header->magic, MX_ICON_INDEX_MAGIC, sizeof (header->magic)) ||
+      GUINT32_FROM_LE (header->version) != MX_ICON_INDEX_VERSION)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "Not an icon index or unsupported version");
+      return NULL;
+    }
+
+  strings_offset = GUINT32_FROM_LE (header->strings_offset);
+
+  if (header->n_buckets == 0 ||
+      !mx_icon_theme_index_check_section (length,
+                                          GUINT32_FROM_LE (header->buckets_offset),
+                                          GUINT32_FROM_LE (header->n_buckets),
+                                          sizeof (guint32)) ||
+      !mx_icon_theme_index_check_section (length,
+                                          GUINT32_FROM_LE (header->entries_offset),
+                                          GUINT32_FROM_LE (header->n_entries),
+                                          sizeof (MxIconIndexEntry)) ||
+      !mx_icon_theme_index_check_section (length,
+                                          GUINT32_FROM_LE (header->images_offset),
+                                          GUINT32_FROM_LE (header->n_images),
+                                          sizeof (MxIconIndexImage)) ||
+      !mx_icon_theme_index_check_section (length, strings_offset,
+                                          GUINT32_FROM_LE (header->strings_size),
+                                          1) ||
+      header->strings_size == 0 ||
+      contents[strings_offset + GUINT32_FROM_LE (header->strings_size) - 1] != '\0' ||
+      mx_image_cache_checksum ((const guchar *) contents +
+                               sizeof (MxIconIndexHeader),
+                               length - sizeof (MxIconIndexHeader)) !=
+      GUINT32_FROM_LE (header->checksum))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "Corrupt icon index");
+      return NULL;
+    }
+
+  index = g_slice_new0 (MxIconIndex);
+  index->buckets = (const guint32 *)
+    (contents + GUINT32_FROM_LE (header->buckets_offset));
+  index->n_buckets = GUINT32_FROM_LE (header->n_buckets);
+  index->entries = (const MxIconIndexEntry *)
+    (contents + GUINT32_FROM_LE (header->entries_offset));
+  index->n_entries = GUINT32_FROM_LE (header->n_entries);
+  index->images = (const MxIconIndexImage *)
+    (contents + GUINT32_FROM_LE (header->images_offset));
+  index->n_images = GUINT32_FROM_LE (header->n_images);
+  index->strings = contents + strings_offset;
+  index->strings_size = GUINT32_FROM_LE (header->strings_size);
+
+  return index;
+}
+
+static MxIconIndex *
+mx_icon_theme_index_new (const gchar  *filename,
+                         GError      **error)
+{
+  MxIconIndex *index;
+  GMappedFile *mapped;
+
+  mapped = g_mapped_file_new (filename, FALSE, error);
+  if (!mapped)
+    return NULL;
+
+  index = mx_icon_theme_index_new_from_data (g_mapped_file_get_contents (mapped),
+                                             g_mapped_file_get_length (mapped),
+                                             error);
+  if (!index)
+    {
+      g_mapped_file_unref (mapped);
+      return NULL;
+    }
+
+  index->mapped = mapped;
+
+  return index;
+}
+
+static const gchar *
+mx_icon_theme_index_get_string (MxIconIndex *index,
+                                guint32      offset)
+{
+  offset = GUINT32_FROM_LE (offset);
+
+  /* the string table is nul-terminated, so any offset inside it is a
+   * valid string */
+  return (offset < index->strings_size) ? index->strings + offset : NULL;
+}
+
+static const MxIconIndexEntry *
+mx_icon_theme_index_lookup (MxIconIndex *index,
+                            const gchar *icon)
+{
+  guint32 next, n_steps;
+
+  if (!index->n_buckets)
+    return NULL;
+
+  next = GUINT32_FROM_LE (index->buckets[mx_icon_index_hash (icon) %
+                                         index->n_buckets]);
+
+  /* a corrupt chain could loop, so never follow more links than there are
+   * entries */
+  for (n_steps = 0; next && n_steps < index->n_entries; n_steps++)
+    {
+      const MxIconIndexEntry *entry;
+      const gchar *name;
+
+      if (next > index->n_entries)
+        return NULL;
+
+      entry = &index->entries[next - 1];
+      name = mx_icon_theme_index_get_string (index, entry->name);
+
+      if (name && g_str_equal (name, icon))
+        {
+          guint32 first = GUINT32_FROM_LE (entry->first_image);
+
+          if (first > index->n_images ||
+              GUINT32_FROM_LE (entry->n_images) > index->n_images - first)
+            return NULL;
+
+          return entry;
+        }
+
+      next = GUINT32_FROM_LE (entry->next);
+    }
+
+  return NULL;
+}
+
+/* Returns the MxIconIndexFlags of the images of an entry in a directory */
+static guint32
+mx_icon_theme_index_get_flags (MxIconIndex            *index,
+                               const MxIconIndexEntry *entry,
+                               const gchar            *dir)
+{
+  guint32 i, first, n_images;
+
+  first = GUINT32_FROM_LE (entry->first_image);
+  n_images = GUINT32_FROM_LE (entry->n_images);
+
+  for (i = first; i < first + n_images; i++)
+    {
+      const MxIconIndexImage *image = &index->images[i];
+      const gchar *directory;
+
+      directory = mx_icon_theme_index_get_string (index, image->directory);
+      if (directory && g_str_equal (directory, dir))
+        return GUINT32_FROM_LE (image->flags);
+    }
+
+  return 0;
+}
+
+/* Returns the index of a theme directory, if it has one that is at least
+ * as recent as the directory, or an empty index if the directory doesn't
+ * exist. Directories are only checked once, until the theme or the search
+ * paths change.
+ */
+static MxIconIndex *
+mx_icon_theme_get_index (MxIconTheme *self,
+                         const gchar *theme_path)
+{
+  MxIconThemePrivate *priv = self->priv;
+  MxIconIndex *index = NULL;
+  struct stat dir_stat, index_stat;
+  gpointer value;
+  gchar *filename;
+
+  if (g_hash_table_lookup_extended (priv->indexes, theme_path, NULL, &value))
+    return value;
+
+  filename = g_build_filename (theme_path, MX_ICON_INDEX_FILENAME, NULL);
+
+  if (g_stat (theme_path, &dir_stat) != 0)
+    {
+      /* The theme isn't installed in this search path, an empty index saves
+       * testing for its files */
+      index = g_slice_new0 (MxIconIndex);
+    }
+  else if (g_stat (filename, &index_stat) == 0)
+    {
+      if (index_stat.st_mtime >= dir_stat.st_mtime)
+        {
+          GError *error = NULL;
+
+          index = mx_icon_theme_index_new (filename, &error);
+          if (!index)
+            {
+              g_warning ("Error loading icon index '%s': %s",
+                         filename, error->message);
+              g_error_free (error);
+            }
+        }
+    }
+
+  g_free (filename);
+
+  g_hash_table_insert (priv->indexes, g_strdup (theme_path), index);
+
+  return index;
+}
+
+static void
+mx_icon_theme_warmup_free (MxIconThemeWarmup *warmup)
+{
+  mx_icon_theme_index_free (warmup->index);
+  g_free (warmup->theme_dir);
+  g_object_unref (warmup->theme);
+
+  g_slice_free (MxIconThemeWarmup, warmup);
+}
+
+static void
+mx_icon_theme_monitor_changed_cb (GFileMonitor      *monitor,
+                                  GFile             *file,
+                                  GFile             *other_file,
+                                  GFileMonitorEvent  event_type,
+                                  MxIconTheme       *theme)
+{
+  MxIconThemePrivate *priv = theme->priv;
+  const gchar *theme_dir;
+  gchar *basename;
+
+  theme_dir = g_object_get_data (G_OBJECT (monitor), "mx-icon-theme-dir");
+
+  /* Only the theme directory itself is watched, so icons that are added to
+   * or removed from its subdirectories aren't noticed until the directory
+   * is touched, as mx-create-icon-index does after writing an index. The
+   * changes that are noticed can't be tied to an icon name, so they forget
+   * every icon.
+   */
+  if (event_type == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED)
+    {
+      GFile *dir = g_file_new_for_path (theme_dir);
+      gboolean is_theme_dir = g_file_equal (file, dir);
+
+      g_object_unref (dir);
+      if (!is_theme_dir)
+        return;
+    }
+  else if (event_type != G_FILE_MONITOR_EVENT_CREATED &&
+           event_type != G_FILE_MONITOR_EVENT_DELETED)
+    return;
+
+  basename = g_file_get_basename (file);
+
+  /* Writing an index goes through a temporary file next to it, named after
+   * the index */
+  if (g_str_has_prefix (basename, MX_ICON_INDEX_FILENAME))
+    {
+      g_free (basename);
+      return;
+    }
+
+  g_hash_table_remove_all (priv->icon_hash);
+  g_hash_table_remove_all (priv->lookups);
+
+  MX_NOTE (ICON_THEME, "%s changed in %s, reindexing", basename, theme_dir);
+
+  g_free (basename);
+
+  /* Until the directory is indexed again, icons are looked for on disk */
+  g_hash_table_insert (priv->indexes, g_strdup (theme_dir), NULL);
+  mx_icon_theme_warmup_dir (theme, theme_dir);
+}
+
+static void
+mx_icon_theme_monitor_free (GFileMonitor *monitor)
+{
+  g_signal_handlers_disconnect_matched (monitor, G_SIGNAL_MATCH_FUNC,
+                                        0, 0, NULL,
+                                        mx_icon_theme_monitor_changed_cb,
+                                        NULL);
+  g_file_monitor_cancel (monitor);
+  g_object_unref (monitor);
+}
+
+/* Watches a theme directory that has been indexed. Its subdirectories
+ * aren't watched, as a theme can have hundreds of them, each of which would
+ * take a watch from the limited number available.
+ */
+static void
+mx_icon_theme_watch (MxIconTheme *theme,
+                     const gchar *theme_dir)
+{
+  MxIconThemePrivate *priv = theme->priv;
+  GFileMonitor *monitor;
+  GFile *file;
+
+  file = g_file_new_for_path (theme_dir);
+  monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, NULL);
+  g_object_unref (file);
+
+  if (!monitor)
+    {
+      g_hash_table_remove (priv->monitors, theme_dir);
+      return;
+    }
+
+  g_object_set_data_full (G_OBJECT (monitor), "mx-icon-theme-dir",
+                          g_strdup (theme_dir), g_free);
+  g_signal_connect (monitor, "changed",
+                    G_CALLBACK (mx_icon_theme_monitor_changed_cb), theme);
+
+  g_hash_table_insert (priv->monitors, g_strdup (theme_dir), monitor);
+}
+
+static gboolean
+mx_icon_theme_warmup_done_cb (MxIconThemeWarmup *warmup)
+{
+  MxIconTheme *theme = warmup->theme;
+  MxIconThemePrivate *priv = theme->priv;
+  gint state;
+
+  /* the theme or the search paths have changed since */
+  if (warmup->generation != priv->generation)
+    {
+      mx_icon_theme_warmup_free (warmup);
+      return FALSE;
+    }
+
+  state = GPOINTER_TO_INT (g_hash_table_lookup (priv->warming,
+                                                warmup->theme_dir));
+  g_hash_table_remove (priv->warming, warmup->theme_dir);
+
+  /* files were added or removed while indexing, so index it again */
+  if (state == MX_ICON_THEME_WARMING_DIRTY)
+    {
+      mx_icon_theme_warmup_dir (theme, warmup->theme_dir);
+      mx_icon_theme_warmup_free (warmup);
+      return FALSE;
+    }
+
+  MX_NOTE (ICON_THEME, "indexed %s: %u icons",
+           warmup->theme_dir, warmup->index->n_entries);
+
+  g_hash_table_insert (priv->indexes, g_strdup (warmup->theme_dir),
+                       warmup->index);
+  warmup->index = NULL;
+
+  mx_icon_theme_watch (theme, warmup->theme_dir);
+
+  mx_icon_theme_warmup_free (warmup);
+
+  return FALSE;
+}
+
+static void
+mx_icon_theme_warmup_cb (MxIconThemeWarmup *warmup,
+                         gpointer           user_data)
+{
+  if (g_file_test (warmup->theme_dir, G_FILE_TEST_IS_DIR))
+    {
+      gchar *data;
+      gsize length;
+
+      data = _mx_icon_index_build (warmup->theme_dir, &length, NULL);
+      warmup->index = mx_icon_theme_index_new_from_data (data, length, NULL);
+
+      if (warmup->index)
+        warmup->index->data = data;
+      else
+        g_free (data);
+    }
+
+  /* a theme that isn't installed in this search path has no icons */
+  if (!warmup->index)
+    warmup->index = g_slice_new0 (MxIconIndex);
+
+  /* install the index before the next frame is drawn */
+  clutter_threads_add_idle_full (G_PRIORITY_HIGH_IDLE,
+                                 (GSourceFunc) mx_icon_theme_warmup_done_cb,
+                                 warmup, NULL);
+}
+
+static void
+mx_icon_theme_warmup_dir (MxIconTheme *theme,
+                          const gchar *theme_dir)
+{
+  MxIconThemePrivate *priv = theme->priv;
+  MxIconThemeWarmup *warmup;
+  GError *error = NULL;
+
+  if (g_hash_table_lookup (priv->warming, theme_dir))
+    {
+      g_hash_table_insert (priv->warming, g_strdup (theme_dir),
+                           GINT_TO_POINTER (MX_ICON_THEME_WARMING_DIRTY));
+      return;
+    }
+
+  if (!mx_icon_theme_warmup_threads)
+    {
+      mx_icon_theme_warmup_threads =
+        g_thread_pool_new ((GFunc) mx_icon_theme_warmup_cb, NULL, 1, FALSE,
+                           &error);
+
+      if (!mx_icon_theme_warmup_threads)
+        {
+          g_warning ("Unable to index icon themes: %s", error->message);
+          g_error_free (error);
+          return;
+        }
+    }
+
+  warmup = g_slice_new0 (MxIconThemeWarmup);
+  warmup->theme = g_object_ref (theme);
+  warmup->generation = priv->generation;
+  warmup->theme_dir = g_strdup (theme_dir);
+
+  g_hash_table_insert (priv->warming, g_strdup (theme_dir),
+                       GINT_TO_POINTER (MX_ICON_THEME_WARMING));
+  g_thread_pool_push (mx_icon_theme_warmup_threads, warmup, NULL);
+}
+
+static void
+mx_icon_theme_warmup_theme_cb (gpointer key,
+                               gpointer value,
+                               gpointer user_data)
+{
+  MxIconTheme *theme = user_data;
+  GList *p;
+
+  for (p = theme->priv->search_paths; p; p = p->next)
+    {
+      gchar *theme_dir = g_build_filename ((const gchar *) p->data,
+                                           (const gchar *) value, NULL);
+      mx_icon_theme_warmup_dir (theme, theme_dir);
+      g_free (theme_dir);
+    }
+}
+
+/* Indexes the directories of the loaded themes in a thread, if warmup is
+ * enabled */
+static void
+mx_icon_theme_warmup (MxIconTheme *theme)
+{
+  MxIconThemePrivate *priv = theme->priv;
+
+  if (!priv->warmup)
+    return;
+
+  g_hash_table_foreach (priv->theme_path_hash,
+                        mx_icon_theme_warmup_theme_cb, theme);
+}
+
+static void
+mx_icon_theme_lookup_free (MxIconLookup *lookup)
+{
+  if (!lookup)
+    return;
+
+  g_free (lookup->path);
+  g_slice_free (MxIconLookup, lookup);
+}
+
 static void
 mx_icon_theme_icon_data_free (MxIconData *data)
 {
@@ -270,6 +865,82 @@ mx_icon_theme_find_name_cb (gpointer key,
   return g_str_equal (name1, name2);
 }
 
+static void
+mx_icon_theme_clear_caches (MxIconTheme *theme)
+{
+  MxIconThemePrivate *priv = theme->priv;
+
+  g_hash_table_remove_all (priv->icon_hash);
+  g_hash_table_remove_all (priv->indexes);
+  g_hash_table_remove_all (priv->lookups);
+
+  /* warmups in progress are ignored when they finish */
+  priv->generation ++;
+  g_hash_table_remove_all (priv->warming);
+  g_hash_table_remove_all (priv->monitors);
+
+  /* record the state of the directories again on the next lookup */
+  priv->last_check = 0;
+}
+
+static void
+mx_icon_theme_dir_mtime_cb (gpointer key,
+                            gpointer value,
+                            gpointer user_data)
+{
+  const gchar *search_path = ((gpointer *)user_data)[0];
+  time_t *mtime = ((gpointer *)user_data)[1];
+  struct stat dir_stat;
+  gchar *path;
+
+  path = g_build_filename (search_path, (const gchar *)value, NULL);
+  if (g_stat (path, &dir_stat) == 0)
+    *mtime = MAX (*mtime, dir_stat.st_mtime);
+  g_free (path);
+}
+
+/* Clears the caches if a search path or the directory of a loaded theme
+ * has changed since the last check, which happens at most every
+ * MX_ICON_THEME_CHECK_INTERVAL seconds. Installing or removing a theme, or
+ * an icon index, changes these; like an icon index, this doesn't notice
+ * icons that are added to existing directories of a theme.
+ */
+static void
+mx_icon_theme_check_dirs (MxIconTheme *theme)
+{
+  MxIconThemePrivate *priv = theme->priv;
+  time_t mtime = 0;
+  gint64 now;
+  GList *p;
+
+  now = g_get_monotonic_time ();
+  if (priv->last_check &&
+      now - priv->last_check < MX_ICON_THEME_CHECK_INTERVAL * G_USEC_PER_SEC)
+    return;
+
+  for (p = priv->search_paths; p; p = p->next)
+    {
+      gpointer data[2] = { p->data, &mtime };
+      struct stat dir_stat;
+
+      if (g_stat ((const gchar *)p->data, &dir_stat) == 0)
+        mtime = MAX (mtime, dir_stat.st_mtime);
+
+      g_hash_table_foreach (priv->theme_path_hash,
+                            mx_icon_theme_dir_mtime_cb,
+                            data);
+    }
+
+  if (priv->last_check && mtime != priv->dirs_mtime)
+    {
+      mx_icon_theme_clear_caches (theme);
+      mx_icon_theme_warmup (theme);
+    }
+
+  priv->dirs_mtime = mtime;
+  priv->last_check = now;
+}
+
 static void
 mx_icon_theme_load_fallbacks (MxIconTheme *theme,
                               GKeyFile    *theme_file,
@@ -383,6 +1054,20 @@ mx_icon_theme_init (MxIconTheme *self)
                                                  NULL,
                                                  g_free);
 
+  priv->indexes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify)
+                                         mx_icon_theme_index_free);
+
+  priv->lookups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify)
+                                         mx_icon_theme_lookup_free);
+
+  priv->warming = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, NULL);
+  priv->monitors = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify)
+                                          mx_icon_theme_monitor_free);
+
   priv->hicolor_file = mx_icon_theme_load_theme (self, "hicolor");
   if (!priv->hicolor_file)
     g_warning ("Error loading fallback icon theme");
@@ -498,7 +1183,7 @@ mx_icon_theme_set_theme_name (MxIconTheme *theme,
     return;
 
   /* Clear old data */
-  g_hash_table_remove_all (priv->icon_hash);
+  mx_icon_theme_clear_caches (theme);
 
   g_free (priv->theme);
 
@@ -529,6 +1214,8 @@ mx_icon_theme_set_theme_name (MxIconTheme *theme,
   /* Load fallbacks */
   mx_icon_theme_load_fallbacks (theme, priv->theme_file, TRUE);
 
+  mx_icon_theme_warmup (theme);
+
   g_object_notify (G_OBJECT (theme), "theme-name");
 }
 
@@ -568,6 +1255,35 @@ mx_icon_theme_collect_dirs (GString     *string,
   g_dir_close (dir);
 }
 
+static gchar *
+mx_icon_theme_collect_all_dirs (MxIconTheme *self,
+                                const gchar *theme)
+{
+  GList *p;
+  GString *string;
+  MxIconThemePrivate *priv = self->priv;
+
+  /* Icon theme hasn't specified directories, so recurse and
+   * collect all of them.
+   */
+  string = g_string_new ("");
+
+  for (p = priv->search_paths; p; p = p->next)
+    {
+      const gchar *search_path = p->data;
+      gchar *path = g_build_filename (search_path,
+                                      theme,
+                                      NULL);
+      mx_icon_theme_collect_dirs (string, "", path);
+      g_free (path);
+    }
+
+  /* Chop off the trailing comma */
+  g_string_truncate (string, string->len - 1);
+
+  return g_string_free (string, FALSE);
+}
+
 static GList *
 mx_icon_theme_theme_load_icon (MxIconTheme *self,
                                GKeyFile    *theme_file,
@@ -575,43 +1291,56 @@ mx_icon_theme_theme_load_icon (MxIconTheme *self,
                                GIcon       *store_icon,
                                gboolean     store_fail)
 {
+  GList *p;
+  gint n_paths, k;
   gchar *dirs;
   const gchar *theme;
+  MxIconIndex **indexes;
+  const MxIconIndexEntry **entries;
+  gboolean all_indexed, indexed_entry;
 
   GList *data = NULL;
   MxIconThemePrivate *priv = self->priv;
 
-  dirs = g_key_file_get_string (theme_file,
-                                "Icon Theme",
-                                "Directories",
-                                NULL);
   theme = g_hash_table_lookup (priv->theme_path_hash, theme_file);
 
-  if (!dirs)
+  /* Look the icon up once in the index of each theme directory that has
+   * one, the directories below are then matched against the entry instead
+   * of testing for files.
+   */
+  n_paths = g_list_length (priv->search_paths);
+  indexes = g_new (MxIconIndex *, n_paths);
+  entries = g_new (const MxIconIndexEntry *, n_paths);
+  all_indexed = TRUE;
+  indexed_entry = FALSE;
+
+  for (p = priv->search_paths, k = 0; p; p = p->next, k++)
     {
-      GList *p;
-      GString *string;
+      gchar *path = g_build_filename ((const gchar *)p->data, theme, NULL);
 
-      /* Icon theme hasn't specified directories, so recurse and
-       * collect all of them.
-       */
-      string = g_string_new ("");
+      indexes[k] = mx_icon_theme_get_index (self, path);
+      entries[k] = NULL;
 
-      for (p = priv->search_paths; p; p = p->next)
-        {
-          const gchar *search_path = p->data;
-          gchar *path = g_build_filename (search_path,
-                                          theme,
-                                          NULL);
-          mx_icon_theme_collect_dirs (string, "", path);
-          g_free (path);
-        }
+      if (!indexes[k])
+        all_indexed = FALSE;
+      else if ((entries[k] = mx_icon_theme_index_lookup (indexes[k], icon)))
+        indexed_entry = TRUE;
 
-      /* Chop off the trailing comma */
-      g_string_truncate (string, string->len - 1);
+      g_free (path);
+    }
 
-      dirs = string->str;
-      g_string_free (string, FALSE);
+  /* If every directory of the theme is indexed and none has the icon, there
+   * is nothing to look for */
+  if (all_indexed && !indexed_entry)
+    dirs = NULL;
+  else
+    {
+      dirs = g_key_file_get_string (theme_file,
+                                    "Icon Theme",
+                                    "Directories",
+                                    NULL);
+      if (!dirs)
+        dirs = mx_icon_theme_collect_all_dirs (self, theme);
     }
 
   if (dirs)
@@ -624,7 +1353,6 @@ mx_icon_theme_theme_load_icon (MxIconTheme *self,
       i = 0;
       while (i < dirs_len)
         {
-          GList *p;
           MxIconType type;
           gchar *type_string;
           gint size, min, max, threshold;
@@ -686,16 +1414,51 @@ mx_icon_theme_theme_load_icon (MxIconTheme *self,
               g_free (type_string);
             }
 
-          for (p = priv->search_paths; p; p = p->next)
+          for (p = priv->search_paths, k = 0; p; p = p->next, k++)
             {
               gchar *file;
+              gchar *path;
 
               MxIconData *icon_data = NULL;
               const gchar *search_path = p->data;
-              gchar *path = g_build_filename (search_path,
-                                              theme,
-                                              dir,
-                                              NULL);
+
+              if (indexes[k])
+                {
+                  guint32 flags;
+
+                  if (!entries[k])
+                    continue;
+
+                  flags = mx_icon_theme_index_get_flags (indexes[k],
+                                                         entries[k],
+                                                         dir);
+                  if (!flags)
+                    continue;
+
+                  /* Prefer png, then svg and xpm, as below */
+                  path = g_build_filename (search_path, theme, dir, NULL);
+                  file = g_strconcat (path, G_DIR_SEPARATOR_S, icon,
+                                      (flags & MX_ICON_INDEX_PNG) ? ".png" :
+                                      (flags & MX_ICON_INDEX_SVG) ? ".svg" :
+                                      ".xpm", NULL);
+                  g_free (path);
+
+                  icon_data = mx_icon_theme_icon_data_new (size,
+                                                           file,
+                                                           type,
+                                                           min,
+                                                           max,
+                                                           threshold);
+                  g_free (file);
+
+                  data = g_list_prepend (data, icon_data);
+                  continue;
+                }
+
+              path = g_build_filename (search_path,
+                                       theme,
+                                       dir,
+                                       NULL);
 
               /* Try png first, then svg and xpm */
               file = g_strconcat (path, G_DIR_SEPARATOR_S, icon, ".png", NULL);
@@ -738,6 +1501,9 @@ mx_icon_theme_theme_load_icon (MxIconTheme *self,
       g_free (dirs);
     }
 
+  g_free (indexes);
+  g_free (entries);
+
   if (data || store_fail)
     {
       data = g_list_reverse (data);
@@ -859,18 +1625,38 @@ mx_icon_theme_get_icons (MxIconTheme *theme,
   return data;
 }
 
-static MxIconData *
+static const MxIconLookup *
 mx_icon_theme_lookup_internal (MxIconTheme *theme,
                                const gchar *icon_name,
                                gint         size)
 {
+  MxIconThemePrivate *priv = theme->priv;
   MxIconData *best_match;
+  MxIconLookup *lookup;
   GList *d, *data;
   gint distance;
+  gpointer value;
+  gchar *key;
+
+  mx_icon_theme_check_dirs (theme);
+
+  /* Results, including misses, are cached for each name and size so that
+   * looking up the same icon again doesn't need to compare the candidates
+   * or, for an icon that doesn't exist, search the disk again.
+   */
+  key = g_strdup_printf ("%d:%s", size, icon_name);
+  if (g_hash_table_lookup_extended (priv->lookups, key, NULL, &value))
+    {
+      g_free (key);
+      return value;
+    }
 
   data = mx_icon_theme_get_icons (theme, icon_name);
   if (!data)
-    return NULL;
+    {
+      g_hash_table_insert (priv->lookups, key, NULL);
+      return NULL;
+    }
 
   best_match = NULL;
   distance = G_MAXINT;
@@ -911,10 +1697,68 @@ mx_icon_theme_lookup_internal (MxIconTheme *theme,
   if (!best_match)
     {
       g_warning ("No match found, but icon is in cache");
+      g_hash_table_insert (priv->lookups, key, NULL);
       return NULL;
     }
 
-  return best_match;
+  lookup = g_slice_new (MxIconLookup);
+  lookup->path = g_strdup (best_match->path);
+  lookup->size = best_match->size;
+  g_hash_table_insert (priv->lookups, key, lookup);
+
+  return lookup;
+}
+
+/* Returns the identifier in the texture cache's meta table of the icon at
+ * @path rendered at @size, rendering it if it isn't in the cache yet, or
+ * NULL if it can't be rendered. Icons that aren't available at the size
+ * they're requested at are scaled once and shared by everything showing
+ * them at that size, and scalable icons are rendered at the size.
+ */
+static gpointer
+mx_icon_theme_get_scaled (MxTextureCache *texture_cache,
+                          const gchar    *path,
+                          gint            size)
+{
+  CoglHandle texture;
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+  gpointer ident;
+  gchar *key;
+
+  key = g_strdup_printf ("mx-icon-theme-%d", size);
+  ident = GUINT_TO_POINTER (g_quark_from_string (key));
+  g_free (key);
+
+  if (mx_texture_cache_contains_meta (texture_cache, path, ident))
+    return ident;
+
+  pixbuf = gdk_pixbuf_new_from_file_at_size (path, size, size, &error);
+  if (!pixbuf)
+    {
+      g_warning ("Error loading icon '%s': %s", path, error->message);
+      g_error_free (error);
+      return NULL;
+    }
+
+  texture = cogl_texture_new_from_data (gdk_pixbuf_get_width (pixbuf),
+                                        gdk_pixbuf_get_height (pixbuf),
+                                        COGL_TEXTURE_NONE,
+                                        gdk_pixbuf_get_has_alpha (pixbuf) ?
+                                        COGL_PIXEL_FORMAT_RGBA_8888 :
+                                        COGL_PIXEL_FORMAT_RGB_888,
+                                        COGL_PIXEL_FORMAT_ANY,
+                                        gdk_pixbuf_get_rowstride (pixbuf),
+                                        gdk_pixbuf_get_pixels (pixbuf));
+  g_object_unref (pixbuf);
+
+  if (texture == COGL_INVALID_HANDLE)
+    return NULL;
+
+  mx_texture_cache_insert_meta (texture_cache, path, ident, texture, NULL);
+  cogl_handle_unref (texture);
+
+  return ident;
 }
 
 /**
@@ -932,18 +1776,25 @@ mx_icon_theme_lookup (MxIconTheme *theme,
                       const gchar *icon_name,
                       gint         size)
 {
+  const MxIconLookup *lookup;
   MxTextureCache *texture_cache;
-  MxIconData *icon_data;
+  gpointer ident;
 
   g_return_val_if_fail (MX_IS_ICON_THEME (theme), NULL);
   g_return_val_if_fail (icon_name, NULL);
   g_return_val_if_fail (size > 0, NULL);
 
-  if (!(icon_data = mx_icon_theme_lookup_internal (theme, icon_name, size)))
+  if (!(lookup = mx_icon_theme_lookup_internal (theme, icon_name, size)))
     return NULL;
 
   texture_cache = mx_texture_cache_get_default ();
-  return mx_texture_cache_get_cogl_texture (texture_cache, icon_data->path);
+
+  if (lookup->size != size &&
+      (ident = mx_icon_theme_get_scaled (texture_cache, lookup->path, size)))
+    return mx_texture_cache_get_meta_cogl_texture (texture_cache,
+                                                   lookup->path, ident);
+
+  return mx_texture_cache_get_cogl_texture (texture_cache, lookup->path);
 }
 
 /**
@@ -961,18 +1812,25 @@ mx_icon_theme_lookup_texture (MxIconTheme *theme,
                               const gchar *icon_name,
                               gint         size)
 {
+  const MxIconLookup *lookup;
   MxTextureCache *texture_cache;
-  MxIconData *icon_data;
+  gpointer ident;
 
   g_return_val_if_fail (MX_IS_ICON_THEME (theme), NULL);
   g_return_val_if_fail (icon_name, NULL);
   g_return_val_if_fail (size > 0, NULL);
 
-  if (!(icon_data = mx_icon_theme_lookup_internal (theme, icon_name, size)))
+  if (!(lookup = mx_icon_theme_lookup_internal (theme, icon_name, size)))
     return NULL;
 
   texture_cache = mx_texture_cache_get_default ();
-  return mx_texture_cache_get_texture (texture_cache, icon_data->path);
+
+  if (lookup->size != size &&
+      (ident = mx_icon_theme_get_scaled (texture_cache, lookup->path, size)))
+    return mx_texture_cache_get_meta_texture (texture_cache, lookup->path,
+                                              ident);
+
+  return mx_texture_cache_get_texture (texture_cache, lookup->path);
 }
 
 gboolean
@@ -982,6 +1840,8 @@ mx_icon_theme_has_icon (MxIconTheme *theme,
   g_return_val_if_fail (MX_IS_ICON_THEME (theme), FALSE);
   g_return_val_if_fail (icon_name, FALSE);
 
+  mx_icon_theme_check_dirs (theme);
+
   if (mx_icon_theme_get_icons (theme, icon_name))
     return TRUE;
   else
@@ -1033,4 +1893,75 @@ mx_icon_theme_set_search_paths (MxIconTheme *theme,
   priv->search_paths = g_list_copy ((GList *)paths);
   for (p = priv->search_paths; p; p = p->next)
     p->data = g_strdup ((const gchar *)p->data);
+
+  mx_icon_theme_clear_caches (theme);
+  mx_icon_theme_warmup (theme);
+}
+
+/**
+ * mx_icon_theme_set_warmup:
+ * @theme: a #MxIconTheme
+ * @warmup: %TRUE to index the theme directories in a thread
+ *
+ * Sets whether the directories of the theme and the themes it inherits
+ * from are indexed in a thread whenever the theme is loaded, instead of
+ * being searched for each icon when it is first looked up. The indexes
+ * are installed from an idle handler that runs before the next frame is
+ * drawn.
+ *
+ * The indexed theme directories are then watched for changes, and the
+ * icons are looked up again when a subdirectory is added or removed, or
+ * when a theme directory is touched, as mx-create-icon-index does. The
+ * subdirectories themselves aren't watched, so an icon that is installed
+ * into an existing subdirectory is only found once its theme directory
+ * is touched.
+ *
+ * Since: 1.6
+ */
+void
+mx_icon_theme_set_warmup (MxIconTheme *theme,
+                          gboolean     warmup)
+{
+  MxIconThemePrivate *priv;
+
+  g_return_if_fail (MX_IS_ICON_THEME (theme));
+
+  priv = theme->priv;
+  warmup = !!warmup;
+
+  if (priv->warmup == warmup)
+    return;
+
+  priv->warmup = warmup;
+
+  if (warmup)
+    mx_icon_theme_warmup (theme);
+  else
+    {
+      /* indexes already installed are kept, but no longer watched */
+      priv->generation ++;
+      g_hash_table_remove_all (priv->warming);
+      g_hash_table_remove_all (priv->monitors);
+    }
+
+  g_object_notify (G_OBJECT (theme), "warmup");
+}
+
+/**
+ * mx_icon_theme_get_warmup:
+ * @theme: a #MxIconTheme
+ *
+ * Gets whether the theme directories are indexed in a thread, see
+ * mx_icon_theme_set_warmup().
+ *
+ * Returns: the value of the #MxIconTheme:warmup property
+ *
+ * Since: 1.6
+ */
+gboolean
+mx_icon_theme_get_warmup (MxIconTheme *theme)
+{
+  g_return_val_if_fail (MX_IS_ICON_THEME (theme), FALSE);
+
+  return theme->priv->warmup;
 }
@@ -111,6 +111,10 @@ const GList    *mx_icon_theme_get_search_paths (MxIconTheme *theme);
 void            mx_icon_theme_set_search_paths (MxIconTheme *theme,
                                                 const GList *paths);
 
+void            mx_icon_theme_set_warmup (MxIconTheme *theme,
+                                          gboolean     warmup);
+gboolean        mx_icon_theme_get_warmup (MxIconTheme *theme);
+
 G_END_DECLS
 
 #endif /* _MX_ICON_THEME_H */
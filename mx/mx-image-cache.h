@@ -0,0 +1,104 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * mx-image-cache.h: image cache file format
+ *
+ * Copyright 2011 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* An image cache file is written by mx-create-image-cache and read by
+ * mx_texture_cache_load_cache(). It indexes images that have been packed
+ * into one or more atlas pages, which are stored as separate image files.
+ *
+ * The file starts with a header, followed by the page records, the entry
+ * records and a string table. All integers are 32-bit little-endian and
+ * all records are 4-byte aligned, so the file can be mapped and read in
+ * place. Strings are referred to by their offset in the string table and
+ * are nul-terminated.
+ *
+ * Entries are sorted by filename, in strcmp() order, so that they can be
+ * looked up with a binary search. Pages may be followed by reduced levels
+ * of themselves, each half the size of the previous level, which refer to
+ * their full size page as their base page.
+ */
+
+#ifndef __MX_IMAGE_CACHE_H__
+#define __MX_IMAGE_CACHE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define MX_IMAGE_CACHE_MAGIC   "MXICACHE"
+#define MX_IMAGE_CACHE_VERSION 1
+
+typedef struct
+{
+  gchar   magic[8];
+  guint32 version;
+
+  guint32 n_pages;
+  guint32 pages_offset;
+  guint32 n_entries;
+  guint32 entries_offset;
+  guint32 strings_offset;
+  guint32 strings_size;
+
+  /* checksum of everything following the header, for tools; it isn't
+   * checked when a cache is loaded, so that only the parts of the file
+   * that are used are read */
+  guint32 checksum;
+} MxImageCacheHeader;
+
+typedef struct
+{
+  guint32 filename;    /* absolute, or relative to the cache file */
+  guint32 width;
+  guint32 height;
+  guint32 base_page;   /* the full size page, or the page itself */
+  guint32 level;       /* the page is 2^level times smaller than base_page */
+} MxImageCachePage;
+
+typedef struct
+{
+  guint32 filename;
+  guint32 page;        /* a full size page */
+  guint32 x;
+  guint32 y;
+  guint32 width;
+  guint32 height;
+} MxImageCacheEntry;
+
+/* 32-bit FNV-1a */
+static inline guint32
+mx_image_cache_checksum (const guchar *data,
+                         gsize         length)
+{
+  guint32 hash = 2166136261u;
+  gsize i;
+
+  for (i = 0; i < length; i++)
+    {
+      hash ^= data[i];
+      hash *= 16777619u;
+    }
+
+  return hash;
+}
+
+G_END_DECLS
+
+#endif /* __MX_IMAGE_CACHE_H__ */
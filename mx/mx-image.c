@@ -34,6 +34,7 @@
 #include "mx-image.h"
 #include "mx-enum-types.h"
 #include "mx-marshal.h"
+#include "mx-private.h"
 #include "mx-texture-cache.h"
 
 #include <gdk-pixbuf/gdk-pixbuf.h>
@@ -45,20 +46,36 @@ G_DEFINE_TYPE (MxImage, mx_image, MX_TYPE_WIDGET)
 
 #define DEFAULT_DURATION 250
 
+/* The amount of encoded data given to the pixbuf loader at a time */
+#define MX_IMAGE_LOAD_CHUNK_SIZE (64 * 1024)
+
+/* The smallest reduced level built when MxImage:use-mipmaps is set */
+#define MX_IMAGE_MIN_LEVEL_SIZE 16
+
 /* This stucture holds all that is necessary for cancellable async
  * image loading using thread pools.
  *
  * The idea is that you create this structure (with the pixbuf as NULL)
- * and add it to the thread-pool.
+ * and add it to the load queue, which is sorted by priority, then push a
+ * token to the thread-pool. A thread takes the most urgent load from the
+ * queue for each token. A load that is cancelled while it is still queued
+ * is removed from the queue and freed straight away. The queue_iter member
+ * is protected by the queue lock, and is set while the load is queued.
  *
  * The 'complete' member of the struct is protected by the mutex.
  * The thread handler uses this to indicate that the load was completed.
  *
  * The thread will take the mutex while it's loading data - if cancelled
- * is set when it takes the mutex, it will add the idle handler and let the
- * main thread free the data.
- *
- * The idle handler will check that the cancelled member isn't set and if not,
+ * is set when it takes the mutex, it will add the data to the upload queue
+ * and let the main thread free the data. A load cancelled while the thread
+ * is decoding it also sets the stop member, which the thread checks
+ * atomically between chunks of encoded data, so that it gives up early.
+ *
+ * Loaded images are added to the upload queue, which the main thread drains
+ * for a limited time per frame, starting with images that are mapped. The
+ * upload_iter member is protected by the uploads lock, and the cancelled
+ * and mapped members are only changed with both locks held. For
+ * each one it will check that the cancelled member isn't set and if not,
  * will try to upload the image using mx_image_set_from_pixbuf(). It will free
  * the async structure always. It will also reset the pointer to the task in
  * the MxImage priv struct, but only if the cancelled member *isn't* set.
@@ -71,7 +88,7 @@ typedef struct
   guint           complete  : 1;
   guint           cancelled : 1;
   guint           upscale   : 1;
-  guint           idle_handler;
+  guint           mipmaps   : 1;
 
   gchar          *filename;
   guchar         *buffer;
@@ -82,6 +99,18 @@ typedef struct
   gint            height;
   guint           width_threshold;
   guint           height_threshold;
+  gpointer        cache_ident;
+  gboolean        unscaled_cached;
+  gboolean        cached;
+
+  gint            priority;
+  gboolean        mapped;
+  guint           serial;
+  GSequenceIter  *queue_iter;
+  volatile gint   stop;
+
+  guint           upload_serial;
+  GSequenceIter  *upload_iter;
 
   GdkPixbuf      *pixbuf;
   GError         *error;
@@ -93,6 +122,7 @@ struct _MxImagePrivate
   MxImageScaleMode previous_mode;
   guint            load_async : 1;
   guint            upscale    : 1;
+  guint            use_mipmaps : 1;
   guint            width_threshold;
   guint            height_threshold;
 
@@ -113,6 +143,7 @@ struct _MxImagePrivate
 
   guint transition_duration;
 
+  gint load_priority;
   MxImageAsyncData *async_load_data;
 };
 
@@ -126,7 +157,9 @@ enum
   PROP_SCALE_WIDTH_THRESHOLD,
   PROP_SCALE_HEIGHT_THRESHOLD,
   PROP_IMAGE_ROTATION,
-  PROP_TRANSITION_DURATION
+  PROP_TRANSITION_DURATION,
+  PROP_LOAD_PRIORITY,
+  PROP_USE_MIPMAPS
 };
 
 enum
@@ -140,25 +173,142 @@ enum
 static guint signals[LAST_SIGNAL] = { 0, };
 
 static GThreadPool *mx_image_threads = NULL;
+
+/* Asynchronous loads waiting for a thread, most urgent first */
+G_LOCK_DEFINE_STATIC (mx_image_queue);
+static GSequence *mx_image_queue = NULL;
+static guint mx_image_queue_serial = 0;
+
+/* Loaded images waiting to be uploaded by the main thread, in the order
+ * they should be uploaded */
+G_LOCK_DEFINE_STATIC (mx_image_uploads);
+static GSequence *mx_image_uploads = NULL;
+static guint mx_image_uploads_serial = 0;
+static guint mx_image_uploads_source = 0;
+static guint mx_image_upload_time_slice = 5;
+static guint mx_image_upload_overruns = 0;
 static GQuark mx_image_cache_quark = 0;
 
+/* Identifiers of images loaded at a size in the texture cache's meta
+ * tables, counted by the meta entries and loads using them, so that they
+ * are freed with the last cached texture of that size */
+static GHashTable *mx_image_cache_idents = NULL;
+
+/* The reduced levels of a padded pixbuf are attached to it as qdata, and
+ * those of a texture with _mx_texture_cache_set_levels(), so that the
+ * texture cache counts them */
+static GQuark mx_image_levels_quark = 0;
+
 static gboolean
 mx_image_set_from_data_internal (MxImage          *image,
                                  const guchar     *data,
                                  const gchar      *uri,
-                                 gboolean          use_cache,
+                                 gpointer          cache_ident,
                                  CoglPixelFormat   pixel_format,
                                  gint              width,
                                  gint              height,
                                  gint              rowstride,
+                                 gboolean          padded,
                                  GError          **error);
 
+static void mx_image_cancel_in_progress (MxImage *image);
+static void mx_image_texture_set_levels (CoglHandle  texture,
+                                         GdkPixbuf  *pixbuf);
+static gint mx_image_queue_compare (gconstpointer a,
+                                    gconstpointer b,
+                                    gpointer      user_data);
+static gint mx_image_uploads_compare (gconstpointer a,
+                                      gconstpointer b,
+                                      gpointer      user_data);
+
 GQuark
 mx_image_error_quark (void)
 {
   return g_quark_from_static_string ("mx-image-error-quark");
 }
 
+static gpointer
+mx_image_cache_ident_ref (gpointer ident)
+{
+  guint count;
+
+  if (ident == GUINT_TO_POINTER (mx_image_cache_quark))
+    return ident;
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (mx_image_cache_idents, ident));
+  g_hash_table_insert (mx_image_cache_idents, ident,
+                       GUINT_TO_POINTER (count + 1));
+
+  return ident;
+}
+
+static void
+mx_image_cache_ident_unref (gpointer ident)
+{
+  guint count;
+
+  if (!ident || ident == GUINT_TO_POINTER (mx_image_cache_quark))
+    return;
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (mx_image_cache_idents, ident));
+  if (count > 1)
+    g_hash_table_insert (mx_image_cache_idents, ident,
+                         GUINT_TO_POINTER (count - 1));
+  else
+    {
+      g_hash_table_remove (mx_image_cache_idents, ident);
+      g_free (ident);
+    }
+}
+
+/* Returns a reference to the identifier of the processed texture of an
+ * image loaded at the given size in the texture cache's meta table.
+ * Everything that affects scaling is part of the identifier, so that images
+ * requested at the same size are shared. It is an interned string rather
+ * than a quark, as quarks are never freed.
+ */
+static gpointer
+mx_image_get_cache_ident (MxImage *image,
+                          gint     width,
+                          gint     height)
+{
+  MxImagePrivate *priv = image->priv;
+  gpointer ident, count;
+  gchar *key;
+
+  if ((width == -1) && (height == -1))
+    return GUINT_TO_POINTER (mx_image_cache_quark);
+
+  if (!mx_image_cache_idents)
+    mx_image_cache_idents = g_hash_table_new (g_str_hash, g_str_equal);
+
+  key = g_strdup_printf ("mx-image-cache-%dx%d-%u-%u-%d", width, height,
+                         priv->width_threshold, priv->height_threshold,
+                         priv->upscale);
+
+  if (g_hash_table_lookup_extended (mx_image_cache_idents, key,
+                                    &ident, &count))
+    g_free (key);
+  else
+    ident = key;
+
+  return mx_image_cache_ident_ref (ident);
+}
+
+/* Whether the unscaled image is in the cache, when loading at a size */
+static gboolean
+mx_image_unscaled_cached (const gchar *filename,
+                          gint         width,
+                          gint         height)
+{
+  if ((width == -1) && (height == -1))
+    return FALSE;
+
+  return mx_texture_cache_contains_meta (mx_texture_cache_get_default (),
+                                         filename,
+                                         GINT_TO_POINTER (mx_image_cache_quark));
+}
+
 static void
 mx_image_async_data_free (MxImageAsyncData *data)
 {
@@ -168,9 +318,7 @@ mx_image_async_data_free (MxImageAsyncData *data)
     data->free_func (data->buffer);
 
   g_free (data->filename);
-
-  if (data->idle_handler)
-    g_source_remove (data->idle_handler);
+  mx_image_cache_ident_unref (data->cache_ident);
 
   if (data->pixbuf)
     g_object_unref (data->pixbuf);
@@ -193,6 +341,9 @@ mx_image_async_data_new (MxImage *parent)
   data->upscale = parent->priv->upscale;
   data->width_threshold = parent->priv->width_threshold;
   data->height_threshold = parent->priv->height_threshold;
+  data->priority = parent->priv->load_priority;
+  data->mapped = CLUTTER_ACTOR_IS_MAPPED (CLUTTER_ACTOR (parent));
+  data->mipmaps = parent->priv->use_mipmaps;
 
   return data;
 }
@@ -260,6 +411,28 @@ calculate_scale (CoglHandle       texture,
     }
 }
 
+/* Returns the reduced level of @texture to use when drawing it @scale
+ * times smaller, or @texture itself */
+static CoglHandle
+mx_image_get_level (CoglHandle texture,
+                    gfloat     scale)
+{
+  GPtrArray *levels;
+  guint level = 0;
+
+  levels = _mx_texture_cache_get_levels (texture);
+  if (!levels)
+    return texture;
+
+  while (level < levels->len && scale >= 2.0)
+    {
+      scale /= 2.0;
+      level++;
+    }
+
+  return level ? g_ptr_array_index (levels, level - 1) : texture;
+}
+
 static void
 mx_image_paint (ClutterActor *actor)
 {
@@ -270,7 +443,7 @@ mx_image_paint (ClutterActor *actor)
   float tex_coords[8];
   MxPadding padding;
   CoglMatrix matrix;
-  gfloat scale = 1;
+  gfloat scale = 1, old_scale;
   gfloat ratio;
   CoglColor color;
 
@@ -305,10 +478,7 @@ mx_image_paint (ClutterActor *actor)
       cogl_material_set_layer_combine_constant (priv->material, 2, &color);
     }
   else
-    {
-      cogl_material_set_color (priv->material, &color);
-      cogl_material_set_layer (priv->material, 0, priv->texture);
-    }
+    cogl_material_set_color (priv->material, &color);
 
   /* calculate texture co-ordinates */
   get_center_coords (priv->texture, priv->rotation, aw, ah, tex_coords);
@@ -327,6 +497,11 @@ mx_image_paint (ClutterActor *actor)
       scale = scale + (previous_scale - scale) * (1 - progress);
     }
 
+  /* the levels are scaled copies of the whole texture, so the texture
+   * co-ordinates are the same for all of them */
+  cogl_material_set_layer (priv->material, 0,
+                           mx_image_get_level (priv->texture, scale));
+
   cogl_matrix_init_identity (&matrix);
   cogl_matrix_translate (&matrix, 0.5, 0.5, 0);
 
@@ -346,8 +521,9 @@ mx_image_paint (ClutterActor *actor)
       get_center_coords (priv->old_texture, priv->old_rotation, aw, ah,
                          tex_coords + 4);
 
-      scale = calculate_scale (priv->old_texture, priv->old_rotation, aw, ah,
-                               priv->old_mode);
+      /* the outgoing texture picks its level by its own scale */
+      old_scale = calculate_scale (priv->old_texture, priv->old_rotation,
+                                   aw, ah, priv->old_mode);
 
       bw = cogl_texture_get_width (priv->old_texture);
       bh = cogl_texture_get_height (priv->old_texture);
@@ -360,11 +536,15 @@ mx_image_paint (ClutterActor *actor)
       cogl_matrix_rotate (&matrix, priv->old_rotation, 0, 0, -1);
       cogl_matrix_scale (&matrix, 1, 1 / ratio, 1);
 
-      cogl_matrix_scale (&matrix, scale, scale, 1);
+      cogl_matrix_scale (&matrix, old_scale, old_scale, 1);
 
       cogl_matrix_translate (&matrix, -0.5, -0.5, 0);
       cogl_material_set_layer_matrix (priv->material, 1, &matrix);
 
+      cogl_material_set_layer (priv->material, 1,
+                               mx_image_get_level (priv->old_texture,
+                                                   old_scale));
+
     }
 
   cogl_set_source (priv->material);
@@ -454,6 +634,14 @@ mx_image_set_property (GObject      *object,
       mx_image_set_transition_duration (image, g_value_get_uint (value));
       break;
 
+    case PROP_LOAD_PRIORITY:
+      mx_image_set_load_priority (image, g_value_get_int (value));
+      break;
+
+    case PROP_USE_MIPMAPS:
+      mx_image_set_use_mipmaps (image, g_value_get_boolean (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -498,12 +686,63 @@ mx_image_get_property (GObject    *object,
       g_value_set_uint (value, priv->transition_duration);
       break;
 
+    case PROP_LOAD_PRIORITY:
+      g_value_set_int (value, priv->load_priority);
+      break;
+
+    case PROP_USE_MIPMAPS:
+      g_value_set_boolean (value, priv->use_mipmaps);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
     }
 }
 
+/* Moves the queued load of @image, if it is waiting for a thread, after its
+ * priority or mapped state has changed */
+static void
+mx_image_update_queued_load (MxImage *image)
+{
+  MxImagePrivate *priv = image->priv;
+  MxImageAsyncData *data = priv->async_load_data;
+
+  if (!data)
+    return;
+
+  G_LOCK (mx_image_queue);
+  G_LOCK (mx_image_uploads);
+
+  data->priority = priv->load_priority;
+  data->mapped = CLUTTER_ACTOR_IS_MAPPED (CLUTTER_ACTOR (image));
+
+  if (data->queue_iter)
+    g_sequence_sort_changed (data->queue_iter, mx_image_queue_compare, NULL);
+  if (data->upload_iter)
+    g_sequence_sort_changed (data->upload_iter, mx_image_uploads_compare,
+                             NULL);
+
+  G_UNLOCK (mx_image_uploads);
+  G_UNLOCK (mx_image_queue);
+}
+
+static void
+mx_image_map (ClutterActor *actor)
+{
+  CLUTTER_ACTOR_CLASS (mx_image_parent_class)->map (actor);
+
+  mx_image_update_queued_load (MX_IMAGE (actor));
+}
+
+static void
+mx_image_unmap (ClutterActor *actor)
+{
+  CLUTTER_ACTOR_CLASS (mx_image_parent_class)->unmap (actor);
+
+  mx_image_update_queued_load (MX_IMAGE (actor));
+}
+
 static void
 mx_image_dispose (GObject *object)
 {
@@ -569,11 +808,7 @@ mx_image_dispose (GObject *object)
       priv->template_material = NULL;
     }
 
-  if (priv->async_load_data)
-    {
-      priv->async_load_data->cancelled = TRUE;
-      priv->async_load_data = NULL;
-    }
+  mx_image_cancel_in_progress (MX_IMAGE (object));
 
   G_OBJECT_CLASS (mx_image_parent_class)->dispose (object);
 }
@@ -595,6 +830,8 @@ mx_image_class_init (MxImageClass *klass)
   actor_class->paint = mx_image_paint;
   actor_class->get_preferred_width = mx_image_get_preferred_width;
   actor_class->get_preferred_height = mx_image_get_preferred_height;
+  actor_class->map = mx_image_map;
+  actor_class->unmap = mx_image_unmap;
 
   pspec = g_param_spec_enum ("scale-mode",
                              "Scale Mode",
@@ -658,6 +895,41 @@ mx_image_class_init (MxImageClass *klass)
 
   g_object_class_install_property (object_class, PROP_TRANSITION_DURATION, pspec);
 
+  /**
+   * MxImage:load-priority:
+   *
+   * The priority of asynchronous loads of this image. Loads with lower
+   * values are started first, as with #GSource priorities. Among loads of
+   * the same priority, those of images that are mapped are started first.
+   * Changing the priority also affects a load that has not started yet.
+   *
+   * Since: 1.6
+   */
+  pspec = g_param_spec_int ("load-priority",
+                            "Load priority",
+                            "Priority of asynchronous loads",
+                            G_MININT, G_MAXINT, G_PRIORITY_DEFAULT,
+                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_property (object_class, PROP_LOAD_PRIORITY, pspec);
+
+  /**
+   * MxImage:use-mipmaps:
+   *
+   * Whether to build reduced levels of images as they are loaded, each half
+   * the size of the previous one. When the image is painted scaled down,
+   * the nearest level is used instead of the full size texture.
+   *
+   * Since: 1.6
+   */
+  pspec = g_param_spec_boolean ("use-mipmaps",
+                                "Use mipmaps",
+                                "Build reduced levels of loaded images",
+                                FALSE,
+                                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_property (object_class, PROP_USE_MIPMAPS, pspec);
+
 
   /**
    * MxImage::image-loaded:
@@ -695,6 +967,7 @@ mx_image_class_init (MxImageClass *klass)
                   G_TYPE_NONE, 1, G_TYPE_ERROR);
 
   mx_image_cache_quark = g_quark_from_static_string ("mx-image-cache");
+  mx_image_levels_quark = g_quark_from_static_string ("mx-image-levels");
 }
 
 static void
@@ -779,6 +1052,7 @@ mx_image_init (MxImage *self)
   priv = self->priv = MX_IMAGE_GET_PRIVATE (self);
 
   priv->transition_duration = DEFAULT_DURATION;
+  priv->load_priority = G_PRIORITY_DEFAULT;
   priv->timeline = clutter_timeline_new (priv->transition_duration);
   priv->redraw_timeline = clutter_timeline_new (200);
   priv->redraw_alpha = clutter_alpha_new_full (priv->redraw_timeline,
@@ -961,12 +1235,37 @@ static void
 mx_image_cancel_in_progress (MxImage *image)
 {
   MxImagePrivate *priv = image->priv;
+  MxImageAsyncData *data = priv->async_load_data;
 
   /* Cancel any asynchronous image load */
-  if (priv->async_load_data)
+  if (data)
     {
-      priv->async_load_data->cancelled = TRUE;
       priv->async_load_data = NULL;
+
+      G_LOCK (mx_image_queue);
+      if (data->queue_iter)
+        {
+          /* The load hasn't begun, so no thread will see it again */
+          g_sequence_remove (data->queue_iter);
+          data->queue_iter = NULL;
+          G_UNLOCK (mx_image_queue);
+
+          mx_image_async_data_free (data);
+        }
+      else
+        {
+          /* The load is in progress or waiting to be uploaded, in which
+           * case it moves to the front of the upload queue */
+          G_LOCK (mx_image_uploads);
+          data->cancelled = TRUE;
+          if (data->upload_iter)
+            g_sequence_sort_changed (data->upload_iter,
+                                     mx_image_uploads_compare, NULL);
+          G_UNLOCK (mx_image_uploads);
+
+          g_atomic_int_set (&data->stop, TRUE);
+          G_UNLOCK (mx_image_queue);
+        }
     }
 }
 
@@ -1015,28 +1314,37 @@ mx_image_clear (MxImage *image)
  * @image: An #MxImage
  * @data: Image data, or %NULL
  * @uri: A local file path / URI, or %NULL
- * @use_cache: Whether the texture cache should be used
+ * @cache_ident: The identifier of the texture in the cache, or %NULL to not
+ *   use the cache
  * @pixel_format: The #CoglPixelFormat of the buffer
  * @width: Width in pixels of image data.
  * @height: Height in pixels of image data
  * @rowstride: Distance in bytes between row starts.
+ * @padded: Whether @data already has a one pixel transparent border
  * @error: Return location for a #GError, or #NULL
  *
  * Set the image data from a buffer. In case of failure, #FALSE is returned
  * and @error is set. If @data is %NULL, the image will be loaded from the
  * cache.
  *
+ * The texture has a one pixel transparent border around the image. If
+ * @padded is %TRUE, @data is @width + 2 by @height + 2 pixels and already
+ * includes the border, and is uploaded in one go. The texture is then not
+ * added to the cache, so that the caller can attach its reduced levels
+ * first. Otherwise the image and the border are uploaded separately.
+ *
  * Returns: #TRUE if the image was successfully updated
  */
 static gboolean
 mx_image_set_from_data_internal (MxImage          *image,
                                  const guchar     *data,
                                  const gchar      *uri,
-                                 gboolean          use_cache,
+                                 gpointer          cache_ident,
                                  CoglPixelFormat   pixel_format,
                                  gint              width,
                                  gint              height,
                                  gint              rowstride,
+                                 gboolean          padded,
                                  GError          **error)
 {
   MxImagePrivate *priv;
@@ -1062,10 +1370,10 @@ mx_image_set_from_data_internal (MxImage          *image,
   /* See if the texture's cached, otherwise create it */
   cache = mx_texture_cache_get_default ();
 
-  if (use_cache && uri && !data)
+  if (cache_ident && uri && !data)
     {
       priv->texture = mx_texture_cache_get_meta_cogl_texture (
-        cache, uri, GINT_TO_POINTER (mx_image_cache_quark));
+        cache, uri, cache_ident);
 
       if (!priv->texture)
         {
@@ -1077,6 +1385,25 @@ mx_image_set_from_data_internal (MxImage          *image,
           return FALSE;
         }
     }
+  else if (padded)
+    {
+      priv->texture = cogl_texture_new_from_data (width + 2, height + 2,
+                                                  COGL_TEXTURE_NO_ATLAS,
+                                                  pixel_format,
+                                                  COGL_PIXEL_FORMAT_ANY,
+                                                  rowstride, data);
+
+      if (!priv->texture)
+        {
+          priv->texture = old_texture;
+
+          if (error)
+            g_set_error (error, MX_IMAGE_ERROR, MX_IMAGE_ERROR_BAD_FORMAT,
+                         "Failed to create Cogl texture");
+
+          return FALSE;
+        }
+    }
   else
     {
       gint *blank_area;
@@ -1122,11 +1449,12 @@ mx_image_set_from_data_internal (MxImage          *image,
       g_free (blank_area);
 
       /* Insert the processed image into the cache, if we have a URI */
-      if (uri)
+      if (cache_ident && uri)
         {
           mx_texture_cache_insert_meta (cache, uri,
-                                        GINT_TO_POINTER (mx_image_cache_quark),
-                                        priv->texture, NULL);
+                                        mx_image_cache_ident_ref (cache_ident),
+                                        priv->texture,
+                                        mx_image_cache_ident_unref);
         }
     }
 
@@ -1178,9 +1506,52 @@ mx_image_set_from_data (MxImage          *image,
       return FALSE;
     }
 
-  return mx_image_set_from_data_internal (image, data, NULL, FALSE,
+  return mx_image_set_from_data_internal (image, data, NULL, 0,
                                           pixel_format, width, height,
-                                          rowstride, error);
+                                          rowstride, FALSE, error);
+}
+
+/**
+ * mx_image_set_from_padded_data:
+ * @image: An #MxImage
+ * @data: Image data, including a one pixel transparent border
+ * @pixel_format: The #CoglPixelFormat of the buffer
+ * @width: Width in pixels of the image, without the border
+ * @height: Height in pixels of the image, without the border
+ * @rowstride: Distance in bytes between row starts.
+ * @error: Return location for a #GError, or #NULL
+ *
+ * Set the image data from a buffer of @width + 2 by @height + 2 pixels
+ * that already has a one pixel transparent border around the image, as
+ * #MxImage needs to draw it. Unlike mx_image_set_from_data(), the data is
+ * uploaded in one go. In case of failure, #FALSE is returned and @error
+ * is set.
+ *
+ * Returns: #TRUE if the image was successfully updated
+ *
+ * Since: 1.6
+ */
+gboolean
+mx_image_set_from_padded_data (MxImage          *image,
+                               const guchar     *data,
+                               CoglPixelFormat   pixel_format,
+                               gint              width,
+                               gint              height,
+                               gint              rowstride,
+                               GError          **error)
+{
+  if (G_UNLIKELY (!MX_IS_IMAGE (image)))
+    {
+      if (error)
+        g_set_error (error, MX_IMAGE_ERROR,
+                     MX_IMAGE_ERROR_INVALID_PARAMETER,
+                     "image parameter is not a MxImage");
+      return FALSE;
+    }
+
+  return mx_image_set_from_data_internal (image, data, NULL, 0,
+                                          pixel_format, width, height,
+                                          rowstride, TRUE, error);
 }
 
 /*
@@ -1188,10 +1559,15 @@ mx_image_set_from_data (MxImage          *image,
  * @image: A #MxImage
  * @pixbuf: A #GdkPixbuf, or %NULL
  * @filename: A path or URI to an image file, or %NULL
+ * @cache_ident: The identifier of the texture in the cache, as returned by
+ *   mx_image_get_cache_ident(), or %NULL
  * @error: A pointer to a #GError, or %NULL
  *
  * Sets the MxImage from a #GdkPixbuf, or from the cache if a filename is
  * given, no pixbuf is given and the filename has been previously cached.
+ * If @pixbuf and @filename are given, the new texture is added to the
+ * cache.
+ * @pixbuf must have been padded with mx_image_pad_pixbuf().
  *
  * Returns: %TRUE on success, %FALSE otherwise. @error is set on failure
  */
@@ -1199,6 +1575,7 @@ static gboolean
 mx_image_set_from_pixbuf (MxImage      *image,
                           GdkPixbuf    *pixbuf,
                           const gchar  *filename,
+                          gpointer      cache_ident,
                           GError      **error)
 {
   gboolean has_alpha;
@@ -1218,8 +1595,7 @@ mx_image_set_from_pixbuf (MxImage      *image,
 
   /* Check if we have valid input arguments */
   if ((!pixbuf && !filename) || (!pixbuf && filename &&
-      !mx_texture_cache_contains_meta (cache, filename,
-                                       GINT_TO_POINTER (mx_image_cache_quark))))
+      !mx_texture_cache_contains_meta (cache, filename, cache_ident)))
     {
       if (error)
         {
@@ -1239,8 +1615,8 @@ mx_image_set_from_pixbuf (MxImage      *image,
       gint bps, channels;
       GdkColorspace color_space;
 
-      width = gdk_pixbuf_get_width (pixbuf);
-      height = gdk_pixbuf_get_height (pixbuf);
+      width = gdk_pixbuf_get_width (pixbuf) - 2;
+      height = gdk_pixbuf_get_height (pixbuf) - 2;
       has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
       rowstride = gdk_pixbuf_get_rowstride (pixbuf);
       bps = gdk_pixbuf_get_bits_per_sample (pixbuf);
@@ -1268,49 +1644,95 @@ mx_image_set_from_pixbuf (MxImage      *image,
       has_alpha = TRUE;
     }
 
-  return
-    mx_image_set_from_data_internal (image,
+  if (!mx_image_set_from_data_internal (image,
                                  pixbuf ? gdk_pixbuf_get_pixels (pixbuf) : NULL,
-                                 filename, TRUE,
+                                 filename, cache_ident,
                                  has_alpha ? COGL_PIXEL_FORMAT_RGBA_8888 :
                                              COGL_PIXEL_FORMAT_RGB_888,
-                                 width, height, rowstride, error);
+                                 width, height, rowstride, TRUE, error))
+    return FALSE;
+
+  if (pixbuf)
+    {
+      mx_image_texture_set_levels (image->priv->texture, pixbuf);
+
+      /* Add the new texture to the cache, levels included */
+      if (filename && cache_ident)
+        mx_texture_cache_insert_meta (cache, filename,
+                                      mx_image_cache_ident_ref (cache_ident),
+                                      image->priv->texture,
+                                      mx_image_cache_ident_unref);
+    }
+
+  return TRUE;
 }
 
-static gboolean
-mx_image_load_complete_cb (gpointer task_data)
+/* Adds @data to the load queue and pushes a token for it to the thread
+ * pool */
+static void
+mx_image_queue_load (MxImageAsyncData *data)
 {
-  MxImageAsyncData *data = task_data;
+  G_LOCK (mx_image_queue);
+  if (!mx_image_queue)
+    mx_image_queue = g_sequence_new (NULL);
+  data->serial = mx_image_queue_serial++;
+  data->queue_iter = g_sequence_insert_sorted (mx_image_queue, data,
+                                               mx_image_queue_compare, NULL);
+  G_UNLOCK (mx_image_queue);
+
+  g_thread_pool_push (mx_image_threads, GINT_TO_POINTER (1), NULL);
+}
 
+static void
+mx_image_load_complete (MxImageAsyncData *data)
+{
   /* Lock/unlock mutex to make sure the thread is finished. This is necessary
-   * as it's possible that this idle handler will run before the thread unlocks
+   * as it's possible that the upload will run before the thread unlocks
    * the mutex, and freeing a locked mutex results in undefined behaviour
    * (well, it crashes on Linux with an assert in pthreads...)
    */
   g_mutex_lock (data->mutex);
   g_mutex_unlock (data->mutex);
 
-  /* Reset the idle handler id so we don't try to remove it when we free
-   * the data later on.
-   */
-  data->idle_handler = 0;
-
   /* Don't do anything with the image data if we've been cancelled already */
   if (!data->cancelled && data->complete)
     {
+      /* The thread stopped decoding because the unscaled image was in the
+       * cache when the load was queued. If it has been evicted since, load
+       * the file again, decoding it this time.
+       */
+      if (data->cached &&
+          !mx_texture_cache_contains_meta (mx_texture_cache_get_default (),
+                                           data->filename,
+                                           GUINT_TO_POINTER (mx_image_cache_quark)))
+        {
+          MX_NOTE (IMAGE, "'%s' was evicted from the cache while loading",
+                   data->filename);
+
+          data->complete = FALSE;
+          data->cached = FALSE;
+          data->unscaled_cached = FALSE;
+          mx_image_queue_load (data);
+
+          return;
+        }
+
       /* Reset the current async image load data pointer */
       data->parent->priv->async_load_data = NULL;
 
       /* If we managed to load the pixbuf, set it now, otherwise forward the
        * error on to the user via a signal.
        */
-      if (data->pixbuf)
+      if (data->pixbuf || data->cached)
         {
           GError *error = NULL;
-          gboolean resized = (data->width != -1 || data->height != -1);
           gboolean success =
             mx_image_set_from_pixbuf (data->parent, data->pixbuf,
-                                      resized ? data->filename : NULL, &error);
+                                      data->filename,
+                                      data->cached ?
+                                        GUINT_TO_POINTER (mx_image_cache_quark) :
+                                        data->cache_ident,
+                                      &error);
 
           if (success)
             g_signal_emit (data->parent, signals[IMAGE_LOADED], 0);
@@ -1326,10 +1748,126 @@ mx_image_load_complete_cb (gpointer task_data)
 
   /* Free the async loading struct */
   mx_image_async_data_free (data);
+}
+
+/* Cancelled loads are freed first, as they cost nothing, then images that
+ * are mapped, then the others in the order they were loaded. */
+static gint
+mx_image_uploads_compare (gconstpointer a,
+                          gconstpointer b,
+                          gpointer      user_data)
+{
+  const MxImageAsyncData *data_a = a;
+  const MxImageAsyncData *data_b = b;
+
+  if (data_a->cancelled != data_b->cancelled)
+    return data_a->cancelled ? -1 : 1;
+
+  if (data_a->mapped != data_b->mapped)
+    return data_a->mapped ? -1 : 1;
+
+  return (data_a->upload_serial < data_b->upload_serial) ? -1 : 1;
+}
+
+/* Called with the uploads lock held */
+static MxImageAsyncData *
+mx_image_uploads_pop (void)
+{
+  MxImageAsyncData *data;
+  GSequenceIter *iter;
+
+  if (!mx_image_uploads)
+    return NULL;
+
+  iter = g_sequence_get_begin_iter (mx_image_uploads);
+  if (g_sequence_iter_is_end (iter))
+    return NULL;
+
+  data = g_sequence_get (iter);
+  g_sequence_remove (iter);
+  data->upload_iter = NULL;
+
+  return data;
+}
+
+static gboolean
+mx_image_process_uploads (gpointer user_data)
+{
+  MxImageAsyncData *data;
+  GTimer *timer;
+  gdouble elapsed;
+  guint n_uploads = 0;
+
+  timer = g_timer_new ();
+
+  while (TRUE)
+    {
+      G_LOCK (mx_image_uploads);
+      data = mx_image_uploads_pop ();
+      if (!data)
+        {
+          mx_image_uploads_source = 0;
+          G_UNLOCK (mx_image_uploads);
+          break;
+        }
+      G_UNLOCK (mx_image_uploads);
+
+      /* data->cancelled may only be changed by this thread */
+      if (!data->cancelled)
+        n_uploads++;
+
+      mx_image_load_complete (data);
+
+      if (g_timer_elapsed (timer, NULL) * 1000 >= mx_image_upload_time_slice)
+        {
+          /* Carry on after the next frame has been drawn */
+          G_LOCK (mx_image_uploads);
+          mx_image_uploads_source =
+            (g_sequence_get_length (mx_image_uploads) == 0) ? 0 :
+            clutter_threads_add_idle_full (CLUTTER_PRIORITY_REDRAW + 1,
+                                           mx_image_process_uploads,
+                                           NULL, NULL);
+          G_UNLOCK (mx_image_uploads);
+          break;
+        }
+    }
+
+  elapsed = g_timer_elapsed (timer, NULL) * 1000;
+  g_timer_destroy (timer);
+
+  /* A single upload can't be split, so the time slice is exceeded when an
+   * upload takes longer than what was left of it */
+  if (elapsed > mx_image_upload_time_slice)
+    {
+      mx_image_upload_overruns++;
+      MX_NOTE (IMAGE, "%u uploads took %.2fms, over the time slice of %ums",
+               n_uploads, elapsed, mx_image_upload_time_slice);
+    }
 
   return FALSE;
 }
 
+/* Called from the loading threads */
+static void
+mx_image_uploads_push (MxImageAsyncData *data)
+{
+  G_LOCK (mx_image_uploads);
+
+  if (!mx_image_uploads)
+    mx_image_uploads = g_sequence_new (NULL);
+  data->upload_serial = mx_image_uploads_serial++;
+  data->upload_iter = g_sequence_insert_sorted (mx_image_uploads, data,
+                                                mx_image_uploads_compare,
+                                                NULL);
+
+  if (!mx_image_uploads_source)
+    mx_image_uploads_source =
+      clutter_threads_add_idle_full (G_PRIORITY_HIGH_IDLE,
+                                     mx_image_process_uploads, NULL, NULL);
+
+  G_UNLOCK (mx_image_uploads);
+}
+
 typedef struct
 {
   gint     width;
@@ -1338,16 +1876,20 @@ typedef struct
   guint    height_threshold;
   gboolean upscale;
   gboolean scaled;
+
+  /* whether the unscaled image is in the cache, and whether the load was
+   * stopped because the image turned out not to need scaling */
+  gboolean unscaled_cached;
+  gboolean cached;
 } MxImageSizeRequest;
 
 static void
-mx_image_size_prepared_cb (GdkPixbufLoader *loader,
-                           gint             width,
-                           gint             height,
-                           gpointer         user_data)
+mx_image_size_request_apply (GdkPixbufLoader    *loader,
+                             gint                width,
+                             gint                height,
+                             MxImageSizeRequest *constraints)
 {
   gboolean fit_width;
-  MxImageSizeRequest *constraints = user_data;
 
   if (constraints->width >= 0)
     {
@@ -1395,6 +1937,125 @@ mx_image_size_prepared_cb (GdkPixbufLoader *loader,
     }
 }
 
+static void
+mx_image_size_prepared_cb (GdkPixbufLoader *loader,
+                           gint             width,
+                           gint             height,
+                           gpointer         user_data)
+{
+  MxImageSizeRequest *constraints = user_data;
+
+  mx_image_size_request_apply (loader, width, height, constraints);
+
+  /* There's no need to decode an image that would be used as it is if it's
+   * already in the cache */
+  if (!constraints->scaled && constraints->unscaled_cached)
+    constraints->cached = TRUE;
+}
+
+/*
+ * mx_image_pad_pixbuf:
+ * @pixbuf: A #GdkPixbuf
+ *
+ * Copies @pixbuf into the middle of a new pixbuf with alpha that is two
+ * pixels wider and taller, leaving a transparent border around it. This is
+ * done in the loading thread, so that the texture can be created with a
+ * single upload in the main thread.
+ *
+ * Returns: A new #GdkPixbuf
+ */
+static GdkPixbuf *
+mx_image_pad_pixbuf (GdkPixbuf *pixbuf)
+{
+  GdkPixbuf *padded;
+  gint width, height;
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  padded = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width + 2, height + 2);
+  gdk_pixbuf_fill (padded, 0);
+  gdk_pixbuf_copy_area (pixbuf, 0, 0, width, height, padded, 1, 1);
+
+  return padded;
+}
+
+/*
+ * mx_image_pixbuf_add_levels:
+ * @pixbuf: A padded #GdkPixbuf
+ *
+ * Builds reduced levels of @pixbuf, each half the size of the previous one,
+ * and attaches them to it. The whole pixbuf, border included, is scaled, so
+ * that the same texture co-ordinates can be used for every level. This is
+ * done in the loading thread for asynchronous loads.
+ */
+static void
+mx_image_pixbuf_add_levels (GdkPixbuf *pixbuf)
+{
+  GdkPixbuf *level = pixbuf;
+  GPtrArray *levels;
+  gint width, height;
+
+  levels = g_ptr_array_new_with_free_func (g_object_unref);
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  while (width / 2 >= MX_IMAGE_MIN_LEVEL_SIZE &&
+         height / 2 >= MX_IMAGE_MIN_LEVEL_SIZE)
+    {
+      width /= 2;
+      height /= 2;
+
+      level = gdk_pixbuf_scale_simple (level, width, height,
+                                       GDK_INTERP_BILINEAR);
+      g_ptr_array_add (levels, level);
+    }
+
+  if (levels->len)
+    g_object_set_qdata_full (G_OBJECT (pixbuf), mx_image_levels_quark,
+                             levels, (GDestroyNotify) g_ptr_array_unref);
+  else
+    g_ptr_array_unref (levels);
+}
+
+/* Uploads the reduced levels attached to @pixbuf and attaches them to
+ * @texture */
+static void
+mx_image_texture_set_levels (CoglHandle  texture,
+                             GdkPixbuf  *pixbuf)
+{
+  GPtrArray *levels, *textures;
+  guint i;
+
+  levels = g_object_get_qdata (G_OBJECT (pixbuf), mx_image_levels_quark);
+  if (!levels)
+    return;
+
+  textures = g_ptr_array_new_with_free_func (cogl_handle_unref);
+
+  for (i = 0; i < levels->len; i++)
+    {
+      GdkPixbuf *level = g_ptr_array_index (levels, i);
+      CoglHandle level_texture;
+
+      level_texture =
+        cogl_texture_new_from_data (gdk_pixbuf_get_width (level),
+                                    gdk_pixbuf_get_height (level),
+                                    COGL_TEXTURE_NO_ATLAS,
+                                    COGL_PIXEL_FORMAT_RGBA_8888,
+                                    COGL_PIXEL_FORMAT_ANY,
+                                    gdk_pixbuf_get_rowstride (level),
+                                    gdk_pixbuf_get_pixels (level));
+      if (!level_texture)
+        break;
+
+      g_ptr_array_add (textures, level_texture);
+    }
+
+  _mx_texture_cache_set_levels (texture, textures);
+}
+
 /*
  * mx_image_pixbuf_new:
  * @filename: A local file path, or %NULL
@@ -1406,11 +2067,19 @@ mx_image_size_prepared_cb (GdkPixbufLoader *loader,
  * @height_threshold: The delta allowed before actually scaling the height
  * @upscale: %TRUE if the image should be allowed to scale upwards,
  *   %FALSE otherwise
+ * @unscaled_cached: %TRUE if the unscaled image is in the texture cache
+ * @stop: A flag that is set atomically to stop loading, or %NULL
+ * @cached: Return location for whether loading was stopped because the
+ *   image doesn't need scaling and is in the cache, or %NULL
  * @error: A pointer to a #GError
  *
- * Loads and scales a #GdkPixbuf using the given filename or data.
+ * Loads and scales a #GdkPixbuf using the given filename or data. Files are
+ * mapped and fed to the loader in chunks, so that loading can stop as soon
+ * as the size of the image is known, if it is in the cache already, or as
+ * soon as @stop is set.
  *
- * Returns: A new #GdkPixbuf, or %NULL on failure (@error will be set)
+ * Returns: A new #GdkPixbuf, or %NULL on failure (@error will be set) or
+ *   if @cached was set to %TRUE
  */
 static GdkPixbuf *
 mx_image_pixbuf_new (const gchar  *filename,
@@ -1421,12 +2090,16 @@ mx_image_pixbuf_new (const gchar  *filename,
                      guint         width_threshold,
                      guint         height_threshold,
                      gboolean      upscale,
-                     gboolean     *scaled,
+                     gboolean      unscaled_cached,
+                     volatile gint *stop,
+                     gboolean     *cached,
                      GError      **error)
 {
   GdkPixbuf *pixbuf;
   GdkPixbufLoader *loader;
   MxImageSizeRequest constraints;
+  GMappedFile *mapped = NULL;
+  gsize offset;
 
   GError *err = NULL;
 
@@ -1437,6 +2110,12 @@ mx_image_pixbuf_new (const gchar  *filename,
   constraints.width_threshold = width_threshold;
   constraints.height_threshold = height_threshold;
   constraints.upscale = upscale;
+  constraints.scaled = FALSE;
+  constraints.unscaled_cached = unscaled_cached;
+  constraints.cached = FALSE;
+
+  if (cached)
+    *cached = FALSE;
 
   g_signal_connect (loader, "size-prepared",
                     G_CALLBACK (mx_image_size_prepared_cb),
@@ -1444,7 +2123,8 @@ mx_image_pixbuf_new (const gchar  *filename,
 
   if (filename)
     {
-      if (!g_file_get_contents (filename, (gchar **)&buffer, &count, &err))
+      mapped = g_mapped_file_new (filename, FALSE, &err);
+      if (!mapped)
         {
           if (error)
             g_propagate_error (error, err);
@@ -1453,7 +2133,11 @@ mx_image_pixbuf_new (const gchar  *filename,
           return NULL;
         }
 
-      g_object_weak_ref (G_OBJECT (loader), (GWeakNotify)g_free, buffer);
+      buffer = (guchar *) g_mapped_file_get_contents (mapped);
+      count = g_mapped_file_get_length (mapped);
+
+      g_object_weak_ref (G_OBJECT (loader),
+                         (GWeakNotify) g_mapped_file_unref, mapped);
     }
 
   if (!buffer)
@@ -1463,13 +2147,40 @@ mx_image_pixbuf_new (const gchar  *filename,
       return NULL;
     }
 
-  if (!gdk_pixbuf_loader_write (loader, buffer, count, &err))
+  for (offset = 0; offset < count; offset += MX_IMAGE_LOAD_CHUNK_SIZE)
     {
-      if (error)
-        g_propagate_error (error, err);
-      gdk_pixbuf_loader_close (loader, NULL);
-      g_object_unref (loader);
-      return NULL;
+      if (stop && g_atomic_int_get (stop))
+        {
+          g_set_error (error, MX_IMAGE_ERROR, MX_IMAGE_ERROR_INTERNAL,
+                       "Image loading was cancelled");
+          gdk_pixbuf_loader_close (loader, NULL);
+          g_object_unref (loader);
+          return NULL;
+        }
+
+      if (!gdk_pixbuf_loader_write (loader, buffer + offset,
+                                    MIN (MX_IMAGE_LOAD_CHUNK_SIZE,
+                                         count - offset),
+                                    &err))
+        {
+          if (error)
+            g_propagate_error (error, err);
+          gdk_pixbuf_loader_close (loader, NULL);
+          g_object_unref (loader);
+          return NULL;
+        }
+
+      if (constraints.cached)
+        {
+          /* Stop loading, the caller will use the cached image */
+          gdk_pixbuf_loader_close (loader, NULL);
+          g_object_unref (loader);
+
+          if (cached)
+            *cached = TRUE;
+
+          return NULL;
+        }
     }
 
   /* Note, closing the pixbuf loader will make sure that size-prepared
@@ -1483,33 +2194,66 @@ mx_image_pixbuf_new (const gchar  *filename,
       return NULL;
     }
 
-  pixbuf = g_object_ref (gdk_pixbuf_loader_get_pixbuf (loader));
+  pixbuf = mx_image_pad_pixbuf (gdk_pixbuf_loader_get_pixbuf (loader));
 
   g_object_unref (loader);
 
-  if (scaled)
-    *scaled = constraints.scaled;
-
   return pixbuf;
 }
 
+static gint
+mx_image_queue_compare (gconstpointer a,
+                        gconstpointer b,
+                        gpointer      user_data)
+{
+  const MxImageAsyncData *data_a = a;
+  const MxImageAsyncData *data_b = b;
+
+  if (data_a->priority != data_b->priority)
+    return (data_a->priority < data_b->priority) ? -1 : 1;
+
+  /* images that are mapped, and so likely to be visible, come first */
+  if (data_a->mapped != data_b->mapped)
+    return data_a->mapped ? -1 : 1;
+
+  /* loads of the same priority are started in the order they were queued */
+  return (data_a->serial < data_b->serial) ? -1 : 1;
+}
+
 static void
 mx_image_async_cb (gpointer task_data,
                    gpointer user_data)
 {
-  gboolean scaled;
-  MxImageAsyncData *data = task_data;
+  MxImageAsyncData *data;
+  GSequenceIter *iter;
+
+  /* task_data is only a token; take the most urgent queued load */
+  G_LOCK (mx_image_queue);
+
+  iter = g_sequence_get_begin_iter (mx_image_queue);
+  if (g_sequence_iter_is_end (iter))
+    {
+      /* the load this token was pushed for has been cancelled */
+      G_UNLOCK (mx_image_queue);
+      return;
+    }
+
+  data = g_sequence_get (iter);
+  g_sequence_remove (iter);
+  data->queue_iter = NULL;
 
+  /* Take the mutex before releasing the queue, so that the load can't be
+   * freed in between */
   g_mutex_lock (data->mutex);
 
+  G_UNLOCK (mx_image_queue);
+
   /* Check if the task has been cancelled and bail out - leave to the main
    * thread to free the data.
    */
   if (data->cancelled)
     {
-      data->idle_handler =
-        clutter_threads_add_idle_full (G_PRIORITY_HIGH_IDLE,
-                                       mx_image_load_complete_cb, data, NULL);
+      mx_image_uploads_push (data);
       g_mutex_unlock (data->mutex);
 
       return;
@@ -1520,20 +2264,14 @@ mx_image_async_cb (gpointer task_data,
                                       data->count, data->width, data->height,
                                       data->width_threshold,
                                       data->height_threshold, data->upscale,
-                                      &scaled,
-                                      &data->error);
+                                      data->unscaled_cached, &data->stop,
+                                      &data->cached, &data->error);
 
-  /* If scaling was unnecessary, we can cache the result */
-  if (!scaled)
-    {
-      data->width = -1;
-      data->height = -1;
-    }
+  if (data->pixbuf && data->mipmaps)
+    mx_image_pixbuf_add_levels (data->pixbuf);
 
   data->complete = TRUE;
-  data->idle_handler =
-    clutter_threads_add_idle_full (G_PRIORITY_HIGH_IDLE,
-                                   mx_image_load_complete_cb, data, NULL);
+  mx_image_uploads_push (data);
 
   g_mutex_unlock (data->mutex);
 }
@@ -1593,53 +2331,22 @@ mx_image_set_async (MxImage         *image,
     }
 
   /* Cancel/free any in-progress load */
-  if (priv->async_load_data)
-    {
-      MxImageAsyncData *old_data = priv->async_load_data;
-
-      if (!g_mutex_trylock (old_data->mutex))
-        {
-          /* The thread is busy, cancel it and start a new one */
-          old_data->cancelled = TRUE;
-        }
-      else
-        {
-          if (old_data->complete)
-            {
-              /* The load finished, cancel the upload */
-              old_data->cancelled = TRUE;
-              g_mutex_unlock (old_data->mutex);
-            }
-          else
-            {
-              /* The load hasn't begun, we'll hijack it */
-              g_free (old_data->filename);
-              old_data->filename = g_strdup (filename);
-              old_data->buffer = buffer;
-              old_data->count = count;
-              old_data->free_func = free_func;
-              old_data->width = width;
-              old_data->height = height;
-              old_data->cancelled = FALSE;
-              g_mutex_unlock (old_data->mutex);
-
-              data = old_data;
-            }
-        }
-    }
+  mx_image_cancel_in_progress (image);
 
-  if (!data)
-    {
-      /* Create the async load data and add it to the thread-pool */
-      priv->async_load_data = data = mx_image_async_data_new (image);
-      data->filename = g_strdup (filename);
-      data->buffer = buffer;
-      data->count = count;
-      data->free_func = free_func;
-      data->width = width;
-      data->height = height;
-      g_thread_pool_push (mx_image_threads, data, NULL);
-    }
+  /* Create the async load data and add it to the queue */
+  priv->async_load_data = data = mx_image_async_data_new (image);
+  data->filename = g_strdup (filename);
+  data->buffer = buffer;
+  data->count = count;
+  data->free_func = free_func;
+  data->width = width;
+  data->height = height;
+  data->cache_ident = filename ?
+    mx_image_get_cache_ident (image, width, height) : NULL;
+  data->unscaled_cached = filename ?
+    mx_image_unscaled_cached (filename, width, height) : FALSE;
+
+  mx_image_queue_load (data);
 
   return TRUE;
 }
@@ -1677,6 +2384,10 @@ mx_image_set_from_file (MxImage      *image,
  * In case of failure, #FALSE is returned and @error is set. The aspect ratio
  * will always be maintained.
  *
+ * The scaled image is kept in the #MxTextureCache, so loading the same file
+ * again at the same size, with the same scaling thresholds and
+ * #MxImage:allow-upscale setting, does not decode it again.
+ *
  * Returns: #TRUE if the image was successfully updated
  *
  * Since: 1.2
@@ -1691,7 +2402,8 @@ mx_image_set_from_file_at_size (MxImage      *image,
   GdkPixbuf *pixbuf;
   MxImagePrivate *priv;
   MxTextureCache *cache;
-  gboolean retval, use_cache;
+  gpointer cache_ident;
+  gboolean retval, cached;
 
   if (G_UNLIKELY (!MX_IS_IMAGE (image)))
     {
@@ -1705,15 +2417,14 @@ mx_image_set_from_file_at_size (MxImage      *image,
   priv = image->priv;
   pixbuf = NULL;
 
-  /* Check if the processed image is in the cache - we don't use the cache
-   * if we're loading at a particular size.
+  /* Check if the processed image is in the cache. Images loaded at a
+   * particular size are cached separately for each size and set of
+   * scaling parameters.
    */
   cache = mx_texture_cache_get_default ();
-  use_cache = TRUE;
+  cache_ident = mx_image_get_cache_ident (image, width, height);
 
-  if ((width != -1) || (height != -1) ||
-      !mx_texture_cache_contains_meta (cache, filename,
-                                       GINT_TO_POINTER (mx_image_cache_quark)))
+  if (!mx_texture_cache_contains_meta (cache, filename, cache_ident))
     {
       /* Check if the unprocessed image is in the cache, and if so, skip
        * loading it and set it from the Cogl texture handle.
@@ -1725,9 +2436,8 @@ mx_image_set_from_file_at_size (MxImage      *image,
               mx_texture_cache_get_cogl_texture (cache, filename)))
             {
               /* Add the processed image to the cache */
-              mx_texture_cache_insert_meta (cache, filename,
-                                        GINT_TO_POINTER (mx_image_cache_quark),
-                                        priv->texture, NULL);
+              mx_texture_cache_insert_meta (cache, filename, cache_ident,
+                                            priv->texture, NULL);
               return TRUE;
             }
           else
@@ -1742,20 +2452,40 @@ mx_image_set_from_file_at_size (MxImage      *image,
 
       /* Load the pixbuf in a thread, then later on upload it to the GPU */
       if (priv->load_async)
-        return mx_image_set_async (image, filename, NULL, 0, NULL,
-                                   width, height, error);
+        {
+          mx_image_cache_ident_unref (cache_ident);
+          return mx_image_set_async (image, filename, NULL, 0, NULL,
+                                     width, height, error);
+        }
 
-      /* Synchronously load the pixbuf and set it */
+      /* Synchronously load the pixbuf and set it. If it turns out not to
+       * need scaling, the unscaled image may be in the cache already.
+       */
       pixbuf = mx_image_pixbuf_new (filename, NULL, 0, width, height,
                                     priv->width_threshold,
                                     priv->height_threshold,
-                                    priv->upscale, &use_cache, error);
-      if (!pixbuf)
-        return FALSE;
+                                    priv->upscale,
+                                    mx_image_unscaled_cached (filename,
+                                                              width, height),
+                                    NULL, &cached, error);
+      if (cached)
+        {
+          mx_image_cache_ident_unref (cache_ident);
+          cache_ident = GUINT_TO_POINTER (mx_image_cache_quark);
+        }
+      else if (!pixbuf)
+        {
+          mx_image_cache_ident_unref (cache_ident);
+          return FALSE;
+        }
+      else if (priv->use_mipmaps)
+        mx_image_pixbuf_add_levels (pixbuf);
     }
 
-  retval = mx_image_set_from_pixbuf (image, pixbuf,
-                                     use_cache ? filename : NULL, error);
+  retval = mx_image_set_from_pixbuf (image, pixbuf, filename, cache_ident,
+                                     error);
+
+  mx_image_cache_ident_unref (cache_ident);
 
   if (pixbuf)
     g_object_unref (pixbuf);
@@ -1947,11 +2677,14 @@ mx_image_set_from_buffer_at_size (MxImage         *image,
 
   pixbuf = mx_image_pixbuf_new (NULL, buffer, buffer_size, width, height,
                                 priv->width_threshold, priv->height_threshold,
-                                priv->upscale, NULL, error);
+                                priv->upscale, FALSE, NULL, NULL, error);
   if (!pixbuf)
     return FALSE;
 
-  retval = mx_image_set_from_pixbuf (image, pixbuf, NULL, error);
+  if (priv->use_mipmaps)
+    mx_image_pixbuf_add_levels (pixbuf);
+
+  retval = mx_image_set_from_pixbuf (image, pixbuf, NULL, 0, error);
 
   g_object_unref (pixbuf);
 
@@ -1991,11 +2724,8 @@ mx_image_set_load_async (MxImage  *image,
       g_object_notify (G_OBJECT (image), "load-async");
 
       /* Cancel the old transfer if we're turning async off */
-      if (!load_async && priv->async_load_data)
-        {
-          priv->async_load_data->cancelled = TRUE;
-          priv->async_load_data = NULL;
-        }
+      if (!load_async)
+        mx_image_cancel_in_progress (image);
     }
 }
 
@@ -2225,6 +2955,182 @@ mx_image_set_transition_duration (MxImage *image, guint duration)
     }
 }
 
+/**
+ * mx_image_set_load_priority:
+ * @image: A #MxImage
+ * @priority: The priority of asynchronous loads
+ *
+ * Sets the priority of asynchronous loads of @image. Loads with lower
+ * values are started first. For example, images that are on screen can use
+ * %G_PRIORITY_HIGH and images that are only being prefetched
+ * %G_PRIORITY_LOW. Among loads of the same priority, those of images that
+ * are mapped are started first. If a load of @image is waiting for a
+ * thread, it is moved in the queue accordingly.
+ *
+ * Since: 1.6
+ */
+void
+mx_image_set_load_priority (MxImage *image,
+                            gint     priority)
+{
+  MxImagePrivate *priv;
+
+  g_return_if_fail (MX_IS_IMAGE (image));
+
+  priv = image->priv;
+
+  if (priv->load_priority == priority)
+    return;
+
+  priv->load_priority = priority;
+  mx_image_update_queued_load (image);
+
+  g_object_notify (G_OBJECT (image), "load-priority");
+}
+
+/**
+ * mx_image_get_load_priority:
+ * @image: A #MxImage
+ *
+ * Gets the value of the #MxImage:load-priority property.
+ *
+ * Returns: The priority of asynchronous loads of @image
+ *
+ * Since: 1.6
+ */
+gint
+mx_image_get_load_priority (MxImage *image)
+{
+  g_return_val_if_fail (MX_IS_IMAGE (image), G_PRIORITY_DEFAULT);
+
+  return image->priv->load_priority;
+}
+
+/**
+ * mx_image_get_load_queue_depth:
+ *
+ * Gets the number of asynchronous image loads, from all #MxImage<!-- -->s,
+ * that are waiting for a thread. Loads that have already started are not
+ * counted.
+ *
+ * Returns: The number of queued loads
+ *
+ * Since: 1.6
+ */
+guint
+mx_image_get_load_queue_depth (void)
+{
+  guint depth;
+
+  G_LOCK (mx_image_queue);
+  depth = mx_image_queue ? g_sequence_get_length (mx_image_queue) : 0;
+  G_UNLOCK (mx_image_queue);
+
+  return depth;
+}
+
+/**
+ * mx_image_set_upload_time_slice:
+ * @msecs: A time, in milliseconds
+ *
+ * Sets the amount of time spent uploading asynchronously loaded images to
+ * the GPU before yielding, so that a frame can be drawn. Images that are
+ * mapped are uploaded first. This applies to all #MxImage<!-- -->s.
+ *
+ * Lower times will lead to smoother animations, but images will take
+ * longer to appear.
+ *
+ * Since: 1.6
+ */
+void
+mx_image_set_upload_time_slice (guint msecs)
+{
+  mx_image_upload_time_slice = msecs;
+}
+
+/**
+ * mx_image_get_upload_time_slice:
+ *
+ * Gets the time spent uploading images before yielding, as set with
+ * mx_image_set_upload_time_slice().
+ *
+ * Returns: A time, in milliseconds
+ *
+ * Since: 1.6
+ */
+guint
+mx_image_get_upload_time_slice (void)
+{
+  return mx_image_upload_time_slice;
+}
+
+/**
+ * mx_image_get_upload_overruns:
+ *
+ * Gets the number of times uploading images took longer than the upload
+ * time slice. This happens when a single upload takes longer than what is
+ * left of the time slice. Setting the MX_DEBUG environment variable to
+ * "image" also logs each overrun.
+ *
+ * Returns: The number of overruns
+ *
+ * Since: 1.6
+ */
+guint
+mx_image_get_upload_overruns (void)
+{
+  return mx_image_upload_overruns;
+}
+
+/**
+ * mx_image_set_use_mipmaps:
+ * @image: A #MxImage
+ * @use_mipmaps: %TRUE to build reduced levels of loaded images
+ *
+ * Sets whether reduced levels of images are built as they are loaded from
+ * files or buffers, so that images painted scaled down can be drawn from a
+ * smaller texture. The levels are built in the loading thread when
+ * asynchronous loading is enabled. They are kept with the texture, so
+ * images set from the #MxTextureCache have levels only if they were built
+ * when the image was first loaded. This takes effect from the next load.
+ *
+ * Since: 1.6
+ */
+void
+mx_image_set_use_mipmaps (MxImage  *image,
+                          gboolean  use_mipmaps)
+{
+  MxImagePrivate *priv;
+
+  g_return_if_fail (MX_IS_IMAGE (image));
+
+  priv = image->priv;
+
+  if (priv->use_mipmaps != use_mipmaps)
+    {
+      priv->use_mipmaps = use_mipmaps;
+      g_object_notify (G_OBJECT (image), "use-mipmaps");
+    }
+}
+
+/**
+ * mx_image_get_use_mipmaps:
+ * @image: A #MxImage
+ *
+ * Gets the value of the #MxImage:use-mipmaps property.
+ *
+ * Returns: %TRUE if reduced levels of loaded images are built
+ *
+ * Since: 1.6
+ */
+gboolean
+mx_image_get_use_mipmaps (MxImage *image)
+{
+  g_return_val_if_fail (MX_IS_IMAGE (image), FALSE);
+
+  return image->priv->use_mipmaps;
+}
+
 /**
  * mx_image_get_transition_duration:
  * @image: A #MxImage
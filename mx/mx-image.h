@@ -95,6 +95,14 @@ gboolean mx_image_set_from_data (MxImage          *image,
                                  gint              rowstride,
                                  GError          **error);
 
+gboolean mx_image_set_from_padded_data (MxImage          *image,
+                                        const guchar     *data,
+                                        CoglPixelFormat   pixel_format,
+                                        gint              width,
+                                        gint              height,
+                                        gint              rowstride,
+                                        GError          **error);
+
 gboolean mx_image_set_from_file (MxImage      *image,
                                  const gchar  *filename,
                                  GError      **error);
@@ -150,6 +158,20 @@ void     mx_image_set_transition_duration (MxImage *image,
                                            guint    duration);
 guint    mx_image_get_transition_duration (MxImage *image);
 
+void     mx_image_set_load_priority (MxImage *image,
+                                     gint     priority);
+gint     mx_image_get_load_priority (MxImage *image);
+
+void     mx_image_set_use_mipmaps (MxImage  *image,
+                                   gboolean  use_mipmaps);
+gboolean mx_image_get_use_mipmaps (MxImage  *image);
+
+guint    mx_image_get_load_queue_depth (void);
+
+void     mx_image_set_upload_time_slice (guint msecs);
+guint    mx_image_get_upload_time_slice (void);
+guint    mx_image_get_upload_overruns   (void);
+
 void     mx_image_animate_scale_mode (MxImage          *image,
                                       gulong            mode,
                                       guint             duration,
@@ -0,0 +1,1118 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * mx-item-pool.c: children of a model driven view
+ *
+ * Copyright 2011 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <string.h>
+
+#include "mx-item-pool.h"
+#include "mx-private.h"
+
+typedef struct
+{
+  gchar *name;
+  gint   col;
+} AttributeData;
+
+typedef enum
+{
+  ROW_ADDED,
+  ROW_CHANGED,
+  ROW_REMOVED
+} RowChangeType;
+
+/* a change to a single row of the model, kept while the view is frozen */
+typedef struct
+{
+  RowChangeType type;
+  gint          row;
+} RowChange;
+
+/* a child while replaying the changes made while the view was frozen */
+typedef struct
+{
+  ClutterActor *child;
+  gboolean      dirty;
+} RowSlot;
+
+/* the row an item is bound to, plus one, or 0 if it isn't bound */
+static GQuark row_quark = 0;
+
+static void mx_item_pool_model_changed_cb (ClutterModel *model,
+                                           MxItemPool   *pool);
+
+static ClutterActor *
+mx_item_pool_create_item (MxItemPool *pool)
+{
+  if (pool->item_type)
+    return g_object_new (pool->item_type, NULL);
+  else
+    return mx_item_factory_create (pool->factory);
+}
+
+static void
+mx_item_pool_bind_item (MxItemPool   *pool,
+                        ClutterActor *item,
+                        gint          row)
+{
+  ClutterModelIter *iter;
+  GSList *p;
+
+  iter = clutter_model_get_iter_at_row (pool->model, row);
+  if (!iter)
+    return;
+
+  g_object_freeze_notify (G_OBJECT (item));
+  for (p = pool->attributes; p; p = p->next)
+    {
+      GValue value = { 0, };
+      AttributeData *attr = p->data;
+
+      clutter_model_iter_get_value (iter, attr->col, &value);
+
+      g_object_set_property (G_OBJECT (item), attr->name, &value);
+
+      g_value_unset (&value);
+    }
+  g_object_thaw_notify (G_OBJECT (item));
+
+  g_object_unref (iter);
+
+  g_object_set_qdata (G_OBJECT (item), row_quark, GINT_TO_POINTER (row + 1));
+}
+
+/* virtualized mode */
+
+/* Takes a spare item, or creates one, and binds it to @row, which is one of
+ * the rows from @first to @last being realized. An item that is still bound
+ * to @row is preferred, so that it needn't be bound again, and items bound
+ * to the other rows being realized are kept for them. */
+static ClutterActor *
+mx_item_pool_acquire_item (MxItemPool *pool,
+                           gint        row,
+                           gint        first,
+                           gint        last)
+{
+  ClutterActor *item;
+  GList *l, *spare;
+  gint bound;
+
+  spare = NULL;
+  for (l = pool->spare; l; l = l->next)
+    {
+      bound = GPOINTER_TO_INT (g_object_get_qdata (l->data, row_quark)) - 1;
+
+      if (bound == row)
+        break;
+
+      if (!spare && (bound < first || bound >= last))
+        spare = l;
+    }
+
+  if (!l)
+    l = spare ? spare : pool->spare;
+
+  if (l)
+    {
+      item = l->data;
+      pool->spare = g_list_delete_link (pool->spare, l);
+      pool->n_spare--;
+    }
+  else
+    {
+      item = mx_item_pool_create_item (pool);
+      clutter_container_add_actor (CLUTTER_CONTAINER (pool->view), item);
+    }
+
+  if (GPOINTER_TO_INT (g_object_get_qdata (G_OBJECT (item), row_quark))
+      != row + 1)
+    mx_item_pool_bind_item (pool, item, row);
+
+  clutter_actor_show (item);
+
+  return item;
+}
+
+static void
+mx_item_pool_release_item (MxItemPool   *pool,
+                           ClutterActor *item)
+{
+  clutter_actor_hide (item);
+  pool->spare = g_list_prepend (pool->spare, item);
+  pool->n_spare++;
+}
+
+/* Releases all the items and forgets which rows they were bound to, for
+ * when the model or the way it is mapped has changed */
+static void
+mx_item_pool_reset_items (MxItemPool *pool)
+{
+  GList *l;
+  guint i;
+
+  for (i = 0; i < pool->items->len; i++)
+    mx_item_pool_release_item (pool, g_ptr_array_index (pool->items, i));
+  g_ptr_array_set_size (pool->items, 0);
+
+  for (l = pool->spare; l; l = l->next)
+    g_object_set_qdata (l->data, row_quark, NULL);
+
+  pool->first_row = 0;
+  pool->measure (pool->view, NULL);
+  pool->needs_measure = TRUE;
+}
+
+static void
+mx_item_pool_measure_items (MxItemPool *pool)
+{
+  ClutterActor *item;
+  gboolean changed;
+
+  pool->needs_measure = FALSE;
+
+  if (clutter_model_get_n_rows (pool->model) == 0)
+    return;
+
+  item = mx_item_pool_acquire_item (pool, 0, 0, 0);
+  changed = pool->measure (pool->view, item);
+
+  /* still bound to the first row, so reused without binding it again */
+  mx_item_pool_release_item (pool, item);
+
+  if (changed)
+    clutter_actor_queue_relayout (pool->view);
+}
+
+static void
+mx_item_pool_update_items (MxItemPool *pool)
+{
+  GPtrArray *items;
+  ClutterActor *item, *previous;
+  gint first, last, row, old_first, old_last;
+  guint i;
+
+  if (!pool->is_virtualized || pool->is_frozen)
+    return;
+
+  if (!pool->model || (!pool->item_type && !pool->factory))
+    {
+      mx_item_pool_reset_items (pool);
+      return;
+    }
+
+  if (pool->needs_measure)
+    mx_item_pool_measure_items (pool);
+
+  pool->get_range (pool->view, &first, &last);
+
+  old_first = pool->first_row;
+  old_last = pool->first_row + pool->items->len;
+
+  if (first != old_first || last != old_last)
+    {
+      /* release the items of the rows that are no longer visible first,
+       * so that they can be reused straight away */
+      for (i = 0; i < pool->items->len; i++)
+        {
+          row = old_first + i;
+          if (row < first || row >= last)
+            mx_item_pool_release_item (pool,
+                                       g_ptr_array_index (pool->items, i));
+        }
+
+      items = g_ptr_array_sized_new (last - first);
+      previous = NULL;
+      for (row = first; row < last; row++)
+        {
+          if (row >= old_first && row < old_last)
+            item = g_ptr_array_index (pool->items, row - old_first);
+          else
+            item = mx_item_pool_acquire_item (pool, row, first, last);
+
+          g_ptr_array_add (items, item);
+
+          /* keep the children in the order of the rows, for keyboard
+           * focus */
+          if (previous)
+            clutter_container_raise_child (CLUTTER_CONTAINER (pool->view),
+                                           item, previous);
+          else
+            clutter_container_lower_child (CLUTTER_CONTAINER (pool->view),
+                                           item, NULL);
+          previous = item;
+        }
+
+      g_ptr_array_free (pool->items, TRUE);
+      pool->items = items;
+      pool->first_row = first;
+    }
+
+  /* don't keep more spare items around than there are items in use */
+  while (pool->n_spare > pool->items->len)
+    {
+      item = pool->spare->data;
+      pool->spare = g_list_delete_link (pool->spare, pool->spare);
+      pool->n_spare--;
+      clutter_container_remove_actor (CLUTTER_CONTAINER (pool->view), item);
+    }
+}
+
+static gboolean
+mx_item_pool_update_idle_cb (gpointer data)
+{
+  MxItemPool *pool = data;
+
+  pool->update_idle = 0;
+  mx_item_pool_update_items (pool);
+
+  return FALSE;
+}
+
+/* Updates the items before the next frame is laid out */
+static void
+mx_item_pool_add_update_idle (MxItemPool *pool)
+{
+  if (!pool->update_idle)
+    pool->update_idle =
+      clutter_threads_add_idle_full (G_PRIORITY_HIGH_IDLE,
+                                     mx_item_pool_update_idle_cb,
+                                     pool, NULL);
+}
+
+/*
+ * _mx_item_pool_queue_update:
+ * @pool: an #MxItemPool
+ *
+ * Binds items to the rows that have become visible, straight away if
+ * possible.
+ */
+void
+_mx_item_pool_queue_update (MxItemPool *pool)
+{
+  /* children can't be added or shown while allocating, so the items are
+   * updated before the next frame is laid out instead; the same goes for
+   * when the rows of the items are being updated */
+  if (pool->in_allocation || pool->update_idle)
+    mx_item_pool_add_update_idle (pool);
+  else
+    mx_item_pool_update_items (pool);
+}
+
+/*
+ * _mx_item_pool_queue_measure:
+ * @pool: an #MxItemPool
+ *
+ * Measures the items again, and updates them for their new size, before
+ * the next frame is laid out. This is deferred, as when the style of the
+ * view changes, the items are only restyled after it.
+ */
+void
+_mx_item_pool_queue_measure (MxItemPool *pool)
+{
+  if (!pool->is_virtualized)
+    return;
+
+  pool->needs_measure = TRUE;
+  mx_item_pool_add_update_idle (pool);
+}
+
+/* Updates the row an item is bound to for a row being added or removed
+ * before it, and forgets it if its own row is removed or changed */
+static void
+mx_item_pool_shift_item (ClutterActor    *item,
+                         const RowChange *change)
+{
+  gint bound;
+
+  bound = GPOINTER_TO_INT (g_object_get_qdata (G_OBJECT (item),
+                                               row_quark)) - 1;
+  if (bound < 0)
+    return;
+
+  switch (change->type)
+    {
+    case ROW_ADDED:
+      if (bound >= change->row)
+        bound++;
+      break;
+
+    case ROW_CHANGED:
+      if (bound == change->row)
+        bound = -1;
+      break;
+
+    case ROW_REMOVED:
+      if (bound == change->row)
+        bound = -1;
+      else if (bound > change->row)
+        bound--;
+      break;
+    }
+
+  g_object_set_qdata (G_OBJECT (item), row_quark, GINT_TO_POINTER (bound + 1));
+}
+
+static void
+mx_item_pool_shift_items (MxItemPool      *pool,
+                          const RowChange *change)
+{
+  GList *l;
+  guint i;
+
+  for (i = 0; i < pool->items->len; i++)
+    mx_item_pool_shift_item (g_ptr_array_index (pool->items, i), change);
+
+  for (l = pool->spare; l; l = l->next)
+    mx_item_pool_shift_item (l->data, change);
+}
+
+/* Releases the items, which keep the rows they are bound to, so that the
+ * visible rows are realized again with the items of the same rows, once
+ * the model has finished changing */
+static void
+mx_item_pool_queue_rebind (MxItemPool *pool)
+{
+  guint i;
+
+  for (i = 0; i < pool->items->len; i++)
+    mx_item_pool_release_item (pool, g_ptr_array_index (pool->items, i));
+  g_ptr_array_set_size (pool->items, 0);
+  pool->first_row = 0;
+
+  /* the first row may have changed */
+  pool->needs_measure = TRUE;
+  mx_item_pool_add_update_idle (pool);
+
+  /* the number of rows may have changed */
+  clutter_actor_queue_relayout (pool->view);
+}
+
+static void
+mx_item_pool_adjustment_value_notify_cb (MxAdjustment *adjustment,
+                                         GParamSpec   *pspec,
+                                         MxItemPool   *pool)
+{
+  if (pool->is_virtualized)
+    _mx_item_pool_queue_update (pool);
+}
+
+static gboolean
+mx_item_pool_track_adjustment (MxItemPool    *pool,
+                               MxAdjustment **adjustment_p,
+                               MxAdjustment  *adjustment)
+{
+  if (*adjustment_p == adjustment)
+    return FALSE;
+
+  if (*adjustment_p)
+    {
+      g_signal_handlers_disconnect_matched (*adjustment_p,
+                                            G_SIGNAL_MATCH_DATA,
+                                            0, 0, NULL, NULL, pool);
+      g_object_unref (*adjustment_p);
+    }
+
+  *adjustment_p = adjustment;
+
+  if (adjustment)
+    {
+      g_object_ref (adjustment);
+      g_signal_connect (adjustment, "notify::value",
+                        G_CALLBACK (mx_item_pool_adjustment_value_notify_cb),
+                        pool);
+    }
+
+  return TRUE;
+}
+
+/*
+ * _mx_item_pool_set_adjustments:
+ * @pool: an #MxItemPool
+ * @hadjustment: (allow-none): the horizontal adjustment of the view
+ * @vadjustment: (allow-none): the vertical adjustment of the view
+ *
+ * Tracks the adjustments the view scrolls with, as the visible rows depend
+ * on their values. The views keep their adjustments to themselves, so they
+ * pass them on as they are set or created.
+ */
+void
+_mx_item_pool_set_adjustments (MxItemPool   *pool,
+                               MxAdjustment *hadjustment,
+                               MxAdjustment *vadjustment)
+{
+  gboolean changed;
+
+  changed = mx_item_pool_track_adjustment (pool, &pool->hadjustment,
+                                           hadjustment);
+  changed |= mx_item_pool_track_adjustment (pool, &pool->vadjustment,
+                                            vadjustment);
+
+  if (changed && pool->is_virtualized)
+    _mx_item_pool_queue_update (pool);
+}
+
+/* model monitors */
+
+static void
+mx_item_pool_model_changed_cb (ClutterModel *model,
+                               MxItemPool   *pool)
+{
+  GSList *p;
+  GList *l, *children;
+  ClutterModelIter *iter = NULL;
+  gint model_n = 0, child_n = 0;
+
+
+  /* bail out if we don't yet have an item type or a factory */
+  if (!pool->item_type && !pool->factory)
+    return;
+
+  if (pool->is_frozen)
+    {
+      /* rebuild everything when thawed rather than replaying changes */
+      pool->needs_rebuild = TRUE;
+      g_array_set_size (pool->changes, 0);
+      return;
+    }
+
+  pool->needs_rebuild = FALSE;
+  g_array_set_size (pool->changes, 0);
+
+  if (pool->item_type)
+    {
+      /* check the item-type is an descendant of ClutterActor */
+      if (!g_type_is_a (pool->item_type, CLUTTER_TYPE_ACTOR))
+        {
+          g_warning ("%s is not a subclass of ClutterActor and therefore"
+                     " cannot be used as items in an %s",
+                     g_type_name (pool->item_type),
+                     G_OBJECT_TYPE_NAME (pool->view));
+          return;
+        }
+    }
+
+  if (pool->is_virtualized)
+    {
+      mx_item_pool_reset_items (pool);
+      mx_item_pool_update_items (pool);
+      clutter_actor_queue_relayout (pool->view);
+      return;
+    }
+
+  children = clutter_container_get_children (CLUTTER_CONTAINER (pool->view));
+  child_n = g_list_length (children);
+
+  if (model)
+    model_n = clutter_model_get_n_rows (pool->model);
+  else
+    model_n = 0;
+
+  /* add children as needed */
+  while (model_n > child_n)
+    {
+      ClutterActor *new_child;
+
+      new_child = mx_item_pool_create_item (pool);
+
+      clutter_container_add_actor (CLUTTER_CONTAINER (pool->view),
+                                   new_child);
+      child_n++;
+    }
+
+  /* remove children as needed */
+  l = g_list_last (children);
+  while (child_n > model_n)
+    {
+      clutter_container_remove_actor (CLUTTER_CONTAINER (pool->view),
+                                      (ClutterActor*) l->data);
+      l = g_list_previous (l);
+      child_n--;
+    }
+
+  g_list_free (children);
+
+  /* the children are in the order of the rows */
+  children = clutter_container_get_children (CLUTTER_CONTAINER (pool->view));
+  g_ptr_array_set_size (pool->items, 0);
+  for (l = children; l; l = l->next)
+    g_ptr_array_add (pool->items, l->data);
+
+  if (!pool->model)
+    {
+      g_list_free (children);
+      return;
+    }
+
+  /* set the properties on the children */
+  iter = clutter_model_get_first_iter (pool->model);
+  l = children;
+  while (iter && !clutter_model_iter_is_last (iter))
+    {
+      GObject *child;
+
+      child = G_OBJECT (l->data);
+
+      g_object_freeze_notify (child);
+      for (p = pool->attributes; p; p = p->next)
+        {
+          GValue value = { 0, };
+          AttributeData *attr = p->data;
+
+          clutter_model_iter_get_value (iter, attr->col, &value);
+
+          g_object_set_property (child, attr->name, &value);
+
+          g_value_unset (&value);
+        }
+      g_object_thaw_notify (child);
+
+      l = g_list_next (l);
+      clutter_model_iter_next (iter);
+    }
+
+  g_list_free (children);
+
+  if (iter)
+    g_object_unref (iter);
+}
+
+/* Inserts @item at @index_ of @items, moving the items after it along */
+static void
+mx_item_pool_insert_item_at (GPtrArray    *items,
+                             guint         index_,
+                             ClutterActor *item)
+{
+  g_ptr_array_add (items, NULL);
+  memmove (items->pdata + index_ + 1, items->pdata + index_,
+           (items->len - index_ - 1) * sizeof (gpointer));
+  g_ptr_array_index (items, index_) = item;
+}
+
+/* Inserts a child for a row added to the model and binds it */
+static void
+mx_item_pool_insert_child (MxItemPool *pool,
+                           gint        row)
+{
+  ClutterActor *child;
+  gint n_children;
+
+  n_children = pool->items->len;
+
+  if (n_children != (gint) clutter_model_get_n_rows (pool->model) - 1)
+    {
+      /* the children don't match the model, start again */
+      mx_item_pool_model_changed_cb (pool->model, pool);
+      return;
+    }
+
+  child = mx_item_pool_create_item (pool);
+  clutter_container_add_actor (CLUTTER_CONTAINER (pool->view), child);
+
+  /* children are added at the end */
+  if (row == 0 && n_children > 0)
+    clutter_container_lower_child (CLUTTER_CONTAINER (pool->view), child, NULL);
+  else if (row > 0 && row < n_children)
+    clutter_container_raise_child (CLUTTER_CONTAINER (pool->view), child,
+                                   g_ptr_array_index (pool->items, row - 1));
+
+  mx_item_pool_insert_item_at (pool->items, row, child);
+
+  mx_item_pool_bind_item (pool, child, row);
+}
+
+/* Applies the row changes made while the view was frozen, creating,
+ * removing and binding as few children as possible: the rows that were
+ * added and then removed are ignored, rows that were changed several times
+ * are only bound once, and the children of removed rows are reused for the
+ * rows that were added. */
+static void
+mx_item_pool_apply_changes (MxItemPool *pool)
+{
+  GList *removed, *l;
+  ClutterActor *previous;
+  GArray *slots;
+  guint i;
+
+  if (pool->is_virtualized)
+    {
+      for (i = 0; i < pool->changes->len; i++)
+        mx_item_pool_shift_items (pool,
+                                  &g_array_index (pool->changes, RowChange, i));
+      g_array_set_size (pool->changes, 0);
+
+      mx_item_pool_queue_rebind (pool);
+      return;
+    }
+
+  slots = g_array_sized_new (FALSE, FALSE, sizeof (RowSlot),
+                             pool->items->len);
+  for (i = 0; i < pool->items->len; i++)
+    {
+      RowSlot slot = { g_ptr_array_index (pool->items, i), FALSE };
+      g_array_append_val (slots, slot);
+    }
+
+  removed = NULL;
+  for (i = 0; i < pool->changes->len; i++)
+    {
+      RowChange *change = &g_array_index (pool->changes, RowChange, i);
+      RowSlot *slot;
+
+      if (change->row < 0 || change->row > (gint) slots->len ||
+          (change->type != ROW_ADDED && change->row == (gint) slots->len))
+        break;
+
+      switch (change->type)
+        {
+        case ROW_ADDED:
+          {
+            RowSlot new_slot = { NULL, TRUE };
+            g_array_insert_val (slots, change->row, new_slot);
+          }
+          break;
+
+        case ROW_CHANGED:
+          g_array_index (slots, RowSlot, change->row).dirty = TRUE;
+          break;
+
+        case ROW_REMOVED:
+          slot = &g_array_index (slots, RowSlot, change->row);
+          if (slot->child)
+            removed = g_list_prepend (removed, slot->child);
+          g_array_remove_index (slots, change->row);
+          break;
+        }
+    }
+
+  if (i < pool->changes->len ||
+      slots->len != clutter_model_get_n_rows (pool->model))
+    {
+      /* the children didn't match the model, start again */
+      g_array_free (slots, TRUE);
+      g_list_free (removed);
+      mx_item_pool_model_changed_cb (pool->model, pool);
+      return;
+    }
+
+  g_array_set_size (pool->changes, 0);
+  g_ptr_array_set_size (pool->items, slots->len);
+
+  previous = NULL;
+  for (i = 0; i < slots->len; i++)
+    {
+      RowSlot *slot = &g_array_index (slots, RowSlot, i);
+
+      if (!slot->child)
+        {
+          if (removed)
+            {
+              slot->child = removed->data;
+              removed = g_list_delete_link (removed, removed);
+            }
+          else
+            {
+              slot->child = mx_item_pool_create_item (pool);
+              clutter_container_add_actor (CLUTTER_CONTAINER (pool->view),
+                                           slot->child);
+            }
+
+          /* the other children are still in order */
+          if (previous)
+            clutter_container_raise_child (CLUTTER_CONTAINER (pool->view),
+                                           slot->child, previous);
+          else
+            clutter_container_lower_child (CLUTTER_CONTAINER (pool->view),
+                                           slot->child, NULL);
+        }
+
+      if (slot->dirty)
+        mx_item_pool_bind_item (pool, slot->child, i);
+
+      g_ptr_array_index (pool->items, i) = slot->child;
+      previous = slot->child;
+    }
+
+  for (l = removed; l; l = l->next)
+    clutter_container_remove_actor (CLUTTER_CONTAINER (pool->view), l->data);
+  g_list_free (removed);
+
+  g_array_free (slots, TRUE);
+}
+
+static void
+mx_item_pool_row_change (MxItemPool       *pool,
+                         RowChangeType     type,
+                         ClutterModelIter *iter)
+{
+  RowChange change;
+  ClutterActor *child;
+
+  /* nothing to update if we don't yet have an item type or a factory */
+  if (!pool->item_type && !pool->factory)
+    return;
+
+  /* When the model has a filter, a row that is added or changed may be
+   * filtered in or out of the view, and the row-added and row-changed
+   * signals don't say which, so the view is rebuilt instead. Removed rows
+   * were in the view, and are still removed individually.
+   */
+  if (type != ROW_REMOVED && clutter_model_get_filter_set (pool->model))
+    {
+      mx_item_pool_model_changed_cb (pool->model, pool);
+      return;
+    }
+
+  change.type = type;
+  change.row = clutter_model_iter_get_row (iter);
+
+  if (pool->is_frozen)
+    {
+      if (pool->needs_rebuild)
+        return;
+
+      g_array_append_val (pool->changes, change);
+
+      /* past a point, rebuilding is cheaper than replaying the changes */
+      if (pool->changes->len > clutter_model_get_n_rows (pool->model))
+        {
+          pool->needs_rebuild = TRUE;
+          g_array_set_size (pool->changes, 0);
+        }
+
+      return;
+    }
+
+  if (pool->is_virtualized)
+    {
+      /* rows are bound again once the model has finished changing, as a
+       * removed row is still in the model */
+      mx_item_pool_shift_items (pool, &change);
+      mx_item_pool_queue_rebind (pool);
+      return;
+    }
+
+  switch (type)
+    {
+    case ROW_ADDED:
+      mx_item_pool_insert_child (pool, change.row);
+      break;
+
+    case ROW_CHANGED:
+      child = (change.row < (gint) pool->items->len) ?
+        g_ptr_array_index (pool->items, change.row) : NULL;
+
+      if (child)
+        mx_item_pool_bind_item (pool, child, change.row);
+      else
+        mx_item_pool_model_changed_cb (pool->model, pool);
+      break;
+
+    case ROW_REMOVED:
+      if (change.row < (gint) pool->items->len)
+        {
+          child = g_ptr_array_index (pool->items, change.row);
+          g_ptr_array_remove_index (pool->items, change.row);
+          clutter_container_remove_actor (CLUTTER_CONTAINER (pool->view),
+                                          child);
+        }
+      break;
+    }
+}
+
+static void
+mx_item_pool_row_added_cb (ClutterModel     *model,
+                           ClutterModelIter *iter,
+                           MxItemPool       *pool)
+{
+  mx_item_pool_row_change (pool, ROW_ADDED, iter);
+}
+
+static void
+mx_item_pool_row_changed_cb (ClutterModel     *model,
+                             ClutterModelIter *iter,
+                             MxItemPool       *pool)
+{
+  mx_item_pool_row_change (pool, ROW_CHANGED, iter);
+}
+
+static void
+mx_item_pool_row_removed_cb (ClutterModel     *model,
+                             ClutterModelIter *iter,
+                             MxItemPool       *pool)
+{
+  mx_item_pool_row_change (pool, ROW_REMOVED, iter);
+}
+
+/*
+ * _mx_item_pool_init:
+ * @pool: an #MxItemPool
+ * @view: the view whose children the items are
+ * @measure: the function that measures the items
+ * @get_range: the function that computes the visible rows
+ *
+ * Initialises @pool, which is embedded in the private structure of @view.
+ */
+void
+_mx_item_pool_init (MxItemPool            *pool,
+                    ClutterActor          *view,
+                    MxItemPoolMeasureFunc  measure,
+                    MxItemPoolRangeFunc    get_range)
+{
+  if (!row_quark)
+    row_quark = g_quark_from_static_string ("mx-item-pool-row");
+
+  pool->view = view;
+  pool->measure = measure;
+  pool->get_range = get_range;
+
+  pool->items = g_ptr_array_new ();
+  pool->changes = g_array_new (FALSE, FALSE, sizeof (RowChange));
+  pool->needs_measure = TRUE;
+}
+
+/*
+ * _mx_item_pool_dispose:
+ * @pool: an #MxItemPool
+ *
+ * Drops the references @pool holds, from the dispose handler of the view.
+ */
+void
+_mx_item_pool_dispose (MxItemPool *pool)
+{
+  /* This will cause the unref of the model and also disconnect the signals */
+  _mx_item_pool_set_model (pool, NULL);
+
+  if (pool->factory)
+    {
+      g_object_unref (pool->factory);
+      pool->factory = NULL;
+    }
+
+  if (pool->update_idle)
+    {
+      g_source_remove (pool->update_idle);
+      pool->update_idle = 0;
+    }
+
+  /* the items are children, they are destroyed with the view */
+  g_ptr_array_set_size (pool->items, 0);
+  g_list_free (pool->spare);
+  pool->spare = NULL;
+  pool->n_spare = 0;
+
+  mx_item_pool_track_adjustment (pool, &pool->hadjustment, NULL);
+  mx_item_pool_track_adjustment (pool, &pool->vadjustment, NULL);
+}
+
+static void
+free_attribute (AttributeData *data)
+{
+  g_free (data->name);
+  g_free (data);
+}
+
+/*
+ * _mx_item_pool_finalize:
+ * @pool: an #MxItemPool
+ *
+ * Frees the memory used by @pool, from the finalize handler of the view.
+ */
+void
+_mx_item_pool_finalize (MxItemPool *pool)
+{
+  if (pool->attributes)
+    {
+      g_slist_foreach (pool->attributes, (GFunc) free_attribute, NULL);
+      g_slist_free (pool->attributes);
+      pool->attributes = NULL;
+    }
+
+  g_ptr_array_free (pool->items, TRUE);
+  g_array_free (pool->changes, TRUE);
+}
+
+/*
+ * _mx_item_pool_set_model:
+ * @pool: an #MxItemPool
+ * @model: (allow-none): a #ClutterModel
+ *
+ * Sets the model the items are created for. Setting the model to %NULL
+ * keeps the children of the view as they are.
+ */
+void
+_mx_item_pool_set_model (MxItemPool   *pool,
+                         ClutterModel *model)
+{
+  if (pool->model)
+    {
+      g_signal_handlers_disconnect_matched (pool->model, G_SIGNAL_MATCH_DATA,
+                                            0, 0, NULL, NULL, pool);
+      g_object_unref (pool->model);
+
+      pool->model = NULL;
+    }
+
+  if (model)
+    {
+      pool->model = g_object_ref (model);
+
+      g_signal_connect (pool->model, "filter-changed",
+                        G_CALLBACK (mx_item_pool_model_changed_cb), pool);
+
+      g_signal_connect (pool->model, "row-added",
+                        G_CALLBACK (mx_item_pool_row_added_cb), pool);
+
+      g_signal_connect (pool->model, "row-changed",
+                        G_CALLBACK (mx_item_pool_row_changed_cb), pool);
+
+      /*
+       * The row is still in the model when row-removed is emitted, it is
+       * only removed by index and rows are only bound again later on
+       */
+      g_signal_connect_after (pool->model, "row-removed",
+                              G_CALLBACK (mx_item_pool_row_removed_cb), pool);
+
+      g_signal_connect (pool->model, "sort-changed",
+                        G_CALLBACK (mx_item_pool_model_changed_cb), pool);
+
+      /*
+       * Only do this inside this block, setting the model to NULL should have
+       * the effect of preserving the view; just disconnect the handlers
+       */
+      mx_item_pool_model_changed_cb (pool->model, pool);
+    }
+}
+
+/*
+ * _mx_item_pool_set_item_type:
+ * @pool: an #MxItemPool
+ * @item_type: a subclass of #ClutterActor
+ *
+ * Sets the type of the items and creates the children again.
+ */
+void
+_mx_item_pool_set_item_type (MxItemPool *pool,
+                             GType       item_type)
+{
+  pool->item_type = item_type;
+
+  mx_item_pool_model_changed_cb (pool->model, pool);
+}
+
+/*
+ * _mx_item_pool_set_factory:
+ * @pool: an #MxItemPool
+ * @factory: (allow-none): an #MxItemFactory
+ *
+ * Sets the factory that creates the items when there is no item type. The
+ * existing children are kept.
+ */
+void
+_mx_item_pool_set_factory (MxItemPool    *pool,
+                           MxItemFactory *factory)
+{
+  if (pool->factory)
+    {
+      g_object_unref (pool->factory);
+      pool->factory = NULL;
+    }
+
+  if (factory)
+    pool->factory = g_object_ref (factory);
+}
+
+/*
+ * _mx_item_pool_add_attribute:
+ * @pool: an #MxItemPool
+ * @attribute: the name of a property of the items
+ * @column: a column of the model
+ *
+ * Maps @column of the model to the @attribute property of the items and
+ * binds the children again.
+ */
+void
+_mx_item_pool_add_attribute (MxItemPool  *pool,
+                             const gchar *attribute,
+                             gint         column)
+{
+  AttributeData *prop;
+
+  prop = g_new (AttributeData, 1);
+  prop->name = g_strdup (attribute);
+  prop->col = column;
+
+  pool->attributes = g_slist_prepend (pool->attributes, prop);
+  mx_item_pool_model_changed_cb (pool->model, pool);
+}
+
+/*
+ * _mx_item_pool_freeze:
+ * @pool: an #MxItemPool
+ *
+ * Keeps the changes to the model until _mx_item_pool_thaw() is called.
+ */
+void
+_mx_item_pool_freeze (MxItemPool *pool)
+{
+  pool->is_frozen = TRUE;
+}
+
+/*
+ * _mx_item_pool_thaw:
+ * @pool: an #MxItemPool
+ *
+ * Applies the changes made to the model since _mx_item_pool_freeze() was
+ * called, or rebuilds the children if there were too many of them.
+ */
+void
+_mx_item_pool_thaw (MxItemPool *pool)
+{
+  pool->is_frozen = FALSE;
+
+  /* Repopulate, or only update the rows that have changed */
+  if (pool->needs_rebuild)
+    mx_item_pool_model_changed_cb (pool->model, pool);
+  else if (pool->changes->len)
+    mx_item_pool_apply_changes (pool);
+}
+
+/*
+ * _mx_item_pool_set_virtualized:
+ * @pool: an #MxItemPool
+ * @virtualized: whether to only create items for the visible rows
+ *
+ * Destroys the children of the view and creates them again, for every row
+ * or for the visible rows only.
+ */
+void
+_mx_item_pool_set_virtualized (MxItemPool *pool,
+                               gboolean    virtualized)
+{
+  /* start again from no children, as they are managed differently */
+  g_ptr_array_set_size (pool->items, 0);
+  g_list_free (pool->spare);
+  pool->spare = NULL;
+  pool->n_spare = 0;
+  clutter_container_foreach (CLUTTER_CONTAINER (pool->view),
+                             (ClutterCallback) clutter_actor_destroy, NULL);
+
+  pool->is_virtualized = virtualized;
+
+  mx_item_pool_model_changed_cb (pool->model, pool);
+}
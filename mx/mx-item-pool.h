@@ -0,0 +1,119 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * mx-item-pool.h: children of a model driven view
+ *
+ * Copyright 2011 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* An MxItemPool creates and binds the children of MxListView and
+ * MxItemView for the rows of their model. It keeps the model and how its
+ * columns map to the properties of the children, replays the changes made
+ * to the model while the view was frozen, and when the view is
+ * virtualized, binds items to the visible rows only and keeps the hidden
+ * items that can be bound to other rows. The views embed it in their
+ * private structure and lay the items out themselves.
+ */
+
+#ifndef __MX_ITEM_POOL_H__
+#define __MX_ITEM_POOL_H__
+
+#include <clutter/clutter.h>
+
+#include "mx-adjustment.h"
+#include "mx-item-factory.h"
+
+G_BEGIN_DECLS
+
+typedef struct _MxItemPool MxItemPool;
+
+/* Measures @item, which is bound to the first row, as all the items are
+ * expected to be the same size, or forgets the size of the items if @item
+ * is %NULL. Returns whether the size has changed. */
+typedef gboolean (*MxItemPoolMeasureFunc) (ClutterActor *view,
+                                           ClutterActor *item);
+
+/* Computes the rows from @first up to @last to bind items to when the
+ * view is virtualized */
+typedef void (*MxItemPoolRangeFunc) (ClutterActor *view,
+                                     gint         *first,
+                                     gint         *last);
+
+struct _MxItemPool
+{
+  ClutterActor          *view;
+  MxItemPoolMeasureFunc  measure;
+  MxItemPoolRangeFunc    get_range;
+
+  ClutterModel          *model;
+  GSList                *attributes;
+  GType                  item_type;
+  MxItemFactory         *factory;
+
+  /* the row changes since the view was frozen, unless it needs to be
+   * rebuilt anyway */
+  GArray                *changes;
+
+  /* the adjustments of the view, which decide the visible rows */
+  MxAdjustment          *hadjustment;
+  MxAdjustment          *vadjustment;
+
+  /* the items bound to the rows from first_row on, which are all the rows
+   * unless virtualized, and when virtualized, the n_spare hidden items
+   * that can be bound to other rows */
+  GPtrArray             *items;
+  GList                 *spare;
+  guint                  n_spare;
+  gint                   first_row;
+  guint                  update_idle;
+
+  guint                  is_frozen : 1;
+  guint                  needs_rebuild : 1;
+  guint                  is_virtualized : 1;
+  guint                  in_allocation : 1;
+  guint                  needs_measure : 1;
+};
+
+void     _mx_item_pool_init             (MxItemPool            *pool,
+                                         ClutterActor          *view,
+                                         MxItemPoolMeasureFunc  measure,
+                                         MxItemPoolRangeFunc    get_range);
+void     _mx_item_pool_dispose          (MxItemPool            *pool);
+void     _mx_item_pool_finalize         (MxItemPool            *pool);
+
+void     _mx_item_pool_set_model        (MxItemPool            *pool,
+                                         ClutterModel          *model);
+void     _mx_item_pool_set_item_type    (MxItemPool            *pool,
+                                         GType                  item_type);
+void     _mx_item_pool_set_factory      (MxItemPool            *pool,
+                                         MxItemFactory         *factory);
+void     _mx_item_pool_add_attribute    (MxItemPool            *pool,
+                                         const gchar           *attribute,
+                                         gint                   column);
+void     _mx_item_pool_freeze           (MxItemPool            *pool);
+void     _mx_item_pool_thaw             (MxItemPool            *pool);
+void     _mx_item_pool_set_virtualized  (MxItemPool            *pool,
+                                         gboolean               virtualized);
+void     _mx_item_pool_set_adjustments  (MxItemPool            *pool,
+                                         MxAdjustment          *hadjustment,
+                                         MxAdjustment          *vadjustment);
+
+void     _mx_item_pool_queue_update     (MxItemPool            *pool);
+void     _mx_item_pool_queue_measure    (MxItemPool            *pool);
+
+G_END_DECLS
+
+#endif /* __MX_ITEM_POOL_H__ */
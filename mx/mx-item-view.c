@@ -32,47 +32,495 @@
  *
  * Data is set on the children by mapping columns in the model to object
  * properties on the children.
+ *
+ * For large models, #MxItemView:virtualized can be set so that children are
+ * only created for the rows that are visible, see
+ * mx_item_view_set_virtualized().
  */
 
 #include "mx-item-view.h"
+#include "mx-scrollable.h"
 #include "mx-private.h"
+#include "mx-item-pool.h"
+
+static void mx_item_view_scrollable_iface_init (MxScrollableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (MxItemView, mx_item_view, MX_TYPE_GRID,
+                         G_IMPLEMENT_INTERFACE (MX_TYPE_SCROLLABLE,
+                                                mx_item_view_scrollable_iface_init))
 
-G_DEFINE_TYPE (MxItemView, mx_item_view, MX_TYPE_GRID)
+static MxScrollableIface *scrollable_parent_iface = NULL;
+
+/* number of lines of items realized beyond each edge of the visible area
+ * when virtualized, so that scrolling by a small amount doesn't need to
+ * bind new items straight away */
+#define MX_ITEM_VIEW_BUFFER_LINES 2
 
 #define ITEM_VIEW_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), MX_TYPE_ITEM_VIEW, MxItemViewPrivate))
 
-typedef struct
-{
-  gchar *name;
-  gint   col;
-} AttributeData;
-
 enum
 {
   PROP_0,
 
   PROP_MODEL,
   PROP_ITEM_TYPE,
-  PROP_FACTORY
+  PROP_FACTORY,
+  PROP_VIRTUALIZED
 };
 
 struct _MxItemViewPrivate
 {
-  ClutterModel  *model;
-  GSList        *attributes;
-  GType          item_type;
+  MxItemPool     pool;
 
-  MxItemFactory *factory;
+  /* the size of the items, measured for lines of line_length */
+  gfloat         item_width;
+  gfloat         item_height;
+  gfloat         line_length;
+};
 
-  gulong         filter_changed;
-  gulong         row_added;
-  gulong         row_changed;
-  gulong         row_removed;
-  gulong         sort_changed;
+/* virtualized mode */
+
+/* Measures the first item. Items are no longer than the lines, so items
+ * whose size across the lines depends on their length are measured for
+ * the length they get. */
+static gboolean
+mx_item_view_measure_item (ClutterActor *actor,
+                           ClutterActor *item)
+{
+  MxItemViewPrivate *priv = MX_ITEM_VIEW (actor)->priv;
+  gfloat width, height;
+
+  if (!item)
+    width = height = 0;
+  else if (mx_grid_get_orientation (MX_GRID (actor))
+           == MX_ORIENTATION_VERTICAL)
+    {
+      clutter_actor_get_preferred_height (item, -1, NULL, &height);
+      if (priv->line_length >= 0)
+        height = MIN (height, priv->line_length);
+      clutter_actor_get_preferred_width (item, height, NULL, &width);
+    }
+  else
+    {
+      clutter_actor_get_preferred_width (item, -1, NULL, &width);
+      if (priv->line_length >= 0)
+        width = MIN (width, priv->line_length);
+      clutter_actor_get_preferred_height (item, width, NULL, &height);
+    }
+
+  if (width == priv->item_width && height == priv->item_height)
+    return FALSE;
+
+  priv->item_width = width;
+  priv->item_height = height;
+
+  return TRUE;
+}
+
+/* Gets the size of the items and the spacing between them along the lines
+ * of the grid (a) and across them (b), as MxGrid does */
+static void
+mx_item_view_get_extents (MxItemView *item_view,
+                          gfloat     *item_a,
+                          gfloat     *item_b,
+                          gfloat     *agap,
+                          gfloat     *bgap)
+{
+  MxItemViewPrivate *priv = item_view->priv;
+  MxGrid *grid = MX_GRID (item_view);
+
+  if (mx_grid_get_orientation (grid) == MX_ORIENTATION_VERTICAL)
+    {
+      *item_a = priv->item_height;
+      *item_b = priv->item_width;
+      *agap = mx_grid_get_row_spacing (grid);
+      *bgap = mx_grid_get_column_spacing (grid);
+    }
+  else
+    {
+      *item_a = priv->item_width;
+      *item_b = priv->item_height;
+      *agap = mx_grid_get_column_spacing (grid);
+      *bgap = mx_grid_get_row_spacing (grid);
+    }
+}
+
+/* the number of items on each line of the grid, for lines of @length, or
+ * of unlimited length if @length is negative */
+static gint
+mx_item_view_get_items_per_line (MxItemView *item_view,
+                                 gfloat      length)
+{
+  MxItemViewPrivate *priv = item_view->priv;
+  gfloat item_a, item_b, agap, bgap;
+  gint n_rows, per_line, max_stride;
+
+  n_rows = priv->pool.model ? clutter_model_get_n_rows (priv->pool.model) : 0;
+  mx_item_view_get_extents (item_view, &item_a, &item_b, &agap, &bgap);
+
+  if (length >= 0 && item_a + agap > 0)
+    per_line = (gint) ((length + agap) / (item_a + agap));
+  else
+    per_line = n_rows;
+
+  max_stride = mx_grid_get_max_stride (MX_GRID (item_view));
+  if (max_stride > 0)
+    per_line = MIN (per_line, max_stride);
+
+  return MAX (per_line, 1);
+}
+
+/* the size of all the lines across them, without padding */
+static gfloat
+mx_item_view_get_virtual_size (MxItemView *item_view,
+                               gint        per_line)
+{
+  MxItemViewPrivate *priv = item_view->priv;
+  gfloat item_a, item_b, agap, bgap;
+  gint n_rows, n_lines;
+
+  n_rows = priv->pool.model ? clutter_model_get_n_rows (priv->pool.model) : 0;
+  if (n_rows == 0)
+    return 0;
+
+  mx_item_view_get_extents (item_view, &item_a, &item_b, &agap, &bgap);
+  n_lines = (n_rows + per_line - 1) / per_line;
+
+  return n_lines * item_b + (n_lines - 1) * bgap;
+}
+
+/* Computes the rows of the model that are on the lines that intersect the
+ * visible area, plus a buffer */
+static void
+mx_item_view_get_range (ClutterActor *actor,
+                        gint         *first,
+                        gint         *last)
+{
+  MxItemView *item_view = MX_ITEM_VIEW (actor);
+  MxItemViewPrivate *priv = item_view->priv;
+  MxPadding padding = { 0, };
+  ClutterActorBox box;
+  MxAdjustment *adjustment;
+  gfloat item_a, item_b, agap, bgap, stride, length;
+  gdouble value, page_size, start;
+  gint n_rows, per_line;
+
+  n_rows = priv->pool.model ? clutter_model_get_n_rows (priv->pool.model) : 0;
+
+  mx_widget_get_padding (MX_WIDGET (item_view), &padding);
+  clutter_actor_get_allocation_box (CLUTTER_ACTOR (item_view), &box);
+
+  if (mx_grid_get_orientation (MX_GRID (item_view))
+      == MX_ORIENTATION_VERTICAL)
+    {
+      adjustment = priv->pool.hadjustment;
+      start = padding.left;
+      page_size = box.x2 - box.x1;
+      length = box.y2 - box.y1 - padding.top - padding.bottom;
+    }
+  else
+    {
+      adjustment = priv->pool.vadjustment;
+      start = padding.top;
+      page_size = box.y2 - box.y1;
+      length = box.x2 - box.x1 - padding.left - padding.right;
+    }
+
+  value = 0;
+  if (adjustment)
+    {
+      value = mx_adjustment_get_value (adjustment);
+      if (mx_adjustment_get_page_size (adjustment) > 0)
+        page_size = mx_adjustment_get_page_size (adjustment);
+    }
+
+  per_line = mx_item_view_get_items_per_line (item_view, MAX (length, 0));
+
+  mx_item_view_get_extents (item_view, &item_a, &item_b, &agap, &bgap);
+  stride = item_b + bgap;
+  if (stride < 1)
+    stride = 1;
+
+  *first = (gint) ((value - start) / stride) - MX_ITEM_VIEW_BUFFER_LINES;
+  *last = (gint) ((value + page_size - start) / stride) + 1
+    + MX_ITEM_VIEW_BUFFER_LINES;
+
+  *first = CLAMP (*first, 0, n_rows / per_line + 1) * per_line;
+  *last = CLAMP (*last, 0, n_rows / per_line + 1) * per_line;
+
+  *first = CLAMP (*first, 0, n_rows);
+  *last = CLAMP (*last, *first, n_rows);
+}
+
+static void
+mx_item_view_set_adjustments (MxScrollable *scrollable,
+                              MxAdjustment *hadjustment,
+                              MxAdjustment *vadjustment)
+{
+  MxItemView *item_view = MX_ITEM_VIEW (scrollable);
+
+  scrollable_parent_iface->set_adjustments (scrollable, hadjustment,
+                                            vadjustment);
+
+  _mx_item_pool_set_adjustments (&item_view->priv->pool, hadjustment,
+                                 vadjustment);
+}
+
+static void
+mx_item_view_get_adjustments (MxScrollable  *scrollable,
+                              MxAdjustment **hadjustment,
+                              MxAdjustment **vadjustment)
+{
+  MxItemPool *pool = &MX_ITEM_VIEW (scrollable)->priv->pool;
+
+  scrollable_parent_iface->get_adjustments (scrollable, hadjustment,
+                                            vadjustment);
+
+  /* the grid creates the adjustments when they're first asked for */
+  _mx_item_pool_set_adjustments (pool,
+                                 hadjustment ? *hadjustment :
+                                 pool->hadjustment,
+                                 vadjustment ? *vadjustment :
+                                 pool->vadjustment);
+}
+
+static void
+mx_item_view_scrollable_iface_init (MxScrollableIface *iface)
+{
+  scrollable_parent_iface = g_type_interface_peek_parent (iface);
+
+  iface->set_adjustments = mx_item_view_set_adjustments;
+  iface->get_adjustments = mx_item_view_get_adjustments;
+}
+
+/* Gets the preferred size of the lines of the grid (a), and of all the
+ * lines stacked up for lines of @for_a (b), including padding */
+static void
+mx_item_view_get_preferred_size (MxItemView *item_view,
+                                 gfloat      for_a,
+                                 gfloat     *min_a_p,
+                                 gfloat     *natural_a_p,
+                                 gfloat     *natural_b_p)
+{
+  gfloat item_a, item_b, agap, bgap, padding_a, padding_b;
+  MxPadding padding;
+  gint per_line;
+
+  mx_widget_get_padding (MX_WIDGET (item_view), &padding);
+  mx_item_view_get_extents (item_view, &item_a, &item_b, &agap, &bgap);
+
+  if (mx_grid_get_orientation (MX_GRID (item_view))
+      == MX_ORIENTATION_VERTICAL)
+    {
+      padding_a = padding.top + padding.bottom;
+      padding_b = padding.left + padding.right;
+    }
+  else
+    {
+      padding_a = padding.left + padding.right;
+      padding_b = padding.top + padding.bottom;
+    }
+
+  if (min_a_p)
+    *min_a_p = item_a + padding_a;
+
+  if (natural_a_p)
+    {
+      /* like MxGrid, prefer everything on one line */
+      per_line = mx_item_view_get_items_per_line (item_view, -1);
+      *natural_a_p = per_line * (item_a + agap) - agap + padding_a;
+    }
+
+  if (natural_b_p)
+    {
+      per_line = mx_item_view_get_items_per_line (item_view,
+                                                  for_a < 0 ? -1 :
+                                                  MAX (for_a - padding_a, 0));
+      *natural_b_p = mx_item_view_get_virtual_size (item_view, per_line)
+        + padding_b;
+    }
+}
+
+static void
+mx_item_view_get_preferred_width (ClutterActor *actor,
+                                  gfloat        for_height,
+                                  gfloat       *min_width_p,
+                                  gfloat       *natural_width_p)
+{
+  MxItemView *item_view = MX_ITEM_VIEW (actor);
+  gfloat width;
+
+  if (!item_view->priv->pool.is_virtualized)
+    {
+      CLUTTER_ACTOR_CLASS (mx_item_view_parent_class)->
+        get_preferred_width (actor, for_height, min_width_p, natural_width_p);
+      return;
+    }
+
+  if (mx_grid_get_orientation (MX_GRID (actor)) == MX_ORIENTATION_VERTICAL)
+    {
+      mx_item_view_get_preferred_size (item_view, for_height,
+                                       NULL, NULL, &width);
+      if (min_width_p)
+        *min_width_p = width;
+      if (natural_width_p)
+        *natural_width_p = width;
+    }
+  else
+    mx_item_view_get_preferred_size (item_view, -1,
+                                     min_width_p, natural_width_p, NULL);
+}
+
+static void
+mx_item_view_get_preferred_height (ClutterActor *actor,
+                                   gfloat        for_width,
+                                   gfloat       *min_height_p,
+                                   gfloat       *natural_height_p)
+{
+  MxItemView *item_view = MX_ITEM_VIEW (actor);
+  gfloat height;
+
+  if (!item_view->priv->pool.is_virtualized)
+    {
+      CLUTTER_ACTOR_CLASS (mx_item_view_parent_class)->
+        get_preferred_height (actor, for_width, min_height_p,
+                              natural_height_p);
+      return;
+    }
+
+  if (mx_grid_get_orientation (MX_GRID (actor)) == MX_ORIENTATION_VERTICAL)
+    mx_item_view_get_preferred_size (item_view, -1,
+                                     min_height_p, natural_height_p, NULL);
+  else
+    {
+      mx_item_view_get_preferred_size (item_view, for_width,
+                                       NULL, NULL, &height);
+      if (min_height_p)
+        *min_height_p = height;
+      if (natural_height_p)
+        *natural_height_p = height;
+    }
+}
+
+static void
+mx_item_view_allocate (ClutterActor          *actor,
+                       const ClutterActorBox *box,
+                       ClutterAllocationFlags flags)
+{
+  MxItemView *item_view = MX_ITEM_VIEW (actor);
+  MxItemViewPrivate *priv = item_view->priv;
+  MxAdjustment *adjustment, *other_adjustment;
+  gfloat item_a, item_b, agap, bgap, length, page_size, size;
+  gboolean vertical;
+  MxPadding padding;
+  gint per_line, first, last;
+  guint i;
+
+  if (!priv->pool.is_virtualized)
+    {
+      CLUTTER_ACTOR_CLASS (mx_item_view_parent_class)->
+        allocate (actor, box, flags);
+      return;
+    }
+
+  /* the items are laid out here rather than by the grid, which only knows
+   * about the realized rows */
+  CLUTTER_ACTOR_CLASS (g_type_class_peek_parent (mx_item_view_parent_class))->
+    allocate (actor, box, flags);
+
+  priv->pool.in_allocation = TRUE;
+
+  vertical = (mx_grid_get_orientation (MX_GRID (actor))
+              == MX_ORIENTATION_VERTICAL);
+  mx_widget_get_padding (MX_WIDGET (actor), &padding);
+  mx_item_view_get_extents (item_view, &item_a, &item_b, &agap, &bgap);
+
+  if (vertical)
+    {
+      adjustment = priv->pool.hadjustment;
+      other_adjustment = priv->pool.vadjustment;
+      length = box->y2 - box->y1 - padding.top - padding.bottom;
+      page_size = box->x2 - box->x1;
+      size = padding.left + padding.right;
+    }
+  else
+    {
+      adjustment = priv->pool.vadjustment;
+      other_adjustment = priv->pool.hadjustment;
+      length = box->x2 - box->x1 - padding.left - padding.right;
+      page_size = box->y2 - box->y1;
+      size = padding.top + padding.bottom;
+    }
+
+  /* the items may be a different size on lines of a different length */
+  if (MAX (length, 0) != priv->line_length)
+    {
+      priv->line_length = MAX (length, 0);
+      _mx_item_pool_queue_measure (&priv->pool);
+    }
+
+  per_line = mx_item_view_get_items_per_line (item_view, MAX (length, 0));
+  size += mx_item_view_get_virtual_size (item_view, per_line);
+
+  /* like MxGrid, only scroll across the lines */
+  if (adjustment)
+    {
+      g_object_set (G_OBJECT (adjustment),
+                    "lower", 0.0,
+                    "upper", size,
+                    "page-size", page_size,
+                    "step-increment", (item_b > 0) ?
+                      item_b + bgap : page_size / 6,
+                    "page-increment", page_size,
+                    NULL);
+
+      mx_adjustment_set_value (adjustment,
+                               mx_adjustment_get_value (adjustment));
+    }
+
+  if (other_adjustment)
+    g_object_set (G_OBJECT (other_adjustment),
+                  "lower", 0.0,
+                  "upper", 0.0,
+                  NULL);
+
+  for (i = 0; i < priv->pool.items->len; i++)
+    {
+      ClutterActor *child = g_ptr_array_index (priv->pool.items, i);
+      ClutterActorBox child_box;
+      gint row = priv->pool.first_row + i;
+      gfloat a, b;
+
+      a = (row % per_line) * (item_a + agap);
+      b = (row / per_line) * (item_b + bgap);
+
+      if (vertical)
+        {
+          child_box.x1 = (gint) (padding.left + b);
+          child_box.y1 = (gint) (padding.top + a);
+        }
+      else
+        {
+          child_box.x1 = (gint) (padding.left + a);
+          child_box.y1 = (gint) (padding.top + b);
+        }
+      child_box.x2 = child_box.x1 + priv->item_width;
+      child_box.y2 = child_box.y1 + priv->item_height;
+
+      clutter_actor_allocate (child, &child_box, flags);
+    }
+
+  /* the visible area, or the number of items on each line, may have
+   * changed */
+  mx_item_view_get_range (actor, &first, &last);
+  if (first != priv->pool.first_row ||
+      last != priv->pool.first_row + priv->pool.items->len)
+    _mx_item_pool_queue_update (&priv->pool);
+
+  priv->pool.in_allocation = FALSE;
+}
 
-  guint          is_frozen : 1;
-};
 
 /* gobject implementations */
 
@@ -86,13 +534,16 @@ mx_item_view_get_property (GObject    *object,
   switch (property_id)
     {
     case PROP_MODEL:
-      g_value_set_object (value, priv->model);
+      g_value_set_object (value, priv->pool.model);
       break;
     case PROP_ITEM_TYPE:
-      g_value_set_gtype (value, priv->item_type);
+      g_value_set_gtype (value, priv->pool.item_type);
       break;
     case PROP_FACTORY:
-      g_value_set_object (value, priv->factory);
+      g_value_set_object (value, priv->pool.factory);
+      break;
+    case PROP_VIRTUALIZED:
+      g_value_set_boolean (value, priv->pool.is_virtualized);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -118,6 +569,10 @@ mx_item_view_set_property (GObject      *object,
       mx_item_view_set_factory ((MxItemView*) object,
                                 (MxItemFactory*) g_value_get_object (value));
       break;
+    case PROP_VIRTUALIZED:
+      mx_item_view_set_virtualized ((MxItemView*) object,
+                                    g_value_get_boolean (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -126,8 +581,9 @@ mx_item_view_set_property (GObject      *object,
 static void
 mx_item_view_dispose (GObject *object)
 {
-  /* This will cause the unref of the model and also disconnect the signals */
-  mx_item_view_set_model (MX_ITEM_VIEW (object), NULL);
+  MxItemViewPrivate *priv = MX_ITEM_VIEW (object)->priv;
+
+  _mx_item_pool_dispose (&priv->pool);
 
   G_OBJECT_CLASS (mx_item_view_parent_class)->dispose (object);
 }
@@ -137,12 +593,7 @@ mx_item_view_finalize (GObject *object)
 {
   MxItemViewPrivate *priv = MX_ITEM_VIEW (object)->priv;
 
-  if (priv->attributes)
-    {
-      g_slist_foreach (priv->attributes, (GFunc) g_free, NULL);
-      g_slist_free (priv->attributes);
-      priv->attributes = NULL;
-    }
+  _mx_item_pool_finalize (&priv->pool);
 
   G_OBJECT_CLASS (mx_item_view_parent_class)->finalize (object);
 }
@@ -151,6 +602,7 @@ static void
 mx_item_view_class_init (MxItemViewClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  ClutterActorClass *actor_class = CLUTTER_ACTOR_CLASS (klass);
   GParamSpec *pspec;
 
   g_type_class_add_private (klass, sizeof (MxItemViewPrivate));
@@ -160,6 +612,10 @@ mx_item_view_class_init (MxItemViewClass *klass)
   object_class->dispose = mx_item_view_dispose;
   object_class->finalize = mx_item_view_finalize;
 
+  actor_class->get_preferred_width = mx_item_view_get_preferred_width;
+  actor_class->get_preferred_height = mx_item_view_get_preferred_height;
+  actor_class->allocate = mx_item_view_allocate;
+
   pspec = g_param_spec_object ("model",
                                "model",
                                "The model for the item view",
@@ -185,150 +641,45 @@ mx_item_view_class_init (MxItemViewClass *klass)
                                G_TYPE_OBJECT /*MX_TYPE_ITEM_FACTORY*/,
                                MX_PARAM_READWRITE);
   g_object_class_install_property (object_class, PROP_FACTORY, pspec);
-}
-
-static void
-mx_item_view_init (MxItemView *item_view)
-{
-  item_view->priv = ITEM_VIEW_PRIVATE (item_view);
-}
-
-
-/* model monitors */
-static void
-model_changed_cb (ClutterModel *model,
-                  MxItemView   *item_view)
-{
-  GSList *p;
-  GList *l, *children;
-  MxItemViewPrivate *priv = item_view->priv;
-  ClutterModelIter *iter = NULL;
-  gint model_n = 0, child_n = 0;
-
-
-  /* bail out if we don't yet have an item type */
-  if (!priv->item_type && !priv->factory)
-    return;
-
-  if (priv->is_frozen)
-    return;
-
-  if (priv->item_type)
-    {
-      /* check the item-type is an descendant of ClutterActor */
-      if (!g_type_is_a (priv->item_type, CLUTTER_TYPE_ACTOR))
-        {
-          g_warning ("%s is not a subclass of ClutterActor and therefore"
-                     " cannot be used as items in an MxItemView",
-                     g_type_name (priv->item_type));
-          return;
-        }
-    }
-
-  children = clutter_container_get_children (CLUTTER_CONTAINER (item_view));
-  child_n = g_list_length (children);
-
-  if (model)
-    model_n = clutter_model_get_n_rows (priv->model);
-  else
-    model_n = 0;
-
-  /* add children as needed */
-  while (model_n > child_n)
-    {
-      ClutterActor *new_child;
-
-      if (priv->item_type)
-        {
-          new_child = g_object_new (priv->item_type, NULL);
-        }
-      else
-        {
-          new_child = mx_item_factory_create (priv->factory);
-        }
-
-      clutter_container_add_actor (CLUTTER_CONTAINER (item_view),
-                                   new_child);
-      child_n++;
-    }
 
-  /* remove children as needed */
-  l = g_list_last (children);
-  while (child_n > model_n)
-    {
-      clutter_container_remove_actor (CLUTTER_CONTAINER (item_view),
-                                      (ClutterActor*) l->data);
-      l = g_list_previous (l);
-      child_n--;
-    }
-
-  g_list_free (children);
-
-  if (!priv->model)
-    return;
-
-  children = clutter_container_get_children (CLUTTER_CONTAINER (item_view));
-
-  /* set the properties on the children */
-  iter = clutter_model_get_first_iter (priv->model);
-  l = children;
-  while (iter && !clutter_model_iter_is_last (iter))
-    {
-      GObject *child;
-
-      child = G_OBJECT (l->data);
-
-      g_object_freeze_notify (child);
-      for (p = priv->attributes; p; p = p->next)
-        {
-          GValue value = { 0, };
-          AttributeData *attr = p->data;
-
-          clutter_model_iter_get_value (iter, attr->col, &value);
-
-          g_object_set_property (child, attr->name, &value);
-
-          g_value_unset (&value);
-        }
-      g_object_thaw_notify (child);
-
-      l = g_list_next (l);
-      clutter_model_iter_next (iter);
-    }
-
-  g_list_free (children);
-
-  if (iter)
-    g_object_unref (iter);
+  /**
+   * MxItemView:virtualized:
+   *
+   * Whether items are only created for the rows that are visible.
+   *
+   * Since: 1.6
+   */
+  pspec = g_param_spec_boolean ("virtualized",
+                                "Virtualized",
+                                "Whether items are only created for the "
+                                "visible rows",
+                                FALSE,
+                                MX_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_VIRTUALIZED, pspec);
 }
 
 static void
-row_changed_cb (ClutterModel     *model,
-                ClutterModelIter *iter,
-                MxItemView       *item_view)
+mx_item_view_style_changed (MxWidget *widget,
+                            gpointer  userdata)
 {
-  model_changed_cb (model, item_view);
+  /* the items may not have been restyled yet */
+  _mx_item_pool_queue_measure (&MX_ITEM_VIEW (widget)->priv->pool);
 }
 
 static void
-row_removed_cb (ClutterModel     *model,
-                ClutterModelIter *iter,
-                MxItemView       *item_view)
+mx_item_view_init (MxItemView *item_view)
 {
-  GList *children;
-  GList *l;
-  ClutterActor *child;
+  item_view->priv = ITEM_VIEW_PRIVATE (item_view);
 
-  if (item_view->priv->is_frozen)
-    return;
+  _mx_item_pool_init (&item_view->priv->pool, CLUTTER_ACTOR (item_view),
+                      mx_item_view_measure_item, mx_item_view_get_range);
+  item_view->priv->line_length = -1;
 
-  children = clutter_container_get_children (CLUTTER_CONTAINER (item_view));
-  l = g_list_nth (children, clutter_model_iter_get_row (iter));
-  child = (ClutterActor *) l->data;
-  clutter_container_remove_actor (CLUTTER_CONTAINER (item_view), child);
-  g_list_free (children);
+  g_signal_connect (item_view, "style-changed",
+                    G_CALLBACK (mx_item_view_style_changed), NULL);
 }
 
+
 /* public api */
 
 /**
@@ -357,7 +708,7 @@ mx_item_view_get_item_type (MxItemView *item_view)
 {
   g_return_val_if_fail (MX_IS_ITEM_VIEW (item_view), G_TYPE_INVALID);
 
-  return item_view->priv->item_type;
+  return item_view->priv->pool.item_type;
 }
 
 
@@ -376,10 +727,8 @@ mx_item_view_set_item_type (MxItemView *item_view,
   g_return_if_fail (MX_IS_ITEM_VIEW (item_view));
   g_return_if_fail (g_type_is_a (item_type, CLUTTER_TYPE_ACTOR));
 
-  item_view->priv->item_type = item_type;
-
   /* update the view */
-  model_changed_cb (item_view->priv->model, item_view);
+  _mx_item_pool_set_item_type (&item_view->priv->pool, item_type);
 }
 
 /**
@@ -395,7 +744,7 @@ mx_item_view_get_model (MxItemView *item_view)
 {
   g_return_val_if_fail (MX_IS_ITEM_VIEW (item_view), NULL);
 
-  return item_view->priv->model;
+  return item_view->priv->pool.model;
 }
 
 /**
@@ -409,70 +758,10 @@ void
 mx_item_view_set_model (MxItemView   *item_view,
                         ClutterModel *model)
 {
-  MxItemViewPrivate *priv;
-
   g_return_if_fail (MX_IS_ITEM_VIEW (item_view));
   g_return_if_fail (model == NULL || CLUTTER_IS_MODEL (model));
 
-  priv = item_view->priv;
-
-  if (priv->model)
-    {
-      g_signal_handlers_disconnect_by_func (priv->model,
-                                            (GCallback) model_changed_cb,
-                                            item_view);
-      g_signal_handlers_disconnect_by_func (priv->model,
-                                            (GCallback) row_changed_cb,
-                                            item_view);
-      g_signal_handlers_disconnect_by_func (priv->model,
-                                            (GCallback) row_removed_cb,
-                                            item_view);
-      g_object_unref (priv->model);
-
-      priv->model = NULL;
-    }
-
-  if (model)
-    {
-      g_return_if_fail (CLUTTER_IS_MODEL (model));
-
-      priv->model = g_object_ref (model);
-
-      priv->filter_changed = g_signal_connect (priv->model,
-                                               "filter-changed",
-                                               G_CALLBACK (model_changed_cb),
-                                               item_view);
-
-      priv->row_added = g_signal_connect (priv->model,
-                                          "row-added",
-                                          G_CALLBACK (row_changed_cb),
-                                          item_view);
-
-      priv->row_changed = g_signal_connect (priv->model,
-                                            "row-changed",
-                                            G_CALLBACK (row_changed_cb),
-                                            item_view);
-
-      /*
-       * model_changed_cb (called from row_changed_cb) expect the row to already
-       * have been removed, thus we need to use _after
-       */
-      priv->row_removed = g_signal_connect_after (priv->model,
-                                                  "row-removed",
-                                                  G_CALLBACK (row_removed_cb),
-                                                  item_view);
-
-      priv->sort_changed = g_signal_connect (priv->model,
-                                             "sort-changed",
-                                             G_CALLBACK (model_changed_cb),
-                                             item_view);
-
-      /*
-       * Only do this inside this block, setting the model to NULL should have
-       * the effect of preserving the view; just disconnect the handlers
-       */
-      model_changed_cb (priv->model, item_view);
-    }
+  _mx_item_pool_set_model (&item_view->priv->pool, model);
 }
 
 /**
@@ -490,21 +779,11 @@ mx_item_view_add_attribute (MxItemView  *item_view,
                             const gchar *_attribute,
                             gint         column)
 {
-  MxItemViewPrivate *priv;
-  AttributeData *prop;
-
   g_return_if_fail (MX_IS_ITEM_VIEW (item_view));
   g_return_if_fail (_attribute != NULL);
   g_return_if_fail (column >= 0);
 
-  priv = item_view->priv;
-
-  prop = g_new (AttributeData, 1);
-  prop->name = g_strdup (_attribute);
-  prop->col = column;
-
-  priv->attributes = g_slist_prepend (priv->attributes, prop);
-  model_changed_cb (priv->model, item_view);
+  _mx_item_pool_add_attribute (&item_view->priv->pool, _attribute, column);
 }
 
 /**
@@ -519,7 +798,7 @@ mx_item_view_freeze (MxItemView *item_view)
 {
   g_return_if_fail (MX_IS_ITEM_VIEW (item_view));
 
-  item_view->priv->is_frozen = TRUE;
+  _mx_item_pool_freeze (&item_view->priv->pool);
 }
 
 /**
@@ -527,21 +806,18 @@ mx_item_view_freeze (MxItemView *item_view)
  * @item_view: An #MxItemView
  *
  * Thaw the view. This means that the view will now act on changes to the
- * model.
+ * model. Rows that were added, changed or removed while the view was frozen
+ * are updated together, only creating, removing or setting the attributes
+ * of the children of those rows. When the model has a filter, rows that
+ * are added or changed can be filtered in or out, so the view is rebuilt
+ * for them instead.
  */
 void
 mx_item_view_thaw (MxItemView *item_view)
 {
-  MxItemViewPrivate *priv;
-
   g_return_if_fail (MX_IS_ITEM_VIEW (item_view));
 
-  priv = item_view->priv;
-
-  priv->is_frozen = FALSE;
-
-  /* Repopulate */
-  model_changed_cb (priv->model, item_view);
+  _mx_item_pool_thaw (&item_view->priv->pool);
 }
 
 /**
@@ -555,24 +831,13 @@ void
 mx_item_view_set_factory (MxItemView    *item_view,
                           MxItemFactory *factory)
 {
-  MxItemViewPrivate *priv;
-
   g_return_if_fail (MX_IS_ITEM_VIEW (item_view));
   g_return_if_fail (!factory || MX_IS_ITEM_FACTORY (factory));
 
-  priv = item_view->priv;
-
-  if (priv->factory == factory)
+  if (item_view->priv->pool.factory == factory)
     return;
 
-  if (priv->factory)
-    {
-      g_object_unref (priv->factory);
-      priv->factory = NULL;
-    }
-
-  if (factory)
-    priv->factory = g_object_ref (factory);
+  _mx_item_pool_set_factory (&item_view->priv->pool, factory);
 
   g_object_notify (G_OBJECT (item_view), "factory");
 }
@@ -589,5 +854,57 @@ MxItemFactory *
 mx_item_view_get_factory (MxItemView *item_view)
 {
   g_return_val_if_fail (MX_IS_ITEM_VIEW (item_view), NULL);
-  return item_view->priv->factory;
+  return item_view->priv->pool.factory;
+}
+
+/**
+ * mx_item_view_set_virtualized:
+ * @item_view: A #MxItemView
+ * @virtualized: %TRUE to only create items for the visible rows
+ *
+ * Sets whether @item_view only creates items for the rows of the model that
+ * are visible, plus a few lines either side, rather than for every row.
+ * Items that scroll out of view are reused for the rows that scroll into
+ * view, and the attributes of an item are only set when it is bound to a
+ * different row. This makes views of large models much cheaper, but only
+ * works when all the items are the same size as the first one; the
+ * homogenous and alignment properties of #MxGrid are not used.
+ *
+ * The visible rows are determined by the adjustments of @item_view, so it
+ * should be placed in a #MxScrollView or similar. Only the items of the
+ * visible rows are children of @item_view.
+ *
+ * Since: 1.6
+ */
+void
+mx_item_view_set_virtualized (MxItemView *item_view,
+                              gboolean    virtualized)
+{
+  g_return_if_fail (MX_IS_ITEM_VIEW (item_view));
+
+  if (item_view->priv->pool.is_virtualized == virtualized)
+    return;
+
+  _mx_item_pool_set_virtualized (&item_view->priv->pool, virtualized);
+
+  g_object_notify (G_OBJECT (item_view), "virtualized");
+}
+
+/**
+ * mx_item_view_get_virtualized:
+ * @item_view: A #MxItemView
+ *
+ * Gets whether @item_view only creates items for the visible rows, see
+ * mx_item_view_set_virtualized().
+ *
+ * Returns: %TRUE if @item_view is virtualized
+ *
+ * Since: 1.6
+ */
+gboolean
+mx_item_view_get_virtualized (MxItemView *item_view)
+{
+  g_return_val_if_fail (MX_IS_ITEM_VIEW (item_view), FALSE);
+
+  return item_view->priv->pool.is_virtualized;
 }
@@ -106,6 +106,10 @@ void          mx_item_view_set_factory   (MxItemView    *item_view,
                                           MxItemFactory *factory);
 MxItemFactory* mx_item_view_get_factory  (MxItemView    *item_view);
 
+void          mx_item_view_set_virtualized (MxItemView  *item_view,
+                                            gboolean     virtualized);
+gboolean      mx_item_view_get_virtualized (MxItemView  *item_view);
+
 G_END_DECLS
 
 #endif /* _MX_ITEM_VIEW_H */
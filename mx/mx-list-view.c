@@ -32,49 +32,391 @@
  *
  * Data is set on the children by mapping columns in the model to object
  * properties on the children.
+ *
+ * For large models, #MxListView:virtualized can be set so that children are
+ * only created for the rows that are visible, see
+ * mx_list_view_set_virtualized().
  */
 
 #include "mx-list-view.h"
 #include "mx-box-layout.h"
+#include "mx-box-layout-child.h"
+#include "mx-scrollable.h"
 #include "mx-private.h"
 #include "mx-item-factory.h"
+#include "mx-item-pool.h"
+
+static void mx_list_view_scrollable_iface_init (MxScrollableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (MxListView, mx_list_view, MX_TYPE_BOX_LAYOUT,
+                         G_IMPLEMENT_INTERFACE (MX_TYPE_SCROLLABLE,
+                                                mx_list_view_scrollable_iface_init))
+
+static MxScrollableIface *scrollable_parent_iface = NULL;
 
-G_DEFINE_TYPE (MxListView, mx_list_view, MX_TYPE_BOX_LAYOUT)
+/* number of rows realized beyond each edge of the visible area when
+ * virtualized, so that scrolling by a small amount doesn't need to bind
+ * new items straight away */
+#define MX_LIST_VIEW_BUFFER_ROWS 4
 
 #define LIST_VIEW_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), MX_TYPE_LIST_VIEW, MxListViewPrivate))
 
-typedef struct
-{
-  gchar *name;
-  gint   col;
-} AttributeData;
-
 enum
 {
   PROP_0,
 
   PROP_MODEL,
   PROP_ITEM_TYPE,
-  PROP_FACTORY
+  PROP_FACTORY,
+  PROP_VIRTUALIZED
 };
 
 struct _MxListViewPrivate
 {
-  ClutterModel  *model;
-  GSList        *attributes;
-  GType          item_type;
+  MxItemPool     pool;
 
-  MxItemFactory *factory;
+  /* the size of the items along the rows, measured for the size across
+   * them of for_size */
+  gfloat         item_size;
+  gfloat         for_size;
+};
 
-  gulong         filter_changed;
-  gulong         row_added;
-  gulong         row_changed;
-  gulong         row_removed;
-  gulong         sort_changed;
+/* virtualized mode */
 
-  guint          is_frozen : 1;
-};
+static gboolean
+mx_list_view_measure_item (ClutterActor *actor,
+                           ClutterActor *item)
+{
+  MxListViewPrivate *priv = MX_LIST_VIEW (actor)->priv;
+  gfloat size, for_size;
+
+  size = 0;
+  if (item)
+    {
+      for_size = priv->for_size > 0 ? priv->for_size : -1;
+      if (mx_box_layout_get_orientation (MX_BOX_LAYOUT (actor))
+          == MX_ORIENTATION_VERTICAL)
+        clutter_actor_get_preferred_height (item, for_size, NULL, &size);
+      else
+        clutter_actor_get_preferred_width (item, for_size, NULL, &size);
+    }
+
+  if (size == priv->item_size)
+    return FALSE;
+
+  priv->item_size = size;
+
+  return TRUE;
+}
+
+/* Computes the rows that intersect the visible area, plus a buffer */
+static void
+mx_list_view_get_range (ClutterActor *actor,
+                        gint         *first,
+                        gint         *last)
+{
+  MxListViewPrivate *priv = MX_LIST_VIEW (actor)->priv;
+  MxOrientation orientation;
+  MxPadding padding = { 0, };
+  ClutterActorBox box;
+  MxAdjustment *adjustment;
+  gdouble value, page_size, start;
+  gfloat stride;
+  gint n_rows;
+
+  n_rows = priv->pool.model ? clutter_model_get_n_rows (priv->pool.model) : 0;
+
+  orientation = mx_box_layout_get_orientation (MX_BOX_LAYOUT (actor));
+  mx_widget_get_padding (MX_WIDGET (actor), &padding);
+  clutter_actor_get_allocation_box (actor, &box);
+
+  if (orientation == MX_ORIENTATION_VERTICAL)
+    {
+      adjustment = priv->pool.vadjustment;
+      start = padding.top;
+      page_size = box.y2 - box.y1;
+    }
+  else
+    {
+      adjustment = priv->pool.hadjustment;
+      start = padding.left;
+      page_size = box.x2 - box.x1;
+    }
+
+  value = 0;
+  if (adjustment)
+    {
+      value = mx_adjustment_get_value (adjustment);
+      if (mx_adjustment_get_page_size (adjustment) > 0)
+        page_size = mx_adjustment_get_page_size (adjustment);
+    }
+
+  stride = priv->item_size +
+    mx_box_layout_get_spacing (MX_BOX_LAYOUT (actor));
+  if (stride < 1)
+    stride = 1;
+
+  *first = (gint) ((value - start) / stride) - MX_LIST_VIEW_BUFFER_ROWS;
+  *last = (gint) ((value + page_size - start) / stride) + 1
+    + MX_LIST_VIEW_BUFFER_ROWS;
+
+  *first = CLAMP (*first, 0, n_rows);
+  *last = CLAMP (*last, *first, n_rows);
+}
+
+/* MxBoxLayout keeps the adjustments to itself, so they are tracked here as
+ * they are set on the box layout, to know which rows are visible */
+static void
+mx_list_view_set_adjustments (MxScrollable *scrollable,
+                              MxAdjustment *hadjustment,
+                              MxAdjustment *vadjustment)
+{
+  MxListView *list_view = MX_LIST_VIEW (scrollable);
+
+  scrollable_parent_iface->set_adjustments (scrollable, hadjustment,
+                                            vadjustment);
+
+  _mx_item_pool_set_adjustments (&list_view->priv->pool, hadjustment,
+                                 vadjustment);
+}
+
+static void
+mx_list_view_get_adjustments (MxScrollable  *scrollable,
+                              MxAdjustment **hadjustment,
+                              MxAdjustment **vadjustment)
+{
+  MxItemPool *pool = &MX_LIST_VIEW (scrollable)->priv->pool;
+
+  scrollable_parent_iface->get_adjustments (scrollable, hadjustment,
+                                            vadjustment);
+
+  /* the box layout creates the adjustments when they're first asked for */
+  _mx_item_pool_set_adjustments (pool,
+                                 hadjustment ? *hadjustment :
+                                 pool->hadjustment,
+                                 vadjustment ? *vadjustment :
+                                 pool->vadjustment);
+}
+
+static void
+mx_list_view_scrollable_iface_init (MxScrollableIface *iface)
+{
+  scrollable_parent_iface = g_type_interface_peek_parent (iface);
+
+  iface->set_adjustments = mx_list_view_set_adjustments;
+  iface->get_adjustments = mx_list_view_get_adjustments;
+}
+
+/* the size of all the rows along the orientation, without padding */
+static gfloat
+mx_list_view_get_virtual_size (MxListView *list_view)
+{
+  MxListViewPrivate *priv = list_view->priv;
+  gint n_rows;
+
+  n_rows = priv->pool.model ? clutter_model_get_n_rows (priv->pool.model) : 0;
+  if (n_rows == 0)
+    return 0;
+
+  return n_rows * priv->item_size + (n_rows - 1) *
+    mx_box_layout_get_spacing (MX_BOX_LAYOUT (list_view));
+}
+
+static void
+mx_list_view_get_preferred_width (ClutterActor *actor,
+                                  gfloat        for_height,
+                                  gfloat       *min_width_p,
+                                  gfloat       *natural_width_p)
+{
+  MxListView *list_view = MX_LIST_VIEW (actor);
+  MxPadding padding;
+  gfloat width;
+
+  if (!list_view->priv->pool.is_virtualized ||
+      mx_box_layout_get_orientation (MX_BOX_LAYOUT (actor))
+      != MX_ORIENTATION_HORIZONTAL)
+    {
+      CLUTTER_ACTOR_CLASS (mx_list_view_parent_class)->
+        get_preferred_width (actor, for_height, min_width_p, natural_width_p);
+      return;
+    }
+
+  mx_widget_get_padding (MX_WIDGET (actor), &padding);
+  width = mx_list_view_get_virtual_size (list_view) +
+    padding.left + padding.right;
+
+  if (min_width_p)
+    *min_width_p = width;
+  if (natural_width_p)
+    *natural_width_p = width;
+}
+
+static void
+mx_list_view_get_preferred_height (ClutterActor *actor,
+                                   gfloat        for_width,
+                                   gfloat       *min_height_p,
+                                   gfloat       *natural_height_p)
+{
+  MxListView *list_view = MX_LIST_VIEW (actor);
+  MxPadding padding;
+  gfloat height;
+
+  if (!list_view->priv->pool.is_virtualized ||
+      mx_box_layout_get_orientation (MX_BOX_LAYOUT (actor))
+      != MX_ORIENTATION_VERTICAL)
+    {
+      CLUTTER_ACTOR_CLASS (mx_list_view_parent_class)->
+        get_preferred_height (actor, for_width, min_height_p,
+                              natural_height_p);
+      return;
+    }
+
+  mx_widget_get_padding (MX_WIDGET (actor), &padding);
+  height = mx_list_view_get_virtual_size (list_view) +
+    padding.top + padding.bottom;
+
+  if (min_height_p)
+    *min_height_p = height;
+  if (natural_height_p)
+    *natural_height_p = height;
+}
+
+static void
+mx_list_view_allocate (ClutterActor          *actor,
+                       const ClutterActorBox *box,
+                       ClutterAllocationFlags flags)
+{
+  MxListView *list_view = MX_LIST_VIEW (actor);
+  MxListViewPrivate *priv = list_view->priv;
+  MxAdjustment *adjustment, *other_adjustment;
+  gfloat avail_width, avail_height, avail, stride, for_size;
+  MxOrientation orientation;
+  MxPadding padding;
+  gint first, last;
+  guint i;
+
+  if (!priv->pool.is_virtualized)
+    {
+      CLUTTER_ACTOR_CLASS (mx_list_view_parent_class)->
+        allocate (actor, box, flags);
+      return;
+    }
+
+  /* the items are laid out here rather than by the box layout, which only
+   * knows about the realized rows */
+  CLUTTER_ACTOR_CLASS (g_type_class_peek_parent (mx_list_view_parent_class))->
+    allocate (actor, box, flags);
+
+  priv->pool.in_allocation = TRUE;
+
+  orientation = mx_box_layout_get_orientation (MX_BOX_LAYOUT (actor));
+  mx_widget_get_padding (MX_WIDGET (actor), &padding);
+
+  avail_width = box->x2 - box->x1 - padding.left - padding.right;
+  avail_height = box->y2 - box->y1 - padding.top - padding.bottom;
+
+  if (orientation == MX_ORIENTATION_VERTICAL)
+    {
+      adjustment = priv->pool.vadjustment;
+      other_adjustment = priv->pool.hadjustment;
+      avail = avail_height;
+      for_size = avail_width;
+    }
+  else
+    {
+      adjustment = priv->pool.hadjustment;
+      other_adjustment = priv->pool.vadjustment;
+      avail = avail_width;
+      for_size = avail_height;
+    }
+
+  /* the items may be a different size for a different size across them */
+  if (for_size != priv->for_size)
+    {
+      priv->for_size = for_size;
+      _mx_item_pool_queue_measure (&priv->pool);
+    }
+
+  if (adjustment)
+    {
+      gdouble step_inc, page_inc;
+
+      if (priv->item_size > 0)
+        {
+          step_inc = priv->item_size;
+          page_inc = ((gint)(avail / step_inc)) * step_inc;
+        }
+      else
+        {
+          step_inc = avail / 6;
+          page_inc = avail;
+        }
+
+      g_object_set (G_OBJECT (adjustment),
+                    "lower", 0.0,
+                    "upper", mx_list_view_get_virtual_size (list_view),
+                    "page-size", avail,
+                    "step-increment", step_inc,
+                    "page-increment", page_inc,
+                    NULL);
+    }
+
+  if (other_adjustment)
+    {
+      avail = (orientation == MX_ORIENTATION_VERTICAL) ?
+        avail_width : avail_height;
+
+      g_object_set (G_OBJECT (other_adjustment),
+                    "lower", 0.0,
+                    "upper", avail,
+                    "page-size", avail,
+                    "step-increment", avail / 6,
+                    "page-increment", avail,
+                    NULL);
+    }
+
+  stride = priv->item_size +
+    mx_box_layout_get_spacing (MX_BOX_LAYOUT (actor));
+
+  for (i = 0; i < priv->pool.items->len; i++)
+    {
+      ClutterActor *child = g_ptr_array_index (priv->pool.items, i);
+      ClutterActorBox child_box;
+      MxBoxLayoutChild *meta;
+      gint row = priv->pool.first_row + i;
+
+      if (orientation == MX_ORIENTATION_VERTICAL)
+        {
+          child_box.x1 = padding.left;
+          child_box.x2 = padding.left + avail_width;
+          child_box.y1 = (gint) (padding.top + row * stride);
+          child_box.y2 = child_box.y1 + priv->item_size;
+        }
+      else
+        {
+          child_box.x1 = (gint) (padding.left + row * stride);
+          child_box.x2 = child_box.x1 + priv->item_size;
+          child_box.y1 = padding.top;
+          child_box.y2 = padding.top + avail_height;
+        }
+
+      meta = (MxBoxLayoutChild *)
+        clutter_container_get_child_meta (CLUTTER_CONTAINER (actor), child);
+      mx_allocate_align_fill (child, &child_box, meta->x_align, meta->y_align,
+                              meta->x_fill, meta->y_fill);
+
+      clutter_actor_allocate (child, &child_box, flags);
+    }
+
+  /* the visible area may have changed size */
+  mx_list_view_get_range (actor, &first, &last);
+  if (first != priv->pool.first_row ||
+      last != priv->pool.first_row + priv->pool.items->len)
+    _mx_item_pool_queue_update (&priv->pool);
+
+  priv->pool.in_allocation = FALSE;
+}
 
 /* gobject implementations */
 
@@ -88,13 +430,16 @@ mx_list_view_get_property (GObject    *object,
   switch (property_id)
     {
     case PROP_MODEL:
-      g_value_set_object (value, priv->model);
+      g_value_set_object (value, priv->pool.model);
       break;
     case PROP_ITEM_TYPE:
-      g_value_set_gtype (value, priv->item_type);
+      g_value_set_gtype (value, priv->pool.item_type);
       break;
     case PROP_FACTORY:
-      g_value_set_object (value, priv->factory);
+      g_value_set_object (value, priv->pool.factory);
+      break;
+    case PROP_VIRTUALIZED:
+      g_value_set_boolean (value, priv->pool.is_virtualized);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -121,6 +466,10 @@ mx_list_view_set_property (GObject      *object,
       mx_list_view_set_factory ((MxListView*) object,
                                 (MxItemFactory*) g_value_get_object (value));
       break;
+    case PROP_VIRTUALIZED:
+      mx_list_view_set_virtualized ((MxListView*) object,
+                                    g_value_get_boolean (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -131,36 +480,17 @@ mx_list_view_dispose (GObject *object)
 {
   MxListViewPrivate *priv = MX_LIST_VIEW (object)->priv;
 
-  /* This will cause the unref of the model and also disconnect the signals */
-  mx_list_view_set_model (MX_LIST_VIEW (object), NULL);
-
-  if (priv->factory)
-    {
-      g_object_unref (priv->factory);
-      priv->factory = NULL;
-    }
+  _mx_item_pool_dispose (&priv->pool);
 
   G_OBJECT_CLASS (mx_list_view_parent_class)->dispose (object);
 }
 
-static void
-free_attribute (AttributeData *data)
-{
-  g_free (data->name);
-  g_free (data);
-}
-
 static void
 mx_list_view_finalize (GObject *object)
 {
   MxListViewPrivate *priv = MX_LIST_VIEW (object)->priv;
 
-  if (priv->attributes)
-    {
-      g_slist_foreach (priv->attributes, (GFunc) free_attribute, NULL);
-      g_slist_free (priv->attributes);
-      priv->attributes = NULL;
-    }
+  _mx_item_pool_finalize (&priv->pool);
 
   G_OBJECT_CLASS (mx_list_view_parent_class)->finalize (object);
 }
@@ -169,6 +499,7 @@ static void
 mx_list_view_class_init (MxListViewClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  ClutterActorClass *actor_class = CLUTTER_ACTOR_CLASS (klass);
   GParamSpec *pspec;
 
   g_type_class_add_private (klass, sizeof (MxListViewPrivate));
@@ -178,6 +509,10 @@ mx_list_view_class_init (MxListViewClass *klass)
   object_class->dispose = mx_list_view_dispose;
   object_class->finalize = mx_list_view_finalize;
 
+  actor_class->get_preferred_width = mx_list_view_get_preferred_width;
+  actor_class->get_preferred_height = mx_list_view_get_preferred_height;
+  actor_class->allocate = mx_list_view_allocate;
+
   pspec = g_param_spec_object ("model",
                                "model",
                                "The model for the item view",
@@ -203,150 +538,44 @@ mx_list_view_class_init (MxListViewClass *klass)
                                G_TYPE_OBJECT /*MX_TYPE_ITEM_FACTORY*/,
                                MX_PARAM_READWRITE);
   g_object_class_install_property (object_class, PROP_FACTORY, pspec);
-}
-
-static void
-mx_list_view_init (MxListView *list_view)
-{
-  list_view->priv = LIST_VIEW_PRIVATE (list_view);
 
-  mx_box_layout_set_orientation (MX_BOX_LAYOUT (list_view), MX_ORIENTATION_VERTICAL);
+  /**
+   * MxListView:virtualized:
+   *
+   * Whether items are only created for the rows that are visible.
+   *
+   * Since: 1.6
+   */
+  pspec = g_param_spec_boolean ("virtualized",
+                                "Virtualized",
+                                "Whether items are only created for the "
+                                "visible rows",
+                                FALSE,
+                                MX_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_VIRTUALIZED, pspec);
 }
 
-
-/* model monitors */
 static void
-model_changed_cb (ClutterModel *model,
-                  MxListView   *list_view)
+mx_list_view_style_changed (MxWidget *widget,
+                            gpointer  userdata)
 {
-  GSList *p;
-  GList *l, *children;
-  MxListViewPrivate *priv = list_view->priv;
-  ClutterModelIter *iter = NULL;
-  gint model_n = 0, child_n = 0;
-
-
-  /* bail out if we don't yet have an item type or a factory */
-  if (!priv->item_type && !priv->factory)
-    return;
-
-  if (priv->is_frozen)
-    return;
-
-  if (priv->item_type)
-    {
-      /* check the item-type is an descendant of ClutterActor */
-      if (!g_type_is_a (priv->item_type, CLUTTER_TYPE_ACTOR))
-        {
-          g_warning ("%s is not a subclass of ClutterActor and therefore"
-                     " cannot be used as items in an MxListView",
-                     g_type_name (priv->item_type));
-          return;
-        }
-    }
-
-  children = clutter_container_get_children (CLUTTER_CONTAINER (list_view));
-  child_n = g_list_length (children);
-
-  if (model)
-    model_n = clutter_model_get_n_rows (priv->model);
-  else
-    model_n = 0;
-
-  /* add children as needed */
-  while (model_n > child_n)
-    {
-      ClutterActor *new_child;
-
-      if (priv->item_type)
-        {
-          new_child = g_object_new (priv->item_type, NULL);
-        }
-      else
-        {
-          new_child = mx_item_factory_create (priv->factory);
-        }
-
-      clutter_container_add_actor (CLUTTER_CONTAINER (list_view),
-                                   new_child);
-      child_n++;
-    }
-
-  /* remove children as needed */
-  l = g_list_last (children);
-  while (child_n > model_n)
-    {
-      clutter_container_remove_actor (CLUTTER_CONTAINER (list_view),
-                                      (ClutterActor*) l->data);
-      l = g_list_previous (l);
-      child_n--;
-    }
-
-  g_list_free (children);
-
-  if (!priv->model)
-    return;
-
-  children = clutter_container_get_children (CLUTTER_CONTAINER (list_view));
-
-  /* set the properties on the children */
-  iter = clutter_model_get_first_iter (priv->model);
-  l = children;
-  while (iter && !clutter_model_iter_is_last (iter))
-    {
-      GObject *child;
-
-      child = G_OBJECT (l->data);
-
-      g_object_freeze_notify (child);
-      for (p = priv->attributes; p; p = p->next)
-        {
-          GValue value = { 0, };
-          AttributeData *attr = p->data;
-
-          clutter_model_iter_get_value (iter, attr->col, &value);
-
-          g_object_set_property (child, attr->name, &value);
-
-          g_value_unset (&value);
-        }
-      g_object_thaw_notify (child);
-
-      l = g_list_next (l);
-      clutter_model_iter_next (iter);
-    }
-
-  g_list_free (children);
-
-  if (iter)
-    g_object_unref (iter);
+  /* the items may not have been restyled yet */
+  _mx_item_pool_queue_measure (&MX_LIST_VIEW (widget)->priv->pool);
 }
 
 static void
-row_changed_cb (ClutterModel     *model,
-                ClutterModelIter *iter,
-                MxListView       *list_view)
+mx_list_view_init (MxListView *list_view)
 {
-  model_changed_cb (model, list_view);
-}
+  list_view->priv = LIST_VIEW_PRIVATE (list_view);
 
-static void
-row_removed_cb (ClutterModel     *model,
-                ClutterModelIter *iter,
-                MxListView       *list_view)
-{
-  GList *children;
-  GList *l;
-  ClutterActor *child;
+  _mx_item_pool_init (&list_view->priv->pool, CLUTTER_ACTOR (list_view),
+                      mx_list_view_measure_item, mx_list_view_get_range);
+  list_view->priv->for_size = -1;
 
-  if (list_view->priv->is_frozen)
-    return;
+  g_signal_connect (list_view, "style-changed",
+                    G_CALLBACK (mx_list_view_style_changed), NULL);
 
-  children = clutter_container_get_children (CLUTTER_CONTAINER (list_view));
-  l = g_list_nth (children, clutter_model_iter_get_row (iter));
-  child = (ClutterActor *) l->data;
-  clutter_container_remove_actor (CLUTTER_CONTAINER (list_view), child);
-  g_list_free (children);
+  mx_box_layout_set_orientation (MX_BOX_LAYOUT (list_view), MX_ORIENTATION_VERTICAL);
 }
 
 /* public api */
@@ -377,7 +606,7 @@ mx_list_view_get_item_type (MxListView *list_view)
 {
   g_return_val_if_fail (MX_IS_LIST_VIEW (list_view), G_TYPE_INVALID);
 
-  return list_view->priv->item_type;
+  return list_view->priv->pool.item_type;
 }
 
 
@@ -396,10 +625,8 @@ mx_list_view_set_item_type (MxListView *list_view,
   g_return_if_fail (MX_IS_LIST_VIEW (list_view));
   g_return_if_fail (g_type_is_a (item_type, CLUTTER_TYPE_ACTOR));
 
-  list_view->priv->item_type = item_type;
-
   /* update the view */
-  model_changed_cb (list_view->priv->model, list_view);
+  _mx_item_pool_set_item_type (&list_view->priv->pool, item_type);
 }
 
 /**
@@ -415,7 +642,7 @@ mx_list_view_get_model (MxListView *list_view)
 {
   g_return_val_if_fail (MX_IS_LIST_VIEW (list_view), NULL);
 
-  return list_view->priv->model;
+  return list_view->priv->pool.model;
 }
 
 /**
@@ -429,70 +656,10 @@ void
 mx_list_view_set_model (MxListView   *list_view,
                         ClutterModel *model)
 {
-  MxListViewPrivate *priv;
-
   g_return_if_fail (MX_IS_LIST_VIEW (list_view));
   g_return_if_fail (model == NULL || CLUTTER_IS_MODEL (model));
 
-  priv = list_view->priv;
-
-  if (priv->model)
-    {
-      g_signal_handlers_disconnect_by_func (priv->model,
-                                            (GCallback) model_changed_cb,
-                                            list_view);
-      g_signal_handlers_disconnect_by_func (priv->model,
-                                            (GCallback) row_changed_cb,
-                                            list_view);
-      g_signal_handlers_disconnect_by_func (priv->model,
-                                            (GCallback) row_removed_cb,
-                                            list_view);
-      g_object_unref (priv->model);
-
-      priv->model = NULL;
-    }
-
-  if (model)
-    {
-      g_return_if_fail (CLUTTER_IS_MODEL (model));
-
-      priv->model = g_object_ref (model);
-
-      priv->filter_changed = g_signal_connect (priv->model,
-                                               "filter-changed",
-                                               G_CALLBACK (model_changed_cb),
-                                               list_view);
-
-      priv->row_added = g_signal_connect (priv->model,
-                                          "row-added",
-                                          G_CALLBACK (row_changed_cb),
-                                          list_view);
-
-      priv->row_changed = g_signal_connect (priv->model,
-                                            "row-changed",
-                                            G_CALLBACK (row_changed_cb),
-                                            list_view);
-
-      /*
-       * model_changed_cb (called from row_changed_cb) expect the row to already
-       * have been removed, thus we need to use _after
-       */
-      priv->row_removed = g_signal_connect_after (priv->model,
-                                                  "row-removed",
-                                                  G_CALLBACK (row_removed_cb),
-                                                  list_view);
-
-      priv->sort_changed = g_signal_connect (priv->model,
-                                             "sort-changed",
-                                             G_CALLBACK (model_changed_cb),
-                                             list_view);
-
-      /*
-       * Only do this inside this block, setting the model to NULL should have
-       * the effect of preserving the view; just disconnect the handlers
-       */
-      model_changed_cb (priv->model, list_view);
-    }
+  _mx_item_pool_set_model (&list_view->priv->pool, model);
 }
 
 /**
@@ -510,21 +677,11 @@ mx_list_view_add_attribute (MxListView  *list_view,
                             const gchar *_attribute,
                             gint         column)
 {
-  MxListViewPrivate *priv;
-  AttributeData *prop;
-
   g_return_if_fail (MX_IS_LIST_VIEW (list_view));
   g_return_if_fail (_attribute != NULL);
   g_return_if_fail (column >= 0);
 
-  priv = list_view->priv;
-
-  prop = g_new (AttributeData, 1);
-  prop->name = g_strdup (_attribute);
-  prop->col = column;
-
-  priv->attributes = g_slist_prepend (priv->attributes, prop);
-  model_changed_cb (priv->model, list_view);
+  _mx_item_pool_add_attribute (&list_view->priv->pool, _attribute, column);
 }
 
 /**
@@ -537,13 +694,9 @@ mx_list_view_add_attribute (MxListView  *list_view,
 void
 mx_list_view_freeze (MxListView *list_view)
 {
-  MxListViewPrivate *priv;
-
   g_return_if_fail (MX_IS_LIST_VIEW (list_view));
 
-  priv = list_view->priv;
-
-  priv->is_frozen = TRUE;
+  _mx_item_pool_freeze (&list_view->priv->pool);
 }
 
 /**
@@ -551,21 +704,18 @@ mx_list_view_freeze (MxListView *list_view)
  * @list_view: An #MxListView
  *
  * Thaw the view. This means that the view will now act on changes to the
- * model.
+ * model. Rows that were added, changed or removed while the view was frozen
+ * are updated together, only creating, removing or setting the attributes
+ * of the children of those rows. When the model has a filter, rows that
+ * are added or changed can be filtered in or out, so the view is rebuilt
+ * for them instead.
  */
 void
 mx_list_view_thaw (MxListView *list_view)
 {
-  MxListViewPrivate *priv;
-
   g_return_if_fail (MX_IS_LIST_VIEW (list_view));
 
-  priv = list_view->priv;
-
-  priv->is_frozen = FALSE;
-
-  /* Repopulate */
-  model_changed_cb (priv->model, list_view);
+  _mx_item_pool_thaw (&list_view->priv->pool);
 }
 
 /**
@@ -579,24 +729,13 @@ void
 mx_list_view_set_factory (MxListView    *list_view,
                           MxItemFactory *factory)
 {
-  MxListViewPrivate *priv;
-
   g_return_if_fail (MX_IS_LIST_VIEW (list_view));
   g_return_if_fail (!factory || MX_IS_ITEM_FACTORY (factory));
 
-  priv = list_view->priv;
-
-  if (priv->factory == factory)
+  if (list_view->priv->pool.factory == factory)
     return;
 
-  if (priv->factory)
-    {
-      g_object_unref (priv->factory);
-      priv->factory = NULL;
-    }
-
-  if (factory)
-    priv->factory = g_object_ref (factory);
+  _mx_item_pool_set_factory (&list_view->priv->pool, factory);
 
   g_object_notify (G_OBJECT (list_view), "factory");
 }
@@ -613,5 +752,56 @@ MxItemFactory *
 mx_list_view_get_factory (MxListView *list_view)
 {
   g_return_val_if_fail (MX_IS_LIST_VIEW (list_view), NULL);
-  return list_view->priv->factory;
+  return list_view->priv->pool.factory;
+}
+
+/**
+ * mx_list_view_set_virtualized:
+ * @list_view: A #MxListView
+ * @virtualized: %TRUE to only create items for the visible rows
+ *
+ * Sets whether @list_view only creates items for the rows of the model that
+ * are visible, plus a few rows either side, rather than for every row.
+ * Items that scroll out of view are reused for the rows that scroll into
+ * view, and the attributes of an item are only set when it is bound to a
+ * different row. This makes views of large models much cheaper, but only
+ * works when all the items are the same size as the first one.
+ *
+ * The visible rows are determined by the adjustments of @list_view, so it
+ * should be placed in a #MxScrollView or similar. Only the items of the
+ * visible rows are children of @list_view.
+ *
+ * Since: 1.6
+ */
+void
+mx_list_view_set_virtualized (MxListView *list_view,
+                              gboolean    virtualized)
+{
+  g_return_if_fail (MX_IS_LIST_VIEW (list_view));
+
+  if (list_view->priv->pool.is_virtualized == virtualized)
+    return;
+
+  _mx_item_pool_set_virtualized (&list_view->priv->pool, virtualized);
+
+  g_object_notify (G_OBJECT (list_view), "virtualized");
+}
+
+/**
+ * mx_list_view_get_virtualized:
+ * @list_view: A #MxListView
+ *
+ * Gets whether @list_view only creates items for the visible rows, see
+ * mx_list_view_set_virtualized().
+ *
+ * Returns: %TRUE if @list_view is virtualized
+ *
+ * Since: 1.6
+ */
+gboolean
+mx_list_view_get_virtualized (MxListView *list_view)
+{
+  g_return_val_if_fail (MX_IS_LIST_VIEW (list_view), FALSE);
+
+  return list_view->priv->pool.is_virtualized;
 }
@@ -28,7 +28,9 @@ static GDebugKey debug_keys[] =
     {"layout", MX_DEBUG_LAYOUT},
     {"inspector", MX_DEBUG_INSPECTOR},
     {"focus", MX_DEBUG_FOCUS},
-    {"css", MX_DEBUG_CSS}
+    {"css", MX_DEBUG_CSS},
+    {"image", MX_DEBUG_IMAGE},
+    {"icon-theme", MX_DEBUG_ICON_THEME}
 };
 
 
@@ -84,11 +84,29 @@ void _mx_table_update_row_col (MxTable *table,
 
 CoglHandle _mx_window_get_icon_cogl_texture (MxWindow *window);
 
-ClutterActor * _mx_window_get_resize_grip (MxWindow *window);
+void       _mx_texture_cache_set_levels (CoglHandle  texture,
+                                         GPtrArray  *levels);
+GPtrArray *_mx_texture_cache_get_levels (CoglHandle  texture);
 
-void _mx_style_invalidate_cache (MxStylable *stylable);
+ClutterActor * _mx_window_get_resize_grip (MxWindow *window);
 
-gchar * _mx_stylable_get_style_string (MxStylable *stylable);
+/* The difference between the old and new style key of a stylable whose
+ * name, style class or pseudo-class has changed */
+typedef struct
+{
+  gboolean unknown;          /* no old key, or its parent or type differ */
+  GQuark   ids[2];           /* old and new id, if changed */
+  GQuark   classes[2];       /* old and new style class, if changed */
+  guint64  pseudo_classes;   /* pseudo-classes set or unset */
+} MxStyleChange;
+
+void     _mx_style_invalidate_cache (MxStylable *stylable);
+gboolean _mx_style_computed_style_changed (MxStylable *stylable);
+void     _mx_style_update_key (MxStylable    *stylable,
+                               MxStyleChange *change);
+gboolean _mx_style_change_affects_matches (MxStylable          *descendant,
+                                           const MxStyleChange *change);
+void     _mx_style_restyle_skipped (MxStylable *stylable);
 
 const gchar * _mx_enum_to_string (GType type,
                                   gint  value);
@@ -107,7 +125,9 @@ typedef enum
   MX_DEBUG_INSPECTOR   = 1 << 1,
   MX_DEBUG_FOCUS       = 1 << 2,
   MX_DEBUG_CSS         = 1 << 3,
-  MX_DEBUG_STYLE_CACHE = 1 << 4
+  MX_DEBUG_STYLE_CACHE = 1 << 4,
+  MX_DEBUG_IMAGE       = 1 << 5,
+  MX_DEBUG_ICON_THEME  = 1 << 6
 } MxDebugTopic;
 
 gboolean _mx_debug (gint debug);
@@ -200,82 +200,6 @@ mx_stylable_get_type (void)
   return our_type;
 }
 
-static void
-_mx_stylable_prepend_style_string (GString    *string,
-                                   MxStylable *stylable)
-{
-  GType type_id;
-  gchar *style_string;
-  const gchar *type, *id, *class, *pseudo_class;
-
-  type_id = G_OBJECT_CLASS_TYPE (G_OBJECT_GET_CLASS (stylable));
-  type = g_type_name (type_id);
-
-  id = clutter_actor_get_name ((ClutterActor*) stylable);
-
-  class = mx_stylable_get_style_class (stylable);
-
-  pseudo_class = mx_stylable_get_style_pseudo_class (stylable);
-
-  style_string = g_strconcat (type,
-                              "#", id ? id : "",
-                              ".", class ? class : "",
-                              ":", pseudo_class ? pseudo_class : "",
-                              ">",
-                              NULL);
-  g_string_prepend (string, style_string);
-  g_free (style_string);
-}
-
-gchar *
-_mx_stylable_get_style_string (MxStylable *stylable)
-{
-  GType type_id;
-  gchar *cstring;
-  GString *string;
-  const gchar *type, *id, *class, *pseudo_class;
-  ClutterActor *actor;
-  ClutterActor *parent;
-
-  /* Create a string that contains all the properties of a
-   * Stylable that can be matched against in the CSS.
-   */
-  type_id = G_OBJECT_CLASS_TYPE (G_OBJECT_GET_CLASS (stylable));
-  type = g_type_name (type_id);
-
-  actor = CLUTTER_ACTOR (stylable);
-
-  id = clutter_actor_get_name (actor);
-
-  class = mx_stylable_get_style_class (stylable);
-
-  pseudo_class = mx_stylable_get_style_pseudo_class (stylable);
-
-  string = g_string_sized_new (512);
-
-  /* Add the actor hierarchy */
-  parent = clutter_actor_get_parent (actor);
-
-  while (parent)
-    {
-      if (MX_IS_STYLABLE (parent))
-        _mx_stylable_prepend_style_string (string, (MxStylable*) parent);
-
-      parent = clutter_actor_get_parent (parent);
-    }
-
-  g_string_append_printf (string, "%s#%s.%s:%s",
-                          type,
-                          id ? id : "",
-                          class ? class : "",
-                          pseudo_class ? pseudo_class : "");
-
-  cstring = string->str;
-  g_string_free (string, FALSE);
-
-  return cstring;
-}
-
 #if 0
 void
 mx_stylable_freeze_notify (MxStylable *stylable)
@@ -1045,15 +969,17 @@ mx_stylable_style_changed_internal (MxStylable          *stylable,
                                     MxStyleChangedFlags  flags)
 {
 
+  /* the cache is invalidated even when unmapped, as the style key of this
+   * stylable may be used by its children */
+  if (flags & MX_STYLE_CHANGED_INVALIDATE_CACHE)
+    _mx_style_invalidate_cache (stylable);
+
   /* don't update stylables until they are mapped (unless ensure is set) */
   if (G_LIKELY (CLUTTER_IS_ACTOR (stylable)) &&
       !CLUTTER_ACTOR_IS_MAPPED (CLUTTER_ACTOR (stylable)) &&
       !(flags & MX_STYLE_CHANGED_FORCE))
     return;
 
-  if (flags & MX_STYLE_CHANGED_INVALIDATE_CACHE)
-    _mx_style_invalidate_cache (stylable);
-
   /* If the parent style has changed, child cache needs to be
    * invalidated. This needs to happen for internal children as
    * well, which is why it's here and not in the container block
@@ -1075,6 +1001,69 @@ mx_stylable_style_changed_internal (MxStylable          *stylable,
     }
 }
 
+typedef struct
+{
+  MxStyleChange change;
+  gboolean      children_affected;
+} MatchChange;
+
+static void
+mx_stylable_child_match_notify (ClutterActor *actor,
+                                gpointer      data)
+{
+  MatchChange *match_change = data;
+
+  if (!MX_IS_STYLABLE (actor))
+    return;
+
+  if (match_change->children_affected &&
+      _mx_style_change_affects_matches (MX_STYLABLE (actor),
+                                        &match_change->change))
+    mx_stylable_style_changed_internal (MX_STYLABLE (actor),
+                                        MX_STYLE_CHANGED_INVALIDATE_CACHE);
+  else
+    _mx_style_restyle_skipped (MX_STYLABLE (actor));
+}
+
+static void
+mx_stylable_match_changed_notify (MxStylable *stylable)
+{
+  MatchChange match_change;
+
+  /* The name, style class or pseudo-class has changed. Only restyle the
+   * stylable if it now matches different style properties, and only
+   * restyle its children if the style sheet has parent or ancestor
+   * selectors that depend on what changed.
+   */
+  if (!CLUTTER_ACTOR_IS_MAPPED (CLUTTER_ACTOR (stylable)))
+    {
+      _mx_style_invalidate_cache (stylable);
+      return;
+    }
+
+  _mx_style_update_key (stylable, &match_change.change);
+
+  match_change.children_affected =
+    _mx_style_change_affects_matches (stylable, &match_change.change);
+
+  /* internal children are restyled from the style-changed handler, so
+   * the signal is needed if they may be affected */
+  if (!match_change.children_affected &&
+      !_mx_style_computed_style_changed (stylable))
+    {
+      _mx_style_restyle_skipped (stylable);
+      return;
+    }
+
+  g_signal_emit (stylable, stylable_signals[STYLE_CHANGED], 0,
+                 MX_STYLE_CHANGED_INVALIDATE_CACHE);
+
+  if (CLUTTER_IS_CONTAINER (stylable))
+    clutter_container_foreach ((ClutterContainer *) stylable,
+                               mx_stylable_child_match_notify,
+                               &match_change);
+}
+
 /**
  * mx_stylable_style_changed:
  * @stylable: an MxStylable
@@ -1103,7 +1092,7 @@ mx_stylable_connect_change_notifiers (MxStylable *stylable)
 
   /* ClutterActor signals */
   g_signal_connect (stylable, "notify::name",
-                    G_CALLBACK (mx_stylable_property_changed_notify), NULL);
+                    G_CALLBACK (mx_stylable_match_changed_notify), NULL);
   g_signal_connect (stylable, "parent-set",
                     G_CALLBACK (mx_stylable_parent_set_notify), NULL);
 
@@ -1114,9 +1103,9 @@ mx_stylable_connect_change_notifiers (MxStylable *stylable)
 
   /* MxStylable notifiers */
   g_signal_connect (stylable, "notify::style-class",
-                    G_CALLBACK (mx_stylable_property_changed_notify), NULL);
+                    G_CALLBACK (mx_stylable_match_changed_notify), NULL);
   g_signal_connect (stylable, "notify::style-pseudo-class",
-                    G_CALLBACK (mx_stylable_property_changed_notify), NULL);
+                    G_CALLBACK (mx_stylable_match_changed_notify), NULL);
 
 }
 
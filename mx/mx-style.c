@@ -51,6 +51,13 @@ enum
   LAST_SIGNAL
 };
 
+enum
+{
+  PROP_0,
+
+  PROP_CACHE_BUDGET
+};
+
 #define MX_STYLE_GET_PRIVATE(obj) \
         (G_TYPE_INSTANCE_GET_PRIVATE ((obj), MX_TYPE_STYLE, MxStylePrivate))
 
@@ -58,6 +65,8 @@ enum
 
 #define MX_STYLE_CACHE g_style_cache_quark ()
 
+#define MX_STYLE_KEY g_style_key_quark ()
+
 /* This is the amount of entries that will be allowed per
  * stylable object.
  *
@@ -71,23 +80,66 @@ enum
  */
 #define MX_STYLE_CACHE_SIZE 6
 
-/* A style cache entry is the unique string representing all the properties
+/* A style key identifies all the properties of a stylable that can be
+ * matched against in CSS: its type, name, style class and pseudo-classes,
+ * and the key of its parent. Keys are interned, so stylables with the same
+ * properties and ancestry share a key and keys can be compared by pointer.
+ * A stylable's key is kept until its cache is invalidated and is derived
+ * from the key of its parent, rather than by walking all of its ancestors.
+ */
+typedef struct _MxStyleKey MxStyleKey;
+struct _MxStyleKey
+{
+  MxStyleKey *parent;
+  GType       type;
+  GQuark      id;
+  GQuark      class;
+  guint64     pseudo_classes;
+  GQuark      pseudo_class;   /* only set if the pseudo-classes overflowed */
+  guint       serial;         /* pseudo-class registry serial */
+
+  guint       hash;
+  gint        ref_count;
+};
+
+/* A style cache entry is the key representing all the properties
  * that can be matched against in CSS, and the matched properties themselves.
  */
 typedef struct
 {
-  gchar      *style_string;
-  gint        age;
-  GHashTable *properties;
+  MxStyleKey      *key;
+  gint             age;
+  MxComputedStyle *computed;
 } MxStyleCacheEntry;
 
+/* The approximate memory used by a cache entry itself: the entry, its
+ * queue link and hash table node, and the style key it may hold the last
+ * reference to. The computed styles of the entries are charged separately,
+ * see MxStyleCacheCharge.
+ */
+#define MX_STYLE_CACHE_ENTRY_SIZE (sizeof (MxStyleCacheEntry) + \
+                                   sizeof (GList) +             \
+                                   sizeof (MxStyleKey) +        \
+                                   3 * sizeof (gpointer))
+
+/* What the cache is charged for a computed style: its size when last
+ * measured, charged once however many entries use it.
+ */
+typedef struct
+{
+  guint n_entries;
+  gsize size;
+} MxStyleCacheCharge;
+
 /* This is the per-stylable cache store. We need a reference back to the
- * parent style so that we can maintain the count of alive stylables.
+ * parent style so that we can maintain the count of alive stylables. The
+ * computed style last looked up for the stylable is kept so that a change
+ * can be checked against it.
  */
 typedef struct
 {
-  GList   *styles;
-  gchar   *string;
+  GList           *styles;
+  MxComputedStyle *computed;
 } MxStylableCache;
 
 typedef struct {
@@ -107,12 +159,22 @@ struct _MxStylePrivate
   GQueue     *cached_matches;
   GHashTable *cache_hash;
   gint        age;
+  guint       cache_budget;
+  gsize       cache_size;
+  GHashTable *cache_charges;
+
+  guint       skipped_restyles;
+  guint       cache_hits;
+  guint       cache_misses;
+  guint       cache_evictions;
 };
 
 static guint style_signals[LAST_SIGNAL] = { 0, };
 
 static MxStyle *default_style = NULL;
 
+static GHashTable *style_keys = NULL;
+
 G_DEFINE_TYPE (MxStyle, mx_style, G_TYPE_OBJECT);
 
 static GQuark
@@ -127,6 +189,152 @@ g_style_cache_quark (void)
   return g_quark_from_static_string ("mx-style-cache-quark");
 }
 
+static GQuark
+g_style_key_quark (void)
+{
+  return g_quark_from_static_string ("mx-style-key-quark");
+}
+
+static guint
+mx_style_key_hash (gconstpointer data)
+{
+  const MxStyleKey *key = data;
+
+  return key->hash;
+}
+
+static gboolean
+mx_style_key_equal (gconstpointer a,
+                    gconstpointer b)
+{
+  const MxStyleKey *key_a = a;
+  const MxStyleKey *key_b = b;
+
+  return (key_a->parent == key_b->parent &&
+          key_a->type == key_b->type &&
+          key_a->id == key_b->id &&
+          key_a->class == key_b->class &&
+          key_a->pseudo_classes == key_b->pseudo_classes &&
+          key_a->pseudo_class == key_b->pseudo_class &&
+          key_a->serial == key_b->serial);
+}
+
+static MxStyleKey *
+mx_style_key_ref (MxStyleKey *key)
+{
+  key->ref_count ++;
+
+  return key;
+}
+
+static void
+mx_style_key_unref (MxStyleKey *key)
+{
+  if (--key->ref_count > 0)
+    return;
+
+  g_hash_table_remove (style_keys, key);
+
+  if (key->parent)
+    mx_style_key_unref (key->parent);
+
+  g_slice_free (MxStyleKey, key);
+}
+
+static MxStyleKey *
+mx_style_key_intern (MxStyleKey *template)
+{
+  MxStyleKey *key;
+
+  if (G_UNLIKELY (!style_keys))
+    style_keys = g_hash_table_new (mx_style_key_hash, mx_style_key_equal);
+
+  key = g_hash_table_lookup (style_keys, template);
+
+  if (key)
+    return mx_style_key_ref (key);
+
+  key = g_slice_dup (MxStyleKey, template);
+  key->ref_count = 1;
+
+  if (key->parent)
+    mx_style_key_ref (key->parent);
+
+  g_hash_table_insert (style_keys, key, key);
+
+  return key;
+}
+
+/* Returns the key for @stylable, which is owned by the stylable, or %NULL
+ * if its name, style class or pseudo-class, or those of a stylable parent,
+ * have never been interned. No selector can refer to those, and interning
+ * them would grow the quark table for every name an application uses, so
+ * such stylables aren't cached. */
+static MxStyleKey *
+mx_style_key_get (MxStylable *stylable)
+{
+  MxStyleKey template, *key;
+  ClutterActor *parent;
+  const gchar *id, *class, *pseudo_class;
+  guint serial;
+
+  serial = _mx_css_pseudo_class_serial ();
+
+  key = g_object_get_qdata (G_OBJECT (stylable), MX_STYLE_KEY);
+  if (key && key->serial == serial)
+    return key;
+
+  /* selectors can only match through a chain of stylable parents, so the
+   * parent key is only needed if the parent is stylable */
+  parent = clutter_actor_get_parent (CLUTTER_ACTOR (stylable));
+  if (MX_IS_STYLABLE (parent))
+    {
+      template.parent = mx_style_key_get (MX_STYLABLE (parent));
+      if (!template.parent)
+        return NULL;
+    }
+  else
+    template.parent = NULL;
+
+  id = clutter_actor_get_name (CLUTTER_ACTOR (stylable));
+  class = mx_stylable_get_style_class (stylable);
+  pseudo_class = mx_stylable_get_style_pseudo_class (stylable);
+
+  template.type = G_OBJECT_TYPE (stylable);
+  template.id = id ? g_quark_try_string (id) : 0;
+  template.class = class ? g_quark_try_string (class) : 0;
+  template.pseudo_classes = _mx_css_pseudo_class_mask (pseudo_class);
+  template.serial = serial;
+
+  if ((id && !template.id) || (class && !template.class))
+    return NULL;
+
+  /* pseudo-classes without a bit of their own are compared by name */
+  if (template.pseudo_classes & MX_CSS_PSEUDO_CLASS_OVERFLOW)
+    {
+      template.pseudo_class = g_quark_try_string (pseudo_class);
+      if (!template.pseudo_class)
+        return NULL;
+    }
+  else
+    template.pseudo_class = 0;
+
+  template.hash = template.parent ? template.parent->hash : 0;
+  template.hash = template.hash * 31 + template.type;
+  template.hash = template.hash * 31 + template.id;
+  template.hash = template.hash * 31 + template.class;
+  template.hash = template.hash * 31 + (guint) (template.pseudo_classes ^
+                                                (template.pseudo_classes >> 32));
+  template.hash = template.hash * 31 + template.pseudo_class;
+  template.hash = template.hash * 31 + template.serial;
+
+  key = mx_style_key_intern (&template);
+  g_object_set_qdata_full (G_OBJECT (stylable), MX_STYLE_KEY, key,
+                           (GDestroyNotify) mx_style_key_unref);
+
+  return key;
+}
+
 static gboolean
 mx_style_real_load_from_file (MxStyle    *style,
                                 const gchar  *filename,
@@ -182,11 +390,71 @@ mx_style_load_from_file (MxStyle    *style,
   return mx_style_real_load_from_file (style, filename, error, 0);
 }
 
+/**
+ * mx_style_load_from_compiled_file:
+ * @style: a #MxStyle
+ * @filename: filename of the compiled style sheet to load
+ * @error: a #GError or #NULL
+ *
+ * Load style information from a style sheet compiled with
+ * mx-compile-style. Compiled style sheets do not need to be parsed when
+ * loaded. If the CSS file that @filename was compiled from has changed
+ * since, the CSS file is loaded instead.
+ *
+ * returns: TRUE if the style information was loaded successfully. Returns
+ * FALSE on error.
+ *
+ * Since: 1.6
+ */
+gboolean
+mx_style_load_from_compiled_file (MxStyle      *style,
+                                  const gchar  *filename,
+                                  GError      **error)
+{
+  MxStylePrivate *priv;
+  gchar *source = NULL;
+  gboolean result;
+
+  g_return_val_if_fail (MX_IS_STYLE (style), FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+  priv = style->priv;
+
+  if (!priv->stylesheet)
+    priv->stylesheet = mx_style_sheet_new ();
+
+  if (mx_style_sheet_add_from_compiled_file (priv->stylesheet, filename,
+                                             &source))
+    {
+      /* Increment the age so we know if a style cache entry is valid */
+      priv->age ++;
+
+      g_signal_emit (style, style_signals[CHANGED], 0, NULL);
+
+      return TRUE;
+    }
+
+  /* fall back to the CSS if the compiled style sheet is out of date */
+  if (source)
+    {
+      result = mx_style_real_load_from_file (style, source, error, 0);
+      g_free (source);
+
+      return result;
+    }
+
+  g_set_error (error, MX_STYLE_ERROR, MX_STYLE_ERROR_INVALID_FILE,
+               "Invalid compiled style file '%s'", filename);
+
+  return FALSE;
+}
+
 static void
 mx_style_load (MxStyle *style)
 {
   const gchar *env_var;
   gchar *rc_file = NULL;
+  gchar *compiled_file;
   GError *error;
 
   env_var = g_getenv ("MX_RC_FILE");
@@ -202,7 +470,15 @@ mx_style_load (MxStyle *style)
 
   error = NULL;
 
-  if (g_file_test (rc_file, G_FILE_TEST_EXISTS))
+  /* prefer a compiled version of the style sheet, if one is installed */
+  compiled_file = g_strconcat (rc_file, ".cache", NULL);
+
+  if (g_file_test (compiled_file, G_FILE_TEST_EXISTS) &&
+      mx_style_load_from_compiled_file (style, compiled_file, NULL))
+    {
+      /* loaded the compiled style sheet, or the CSS if it was stale */
+    }
+  else if (g_file_test (rc_file, G_FILE_TEST_EXISTS))
     {
       /* load the default theme with lowest priority */
       if (!mx_style_real_load_from_file (style, rc_file, &error, 0))
@@ -214,18 +490,19 @@ mx_style_load (MxStyle *style)
         }
     }
 
+  g_free (compiled_file);
   g_free (rc_file);
 }
 
 static MxStyleCacheEntry *
-mx_style_cache_entry_new (const gchar *style_string,
-                          GHashTable  *properties,
-                          gint         age)
+mx_style_cache_entry_new (MxStyleKey      *key,
+                          MxComputedStyle *computed,
+                          gint             age)
 {
   MxStyleCacheEntry *entry = g_slice_new (MxStyleCacheEntry);
 
-  entry->style_string = g_strdup (style_string);
-  entry->properties = properties;
+  entry->key = mx_style_key_ref (key);
+  entry->computed = computed;
   entry->age = age;
 
   return entry;
@@ -235,12 +512,113 @@ static void
 mx_style_cache_entry_free (MxStyleCacheEntry *entry,
                            gboolean           free_struct)
 {
-  g_free (entry->style_string);
-  g_hash_table_unref (entry->properties);
+  mx_style_key_unref (entry->key);
+  mx_computed_style_unref (entry->computed);
   if (free_struct)
     g_slice_free (MxStyleCacheEntry, entry);
 }
 
+static void
+mx_style_cache_charge_free (MxStyleCacheCharge *charge)
+{
+  g_slice_free (MxStyleCacheCharge, charge);
+}
+
+/* Measures @computed again if the cache is charged for it, as its diffs
+ * grow when it is compared with other computed styles */
+static void
+mx_style_cache_recharge (MxStyle         *style,
+                         MxComputedStyle *computed)
+{
+  MxStylePrivate *priv = style->priv;
+  MxStyleCacheCharge *charge;
+
+  charge = g_hash_table_lookup (priv->cache_charges, computed);
+  if (!charge)
+    return;
+
+  priv->cache_size -= charge->size;
+  charge->size = mx_computed_style_get_size (computed);
+  priv->cache_size += charge->size;
+}
+
+/* Charges the cache for @entry, which is being added to it */
+static void
+mx_style_cache_charge_entry (MxStyle           *style,
+                             MxStyleCacheEntry *entry)
+{
+  MxStylePrivate *priv = style->priv;
+  MxStyleCacheCharge *charge;
+
+  priv->cache_size += MX_STYLE_CACHE_ENTRY_SIZE;
+
+  charge = g_hash_table_lookup (priv->cache_charges, entry->computed);
+  if (!charge)
+    {
+      charge = g_slice_new0 (MxStyleCacheCharge);
+      g_hash_table_insert (priv->cache_charges, entry->computed, charge);
+    }
+
+  charge->n_entries ++;
+  mx_style_cache_recharge (style, entry->computed);
+}
+
+/* Stops charging the cache for @entry, which is being removed from it */
+static void
+mx_style_cache_discharge_entry (MxStyle           *style,
+                                MxStyleCacheEntry *entry)
+{
+  MxStylePrivate *priv = style->priv;
+  MxStyleCacheCharge *charge;
+
+  priv->cache_size -= MX_STYLE_CACHE_ENTRY_SIZE;
+
+  charge = g_hash_table_lookup (priv->cache_charges, entry->computed);
+  if (charge && --charge->n_entries == 0)
+    {
+      priv->cache_size -= charge->size;
+      g_hash_table_remove (priv->cache_charges, entry->computed);
+    }
+}
+
+static void
+mx_style_get_gobject_property (GObject    *object,
+                               guint       property_id,
+                               GValue     *value,
+                               GParamSpec *pspec)
+{
+  MxStyle *style = MX_STYLE (object);
+
+  switch (property_id)
+    {
+    case PROP_CACHE_BUDGET:
+      g_value_set_uint (value, mx_style_get_cache_budget (style));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+mx_style_set_gobject_property (GObject      *object,
+                               guint         property_id,
+                               const GValue *value,
+                               GParamSpec   *pspec)
+{
+  MxStyle *style = MX_STYLE (object);
+
+  switch (property_id)
+    {
+    case PROP_CACHE_BUDGET:
+      mx_style_set_cache_budget (style, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
 static void
 mx_style_finalize (GObject *gobject)
 {
@@ -251,6 +629,7 @@ mx_style_finalize (GObject *gobject)
   while (g_queue_get_length (priv->cached_matches))
     mx_style_cache_entry_free (g_queue_pop_head (priv->cached_matches), TRUE);
   g_queue_free (priv->cached_matches);
+  g_hash_table_unref (priv->cache_charges);
 
   G_OBJECT_CLASS (mx_style_parent_class)->finalize (gobject);
 }
@@ -262,8 +641,29 @@ mx_style_class_init (MxStyleClass *klass)
 
   g_type_class_add_private (klass, sizeof (MxStylePrivate));
 
+  gobject_class->get_property = mx_style_get_gobject_property;
+  gobject_class->set_property = mx_style_set_gobject_property;
   gobject_class->finalize = mx_style_finalize;
 
+  /**
+   * MxStyle:cache-budget:
+   *
+   * The approximate size in bytes that the cache of matched style
+   * properties may grow to, or 0 for no limit other than the number of
+   * stylables using the style.
+   *
+   * Since: 1.6
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_CACHE_BUDGET,
+                                   g_param_spec_uint ("cache-budget",
+                                                      "Cache budget",
+                                                      "Approximate size in "
+                                                      "bytes of the style "
+                                                      "property cache.",
+                                                      0, G_MAXUINT, 0,
+                                                      MX_PARAM_READWRITE));
+
   /**
    * MxStyle::changed:
    *
@@ -290,7 +690,10 @@ mx_style_init (MxStyle *style)
   style->priv = priv = MX_STYLE_GET_PRIVATE (style);
 
   priv->cached_matches = g_queue_new ();
-  priv->cache_hash = g_hash_table_new (g_str_hash, g_str_equal);
+  priv->cache_hash = g_hash_table_new (NULL, NULL);
+  priv->cache_charges =
+    g_hash_table_new_full (NULL, NULL, NULL,
+                           (GDestroyNotify) mx_style_cache_charge_free);
 
   mx_style_load (style);
 }
@@ -330,12 +733,17 @@ mx_style_get_default (void)
 }
 
 
-static void
+/* Returns FALSE if the transformed value depends on state other than the
+ * string, and so cannot be stored with the style sheet value.
+ */
+static gboolean
 mx_style_transform_css_value (MxStyleSheetValue *css_value,
                               MxStylable        *stylable,
                               GParamSpec        *pspec,
                               GValue            *value)
 {
+  gboolean cacheable = TRUE;
+
   if (pspec->value_type == G_TYPE_INT)
     {
       g_value_init (value, pspec->value_type);
@@ -350,6 +758,9 @@ mx_style_transform_css_value (MxStyleSheetValue *css_value,
               ClutterBackend *backend = clutter_get_default_backend ();
               gdouble res = clutter_backend_get_resolution (backend);
               number = number * res / 72.0;
+
+              /* the resolution can change at run-time */
+              cacheable = FALSE;
             }
 
           g_value_set_int (value, number);
@@ -390,7 +801,7 @@ mx_style_transform_css_value (MxStyleSheetValue *css_value,
       if (!g_strcmp0 (css_value->string, "none"))
         {
           g_value_set_string (value, NULL);
-          return;
+          return cacheable;
         }
 
 
@@ -458,6 +869,29 @@ mx_style_transform_css_value (MxStyleSheetValue *css_value,
         }
       g_value_unset (&strval);
     }
+
+  return cacheable;
+}
+
+static void
+mx_style_get_css_value (MxStyleSheetValue *css_value,
+                        MxStylable        *stylable,
+                        GParamSpec        *pspec,
+                        GValue            *value)
+{
+  const GValue *typed_value;
+
+  /* the style sheet value keeps the result of the last transformation to
+   * each type, so that it is only parsed once */
+  typed_value = mx_style_sheet_value_get_typed (css_value, pspec->value_type);
+
+  if (typed_value)
+    {
+      g_value_init (value, pspec->value_type);
+      g_value_copy (typed_value, value);
+    }
+  else if (mx_style_transform_css_value (css_value, stylable, pspec, value))
+    mx_style_sheet_value_set_typed (css_value, value);
 }
 
 
@@ -513,45 +947,183 @@ mx_style_stylable_cache_free (MxStylableCache *cache)
       cache->styles = g_list_delete_link (cache->styles, cache->styles);
     }
 
-  g_free (cache->string);
+  if (cache->computed)
+    mx_computed_style_unref (cache->computed);
+
   g_slice_free (MxStylableCache, cache);
 }
 
 void
 _mx_style_invalidate_cache (MxStylable *stylable)
 {
-  GObject *object = G_OBJECT (stylable);
-  MxStylableCache *cache = g_object_get_qdata (object, MX_STYLE_CACHE);
+  /* Drop the style key, it is recreated when next needed */
+  g_object_set_qdata (G_OBJECT (stylable), MX_STYLE_KEY, NULL);
+}
 
-  /* Reset the cache string */
-  if (cache)
+/*
+ * _mx_style_update_key:
+ * @stylable: a #MxStylable
+ * @change: (out): the difference between the old and new style key
+ *
+ * Invalidates the cache of @stylable like _mx_style_invalidate_cache(),
+ * but recreates its style key straight away to work out what has changed.
+ */
+void
+_mx_style_update_key (MxStylable    *stylable,
+                      MxStyleChange *change)
+{
+  MxStyleKey *old_key, *new_key;
+
+  memset (change, 0, sizeof (MxStyleChange));
+
+  old_key = g_object_get_qdata (G_OBJECT (stylable), MX_STYLE_KEY);
+  if (old_key)
+    mx_style_key_ref (old_key);
+
+  _mx_style_invalidate_cache (stylable);
+  new_key = mx_style_key_get (stylable);
+
+  if (!old_key || !new_key ||
+      old_key->parent != new_key->parent ||
+      old_key->type != new_key->type)
+    change->unknown = TRUE;
+  else
     {
-      g_free (cache->string);
-      cache->string = NULL;
+      if (old_key->id != new_key->id)
+        {
+          change->ids[0] = old_key->id;
+          change->ids[1] = new_key->id;
+        }
+
+      if (old_key->class != new_key->class)
+        {
+          change->classes[0] = old_key->class;
+          change->classes[1] = new_key->class;
+        }
+
+      change->pseudo_classes = old_key->pseudo_classes ^
+                               new_key->pseudo_classes;
+      if (old_key->pseudo_class != new_key->pseudo_class)
+        change->pseudo_classes |= MX_CSS_PSEUDO_CLASS_OVERFLOW;
     }
+
+  if (old_key)
+    mx_style_key_unref (old_key);
 }
 
-static GHashTable *
-mx_style_get_style_sheet_properties (MxStyle    *style,
-                                     MxStylable *stylable)
+/*
+ * _mx_style_change_affects_matches:
+ * @descendant: a #MxStylable
+ * @change: a change to an ancestor of @descendant
+ *
+ * Checks whether the style sheet of @descendant has parent or ancestor
+ * selectors that refer to anything in @change.
+ *
+ * Returns: %FALSE if @descendant will match the same selectors
+ */
+gboolean
+_mx_style_change_affects_matches (MxStylable          *descendant,
+                                  const MxStyleChange *change)
+{
+  MxStyleSheet *sheet;
+  MxStyle *style;
+
+  if (change->unknown)
+    return TRUE;
+
+  style = mx_stylable_get_style (descendant);
+  if (!style || !style->priv->stylesheet)
+    return TRUE;
+
+  sheet = style->priv->stylesheet;
+
+  return (mx_style_sheet_has_ancestor_dependency (sheet,
+                                                  change->ids[0],
+                                                  change->classes[0],
+                                                  change->pseudo_classes) ||
+          mx_style_sheet_has_ancestor_dependency (sheet,
+                                                  change->ids[1],
+                                                  change->classes[1],
+                                                  0));
+}
+
+/*
+ * _mx_style_restyle_skipped:
+ * @stylable: a #MxStylable
+ *
+ * Records that a style change was not propagated to @stylable, as it could
+ * not have changed its style.
+ */
+void
+_mx_style_restyle_skipped (MxStylable *stylable)
+{
+  MxStyle *style = mx_stylable_get_style (stylable);
+
+  if (style)
+    style->priv->skipped_restyles ++;
+}
+
+/* Evicts the least recently used entries until the cache is within both the
+ * per-stylable limit and the byte budget. The entry at the head of the
+ * queue, which has just been looked up, is always kept. Evicting an entry
+ * frees its computed style if no other entry or stylable uses it.
+ */
+static void
+mx_style_cache_trim (MxStyle *style)
+{
+  MxStylePrivate *priv = style->priv;
+  guint max_entries;
+
+  max_entries = MAX (priv->alive_stylables * MX_STYLE_CACHE_SIZE, 1);
+
+  while (priv->cached_matches->length > 1 &&
+         (priv->cached_matches->length > max_entries ||
+          (priv->cache_budget && priv->cache_size > priv->cache_budget)))
+    {
+      MxStyleCacheEntry *old_entry = g_queue_pop_tail (priv->cached_matches);
+
+      g_hash_table_remove (priv->cache_hash, old_entry->key);
+      mx_style_cache_discharge_entry (style, old_entry);
+      mx_style_cache_entry_free (old_entry, TRUE);
+
+      priv->cache_evictions ++;
+    }
+}
+
+/* Keeps @computed as the computed style last looked up for @stylable */
+static void
+mx_style_stylable_cache_set_computed (MxStylableCache *cache,
+                                      MxComputedStyle *computed)
+{
+  if (cache->computed != computed)
+    {
+      if (cache->computed)
+        mx_computed_style_unref (cache->computed);
+      cache->computed = mx_computed_style_ref (computed);
+    }
+}
+
+static MxComputedStyle *
+mx_style_get_computed_style (MxStyle    *style,
+                             MxStylable *stylable)
 {
   GList *entry_link;
   MxStylableCache *cache;
+  MxStyleKey *key;
 
   MxStyleCacheEntry *entry = NULL;
   MxStylePrivate *priv = style->priv;
 
+  /* Make sure that the style key is up-to-date. It is dropped when
+   * invalidating the stylable's cache.
+   */
+  key = mx_style_key_get (stylable);
+
   /* see if we have a cached style and return that if possible */
   cache = g_object_get_qdata (G_OBJECT (stylable), MX_STYLE_CACHE);
 
   if (cache)
     {
-      /* Make sure that the style string is up-to-date. We set this
-       * to NULL when invalidating the stylable's cache.
-       */
-      if (!cache->string)
-        cache->string = _mx_stylable_get_style_string (stylable);
-
       /* Check that the stylable has a reference to us. If the stylable
        * cache struct was created by another style, we need to add ourselves
        * to the list.
@@ -570,7 +1142,6 @@ mx_style_get_style_sheet_properties (MxStyle    *style,
        * properties, initialise a cache.
        */
       cache = g_slice_new0 (MxStylableCache);
-      cache->string = _mx_stylable_get_style_string (stylable);
       cache->styles = g_list_prepend (NULL, style);
 
       /* Increase the alive-stylables count and add a weak reference so we
@@ -587,61 +1158,232 @@ mx_style_get_style_sheet_properties (MxStyle    *style,
                                (GDestroyNotify)mx_style_stylable_cache_free);
     }
 
-  if ((entry_link = g_hash_table_lookup (priv->cache_hash, cache->string)))
+  /* stylables without a key are matched every time */
+  if (!key)
+    {
+      MxComputedStyle *computed =
+        mx_style_sheet_get_computed_style (priv->stylesheet, stylable);
+
+      priv->cache_misses ++;
+      mx_style_stylable_cache_set_computed (cache, computed);
+
+      return computed;
+    }
+
+  if ((entry_link = g_hash_table_lookup (priv->cache_hash, key)))
     {
       entry = entry_link->data;
 
       /* If the entry is old, remove it from the cache */
       if (entry->age != priv->age)
         {
-          g_hash_table_remove (priv->cache_hash, entry->style_string);
+          g_hash_table_remove (priv->cache_hash, entry->key);
           g_queue_delete_link (priv->cached_matches, entry_link);
+          mx_style_cache_discharge_entry (style, entry);
           mx_style_cache_entry_free (entry, TRUE);
           entry = NULL;
         }
-
-      /* As the cache is rarely emptied, FIFO is good enough for the
-       * eviction strategy (preferring speedy retrieval to efficient
-       * eviction)
-       *
-       * If we did want LRU though, for example, here would be the place
-       * to do it. You could remove the link from the queue using
-       * g_queue_unlink() and reinsert it with g_queue_push_head_link()
-       */
+      else if (entry_link != priv->cached_matches->head)
+        {
+          /* Move the entry to the front of the queue, so that the least
+           * recently used entries are evicted first. The link is reused,
+           * so the hash table stays valid.
+           */
+          g_queue_unlink (priv->cached_matches, entry_link);
+          g_queue_push_head_link (priv->cached_matches, entry_link);
+        }
     }
 
   /* No cached style properties were found, or the entry found is out of date,
    * so look them up from the style-sheet and (re-)add them to the cache.
    */
-  if (!entry || (entry->age != priv->age))
+  if (entry)
+    priv->cache_hits ++;
+  else
     {
-      /* Look up style properties */
-      GHashTable *properties = mx_style_sheet_get_properties (priv->stylesheet,
-                                                              stylable);
+      /* Look up style properties, stylables with the same matches share
+       * the computed style */
+      MxComputedStyle *computed =
+        mx_style_sheet_get_computed_style (priv->stylesheet, stylable);
 
       /* Append this to the style cache */
-      entry = mx_style_cache_entry_new (cache->string, properties, priv->age);
+      entry = mx_style_cache_entry_new (key, computed, priv->age);
       g_queue_push_head (priv->cached_matches, entry);
-      g_hash_table_insert (priv->cache_hash, entry->style_string,
+      g_hash_table_insert (priv->cache_hash, entry->key,
                            priv->cached_matches->head);
+      mx_style_cache_charge_entry (style, entry);
 
-      /* Shrink the cache if its grown too large */
-      while (g_queue_get_length (priv->cached_matches) >
-             (priv->alive_stylables * MX_STYLE_CACHE_SIZE))
-        {
-          MxStyleCacheEntry *old_entry =
-            g_queue_pop_tail (priv->cached_matches);
+      priv->cache_misses ++;
 
-          g_hash_table_remove (priv->cache_hash, old_entry->style_string);
-          mx_style_cache_entry_free (old_entry, TRUE);
-        }
+      /* Shrink the cache if its grown too large */
+      mx_style_cache_trim (style);
 
       MX_NOTE (STYLE_CACHE, "(%p) Cache size: %d, (Max-size: %d)",
                style, g_queue_get_length (priv->cached_matches),
                priv->alive_stylables * MX_STYLE_CACHE_SIZE);
     }
 
-  return entry->properties ? g_hash_table_ref (entry->properties) : NULL;
+  mx_style_stylable_cache_set_computed (cache, entry->computed);
+
+  return mx_computed_style_ref (entry->computed);
+}
+
+static GHashTable *
+mx_style_get_style_sheet_properties (MxStyle    *style,
+                                     MxStylable *stylable)
+{
+  MxComputedStyle *computed;
+  GHashTable *properties;
+
+  computed = mx_style_get_computed_style (style, stylable);
+  properties = g_hash_table_ref (mx_computed_style_get_properties (computed));
+  mx_computed_style_unref (computed);
+
+  return properties;
+}
+
+/*
+ * _mx_style_computed_style_changed:
+ * @stylable: a #MxStylable
+ *
+ * Checks whether the style properties matched for @stylable differ from
+ * the ones it last looked up, after something it is matched on changed.
+ *
+ * Returns: %FALSE if @stylable would get the same style properties
+ */
+gboolean
+_mx_style_computed_style_changed (MxStylable *stylable)
+{
+  MxComputedStyle *old_computed, *new_computed;
+  const GPtrArray *changed;
+  MxStylableCache *cache;
+  MxStyle *style;
+  gboolean result;
+
+  style = mx_stylable_get_style (stylable);
+  cache = g_object_get_qdata (G_OBJECT (stylable), MX_STYLE_CACHE);
+
+  if (!style || !style->priv->stylesheet || !cache || !cache->computed)
+    return TRUE;
+
+  old_computed = mx_computed_style_ref (cache->computed);
+  new_computed = mx_style_get_computed_style (style, stylable);
+
+  changed = mx_computed_style_diff (old_computed, new_computed);
+  result = (!changed || changed->len > 0);
+
+  /* the diff is kept with the old computed style */
+  mx_style_cache_recharge (style, old_computed);
+
+  MX_NOTE (STYLE_CACHE, "(%p) Computed style of %s %s", style,
+           G_OBJECT_TYPE_NAME (stylable), result ? "changed" : "unchanged");
+
+  mx_computed_style_unref (new_computed);
+  mx_computed_style_unref (old_computed);
+
+  return result;
+}
+
+/**
+ * mx_style_get_skipped_restyles:
+ * @style: a #MxStyle
+ *
+ * Gets the number of times a stylable using @style was not sent the
+ * #MxStylable::style-changed signal after a change to its name, style
+ * class or pseudo-class, or to those of an ancestor, because the style
+ * sheet showed that its style could not have changed. The descendants of
+ * such a stylable are not restyled either and are not counted.
+ *
+ * Returns: the number of skipped restyles
+ *
+ * Since: 1.6
+ */
+guint
+mx_style_get_skipped_restyles (MxStyle *style)
+{
+  g_return_val_if_fail (MX_IS_STYLE (style), 0);
+
+  return style->priv->skipped_restyles;
+}
+
+/**
+ * mx_style_set_cache_budget:
+ * @style: a #MxStyle
+ * @budget: the budget in bytes, or 0 for no budget
+ *
+ * Limits the approximate memory used by the cache of style properties
+ * matched for stylables. This includes the property tables of the cache
+ * entries, each counted once however many entries share it. The least
+ * recently used entries are evicted first. The cache is also limited by
+ * the number of stylables using @style, whether or not a budget is set.
+ *
+ * Since: 1.6
+ */
+void
+mx_style_set_cache_budget (MxStyle *style,
+                           guint    budget)
+{
+  MxStylePrivate *priv;
+
+  g_return_if_fail (MX_IS_STYLE (style));
+
+  priv = style->priv;
+
+  if (priv->cache_budget != budget)
+    {
+      priv->cache_budget = budget;
+
+      if (budget && !g_queue_is_empty (priv->cached_matches))
+        mx_style_cache_trim (style);
+
+      g_object_notify (G_OBJECT (style), "cache-budget");
+    }
+}
+
+/**
+ * mx_style_get_cache_budget:
+ * @style: a #MxStyle
+ *
+ * Gets the budget set with mx_style_set_cache_budget().
+ *
+ * Returns: the budget in bytes, or 0 if there is no budget
+ *
+ * Since: 1.6
+ */
+guint
+mx_style_get_cache_budget (MxStyle *style)
+{
+  g_return_val_if_fail (MX_IS_STYLE (style), 0);
+
+  return style->priv->cache_budget;
+}
+
+/**
+ * mx_style_get_cache_stats:
+ * @style: a #MxStyle
+ * @stats: (out): return location for the statistics
+ *
+ * Gets statistics about the cache of style properties matched for
+ * stylables, counted since @style was created.
+ *
+ * Since: 1.6
+ */
+void
+mx_style_get_cache_stats (MxStyle           *style,
+                          MxStyleCacheStats *stats)
+{
+  MxStylePrivate *priv;
+
+  g_return_if_fail (MX_IS_STYLE (style));
+  g_return_if_fail (stats != NULL);
+
+  priv = style->priv;
+
+  stats->hits = priv->cache_hits;
+  stats->misses = priv->cache_misses;
+  stats->evictions = priv->cache_evictions;
+  stats->n_entries = g_queue_get_length (priv->cached_matches);
+  stats->size = priv->cache_size;
 }
 
 /**
@@ -685,7 +1427,7 @@ mx_style_get_property (MxStyle    *style,
           mx_stylable_get_default_value (stylable, pspec->name, value);
         }
       else
-        mx_style_transform_css_value (css_value, stylable, pspec, value);
+        mx_style_get_css_value (css_value, stylable, pspec, value);
 
       g_hash_table_unref (properties);
     }
@@ -750,7 +1492,7 @@ mx_style_get_valist (MxStyle     *style,
               mx_stylable_get_default_value (stylable, pspec->name, &value);
             }
           else
-            mx_style_transform_css_value (css_value, stylable, pspec, &value);
+            mx_style_get_css_value (css_value, stylable, pspec, &value);
 
           G_VALUE_LCOPY (&value, va_args, 0, &error);
 
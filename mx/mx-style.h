@@ -48,6 +48,29 @@ typedef struct _MxStyleClass          MxStyleClass;
 typedef struct _MxStylable            MxStylable; /* dummy typedef */
 typedef struct _MxStylableIface       MxStylableIface;
 
+/**
+ * MxStyleCacheStats:
+ * @hits: the number of lookups answered from the cache
+ * @misses: the number of lookups matched against the style sheet
+ * @evictions: the number of entries evicted to keep the cache within its
+ *   limits
+ * @n_entries: the number of entries in the cache
+ * @size: the approximate size of the cache in bytes
+ *
+ * Statistics about the style property cache of a #MxStyle, see
+ * mx_style_get_cache_stats().
+ *
+ * Since: 1.6
+ */
+typedef struct
+{
+  guint hits;
+  guint misses;
+  guint evictions;
+  guint n_entries;
+  gsize size;
+} MxStyleCacheStats;
+
 typedef enum { /*< prefix=MX_STYLE_ERROR >*/
   MX_STYLE_ERROR_INVALID_FILE
 } MxStyleError;
@@ -88,6 +111,9 @@ MxStyle *mx_style_new         (void);
 gboolean mx_style_load_from_file (MxStyle      *style,
                                   const gchar  *filename,
                                   GError      **error);
+gboolean mx_style_load_from_compiled_file (MxStyle      *style,
+                                           const gchar  *filename,
+                                           GError      **error);
 void     mx_style_get_property   (MxStyle      *style,
                                   MxStylable   *stylable,
                                   GParamSpec   *pspec,
@@ -101,6 +127,14 @@ void     mx_style_get_valist     (MxStyle      *style,
                                   const gchar  *first_property_name,
                                   va_list       va_args);
 
+guint    mx_style_get_skipped_restyles (MxStyle *style);
+
+void     mx_style_set_cache_budget (MxStyle           *style,
+                                    guint              budget);
+guint    mx_style_get_cache_budget (MxStyle           *style);
+void     mx_style_get_cache_stats  (MxStyle           *style,
+                                    MxStyleCacheStats *stats);
+
 G_END_DECLS
 
 #endif /* __MX_STYLE_H__ */
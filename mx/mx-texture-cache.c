@@ -37,8 +37,10 @@
 #include <glib-object.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "mx-texture-cache.h"
+#include "mx-image-cache.h"
 #include "mx-marshal.h"
 #include "mx-private.h"
 
@@ -53,21 +55,104 @@ struct _MxTextureCachePrivate
 {
   GHashTable *cache;
   GRegex     *is_uri;
+
+  /* asynchronous loads in progress, by URI */
+  GHashTable *pending;
+
+  /* live textures created by the cache, counted by the serial of the item
+   * or meta entry they show */
+  GHashTable *users;
+
+  guint       use_atlas : 1;
+  GList      *atlas_pages;
+
+  GList      *image_caches;
+
+  /* the items outside atlas pages, most recently used first */
+  GQueue      lru;
+
+  guint       clock;
+  guint       evict_serial;
+  guint       budget;
+  gsize       size;
+  gsize       peak_size;
+  guint       evictions;
 };
 
-typedef struct FinalizedClosure
+/* An asynchronous load of a URI. The image is decoded into a pixbuf in a
+ * thread and uploaded from an idle handler on the main loop, where the
+ * textures requested while the load was in progress are then set.
+ */
+typedef struct
 {
+  MxTextureCache *cache;
   gchar          *uri;
+  gchar          *filename;
+
+  /* ClutterTextures waiting for the load, only used on the main thread */
+  GSList         *textures;
+
+  GdkPixbuf      *pixbuf;
+  GError         *error;
+} MxTextureCacheAsyncData;
+
+typedef struct FinalizedClosure
+{
+  guint           serial;
   MxTextureCache *cache;
 } FinalizedClosure;
 
 enum
 {
   PROP_0,
+
+  PROP_BUDGET,
+  PROP_USE_ATLAS
 };
 
+enum
+{
+  LOADED,
+  ERROR_LOADING,
+
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0, };
+
 static MxTextureCache* __cache_singleton = NULL;
 
+static GThreadPool *mx_texture_cache_threads = NULL;
+
+/* Images no larger than this in either dimension are packed into atlas
+ * pages when the atlas is enabled */
+#define MX_TEXTURE_CACHE_ATLAS_MAX_IMAGE_SIZE 128
+#define MX_TEXTURE_CACHE_ATLAS_PAGE_SIZE      512
+
+/* A shelf is a row of images of similar height in an atlas page, filled
+ * from left to right. Shelves are stacked from the top of the page. */
+typedef struct
+{
+  gint y;
+  gint height;
+  gint x;
+} MxTextureCacheAtlasShelf;
+
+typedef struct
+{
+  MxTextureCache *cache;
+  CoglHandle      texture;
+  GArray         *shelves;
+  gint            height;     /* height used by the shelves */
+  GQueue          items;      /* items with a sub-texture of the page */
+  gsize           size;
+
+  /* used to pick a page to evict */
+  guint           last_used;
+  guint           evict_serial; /* the eviction in_use was checked for */
+  guint           in_use : 1;
+} MxTextureCacheAtlasPage;
+
 /*
  * Convention: posX with a value of -1 indicates whole texture
  */
@@ -77,21 +162,76 @@ typedef struct MxTextureCacheItem {
   int           posX, posY;
   CoglHandle    ptr;
   GHashTable   *meta;
+
+  guint         serial;      /* identifies the item to textures using it */
+  guint         last_used;
+  gsize         size;        /* estimated GPU memory of ptr and meta */
+  guint         sub_texture : 1;
+
+  const gchar  *uri;         /* the key of the item in the cache */
+  GQueue       *lru;         /* the queue lru_link is in, if any */
+  GList         lru_link;
+
+  MxTextureCacheAtlasPage *page;
+  GList         page_link;
 } MxTextureCacheItem;
 
+/* An image cache file loaded with mx_texture_cache_load_cache(). The file
+ * is mapped and its entries are looked up when an image is first requested.
+ */
+typedef struct
+{
+  GMappedFile              *mapped;
+  gchar                    *filename;
+  gchar                    *dirname;
+
+  const MxImageCachePage   *pages;
+  guint                     n_pages;
+  const MxImageCacheEntry  *entries;
+  guint                     n_entries;
+  const gchar              *strings;
+  guint                     strings_size;
+
+  /* the full size pages, loaded when first used, and the pages that could
+   * not be loaded */
+  CoglHandle               *page_textures;
+  guint8                   *page_failed;
+} MxTextureCacheFile;
+
 typedef struct
 {
   gpointer        ident;
   CoglHandle     *texture;
   GDestroyNotify  destroy_func;
+  guint           serial;
 } MxTextureCacheMetaEntry;
 
+static guint
+mx_texture_cache_next_serial (void)
+{
+  static guint serial = 0;
+
+  return ++serial;
+}
+
 static MxTextureCacheItem *
 mx_texture_cache_item_new (void)
 {
-  return g_slice_new0 (MxTextureCacheItem);
+  MxTextureCacheItem *item = g_slice_new0 (MxTextureCacheItem);
+
+  item->serial = mx_texture_cache_next_serial ();
+  item->lru_link.data = item;
+  item->page_link.data = item;
+
+  return item;
 }
 
+static void mx_texture_cache_atlas_page_remove_item (MxTextureCacheAtlasPage *page,
+                                                     MxTextureCacheItem      *item);
+static MxTextureCacheItem *
+mx_texture_cache_get_item_from_files (MxTextureCache *self,
+                                      const gchar    *uri);
+
 static void
 mx_texture_cache_item_free (MxTextureCacheItem *item)
 {
@@ -101,6 +241,12 @@ mx_texture_cache_item_free (MxTextureCacheItem *item)
   if (item->meta)
     g_hash_table_unref (item->meta);
 
+  if (item->lru)
+    g_queue_unlink (item->lru, &item->lru_link);
+
+  if (item->page)
+    mx_texture_cache_atlas_page_remove_item (item->page, item);
+
   g_slice_free (MxTextureCacheItem, item);
 }
 
@@ -112,6 +258,16 @@ mx_texture_cache_set_property (GObject      *object,
 {
   switch (prop_id)
     {
+    case PROP_BUDGET:
+      mx_texture_cache_set_budget (MX_TEXTURE_CACHE (object),
+                                   g_value_get_uint (value));
+      break;
+
+    case PROP_USE_ATLAS:
+      mx_texture_cache_set_use_atlas (MX_TEXTURE_CACHE (object),
+                                      g_value_get_boolean (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -126,12 +282,40 @@ mx_texture_cache_get_property (GObject    *object,
 {
   switch (prop_id)
     {
+    case PROP_BUDGET:
+      g_value_set_uint (value,
+                        mx_texture_cache_get_budget (MX_TEXTURE_CACHE (object)));
+      break;
+
+    case PROP_USE_ATLAS:
+      g_value_set_boolean (value,
+                           mx_texture_cache_get_use_atlas (MX_TEXTURE_CACHE (object)));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
     }
 }
 
+static void
+mx_texture_cache_file_free (MxTextureCacheFile *file)
+{
+  guint i;
+
+  for (i = 0; i < file->n_pages; i++)
+    if (file->page_textures[i])
+      cogl_handle_unref (file->page_textures[i]);
+
+  g_free (file->page_textures);
+  g_free (file->page_failed);
+  g_free (file->filename);
+  g_free (file->dirname);
+  g_mapped_file_unref (file->mapped);
+
+  g_slice_free (MxTextureCacheFile, file);
+}
+
 static void
 mx_texture_cache_dispose (GObject *object)
 {
@@ -150,6 +334,17 @@ mx_texture_cache_finalize (GObject *object)
   if (priv->is_uri)
     g_regex_unref (priv->is_uri);
 
+  /* pending loads hold a reference on the cache, so there are none left */
+  if (priv->pending)
+    g_hash_table_unref (priv->pending);
+
+  if (priv->users)
+    g_hash_table_unref (priv->users);
+
+  g_list_foreach (priv->image_caches, (GFunc) mx_texture_cache_file_free,
+                  NULL);
+  g_list_free (priv->image_caches);
+
   G_OBJECT_CLASS (mx_texture_cache_parent_class)->finalize (object);
 }
 
@@ -165,6 +360,82 @@ mx_texture_cache_class_init (MxTextureCacheClass *klass)
   object_class->dispose = mx_texture_cache_dispose;
   object_class->finalize = mx_texture_cache_finalize;
 
+  /**
+   * MxTextureCache:budget:
+   *
+   * The estimated GPU memory in bytes that the cached textures may use, or
+   * 0 for no limit. When the budget is exceeded, the least recently used
+   * images without any textures created by the cache still alive are
+   * evicted.
+   *
+   * Since: 1.6
+   */
+  g_object_class_install_property (object_class,
+                                   PROP_BUDGET,
+                                   g_param_spec_uint ("budget",
+                                                      "Budget",
+                                                      "Estimated GPU memory in "
+                                                      "bytes the cache may use.",
+                                                      0, G_MAXUINT, 0,
+                                                      MX_PARAM_READWRITE));
+
+  /**
+   * MxTextureCache:use-atlas:
+   *
+   * Whether small images are packed into shared atlas textures, so that
+   * they can be drawn together. Only images loaded while this is set are
+   * packed.
+   *
+   * Since: 1.6
+   */
+  g_object_class_install_property (object_class,
+                                   PROP_USE_ATLAS,
+                                   g_param_spec_boolean ("use-atlas",
+                                                         "Use atlas",
+                                                         "Pack small images "
+                                                         "into shared "
+                                                         "textures.",
+                                                         FALSE,
+                                                         MX_PARAM_READWRITE));
+
+  /**
+   * MxTextureCache::loaded:
+   * @cache: the object that received the signal
+   * @uri: the URI of the loaded image
+   * @texture: a texture returned by mx_texture_cache_get_texture_async()
+   *
+   * Emitted for each texture returned by
+   * mx_texture_cache_get_texture_async() once its image has been loaded.
+   *
+   * Since: 1.6
+   */
+  signals[LOADED] =
+    g_signal_new ("loaded",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  G_STRUCT_OFFSET (MxTextureCacheClass, loaded),
+                  NULL, NULL,
+                  _mx_marshal_VOID__STRING_OBJECT,
+                  G_TYPE_NONE, 2, G_TYPE_STRING, CLUTTER_TYPE_TEXTURE);
+
+  /**
+   * MxTextureCache::error-loading:
+   * @cache: the object that received the signal
+   * @error: a #GError describing the failure
+   *
+   * Emitted when an image requested with
+   * mx_texture_cache_get_texture_async() could not be loaded.
+   *
+   * Since: 1.6
+   */
+  signals[ERROR_LOADING] =
+    g_signal_new ("error-loading",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  G_STRUCT_OFFSET (MxTextureCacheClass, error_loading),
+                  NULL, NULL,
+                  _mx_marshal_VOID__BOXED,
+                  G_TYPE_NONE, 1, G_TYPE_ERROR);
 }
 
 static void
@@ -177,6 +448,9 @@ mx_texture_cache_init (MxTextureCache *self)
     g_hash_table_new_full (g_str_hash, g_str_equal,
                            g_free, (GDestroyNotify)mx_texture_cache_item_free);
 
+  priv->pending = g_hash_table_new (g_str_hash, g_str_equal);
+  priv->users = g_hash_table_new (NULL, NULL);
+
   priv->is_uri = g_regex_new ("^([a-zA-Z0-9+.-]+)://.*",
                               G_REGEX_OPTIMIZE, 0, &error);
   if (!priv->is_uri)
@@ -200,20 +474,329 @@ mx_texture_cache_get_default (void)
   return __cache_singleton;
 }
 
-#if 0
 static void
 on_texure_finalized (gpointer data,
                      GObject *where_the_object_was)
 {
   FinalizedClosure *closure = (FinalizedClosure *) data;
-  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE(closure->cache);
 
-  g_hash_table_remove (priv->cache, closure->uri);
+  if (closure->cache)
+    {
+      MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (closure->cache);
+      gpointer serial = GUINT_TO_POINTER (closure->serial);
+      guint users = GPOINTER_TO_UINT (g_hash_table_lookup (priv->users,
+                                                           serial));
+
+      if (users > 1)
+        g_hash_table_insert (priv->users, serial, GUINT_TO_POINTER (users - 1));
+      else
+        g_hash_table_remove (priv->users, serial);
 
-  g_free(closure->uri);
-  g_free(closure);
+      g_object_remove_weak_pointer (G_OBJECT (closure->cache),
+                                    (gpointer *) &closure->cache);
+    }
+
+  g_slice_free (FinalizedClosure, closure);
+}
+
+/* Counts @texture as a user of the item or meta entry with @serial, so
+ * that the item is not evicted while the texture is alive */
+static void
+mx_texture_cache_add_user (MxTextureCache     *self,
+                           guint               serial,
+                           ClutterTexture     *texture)
+{
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (self);
+  FinalizedClosure *closure;
+  guint users;
+
+  users = GPOINTER_TO_UINT (g_hash_table_lookup (priv->users,
+                                                 GUINT_TO_POINTER (serial)));
+  g_hash_table_insert (priv->users, GUINT_TO_POINTER (serial),
+                       GUINT_TO_POINTER (users + 1));
+
+  closure = g_slice_new (FinalizedClosure);
+  closure->serial = serial;
+  closure->cache = self;
+  g_object_add_weak_pointer (G_OBJECT (self), (gpointer *) &closure->cache);
+
+  g_object_weak_ref (G_OBJECT (texture), on_texure_finalized, closure);
+}
+
+/* The reduced levels of a texture, see _mx_texture_cache_set_levels() */
+static CoglUserDataKey mx_texture_cache_levels_key;
+
+/* Estimates the GPU memory of @texture, including its reduced levels */
+static gsize
+mx_texture_cache_texture_size (CoglHandle texture)
+{
+  GPtrArray *levels;
+  gsize bpp, size;
+  guint i;
+
+  if (!texture)
+    return 0;
+
+  switch (cogl_texture_get_format (texture) & ~COGL_PREMULT_BIT)
+    {
+    case COGL_PIXEL_FORMAT_A_8:
+    case COGL_PIXEL_FORMAT_G_8:
+      bpp = 1;
+      break;
+
+    case COGL_PIXEL_FORMAT_RGB_565:
+    case COGL_PIXEL_FORMAT_RGBA_4444:
+    case COGL_PIXEL_FORMAT_RGBA_5551:
+      bpp = 2;
+      break;
+
+    case COGL_PIXEL_FORMAT_RGB_888:
+    case COGL_PIXEL_FORMAT_BGR_888:
+      bpp = 3;
+      break;
+
+    default:
+      bpp = 4;
+      break;
+    }
+
+  size = (gsize) cogl_texture_get_width (texture) *
+    cogl_texture_get_height (texture) * bpp;
+
+  levels = cogl_object_get_user_data (texture, &mx_texture_cache_levels_key);
+  if (levels)
+    for (i = 0; i < levels->len; i++)
+      size += mx_texture_cache_texture_size (g_ptr_array_index (levels, i));
+
+  return size;
+}
+
+/*
+ * _mx_texture_cache_set_levels:
+ * @texture: A #CoglHandle to a texture
+ * @levels: (transfer full): An array of reduced levels of @texture
+ *
+ * Attaches reduced levels to @texture. They are kept alive with @texture
+ * and count towards its size in the cache, so @texture should be inserted
+ * in the cache after they are set.
+ */
+void
+_mx_texture_cache_set_levels (CoglHandle  texture,
+                              GPtrArray  *levels)
+{
+  cogl_object_set_user_data (texture, &mx_texture_cache_levels_key, levels,
+                             (CoglUserDataDestroyCallback) g_ptr_array_unref);
+}
+
+/*
+ * _mx_texture_cache_get_levels:
+ * @texture: A #CoglHandle to a texture
+ *
+ * Gets the reduced levels attached to @texture with
+ * _mx_texture_cache_set_levels().
+ *
+ * Returns: (transfer none): the levels, or %NULL
+ */
+GPtrArray *
+_mx_texture_cache_get_levels (CoglHandle texture)
+{
+  return cogl_object_get_user_data (texture, &mx_texture_cache_levels_key);
+}
+
+static gboolean
+mx_texture_cache_meta_entry_in_use (gpointer key,
+                                    gpointer value,
+                                    gpointer user_data)
+{
+  MxTextureCacheMetaEntry *entry = value;
+  GHashTable *users = user_data;
+
+  return g_hash_table_lookup (users, GUINT_TO_POINTER (entry->serial)) != NULL;
+}
+
+/* Whether a texture created by the cache for @item or one of its meta
+ * entries is still alive */
+static gboolean
+mx_texture_cache_item_in_use (MxTextureCache     *self,
+                              MxTextureCacheItem *item)
+{
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (self);
+
+  if (g_hash_table_lookup (priv->users, GUINT_TO_POINTER (item->serial)))
+    return TRUE;
+
+  return (item->meta &&
+          g_hash_table_find (item->meta, mx_texture_cache_meta_entry_in_use,
+                             priv->users));
+}
+
+/* Whether an image in @page is still in use, so that the page can't be
+ * evicted. This is only worked out once for each eviction. */
+static gboolean
+mx_texture_cache_atlas_page_in_use (MxTextureCache          *self,
+                                    MxTextureCacheAtlasPage *page,
+                                    MxTextureCacheItem      *keep)
+{
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (self);
+  GList *l;
+
+  if (page->evict_serial == priv->evict_serial)
+    return page->in_use;
+
+  page->evict_serial = priv->evict_serial;
+  page->in_use = FALSE;
+
+  for (l = page->items.head; l; l = l->next)
+    if (l->data == keep || mx_texture_cache_item_in_use (self, l->data))
+      {
+        page->in_use = TRUE;
+        break;
+      }
+
+  return page->in_use;
+}
+
+/* Evicts the least recently used items that are only referenced by the
+ * cache until the cache is within its budget. @keep is never evicted.
+ * Items are taken from the tail of the LRU queue, and images in an atlas
+ * page are evicted together with the page when it is older. */
+static void
+mx_texture_cache_evict (MxTextureCache     *self,
+                        MxTextureCacheItem *keep)
+{
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (self);
+  GList *link;
+
+  if (!priv->budget)
+    return;
+
+  priv->evict_serial ++;
+  link = priv->lru.tail;
+
+  while (priv->size > priv->budget)
+    {
+      MxTextureCacheAtlasPage *lru_page = NULL;
+      MxTextureCacheItem *lru = NULL;
+      GList *p;
+
+      /* items in use stay where they are, they are only skipped */
+      for (; link; link = link->prev)
+        {
+          MxTextureCacheItem *item = link->data;
+
+          if (item != keep && item->size &&
+              !mx_texture_cache_item_in_use (self, item))
+            {
+              lru = item;
+              break;
+            }
+        }
+
+      for (p = priv->atlas_pages; p; p = p->next)
+        {
+          MxTextureCacheAtlasPage *page = p->data;
+
+          if ((!lru_page || page->last_used < lru_page->last_used) &&
+              (!lru || page->last_used < lru->last_used) &&
+              !mx_texture_cache_atlas_page_in_use (self, page, keep))
+            lru_page = page;
+        }
+
+      if (lru_page)
+        {
+          MxTextureCacheItem *item;
+          gboolean last;
+
+          /* the page is freed along with its last item */
+          do
+            {
+              item = lru_page->items.head->data;
+              last = (lru_page->items.length == 1);
+
+              priv->size -= item->size;
+              priv->evictions ++;
+
+              g_hash_table_remove (priv->cache, item->uri);
+            }
+          while (!last);
+
+          continue;
+        }
+
+      if (!lru)
+        break;
+
+      link = link->prev;
+
+      priv->size -= lru->size;
+      priv->evictions ++;
+
+      g_hash_table_remove (priv->cache, lru->uri);
+    }
+}
+
+/* Marks @item as the most recently used */
+static void
+mx_texture_cache_item_touch (MxTextureCache     *self,
+                             MxTextureCacheItem *item)
+{
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (self);
+
+  item->last_used = ++priv->clock;
+
+  if (item->page)
+    {
+      item->page->last_used = item->last_used;
+
+      if (item->lru)
+        {
+          g_queue_unlink (item->lru, &item->lru_link);
+          item->lru = NULL;
+        }
+
+      return;
+    }
+
+  if (item->lru)
+    g_queue_unlink (item->lru, &item->lru_link);
+
+  g_queue_push_head_link (&priv->lru, &item->lru_link);
+  item->lru = &priv->lru;
+}
+
+static void
+mx_texture_cache_add_meta_size (gpointer key,
+                                gpointer value,
+                                gpointer user_data)
+{
+  MxTextureCacheMetaEntry *entry = value;
+  gsize *size = user_data;
+
+  *size += mx_texture_cache_texture_size (entry->texture);
+}
+
+/* Updates the memory accounted for @item after its textures have changed,
+ * evicting other items if the budget is exceeded */
+static void
+mx_texture_cache_item_update_size (MxTextureCache     *self,
+                                   MxTextureCacheItem *item)
+{
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (self);
+  gsize size;
+
+  /* sub-textures share the memory of the texture they are part of */
+  size = item->sub_texture ? 0 : mx_texture_cache_texture_size (item->ptr);
+  if (item->meta)
+    g_hash_table_foreach (item->meta, mx_texture_cache_add_meta_size, &size);
+
+  priv->size = priv->size - item->size + size;
+  priv->peak_size = MAX (priv->peak_size, priv->size);
+  item->size = size;
+
+  mx_texture_cache_item_touch (self, item);
+
+  mx_texture_cache_evict (self, item);
 }
-#endif
 
 /**
  * mx_texture_cache_get_size:
@@ -231,24 +814,247 @@ mx_texture_cache_get_size (MxTextureCache *self)
   return g_hash_table_size (priv->cache);
 }
 
+static CoglHandle
+mx_texture_cache_upload_pixbuf (GdkPixbuf  *pixbuf,
+                                GError    **error)
+{
+  CoglHandle texture;
+  gboolean has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+
+  texture = cogl_texture_new_from_data (gdk_pixbuf_get_width (pixbuf),
+                                        gdk_pixbuf_get_height (pixbuf),
+                                        COGL_TEXTURE_NONE,
+                                        has_alpha ? COGL_PIXEL_FORMAT_RGBA_8888 :
+                                                    COGL_PIXEL_FORMAT_RGB_888,
+                                        COGL_PIXEL_FORMAT_ANY,
+                                        gdk_pixbuf_get_rowstride (pixbuf),
+                                        gdk_pixbuf_get_pixels (pixbuf));
+
+  if (texture == COGL_INVALID_HANDLE)
+    g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                 "Unable to create a texture from the image");
+
+  return texture;
+}
+
+static MxTextureCacheAtlasPage *
+mx_texture_cache_atlas_page_new (MxTextureCache *self)
+{
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (self);
+  MxTextureCacheAtlasPage *page;
+  guchar *clear;
+
+  page = g_slice_new0 (MxTextureCacheAtlasPage);
+  page->cache = self;
+  g_queue_init (&page->items);
+  page->shelves = g_array_new (FALSE, FALSE, sizeof (MxTextureCacheAtlasShelf));
+
+  /* the page is cleared, so that the gaps between images are transparent */
+  clear = g_malloc0 (MX_TEXTURE_CACHE_ATLAS_PAGE_SIZE *
+                     MX_TEXTURE_CACHE_ATLAS_PAGE_SIZE * 4);
+  page->texture = cogl_texture_new_from_data (MX_TEXTURE_CACHE_ATLAS_PAGE_SIZE,
+                                              MX_TEXTURE_CACHE_ATLAS_PAGE_SIZE,
+                                              COGL_TEXTURE_NO_SLICING,
+                                              COGL_PIXEL_FORMAT_RGBA_8888_PRE,
+                                              COGL_PIXEL_FORMAT_RGBA_8888_PRE,
+                                              MX_TEXTURE_CACHE_ATLAS_PAGE_SIZE * 4,
+                                              clear);
+  g_free (clear);
+
+  if (page->texture == COGL_INVALID_HANDLE)
+    {
+      g_array_free (page->shelves, TRUE);
+      g_slice_free (MxTextureCacheAtlasPage, page);
+
+      return NULL;
+    }
+
+  page->size = mx_texture_cache_texture_size (page->texture);
+  priv->size += page->size;
+  priv->peak_size = MAX (priv->peak_size, priv->size);
+
+  priv->atlas_pages = g_list_prepend (priv->atlas_pages, page);
+
+  return page;
+}
+
+static void
+mx_texture_cache_atlas_page_remove_item (MxTextureCacheAtlasPage *page,
+                                         MxTextureCacheItem      *item)
+{
+  MxTextureCachePrivate *priv;
+
+  if (item)
+    g_queue_unlink (&page->items, &item->page_link);
+
+  if (page->items.length > 0)
+    return;
+
+  /* Sub-textures that are still in use keep the texture alive, but their
+   * images can't be moved to another page, so a page is only reclaimed once
+   * all of its images have left the cache.
+   */
+  priv = TEXTURE_CACHE_PRIVATE (page->cache);
+  priv->atlas_pages = g_list_remove (priv->atlas_pages, page);
+  priv->size -= page->size;
+
+  cogl_handle_unref (page->texture);
+  g_array_free (page->shelves, TRUE);
+  g_slice_free (MxTextureCacheAtlasPage, page);
+}
+
+/* Finds space for a @width x @height rectangle in @page using the shelf
+ * that wastes the least height, or a new shelf */
+static gboolean
+mx_texture_cache_atlas_page_reserve (MxTextureCacheAtlasPage *page,
+                                     gint                     width,
+                                     gint                     height,
+                                     gint                    *x,
+                                     gint                    *y)
+{
+  MxTextureCacheAtlasShelf *best = NULL;
+  guint i;
+
+  for (i = 0; i < page->shelves->len; i++)
+    {
+      MxTextureCacheAtlasShelf *shelf =
+        &g_array_index (page->shelves, MxTextureCacheAtlasShelf, i);
+
+      if (shelf->height < height ||
+          shelf->x + width > MX_TEXTURE_CACHE_ATLAS_PAGE_SIZE)
+        continue;
+
+      if (!best || shelf->height < best->height)
+        best = shelf;
+    }
+
+  /* don't waste more than half of a shelf if a new one can be opened */
+  if ((!best || best->height > height * 2) &&
+      page->height + height <= MX_TEXTURE_CACHE_ATLAS_PAGE_SIZE)
+    {
+      MxTextureCacheAtlasShelf shelf = { page->height, height, 0 };
+
+      g_array_append_val (page->shelves, shelf);
+      page->height += height;
+
+      best = &g_array_index (page->shelves, MxTextureCacheAtlasShelf,
+                             page->shelves->len - 1);
+    }
+
+  if (!best)
+    return FALSE;
+
+  *x = best->x;
+  *y = best->y;
+  best->x += width;
+
+  return TRUE;
+}
+
+/* Packs @pixbuf into an atlas page and returns a sub-texture for it */
+static CoglHandle
+mx_texture_cache_atlas_add (MxTextureCache     *self,
+                            MxTextureCacheItem *item,
+                            GdkPixbuf          *pixbuf)
+{
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (self);
+  MxTextureCacheAtlasPage *page = NULL;
+  gint width, height, x, y;
+  GList *p;
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  /* leave a one pixel gap around each image, so that filtering doesn't
+   * sample its neighbours */
+  for (p = priv->atlas_pages; p; p = p->next)
+    if (mx_texture_cache_atlas_page_reserve (p->data, width + 2, height + 2,
+                                             &x, &y))
+      {
+        page = p->data;
+        break;
+      }
+
+  if (!page)
+    {
+      page = mx_texture_cache_atlas_page_new (self);
+      if (!page ||
+          !mx_texture_cache_atlas_page_reserve (page, width + 2, height + 2,
+                                                &x, &y))
+        return COGL_INVALID_HANDLE;
+    }
+
+  x += 1;
+  y += 1;
+
+  if (!cogl_texture_set_region (page->texture, 0, 0, x, y,
+                                width, height, width, height,
+                                gdk_pixbuf_get_has_alpha (pixbuf) ?
+                                  COGL_PIXEL_FORMAT_RGBA_8888 :
+                                  COGL_PIXEL_FORMAT_RGB_888,
+                                gdk_pixbuf_get_rowstride (pixbuf),
+                                gdk_pixbuf_get_pixels (pixbuf)))
+    {
+      /* don't keep a page that was only created for this image */
+      if (page->items.length == 0)
+        mx_texture_cache_atlas_page_remove_item (page, NULL);
+
+      return COGL_INVALID_HANDLE;
+    }
+
+  g_queue_push_tail_link (&page->items, &item->page_link);
+  item->page = page;
+  item->sub_texture = TRUE;
+  item->posX = x;
+  item->posY = y;
+  item->width = width;
+  item->height = height;
+
+  return cogl_texture_new_from_sub_texture (page->texture, x, y,
+                                            width, height);
+}
+
+/* Creates the texture for a decoded image, in an atlas page if the atlas is
+ * enabled and the image is small enough */
+static CoglHandle
+mx_texture_cache_texture_from_pixbuf (MxTextureCache      *self,
+                                      MxTextureCacheItem  *item,
+                                      GdkPixbuf           *pixbuf,
+                                      GError             **error)
+{
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (self);
+
+  if (priv->use_atlas &&
+      gdk_pixbuf_get_width (pixbuf) <= MX_TEXTURE_CACHE_ATLAS_MAX_IMAGE_SIZE &&
+      gdk_pixbuf_get_height (pixbuf) <= MX_TEXTURE_CACHE_ATLAS_MAX_IMAGE_SIZE &&
+      gdk_pixbuf_get_bits_per_sample (pixbuf) == 8)
+    {
+      CoglHandle texture = mx_texture_cache_atlas_add (self, item, pixbuf);
+
+      if (texture != COGL_INVALID_HANDLE)
+        return texture;
+    }
+
+  return mx_texture_cache_upload_pixbuf (pixbuf, error);
+}
+
 static void
 add_texture_to_cache (MxTextureCache     *self,
                       const gchar        *uri,
                       MxTextureCacheItem *item)
 {
-  /*  FinalizedClosure        *closure; */
   MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE(self);
+  MxTextureCacheItem *old_item;
 
-  g_hash_table_insert (priv->cache, g_strdup (uri), item);
+  /* the item being replaced is freed on insertion */
+  old_item = g_hash_table_lookup (priv->cache, uri);
+  if (old_item)
+    priv->size -= old_item->size;
 
-#if 0
-  /* Make sure we can remove from hash */
-  closure = g_new0 (FinalizedClosure, 1);
-  closure->uri = g_strdup (uri);
-  closure->cache = self;
+  item->uri = g_strdup (uri);
+  g_hash_table_replace (priv->cache, (gchar *) item->uri, item);
 
-  g_object_weak_ref (G_OBJECT (res), on_texure_finalized, closure);
-#endif
+  mx_texture_cache_item_update_size (self, item);
 }
 
 /* NOTE: you should unref the returned texture when not needed */
@@ -341,6 +1147,8 @@ mx_texture_cache_get_item (MxTextureCache *self,
     }
 
   item = g_hash_table_lookup (priv->cache, uri);
+  if (!item && priv->image_caches)
+    item = mx_texture_cache_get_item_from_files (self, uri);
 
   if ((!item || !item->ptr) && create_if_not_exists)
     {
@@ -355,9 +1163,21 @@ mx_texture_cache_get_item (MxTextureCache *self,
       else
         created = FALSE;
 
-      item->ptr = cogl_texture_new_from_file (file, COGL_TEXTURE_NONE,
-                                              COGL_PIXEL_FORMAT_ANY,
-                                              &err);
+      if (priv->use_atlas)
+        {
+          GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file (file, &err);
+
+          if (pixbuf)
+            {
+              item->ptr = mx_texture_cache_texture_from_pixbuf (self, item,
+                                                                pixbuf, &err);
+              g_object_unref (pixbuf);
+            }
+        }
+      else
+        item->ptr = cogl_texture_new_from_file (file, COGL_TEXTURE_NONE,
+                                                COGL_PIXEL_FORMAT_ANY,
+                                                &err);
 
       if (!item->ptr)
         {
@@ -378,7 +1198,11 @@ mx_texture_cache_get_item (MxTextureCache *self,
 
       if (created)
         add_texture_to_cache (self, uri, item);
+      else
+        mx_texture_cache_item_update_size (self, item);
     }
+  else if (item)
+    mx_texture_cache_item_touch (self, item);
 
   g_free (new_file);
   g_free (new_uri);
@@ -402,53 +1226,276 @@ CoglHandle
 mx_texture_cache_get_cogl_texture (MxTextureCache *self,
                                    const gchar    *uri)
 {
-  MxTextureCacheItem *item;
+  MxTextureCacheItem *item;
+
+  g_return_val_if_fail (MX_IS_TEXTURE_CACHE (self), NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
+
+  item = mx_texture_cache_get_item (self, uri, TRUE);
+
+  if (item)
+    return cogl_handle_ref (item->ptr);
+  else
+    return NULL;
+}
+
+/**
+ * mx_texture_cache_get_texture:
+ * @self: A #MxTextureCache
+ * @uri: A URI or path to a image file
+ *
+ * Create a new ClutterTexture with the specified image. Adds the image to the
+ * cache if the image had not been previously loaded. Subsequent calls with
+ * the same image URI/path will return a new ClutterTexture with the previously
+ * loaded image.
+ *
+ * Returns: (transfer none): a newly created ClutterTexture
+ */
+ClutterTexture*
+mx_texture_cache_get_texture (MxTextureCache *self,
+                              const gchar    *uri)
+{
+  MxTextureCacheItem *item;
+
+  g_return_val_if_fail (MX_IS_TEXTURE_CACHE (self), NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
+
+  item = mx_texture_cache_get_item (self, uri, TRUE);
+
+  if (item)
+    {
+      ClutterActor *texture = clutter_texture_new ();
+      clutter_texture_set_cogl_texture ((ClutterTexture*) texture, item->ptr);
+      mx_texture_cache_add_user (self, item->serial,
+                                 (ClutterTexture *) texture);
+
+      return (ClutterTexture *)texture;
+    }
+  else
+    return NULL;
+}
+
+static void
+mx_texture_cache_async_data_free (MxTextureCacheAsyncData *data)
+{
+  g_slist_foreach (data->textures, (GFunc) g_object_unref, NULL);
+  g_slist_free (data->textures);
+
+  if (data->pixbuf)
+    g_object_unref (data->pixbuf);
+
+  if (data->error)
+    g_error_free (data->error);
+
+  g_object_unref (data->cache);
+  g_free (data->uri);
+  g_free (data->filename);
+
+  g_slice_free (MxTextureCacheAsyncData, data);
+}
+
+static gboolean
+mx_texture_cache_async_complete_cb (gpointer user_data)
+{
+  MxTextureCacheAsyncData *data = user_data;
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (data->cache);
+  MxTextureCacheItem *item;
+  GSList *t;
+
+  g_hash_table_remove (priv->pending, data->uri);
+
+  /* The image may have been loaded synchronously or inserted while this load
+   * was in progress, in which case the cached texture wins.
+   */
+  item = g_hash_table_lookup (priv->cache, data->uri);
+
+  if ((!item || !item->ptr) && data->pixbuf)
+    {
+      gboolean created = FALSE;
+
+      if (!item)
+        {
+          item = mx_texture_cache_item_new ();
+          created = TRUE;
+        }
+
+      item->ptr = mx_texture_cache_texture_from_pixbuf (data->cache, item,
+                                                        data->pixbuf,
+                                                        &data->error);
+
+      if (item->ptr == COGL_INVALID_HANDLE)
+        {
+          if (created)
+            {
+              mx_texture_cache_item_free (item);
+              item = NULL;
+            }
+        }
+      else if (created)
+        add_texture_to_cache (data->cache, data->uri, item);
+      else
+        mx_texture_cache_item_update_size (data->cache, item);
+    }
+
+  if (item && item->ptr)
+    {
+      for (t = data->textures; t; t = t->next)
+        {
+          clutter_texture_set_cogl_texture (t->data, item->ptr);
+          mx_texture_cache_add_user (data->cache, item->serial, t->data);
+          g_signal_emit (data->cache, signals[LOADED], 0, data->uri, t->data);
+        }
+    }
+  else
+    {
+      if (data->error)
+        g_warning ("Error loading image: %s", data->error->message);
+
+      g_signal_emit (data->cache, signals[ERROR_LOADING], 0, data->error);
+    }
+
+  mx_texture_cache_async_data_free (data);
+
+  return FALSE;
+}
+
+static void
+mx_texture_cache_async_cb (gpointer task_data,
+                           gpointer user_data)
+{
+  MxTextureCacheAsyncData *data = task_data;
+  GError *error = NULL;
 
-  g_return_val_if_fail (MX_IS_TEXTURE_CACHE (self), NULL);
-  g_return_val_if_fail (uri != NULL, NULL);
+  data->pixbuf = gdk_pixbuf_new_from_file (data->filename, &error);
 
-  item = mx_texture_cache_get_item (self, uri, TRUE);
+  if (!data->pixbuf)
+    {
+      data->error = g_error_new (error->domain, error->code,
+                                 "%s: %s", data->uri, error->message);
+      g_error_free (error);
+    }
 
-  if (item)
-    return cogl_handle_ref (item->ptr);
-  else
-    return NULL;
+  clutter_threads_add_idle_full (G_PRIORITY_HIGH_IDLE,
+                                 mx_texture_cache_async_complete_cb,
+                                 data, NULL);
 }
 
 /**
- * mx_texture_cache_get_texture:
+ * mx_texture_cache_get_texture_async:
  * @self: A #MxTextureCache
  * @uri: A URI or path to a image file
  *
- * Create a new ClutterTexture with the specified image. Adds the image to the
- * cache if the image had not been previously loaded. Subsequent calls with
- * the same image URI/path will return a new ClutterTexture with the previously
- * loaded image.
+ * Create a new ClutterTexture with the specified image, without blocking
+ * while the image is decoded. If the image is already in the cache, the
+ * texture is set straight away. Otherwise, the image is decoded in a
+ * thread and uploaded on the main loop, after which the texture is set,
+ * the image is added to the cache and #MxTextureCache::loaded is emitted.
+ * Requests for a URI that is already being loaded share the load.
+ *
+ * If the image cannot be loaded, #MxTextureCache::error-loading is emitted
+ * and the texture is left empty.
  *
  * Returns: (transfer none): a newly created ClutterTexture
+ *
+ * Since: 1.6
  */
-ClutterTexture*
-mx_texture_cache_get_texture (MxTextureCache *self,
-                              const gchar    *uri)
+ClutterTexture *
+mx_texture_cache_get_texture_async (MxTextureCache *self,
+                                    const gchar    *uri)
 {
+  MxTextureCachePrivate *priv;
+  MxTextureCacheAsyncData *data;
   MxTextureCacheItem *item;
+  ClutterActor *texture;
+  gchar *new_uri = NULL;
 
   g_return_val_if_fail (MX_IS_TEXTURE_CACHE (self), NULL);
   g_return_val_if_fail (uri != NULL, NULL);
 
-  item = mx_texture_cache_get_item (self, uri, TRUE);
+  priv = TEXTURE_CACHE_PRIVATE (self);
 
-  if (item)
+  /* Transform path to URI, if necessary */
+  if (!g_regex_match (priv->is_uri, uri, 0, NULL))
     {
-      ClutterActor *texture = clutter_texture_new ();
-      clutter_texture_set_cogl_texture ((ClutterTexture*) texture, item->ptr);
+      uri = new_uri = mx_texture_cache_filename_to_uri (uri);
+      if (!new_uri)
+        return NULL;
+    }
 
-      return (ClutterTexture *)texture;
+  texture = clutter_texture_new ();
+
+  item = g_hash_table_lookup (priv->cache, uri);
+  if (!item && priv->image_caches)
+    item = mx_texture_cache_get_item_from_files (self, uri);
+  if (item && item->ptr)
+    {
+      clutter_texture_set_cogl_texture ((ClutterTexture *) texture, item->ptr);
+      mx_texture_cache_add_user (self, item->serial,
+                                 (ClutterTexture *) texture);
+      mx_texture_cache_item_touch (self, item);
+      g_free (new_uri);
+
+      return (ClutterTexture *) texture;
     }
-  else
-    return NULL;
-}
 
+  /* Start the thread-pool used for decoding */
+  if (!mx_texture_cache_threads)
+    {
+      GError *error = NULL;
+
+      mx_texture_cache_threads =
+        g_thread_pool_new (mx_texture_cache_async_cb, NULL,
+#ifdef _SC_NPROCESSORS_ONLN
+                           sysconf (_SC_NPROCESSORS_ONLN),
+#else
+                           /* FIXME: add more OSs */
+                           1,
+#endif
+                           FALSE, &error);
+
+      if (!mx_texture_cache_threads)
+        {
+          g_warning (G_STRLOC ": Unable to create thread-pool: %s",
+                     error->message);
+          g_error_free (error);
+
+          /* Fall back to loading synchronously */
+          clutter_actor_destroy (texture);
+          texture = (ClutterActor *) mx_texture_cache_get_texture (self, uri);
+          g_free (new_uri);
+
+          return (ClutterTexture *) texture;
+        }
+    }
+
+  data = g_hash_table_lookup (priv->pending, uri);
+  if (!data)
+    {
+      gchar *filename = mx_texture_cache_uri_to_filename (uri);
+
+      if (!filename)
+        {
+          clutter_actor_destroy (texture);
+          g_free (new_uri);
+
+          return NULL;
+        }
+
+      data = g_slice_new0 (MxTextureCacheAsyncData);
+      data->cache = g_object_ref (self);
+      data->uri = g_strdup (uri);
+      data->filename = filename;
+
+      g_hash_table_insert (priv->pending, data->uri, data);
+      g_thread_pool_push (mx_texture_cache_threads, data, NULL);
+    }
+
+  data->textures = g_slist_prepend (data->textures, g_object_ref (texture));
+
+  g_free (new_uri);
+
+  return (ClutterTexture *) texture;
+}
 
 /**
  * mx_texture_cache_get_actor:
@@ -501,17 +1548,20 @@ mx_texture_cache_get_meta_texture (MxTextureCache *self,
   g_return_val_if_fail (MX_IS_TEXTURE_CACHE (self), NULL);
   g_return_val_if_fail (uri != NULL, NULL);
 
-  item = mx_texture_cache_get_item (self, uri, TRUE);
+  /* meta textures don't need the image itself to be loaded */
+  item = mx_texture_cache_get_item (self, uri, FALSE);
 
   if (item && item->meta)
     {
       MxTextureCacheMetaEntry *entry = g_hash_table_lookup (item->meta, ident);
 
-      if (entry->texture)
+      if (entry && entry->texture)
         {
           ClutterActor *texture = clutter_texture_new ();
           clutter_texture_set_cogl_texture ((ClutterTexture*) texture,
                                             entry->texture);
+          mx_texture_cache_add_user (self, entry->serial,
+                                     (ClutterTexture *) texture);
           return (ClutterTexture *)texture;
         }
     }
@@ -545,13 +1595,14 @@ mx_texture_cache_get_meta_cogl_texture (MxTextureCache *self,
   g_return_val_if_fail (MX_IS_TEXTURE_CACHE (self), NULL);
   g_return_val_if_fail (uri != NULL, NULL);
 
-  item = mx_texture_cache_get_item (self, uri, TRUE);
+  /* meta textures don't need the image itself to be loaded */
+  item = mx_texture_cache_get_item (self, uri, FALSE);
 
   if (item && item->meta)
     {
       MxTextureCacheMetaEntry *entry = g_hash_table_lookup (item->meta, ident);
 
-      if (entry->texture)
+      if (entry && entry->texture)
         return cogl_handle_ref (entry->texture);
     }
 
@@ -730,91 +1781,477 @@ mx_texture_cache_insert_meta (MxTextureCache *self,
   entry->ident = ident;
   entry->texture = cogl_handle_ref (texture);
   entry->destroy_func = destroy_func;
+  entry->serial = mx_texture_cache_next_serial ();
 
   g_hash_table_insert (item->meta, ident, entry);
+
+  mx_texture_cache_item_update_size (self, item);
 }
 
+/**
+ * mx_texture_cache_set_budget:
+ * @self: A #MxTextureCache
+ * @budget: the budget in bytes, or 0 for no budget
+ *
+ * Sets the estimated GPU memory that the cached images may use. When the
+ * budget is exceeded, the least recently used images are evicted, unless a
+ * texture created for them by the cache is still alive. Handles returned
+ * by mx_texture_cache_get_cogl_texture() hold their own reference and
+ * remain valid after their image is evicted.
+ *
+ * Since: 1.6
+ */
 void
-mx_texture_cache_load_cache (MxTextureCache *self,
-                             const gchar    *filename)
+mx_texture_cache_set_budget (MxTextureCache *self,
+                             guint           budget)
 {
-  FILE *file;
-  MxTextureCacheItem *element, head;
-  int ret;
-  CoglHandle full_texture;
   MxTextureCachePrivate *priv;
 
   g_return_if_fail (MX_IS_TEXTURE_CACHE (self));
-  g_return_if_fail (filename != NULL);
 
   priv = TEXTURE_CACHE_PRIVATE (self);
 
-  file = fopen(filename, "rm");
-  if (!file)
-    return;
-
-  ret = fread (&head, sizeof(MxTextureCacheItem), 1, file);
-  if (ret < 0)
+  if (priv->budget != budget)
     {
-      fclose (file);
-      return;
+      /* a single pass over the LRU queue, only needed if the budget shrank */
+      priv->budget = budget;
+      if (budget && priv->size > budget)
+        mx_texture_cache_evict (self, NULL);
+
+      g_object_notify (G_OBJECT (self), "budget");
     }
+}
+
+/**
+ * mx_texture_cache_get_budget:
+ * @self: A #MxTextureCache
+ *
+ * Gets the budget set with mx_texture_cache_set_budget().
+ *
+ * Returns: the budget in bytes, or 0 if there is no budget
+ *
+ * Since: 1.6
+ */
+guint
+mx_texture_cache_get_budget (MxTextureCache *self)
+{
+  g_return_val_if_fail (MX_IS_TEXTURE_CACHE (self), 0);
+
+  return TEXTURE_CACHE_PRIVATE (self)->budget;
+}
+
+/**
+ * mx_texture_cache_set_use_atlas:
+ * @self: A #MxTextureCache
+ * @use_atlas: %TRUE to pack small images into shared textures
+ *
+ * Sets whether images of up to 128x128 pixels are packed into shared 512x512
+ * atlas textures as they are loaded. The textures returned for them are
+ * sub-textures of an atlas, so that drawing several of them needs fewer
+ * texture changes. Atlas textures count towards the budget and are evicted
+ * as a whole, once none of their images have textures created by the cache
+ * still alive.
+ *
+ * Since: 1.6
+ */
+void
+mx_texture_cache_set_use_atlas (MxTextureCache *self,
+                                gboolean        use_atlas)
+{
+  MxTextureCachePrivate *priv;
+
+  g_return_if_fail (MX_IS_TEXTURE_CACHE (self));
+
+  priv = TEXTURE_CACHE_PRIVATE (self);
 
-  /* check if we already if this texture in the cache */
-  if (g_hash_table_lookup (priv->cache, head.filename))
+  if (priv->use_atlas != use_atlas)
     {
-      /* skip it, we're done */
-      fclose (file);
-      return;
+      priv->use_atlas = use_atlas;
+      g_object_notify (G_OBJECT (self), "use-atlas");
     }
+}
+
+/**
+ * mx_texture_cache_get_use_atlas:
+ * @self: A #MxTextureCache
+ *
+ * Gets whether small images are packed into shared textures, see
+ * mx_texture_cache_set_use_atlas().
+ *
+ * Returns: %TRUE if the atlas is used
+ *
+ * Since: 1.6
+ */
+gboolean
+mx_texture_cache_get_use_atlas (MxTextureCache *self)
+{
+  g_return_val_if_fail (MX_IS_TEXTURE_CACHE (self), FALSE);
+
+  return TEXTURE_CACHE_PRIVATE (self)->use_atlas;
+}
+
+static void
+mx_texture_cache_count_users (gpointer key,
+                              gpointer value,
+                              gpointer user_data)
+{
+  guint *n_textures = user_data;
+
+  *n_textures += GPOINTER_TO_UINT (value);
+}
+
+/**
+ * mx_texture_cache_get_stats:
+ * @self: A #MxTextureCache
+ * @stats: (out): return location for the statistics
+ *
+ * Gets statistics about the memory used by the texture cache.
+ *
+ * Since: 1.6
+ */
+void
+mx_texture_cache_get_stats (MxTextureCache      *self,
+                            MxTextureCacheStats *stats)
+{
+  MxTextureCachePrivate *priv;
+
+  g_return_if_fail (MX_IS_TEXTURE_CACHE (self));
+  g_return_if_fail (stats != NULL);
+
+  priv = TEXTURE_CACHE_PRIVATE (self);
+
+  stats->n_items = g_hash_table_size (priv->cache);
+  stats->size = priv->size;
+  stats->peak_size = priv->peak_size;
+  stats->evictions = priv->evictions;
+  stats->n_atlas_pages = g_list_length (priv->atlas_pages);
+
+  stats->n_textures = 0;
+  g_hash_table_foreach (priv->users, mx_texture_cache_count_users,
+                        &stats->n_textures);
+  stats->sharing_ratio = g_hash_table_size (priv->users) ?
+    (gdouble) stats->n_textures / g_hash_table_size (priv->users) : 0.0;
+}
+
+static const gchar *
+mx_texture_cache_file_get_string (MxTextureCacheFile *file,
+                                  guint32             offset)
+{
+  offset = GUINT32_FROM_LE (offset);
+
+  /* the string table is nul-terminated, so any offset inside it is a
+   * valid string */
+  return (offset < file->strings_size) ? file->strings + offset : NULL;
+}
+
+static gboolean
+mx_texture_cache_file_check_section (gsize    length,
+                                     guint32  offset,
+                                     guint32  count,
+                                     gsize    record_size)
+{
+  return (offset % 4 == 0 &&
+          offset <= length &&
+          count <= (length - offset) / record_size);
+}
+
+/* Checks that a page refers to a full size page of the file, which refers
+ * to itself, and that a reduced level is no more than 31 levels smaller.
+ * Pages are only checked when they are used. */
+static gboolean
+mx_texture_cache_file_check_page (MxTextureCacheFile *file,
+                                  guint32             page_index)
+{
+  const MxImageCachePage *pages = file->pages;
+  guint32 base_page, level;
 
-  full_texture = mx_texture_cache_get_cogl_texture (self, head.filename);
+  if (page_index >= file->n_pages)
+    return FALSE;
+
+  base_page = GUINT32_FROM_LE (pages[page_index].base_page);
+  level = GUINT32_FROM_LE (pages[page_index].level);
+
+  return (base_page < file->n_pages && level < 32 &&
+          (level != 0 || base_page == page_index) &&
+          GUINT32_FROM_LE (pages[base_page].level) == 0 &&
+          GUINT32_FROM_LE (pages[base_page].base_page) == base_page);
+}
+
+static MxTextureCacheFile *
+mx_texture_cache_file_new (const gchar  *filename,
+                           GError      **error)
+{
+  const MxImageCacheHeader *header;
+  MxTextureCacheFile *file;
+  GMappedFile *mapped;
+  const gchar *contents;
+  guint32 strings_offset;
+  gsize length;
+
+  mapped = g_mapped_file_new (filename, FALSE, error);
+  if (!mapped)
+    return NULL;
+
+  contents = g_mapped_file_get_contents (mapped);
+  length = g_mapped_file_get_length (mapped);
+  header = (const MxImageCacheHeader *) contents;
 
-  if (full_texture == COGL_INVALID_HANDLE)
+  if (length < sizeof (MxImageCacheHeader) ||
+      memcmp (header->magic, MX_IMAGE_CACHE_MAGIC, sizeof (header->magic)) ||
+      GUINT32_FROM_LE (header->version) != MX_IMAGE_CACHE_VERSION)
     {
-      g_critical (G_STRLOC ": Error opening cache image file");
-      fclose (file);
-      return;
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "Not an image cache or unsupported version");
+      g_mapped_file_unref (mapped);
+      return NULL;
     }
 
-  while (!feof (file))
+  strings_offset = GUINT32_FROM_LE (header->strings_offset);
+
+  if (!mx_texture_cache_file_check_section (length,
+                                            GUINT32_FROM_LE (header->pages_offset),
+                                            GUINT32_FROM_LE (header->n_pages),
+                                            sizeof (MxImageCachePage)) ||
+      !mx_texture_cache_file_check_section (length,
+                                            GUINT32_FROM_LE (header->entries_offset),
+                                            GUINT32_FROM_LE (header->n_entries),
+                                            sizeof (MxImageCacheEntry)) ||
+      !mx_texture_cache_file_check_section (length, strings_offset,
+                                            GUINT32_FROM_LE (header->strings_size),
+                                            1) ||
+      header->strings_size == 0 ||
+      contents[strings_offset + GUINT32_FROM_LE (header->strings_size) - 1] != '\0')
     {
-      gchar *uri;
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "Corrupt image cache");
+      g_mapped_file_unref (mapped);
+      return NULL;
+    }
 
-      element = mx_texture_cache_item_new ();
-      ret = fread (element, sizeof (MxTextureCacheItem), 1, file);
+  file = g_slice_new0 (MxTextureCacheFile);
+  file->mapped = mapped;
+  file->filename = g_strdup (filename);
+  file->dirname = g_path_get_dirname (filename);
+  file->pages = (const MxImageCachePage *)
+    (contents + GUINT32_FROM_LE (header->pages_offset));
+  file->n_pages = GUINT32_FROM_LE (header->n_pages);
+  file->entries = (const MxImageCacheEntry *)
+    (contents + GUINT32_FROM_LE (header->entries_offset));
+  file->n_entries = GUINT32_FROM_LE (header->n_entries);
+  file->strings = contents + strings_offset;
+  file->strings_size = GUINT32_FROM_LE (header->strings_size);
+  file->page_textures = g_new0 (CoglHandle, file->n_pages);
+  file->page_failed = g_new0 (guint8, file->n_pages);
 
-      if (ret < 1)
-        {
-          /* end of file */
-          mx_texture_cache_item_free (element);
-          break;
-        }
+  return file;
+}
 
-      uri = mx_texture_cache_filename_to_uri (element->filename);
-      if (!uri)
-        {
-          /* Couldn't resolve path */
-          mx_texture_cache_item_free (element);
-          continue;
-        }
+static const MxImageCacheEntry *
+mx_texture_cache_file_lookup (MxTextureCacheFile *file,
+                              const gchar        *filename)
+{
+  guint lower = 0, upper = file->n_entries;
 
-      if (g_hash_table_lookup (priv->cache, uri))
-        {
-          /* URI is already in the cache.... */
-          mx_texture_cache_item_free (element);
-          g_free (uri);
-        }
+  while (lower < upper)
+    {
+      guint middle = (lower + upper) / 2;
+      const MxImageCacheEntry *entry = &file->entries[middle];
+      const gchar *name;
+      gint result;
+
+      name = mx_texture_cache_file_get_string (file, entry->filename);
+      if (!name)
+        return NULL;
+
+      result = strcmp (filename, name);
+
+      if (result == 0)
+        return entry;
+      else if (result < 0)
+        upper = middle;
       else
-        {
-          element->ptr = cogl_texture_new_from_sub_texture (full_texture,
-                                                            element->posX,
-                                                            element->posY,
-                                                            element->width,
-                                                            element->height);
-          g_hash_table_insert (priv->cache, uri, element);
-        }
+        lower = middle + 1;
+    }
+
+  return NULL;
+}
+
+static CoglHandle
+mx_texture_cache_file_get_page (MxTextureCache     *self,
+                                MxTextureCacheFile *file,
+                                guint               page_index)
+{
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (self);
+  const MxImageCachePage *page;
+  const gchar *name;
+  gchar *path;
+  GError *error = NULL;
+
+  if (file->page_textures[page_index])
+    return file->page_textures[page_index];
+
+  /* don't try to load a page again, or warn about it again */
+  if (file->page_failed[page_index])
+    return COGL_INVALID_HANDLE;
+
+  page = &file->pages[page_index];
+  name = mx_texture_cache_file_get_string (file, page->filename);
+  if (!name || !mx_texture_cache_file_check_page (file, page_index))
+    {
+      file->page_failed[page_index] = TRUE;
+      return COGL_INVALID_HANDLE;
+    }
+
+  if (g_path_is_absolute (name))
+    path = g_strdup (name);
+  else
+    path = g_build_filename (file->dirname, name, NULL);
+
+  file->page_textures[page_index] =
+    cogl_texture_new_from_file (path, COGL_TEXTURE_NONE,
+                                COGL_PIXEL_FORMAT_ANY, &error);
+
+  if (!file->page_textures[page_index])
+    {
+      g_warning (G_STRLOC ": Error opening cache image file: %s",
+                 error ? error->message : path);
+      g_clear_error (&error);
+    }
+  else if (cogl_texture_get_width (file->page_textures[page_index]) !=
+           GUINT32_FROM_LE (page->width) ||
+           cogl_texture_get_height (file->page_textures[page_index]) !=
+           GUINT32_FROM_LE (page->height))
+    {
+      g_warning (G_STRLOC ": Cache image file '%s' has changed", path);
+      cogl_handle_unref (file->page_textures[page_index]);
+      file->page_textures[page_index] = COGL_INVALID_HANDLE;
+    }
+  else
+    {
+      /* pages are kept for as long as the cache file is loaded */
+      priv->size +=
+        mx_texture_cache_texture_size (file->page_textures[page_index]);
+      priv->peak_size = MAX (priv->peak_size, priv->size);
+    }
+
+  g_free (path);
+
+  if (!file->page_textures[page_index])
+    file->page_failed[page_index] = TRUE;
+
+  return file->page_textures[page_index];
+}
+
+/* Looks up @uri in the loaded image cache files and adds it to the cache
+ * as a sub-texture of its page */
+static MxTextureCacheItem *
+mx_texture_cache_get_item_from_files (MxTextureCache *self,
+                                      const gchar    *uri)
+{
+  MxTextureCachePrivate *priv = TEXTURE_CACHE_PRIVATE (self);
+  MxTextureCacheItem *item = NULL;
+  gchar *filename;
+  GList *f;
+
+  filename = g_filename_from_uri (uri, NULL, NULL);
+  if (!filename)
+    return NULL;
+
+  for (f = priv->image_caches; f; f = f->next)
+    {
+      MxTextureCacheFile *file = f->data;
+      const MxImageCacheEntry *entry;
+      guint32 page_index, x, y, width, height, page_width, page_height;
+      CoglHandle page, texture;
+
+      entry = mx_texture_cache_file_lookup (file, filename);
+      if (!entry)
+        continue;
+
+      page_index = GUINT32_FROM_LE (entry->page);
+      x = GUINT32_FROM_LE (entry->x);
+      y = GUINT32_FROM_LE (entry->y);
+      width = GUINT32_FROM_LE (entry->width);
+      height = GUINT32_FROM_LE (entry->height);
+
+      if (page_index >= file->n_pages ||
+          GUINT32_FROM_LE (file->pages[page_index].level) != 0)
+        continue;
+
+      /* written so that a corrupt entry can't wrap around */
+      page_width = GUINT32_FROM_LE (file->pages[page_index].width);
+      page_height = GUINT32_FROM_LE (file->pages[page_index].height);
+      if (x > page_width || width > page_width - x ||
+          y > page_height || height > page_height - y)
+        continue;
+
+      page = mx_texture_cache_file_get_page (self, file, page_index);
+      if (!page)
+        continue;
+
+      texture = cogl_texture_new_from_sub_texture (page, x, y, width, height);
+      if (!texture)
+        continue;
+
+      item = mx_texture_cache_item_new ();
+      g_strlcpy (item->filename, filename, sizeof (item->filename));
+      item->posX = x;
+      item->posY = y;
+      item->width = width;
+      item->height = height;
+      item->ptr = texture;
+      item->sub_texture = TRUE;
+
+      add_texture_to_cache (self, uri, item);
+      break;
+    }
+
+  g_free (filename);
+
+  return item;
+}
+
+/**
+ * mx_texture_cache_load_cache:
+ * @self: A #MxTextureCache
+ * @filename: the image cache file to load
+ *
+ * Loads an image cache file created with mx-create-image-cache. The images
+ * listed in it are taken from its atlas pages when they are requested,
+ * instead of being loaded from their own files. Only the header of the
+ * file is read and checked when it is loaded; its entries and pages are
+ * only read and checked when an image is requested, so loading it is cheap
+ * however many images it contains. Loading a cache that is already loaded
+ * does nothing.
+ */
+void
+mx_texture_cache_load_cache (MxTextureCache *self,
+                             const gchar    *filename)
+{
+  MxTextureCachePrivate *priv;
+  MxTextureCacheFile *file;
+  GError *error = NULL;
+  GList *f;
+
+  g_return_if_fail (MX_IS_TEXTURE_CACHE (self));
+  g_return_if_fail (filename != NULL);
+
+  priv = TEXTURE_CACHE_PRIVATE (self);
+
+  for (f = priv->image_caches; f; f = f->next)
+    if (g_str_equal (((MxTextureCacheFile *) f->data)->filename, filename))
+      return;
+
+  file = mx_texture_cache_file_new (filename, &error);
+  if (!file)
+    {
+      /* a missing cache is not an error */
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning (G_STRLOC ": Unable to load image cache '%s': %s",
+                   filename, error->message);
+      g_error_free (error);
+      return;
     }
 
-  fclose (file);
+  priv->image_caches = g_list_append (priv->image_caches, file);
 }
@@ -85,12 +85,42 @@ typedef struct {
   void (*_padding_4) (void);
 } MxTextureCacheClass;
 
+/**
+ * MxTextureCacheStats:
+ * @n_items: the number of images in the cache
+ * @size: the estimated GPU memory used by the cached textures, in bytes
+ * @peak_size: the largest @size reached
+ * @evictions: the number of images evicted to stay within the budget
+ * @n_atlas_pages: the number of atlas textures, see
+ *   mx_texture_cache_set_use_atlas()
+ * @n_textures: the number of #ClutterTexture<!-- -->s created by the cache
+ *   that are still alive
+ * @sharing_ratio: the average number of those textures showing each cached
+ *   image or meta texture in use, or 0 if there are none
+ *
+ * Statistics about a #MxTextureCache, see mx_texture_cache_get_stats().
+ *
+ * Since: 1.6
+ */
+typedef struct
+{
+  guint n_items;
+  gsize size;
+  gsize peak_size;
+  guint evictions;
+  guint n_atlas_pages;
+  guint n_textures;
+  gdouble sharing_ratio;
+} MxTextureCacheStats;
+
 GType mx_texture_cache_get_type (void);
 
 MxTextureCache* mx_texture_cache_get_default (void);
 
 ClutterTexture* mx_texture_cache_get_texture (MxTextureCache *self,
                                               const gchar    *uri);
+ClutterTexture* mx_texture_cache_get_texture_async (MxTextureCache *self,
+                                                    const gchar    *uri);
 ClutterActor*   mx_texture_cache_get_actor   (MxTextureCache *self,
                                               const gchar    *uri);
 CoglHandle      mx_texture_cache_get_cogl_texture (MxTextureCache *self,
@@ -122,6 +152,15 @@ void            mx_texture_cache_insert_meta (MxTextureCache *self,
                                               CoglHandle     *texture,
                                               GDestroyNotify  destroy_func);
 
+void            mx_texture_cache_set_budget  (MxTextureCache      *self,
+                                              guint                budget);
+guint           mx_texture_cache_get_budget  (MxTextureCache      *self);
+void            mx_texture_cache_set_use_atlas (MxTextureCache    *self,
+                                                gboolean           use_atlas);
+gboolean        mx_texture_cache_get_use_atlas (MxTextureCache    *self);
+void            mx_texture_cache_get_stats   (MxTextureCache      *self,
+                                              MxTextureCacheStats *stats);
+
 void mx_texture_cache_load_cache (MxTextureCache *self,
                                   const char     *filename);
 
@@ -0,0 +1,143 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * Copyright 2011 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Benchmark for MxImage texture uploads: sets an MxImage from the same
+ * decoded pixels, either with mx_image_set_from_data(), which uploads the
+ * image and each side of its transparent border separately, or with
+ * mx_image_set_from_padded_data(), which uploads a padded copy in one go,
+ * as images decoded by MxImage are. Decoding and padding are done before
+ * timing, as MxImage pads in its loading thread.
+ *
+ * Usage: test-image-upload [image] [count]
+ */
+
+#include <stdlib.h>
+
+#include <mx/mx.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+static gdouble
+time_uploads (MxImage   *image,
+              gint       count,
+              gboolean   padded,
+              GdkPixbuf *pixbuf)
+{
+  CoglPixelFormat format;
+  GError *error = NULL;
+  GTimer *timer;
+  gdouble elapsed;
+  gboolean success;
+  gint n;
+
+  format = gdk_pixbuf_get_has_alpha (pixbuf) ? COGL_PIXEL_FORMAT_RGBA_8888 :
+                                               COGL_PIXEL_FORMAT_RGB_888;
+
+  timer = g_timer_new ();
+
+  for (n = 0; n < count; n++)
+    {
+      if (padded)
+        success =
+          mx_image_set_from_padded_data (image,
+                                         gdk_pixbuf_get_pixels (pixbuf),
+                                         format,
+                                         gdk_pixbuf_get_width (pixbuf) - 2,
+                                         gdk_pixbuf_get_height (pixbuf) - 2,
+                                         gdk_pixbuf_get_rowstride (pixbuf),
+                                         &error);
+      else
+        success = mx_image_set_from_data (image,
+                                          gdk_pixbuf_get_pixels (pixbuf),
+                                          format,
+                                          gdk_pixbuf_get_width (pixbuf),
+                                          gdk_pixbuf_get_height (pixbuf),
+                                          gdk_pixbuf_get_rowstride (pixbuf),
+                                          &error);
+
+      if (!success)
+        {
+          g_printerr ("Unable to set the image: %s\n", error->message);
+          g_error_free (error);
+          break;
+        }
+    }
+
+  /* make sure the uploads have been submitted */
+  cogl_flush ();
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  return elapsed;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const gchar *filename;
+  GdkPixbuf *pixbuf, *padded;
+  ClutterActor *stage, *image;
+  GError *error = NULL;
+  gdouble elapsed;
+  gint width, height, count;
+
+  filename = (argc > 1) ? argv[1] : "redhand.png";
+  count = (argc > 2) ? atoi (argv[2]) : 500;
+
+  if (clutter_init (&argc, &argv) != CLUTTER_INIT_SUCCESS)
+    return 1;
+
+  if (!(pixbuf = gdk_pixbuf_new_from_file (filename, &error)))
+    {
+      g_printerr ("Unable to load '%s': %s\n", filename, error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  /* a GL context is needed to create textures */
+  stage = clutter_stage_get_default ();
+  clutter_actor_realize (stage);
+
+  image = mx_image_new ();
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), image);
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  /* pad the image the way MxImage does in its loading thread */
+  padded = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width + 2, height + 2);
+  gdk_pixbuf_fill (padded, 0);
+  gdk_pixbuf_copy_area (pixbuf, 0, 0, width, height, padded, 1, 1);
+
+  g_print ("Uploading %d copies of %s (%dx%d)\n", count, filename,
+           width, height);
+
+  elapsed = time_uploads (MX_IMAGE (image), count, FALSE, pixbuf);
+  g_print ("mx_image_set_from_data: %.3fms, %.1f images/s\n",
+           elapsed * 1000.0, count / elapsed);
+
+  elapsed = time_uploads (MX_IMAGE (image), count, TRUE, padded);
+  g_print ("mx_image_set_from_padded_data: %.3fms, %.1f images/s\n",
+           elapsed * 1000.0, count / elapsed);
+
+  g_object_unref (padded);
+  g_object_unref (pixbuf);
+
+  return 0;
+}
@@ -0,0 +1,175 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * Copyright 2011 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Benchmark for style matching: builds a synthetic tree of about 5,000
+ * stylable actors and times how long it takes to resolve a style property
+ * for each of them against a freshly loaded (and therefore uncached) style.
+ *
+ * Usage: test-style-matching [stylesheet] [iterations]
+ */
+
+#include <stdlib.h>
+
+#include <clutter/clutter.h>
+#include <mx/mx.h>
+
+#define N_ROWS    99
+#define N_COLUMNS 50
+
+static const gchar *style_classes[] = {
+  NULL, "ComboBoxToolbar", "PathBarButton", "mx-toolbar-close-button",
+  "NotebookPage"
+};
+
+static ClutterActor *
+create_child (gint n)
+{
+  ClutterActor *child;
+
+  switch (n % 4)
+    {
+    case 0:
+      child = mx_button_new_with_label ("Button");
+      break;
+    case 1:
+      child = mx_label_new_with_text ("Label");
+      break;
+    case 2:
+      child = mx_entry_new ();
+      break;
+    default:
+      child = mx_frame_new ();
+      break;
+    }
+
+  mx_stylable_set_style_class (MX_STYLABLE (child),
+                               style_classes[n % G_N_ELEMENTS (style_classes)]);
+  if (n % 7 == 0)
+    mx_stylable_set_style_pseudo_class (MX_STYLABLE (child), "hover");
+
+  return child;
+}
+
+static ClutterActor *
+create_tree (GPtrArray *stylables)
+{
+  ClutterActor *root;
+  gint row, column;
+
+  root = mx_box_layout_new ();
+  mx_box_layout_set_orientation (MX_BOX_LAYOUT (root), MX_ORIENTATION_VERTICAL);
+  g_ptr_array_add (stylables, root);
+
+  for (row = 0; row < N_ROWS; row++)
+    {
+      ClutterActor *box = mx_box_layout_new ();
+
+      clutter_container_add_actor (CLUTTER_CONTAINER (root), box);
+      g_ptr_array_add (stylables, box);
+
+      for (column = 0; column < N_COLUMNS; column++)
+        {
+          ClutterActor *child = create_child (row * N_COLUMNS + column);
+          gchar *name;
+
+          name = g_strdup_printf ("item-%d", column);
+          clutter_actor_set_name (child, name);
+          g_free (name);
+
+          clutter_container_add_actor (CLUTTER_CONTAINER (box), child);
+          g_ptr_array_add (stylables, child);
+        }
+    }
+
+  return root;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const gchar *filename;
+  ClutterActor *stage, *root;
+  GPtrArray *stylables;
+  GTimer *timer;
+  gdouble total;
+  gint i, n, iterations;
+
+  filename = (argc > 1) ? argv[1] : "../data/style/default.css";
+  iterations = (argc > 2) ? atoi (argv[2]) : 10;
+
+  if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR))
+    {
+      g_printerr ("Unable to find stylesheet '%s'\n", filename);
+      return 1;
+    }
+
+  /* every new MxStyle loads the stylesheet named by MX_RC_FILE */
+  g_setenv ("MX_RC_FILE", filename, TRUE);
+
+  if (clutter_init (&argc, &argv) != CLUTTER_INIT_SUCCESS)
+    return 1;
+
+  stage = clutter_stage_get_default ();
+  stylables = g_ptr_array_new ();
+
+  root = create_tree (stylables);
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), root);
+
+  g_print ("Matching %u stylables against %s\n", stylables->len, filename);
+
+  timer = g_timer_new ();
+  total = 0;
+
+  for (i = 0; i < iterations; i++)
+    {
+      MxStyle *style = mx_style_new ();
+      gdouble elapsed;
+
+      g_timer_start (timer);
+
+      for (n = 0; n < stylables->len; n++)
+        {
+          ClutterColor *color = NULL;
+
+          mx_style_get (style, MX_STYLABLE (g_ptr_array_index (stylables, n)),
+                        "background-color", &color,
+                        NULL);
+
+          if (color)
+            clutter_color_free (color);
+        }
+
+      elapsed = g_timer_elapsed (timer, NULL);
+      total += elapsed;
+
+      g_print ("Iteration %d: %.3fms\n", i, elapsed * 1000.0);
+
+      g_object_unref (style);
+    }
+
+  g_print ("Average: %.3fms (%.2fus per stylable)\n",
+           total * 1000.0 / iterations,
+           total * 1000000.0 / (iterations * stylables->len));
+
+  g_timer_destroy (timer);
+  g_ptr_array_free (stylables, TRUE);
+  clutter_actor_destroy (root);
+
+  return 0;
+}